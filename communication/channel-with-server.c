@@ -10,6 +10,7 @@ typedef struct channel_server_s {
   size_t client_size;
   void* client_data;
   server_t* server;
+  server_client_t* client;
 } channel_server_t;
 
 static int
@@ -47,7 +48,8 @@ cs_client_write_bytes(channel_t* channel, const unsigned char* bytes, size_t siz
 
   unsigned char* result = NULL;
   size_t ressize = 0;
-  int ret = server_process(cs->server, bytes, size, &result, &ressize);
+  int ret = server_process_client(cs->server, cs->client, bytes, size, &result,
+                                  &ressize);
   if (ret != ERROR_OK) {
     free(result);
     return ERROR_CHANNEL_FAILED;
@@ -93,7 +95,12 @@ cs_free(channel_t* channel)
   channel_server_t* cs = channel->data;
   if (cs != NULL) {
     free(cs->client_data);
-    server_shutdown(cs->server);
+    if (cs->client != NULL) {
+      server_client_free(cs->client);
+    }
+    if (cs->server != NULL) {
+      server_release(cs->server);
+    }
     free(cs);
   }
 
@@ -126,11 +133,29 @@ channel_with_server_new(channel_t** channel, const char* database)
     return ERROR_MEMORY;
   }
 
+  /* uploads are staged per channel, the server may be shared */
   channel_server_t* cs = (*channel)->data;
-  int ret = server_init(&cs->server, database);
+  int ret = server_client_new(&cs->client);
+  if (ret == ERROR_OK) {
+    ret = server_acquire(&cs->server, database);
+  }
   if (ret != ERROR_OK) {
     channel_free(*channel);
   }
 
   return ret;
 }
+
+int
+channel_with_server_get_server(channel_t* channel, server_t** server)
+{
+  if (channel == NULL || channel->data == NULL || server == NULL ||
+      channel->free != cs_free) {
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  channel_server_t* cs = channel->data;
+  *server = cs->server;
+
+  return ERROR_OK;
+}
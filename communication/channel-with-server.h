@@ -9,6 +9,7 @@
  */
 
 #include "communication/channel.h"
+#include "server/server.h"
 
 /**
  * Creates a client-only channel that has its own server spawned.
@@ -25,4 +26,18 @@
  * */
 int channel_with_server_new(channel_t** channel, const char* database);
 
+/**
+ * Returns the server spawned by a channel created with @ref
+ * channel_with_server_new. Lets clients in the same process bypass the packet
+ * encoding, e.g. for streaming blobs.
+ *
+ * @param[in] channel The channel
+ * @param[out] server Pointer to the variable where the server should be stored
+ *
+ * @return @ref ERROR_OK success,
+ * @return @ref ERROR_INVALID_ARGUMENTS If @a channel was not created by @ref
+ *  channel_with_server_new or invalid arguments have been passed
+ * */
+int channel_with_server_get_server(channel_t* channel, server_t** server);
+
 #endif // CHANNEL_WITH_SERVER_H
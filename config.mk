@@ -8,7 +8,7 @@ SQLITE_LIB ?= $(shell pkg-config --libs sqlite3)
 #
 # Make sure that none of the files referenced in REGISTRY_SOURCE contains a
 # main function.
-REGISTRY_SOURCE = registry/registry.c #$(wildcard registry/*.c) $(wildcard ../reference/registry/*.c)
+REGISTRY_SOURCE = registry/registry.c registry/snapshot.c #$(wildcard registry/*.c) $(wildcard ../reference/registry/*.c)
 REGISTRY_INCS   = -I registry
 REGISTRY_LIBS   =
 
@@ -16,7 +16,7 @@ REGISTRY_LIBS   =
 #
 # Make sure that none of the files referenced in SERVER_SOURCE contains a
 # main function.
-SERVER_SOURCE = server/database.c server/server.c #$(wildcard server/*.c) $(wildcard ../reference/server/*.c)
+SERVER_SOURCE = server/codec.c server/database.c server/database-changelog.c server/database-engine.c server/database-heap.c server/database-log.c server/database-memory.c server/database-mirror.c server/database-options.c server/database-sharded.c server/database-snapshot.c server/database-sqlite.c server/file-copy.c server/keymap.c server/server.c #$(wildcard server/*.c) $(wildcard ../reference/server/*.c)
 SERVER_INCS   = -I server $(SQLITE_INC)
 SERVER_LIBS   = $(SQLITE_LIB)
 
@@ -24,7 +24,7 @@ SERVER_LIBS   = $(SQLITE_LIB)
 #
 # Make sure that none of the files referenced in COMMUNICATION_SOURCE contains a
 # main function.
-COMMUNICATION_SOURCE = communication/crypto/sha1.c communication/crypto/hmac.c communication/bpack.c communication/channel-endpoint-connector.c communication/channel-hmac.c communication/channel-with-server.c communication/channel.c communication/datastore.c communication/simple-memory-buffer.c memory.c #$(wildcard communication/*.c) $(wildcard ../reference/communication/*.c)
+COMMUNICATION_SOURCE = communication/crypto/sha1.c communication/crypto/hmac.c communication/bpack.c communication/channel-endpoint-connector.c communication/channel-hmac.c communication/channel-with-server.c communication/channel.c communication/datastore.c communication/simple-memory-buffer.c memory.c hash.c #$(wildcard communication/*.c) $(wildcard ../reference/communication/*.c)
 COMMUNICATION_INCS   = -I communication
 COMMUNICATION_LIBS   = $(LIBS)
 
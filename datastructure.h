@@ -11,11 +11,16 @@
 #include "communication/channel.h"
 #include "server/database.h"
 #include <sqlite3.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 
 struct registry_s {
   channel_t *channel;                     /* channel of registry */
   channel_t *endpoint;                    /* endpoint of channel */
   char *domain;                           /* domain of registry  */
+  struct registry_s *parent;              /* owner of the channel if view */
+  size_t views;                           /* open views of this registry  */
 };
 
 typedef struct channel_hmac_s {
@@ -24,14 +29,59 @@ typedef struct channel_hmac_s {
   channel_t *child;                       /* child channel       */
 } channel_hmac_t;
 
+#define DATABASE_DIRECTORY_CACHE_SIZE 16
+
+typedef struct blob_directory_s {
+  char *name;                             /* path below blob-path */
+  int fd;                                 /* O_DIRECTORY fd       */
+} blob_directory_t;
+
 struct database_handle_s {
   sqlite3* db;
   char* blobpath;
+  int dedup;                              /* content-addressed blobs */
+  int fanout;                             /* hash directory levels */
+  int64_t compress;                       /* smallest value compressed, 0 off */
+  int codecs;                             /* values have a codec column */
+  int durability;                         /* database_durability_t */
+  int readonly;                           /* mode=ro, sets are refused */
+  int blobdir;                            /* O_DIRECTORY fd of blobpath */
+  int hotdir;                             /* O_DIRECTORY fd of the hot tier */
+  int64_t hot_size;                       /* bytes of the hot tier, 0 off */
+  int64_t hot_used;                       /* bytes in it, -1 unknown */
+  blob_directory_t directories[DATABASE_DIRECTORY_CACHE_SIZE];
+  unsigned int nextdirectory;             /* next cache slot to replace */
+  int64_t busy_timeout;                   /* deadline of a wait in ms */
+  int busy_expired;                       /* the last wait gave up */
+  int64_t busy_start;                     /* start of the wait in us */
+  database_busy_stats_t busy_stats;       /* lock contention so far */
+  uint64_t maintenance_cursor;            /* blob files checked this round */
+  int transaction;                        /* depth of nested begin() calls */
+};
+
+struct server_client_s {
+  FILE *upload;                           /* staged chunked blob   */
+  char *upload_domain;                    /* domain of staged blob */
+  char *upload_key;                       /* key of staged blob    */
+  size_t upload_size;                     /* bytes staged so far   */
 };
 
 struct server_s {
-  database_handle_t *db;                  /* database of server */
+  struct database_engine_s *db;           /* storage engine of server */
+  pthread_mutex_t lock;                   /* one caller at a time  */
+  struct server_client_s client;          /* client of server_process */
+  char *backups;                          /* directory of PACKET_BACKUP */
+  size_t memory_limit;                    /* soft RSS limit, 0 off */
+  unsigned int memory_check;              /* packets since last check */
+  time_t last_packet;                     /* end of the latest packet */
 };
 
+typedef struct shared_server_s {
+  char *key;                              /* canonical database    */
+  struct server_s *server;                /* the shared server     */
+  size_t references;                      /* number of users       */
+  struct shared_server_s *next;           /* next shared server    */
+} shared_server_t;
+
 #endif /* DATASTRUCTURE_H */
 
@@ -35,7 +35,11 @@ enum {
   ERROR_SERVER_SHUTDOWN,
   ERROR_SERVER_PROCESS,
 
-  ERROR_HMAC_VERIFICATION_FAILED
+  ERROR_HMAC_VERIFICATION_FAILED,
+
+  ERROR_DATABASE_READONLY,
+  ERROR_DATABASE_BUSY,
+  ERROR_DATABASE_ABORTED
 };
 
 typedef enum packet_type_e {
@@ -58,7 +62,18 @@ typedef enum packet_type_e {
   PACKET_GET_ENUM,
   PACKET_TYPE,
   PACKET_GET_VALUE_TYPE,
-  PACKET_SHUTDOWN
+  PACKET_SHUTDOWN,
+  PACKET_BLOB_CHUNK,
+  PACKET_GET_BLOB_CHUNK,
+  PACKET_SET_BLOB_CHUNK,
+  PACKET_SETTINGS,
+  PACKET_GET_SETTINGS,
+  PACKET_RELEASED,
+  PACKET_RELEASE_MEMORY,
+  PACKET_BACKUP,
+  PACKET_BACKED_UP,
+  PACKET_MAINTAIN,
+  PACKET_MAINTAINED
 } packet_type_t;
 
 #ifdef __cplusplus
@@ -1,7 +1,7 @@
 # See LICENSE file for license and copyright information
 
 INCS = -I . -I..
-LIBS = -lm ../libregistry.a ../libcommunication.a ../libserver.a -lsqlite3
+LIBS = -lm ../libregistry.a ../libserver.a ../libcommunication.a -lsqlite3 -lpthread
 
 # compiler
 CC ?= gcc
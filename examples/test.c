@@ -1,5 +1,18 @@
+#ifndef SYMLINK
+#define SYMLINK
+#define _XOPEN_SOURCE 500
+#include <features.h>
+#endif // SYMLINK
+
 #include "registry/registry.h"
+#include "registry/snapshot.h"
 #include "server/database.h"
+#include "server/database-options.h"
+#include "server/database-engine.h"
+#include "server/database-snapshot.h"
+#include "server/database-heap.h"
+#include "server/file-copy.h"
+#include "server/codec.h"
 #include "server/server.h"
 #include "communication/crypto/sha1.h"
 #include "communication/crypto/sha1_impl.h"
@@ -19,6 +32,12 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <utime.h>
+#include <pthread.h>
 
 
 /* ************************************************************************** */
@@ -48,15 +67,48 @@ void ServerInit();
 void ServerShutdown();
 void ServerProcess();
 void HardcoreEncryptionTests();
+void RegistryBlobStreaming();
+void DatabaseDedup();
+void DatabaseBlobDirectories();
+void DatabaseBlobFanout();
+void DatabaseDurability();
+void DatabaseSchemaFingerprint();
+void ServerSharing();
+void RegistryDomainView();
+void MemoryEngine();
+void LogEngine();
+void ShardedEngine();
+void ReadOnlyDatabase();
+void SnapshotFormat();
+void DomainMirror();
+void DatabaseTuning();
+void DatabaseBusy();
+void DatabaseHeap();
+void ServerMemory();
+void DatabaseBackup();
+void ChangelogFollower();
+void DatabaseMaintenance();
+void DatabaseRecovery();
+void BlobReplacement();
+void ValueCompression();
+void BlobHotTier();
 void TrickyHacks();
 
 
-#define NUMBEROFTESTS 24
+#define NUMBEROFTESTS 49
 const char* testname[NUMBEROFTESTS] = {"NullChecks", "RegistryOpen", "RegistryClose", "RegistryGetInt64", "RegistrySetInt64", 
                                        "RegistryGetDouble", "RegistrySetDouble", "RegistryGetString", "RegistrySetString",
                                        "RegistryGetBlob", "RegistrySetBlob", "RegistryEnumKeys", "RegistryKeyGetValueType",
                                        "RegistryGetChannel","DatabaseChecks", "SHA1Checks", "HMACChecks", "HMACChannelChecks",
                                        "ChannelChecks", "ServerInit", "ServerShutdown", "ServerProcess", "HardcoreEncryptionTests",
+                                       "RegistryBlobStreaming", "DatabaseDedup",
+                                       "DatabaseBlobDirectories", "DatabaseBlobFanout",
+                                       "DatabaseDurability", "DatabaseSchemaFingerprint",
+                                       "ServerSharing", "RegistryDomainView", "MemoryEngine", "LogEngine", "ShardedEngine",
+                                       "ReadOnlyDatabase", "SnapshotFormat", "DomainMirror", "DatabaseTuning", "DatabaseBusy",
+                                       "DatabaseHeap", "ServerMemory", "DatabaseBackup", "ChangelogFollower",
+                                       "DatabaseMaintenance", "DatabaseRecovery", "BlobReplacement",
+                                       "ValueCompression", "BlobHotTier",
                                        "TrickyHacks"};
 
 
@@ -113,6 +165,56 @@ int main(void)
   resetTests();
   HardcoreEncryptionTests();
   resetTests();
+  RegistryBlobStreaming();
+  resetTests();
+  DatabaseDedup();
+  resetTests();
+  DatabaseBlobDirectories();
+  resetTests();
+  DatabaseBlobFanout();
+  resetTests();
+  DatabaseDurability();
+  resetTests();
+  DatabaseSchemaFingerprint();
+  resetTests();
+  ServerSharing();
+  resetTests();
+  RegistryDomainView();
+  resetTests();
+  MemoryEngine();
+  resetTests();
+  LogEngine();
+  resetTests();
+  ShardedEngine();
+  resetTests();
+  ReadOnlyDatabase();
+  resetTests();
+  SnapshotFormat();
+  resetTests();
+  DomainMirror();
+  resetTests();
+  DatabaseTuning();
+  resetTests();
+  DatabaseBusy();
+  resetTests();
+  DatabaseHeap();
+  resetTests();
+  ServerMemory();
+  resetTests();
+  DatabaseBackup();
+  resetTests();
+  ChangelogFollower();
+  resetTests();
+  DatabaseMaintenance();
+  resetTests();
+  DatabaseRecovery();
+  resetTests();
+  BlobReplacement();
+  resetTests();
+  ValueCompression();
+  resetTests();
+  BlobHotTier();
+  resetTests();
 
 
   printf("********************Testcases********************** *\n");
@@ -1977,7 +2079,7 @@ void ServerShutdown()
   const char database[12] = "mydb.sqlite";
   myassert(server_init(&server, database) == ERROR_OK, __LINE__);
   myassert(server_shutdown(NULL)== ERROR_INVALID_ARGUMENTS, __LINE__);
-  database_handle_t* db = server->db;
+  database_engine_t* db = server->db;
   server->db = NULL;
   myassert(server_shutdown(server)== ERROR_INVALID_ARGUMENTS, __LINE__);
   server->db = db;
@@ -2010,7 +2112,7 @@ void ServerProcess()
   unsigned char* response = NULL;
   size_t response_size = 0;
   myassert(server_process(NULL, data, size, &response, &response_size) == ERROR_INVALID_ARGUMENTS, __LINE__);
-  database_handle_t* db = server->db;
+  database_engine_t* db = server->db;
   server->db = NULL;
   myassert(server_process(server, data, size, &response, &response_size) == ERROR_INVALID_ARGUMENTS, __LINE__);
   server->db = db;
@@ -2410,5 +2512,2143 @@ void TrickyHacks()
   myassert(registry_close(registry) == ERROR_OK, __LINE__);
 }
 
+/* ************************************************************************** */
+void RegistryBlobStreaming()
+{
+  registry_t* registry = NULL;
+  char *key = "streamblob";
+  size_t bsize = 3 * REGISTRY_BLOB_CHUNK_SIZE + 42;
+  size_t size = 0;
+  unsigned char *bvalue = NULL;
+  unsigned char *sbvalue = NULL;
+  size_t i = 0;
+
+  myassert(requestMemory((void**)&bvalue, bsize) == ERROR_OK, __LINE__);
+  myassert(requestMemory((void**)&sbvalue, bsize) == ERROR_OK, __LINE__);
+  for(i = 0; i < bsize; i++)
+    bvalue[i] = (i * 31) % 251;
+
+  int in = open("blobstream.in", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  myassert(in >= 0, __LINE__);
+  myassert(write(in, bvalue, bsize) == (ssize_t)bsize, __LINE__);
+
+  /* in-process: the kernel copies the blob file */
+  myassert(registry_open(&registry, "file://mydb.sqlite", "domain") == ERROR_OK, __LINE__);
+  myassert(registry_set_blob_from_fd(NULL, key, in) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_set_blob_from_fd(registry, NULL, in) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_set_blob_from_fd(registry, key, -1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_get_blob_to_fd(registry, key, -1, &size) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_get_blob_to_fd(registry, key, in, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  myassert(lseek(in, 0, SEEK_SET) == 0, __LINE__);
+  myassert(registry_set_blob_from_fd(registry, key, in) == ERROR_OK, __LINE__);
+
+  unsigned char *value = NULL;
+  myassert(registry_get_blob(registry, key, &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == bsize, __LINE__);
+  myassert(value != NULL && memcmp(value, bvalue, bsize) == 0, __LINE__);
+  freeMemory(value);
+
+  int out = open("blobstream.out", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  myassert(out >= 0, __LINE__);
+  myassert(registry_get_blob_to_fd(registry, key, out, &size) == ERROR_OK, __LINE__);
+  myassert(size == bsize, __LINE__);
+  myassert(lseek(out, 0, SEEK_SET) == 0, __LINE__);
+  myassert(read(out, sbvalue, bsize) == (ssize_t)bsize, __LINE__);
+  myassert(memcmp(sbvalue, bvalue, bsize) == 0, __LINE__);
+  close(out);
+
+  myassert(registry_get_blob_to_fd(registry, "NEVEREXISTING", in, &size) == ERROR_REGISTRY_NO_SUCH_KEY, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  /* via HMAC Channel: chunked transfer */
+  registry = NULL;
+  key = "streamblob2";
+  myassert(registry_open(&registry, "file://mydb.sqlite|hmac://theREGISTRY", "domain") == ERROR_OK, __LINE__);
+  myassert(lseek(in, 0, SEEK_SET) == 0, __LINE__);
+  myassert(registry_set_blob_from_fd(registry, key, in) == ERROR_OK, __LINE__);
+
+  value = NULL;
+  myassert(registry_get_blob(registry, key, &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == bsize, __LINE__);
+  myassert(value != NULL && memcmp(value, bvalue, bsize) == 0, __LINE__);
+  freeMemory(value);
+
+  out = open("blobstream.out", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  myassert(out >= 0, __LINE__);
+  myassert(registry_get_blob_to_fd(registry, key, out, &size) == ERROR_OK, __LINE__);
+  myassert(size == bsize, __LINE__);
+  myassert(lseek(out, 0, SEEK_SET) == 0, __LINE__);
+  memset(sbvalue, 0, bsize);
+  myassert(read(out, sbvalue, bsize) == (ssize_t)bsize, __LINE__);
+  myassert(memcmp(sbvalue, bvalue, bsize) == 0, __LINE__);
+  close(out);
+
+  /* empty blob */
+  out = open("blobstream.out", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  myassert(registry_set_blob_from_fd(registry, key, out) == ERROR_OK, __LINE__);
+  myassert(registry_get_blob_to_fd(registry, key, out, &size) == ERROR_OK, __LINE__);
+  myassert(size == 0, __LINE__);
+  close(out);
+
+  myassert(registry_get_blob_to_fd(registry, "NEVEREXISTING", in, &size) == ERROR_REGISTRY_NO_SUCH_KEY, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  close(in);
+  unlink("blobstream.in");
+  unlink("blobstream.out");
+  freeMemory(bvalue);
+  freeMemory(sbvalue);
+}
+
+/* ************************************************************************** */
+int64_t blobRefcount(database_handle_t* database, const char* key)
+{
+  sqlite3_stmt* stmt = NULL;
+  int64_t refcount = -1;
+  sqlite3_prepare_v2(database->db, "SELECT refcount FROM BlobContent WHERE digest = (SELECT substr(replace(path, '/', ''), 6) FROM ValueBlob JOIN KeyInfo ON ValueBlob.id = KeyInfo.id WHERE domain = 'dedup' AND key = :key);", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":key"), key, -1, SQLITE_STATIC);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    refcount = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return refcount;
+}
+
+void DatabaseDedup()
+{
+  database_handle_t* database = NULL;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23, 0x00, 0x17};
+  unsigned char ovalue[] = {0x47, 0x11};
+  unsigned char *value = NULL;
+  size_t size = 0;
+  int64_t count = -1;
+
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database->dedup == 0, __LINE__);
+  myassert(sqlite3_exec(database->db, "INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-dedup', 'Int64'); INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 1);", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  database = NULL;
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database->dedup == 1, __LINE__);
+
+  /* identical content is shared */
+  myassert(database_set_blob(database, "dedup", "a", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_set_blob(database, "dedup", "b", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_set_blob(database, "dedup", "c", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(blobRefcount(database, "a") == 3, __LINE__);
+  myassert(blobRefcount(database, "c") == 3, __LINE__);
+
+  /* rewriting the same content keeps the count */
+  myassert(database_set_blob(database, "dedup", "a", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(blobRefcount(database, "a") == 3, __LINE__);
+
+  myassert(database_get_blob(database, "dedup", "b", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* overwriting and changing the type drop references */
+  myassert(database_set_blob(database, "dedup", "a", ovalue, sizeof(ovalue)) == ERROR_OK, __LINE__);
+  myassert(blobRefcount(database, "a") == 1, __LINE__);
+  myassert(blobRefcount(database, "b") == 2, __LINE__);
+  myassert(database_set_int64(database, "dedup", "b", 42) == ERROR_OK, __LINE__);
+  myassert(blobRefcount(database, "c") == 1, __LINE__);
+
+  /* streamed content ends up in the same file */
+  int in = open("dedup.in", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  myassert(in >= 0, __LINE__);
+  myassert(write(in, bvalue, sizeof(bvalue)) == (ssize_t)sizeof(bvalue), __LINE__);
+  myassert(lseek(in, 0, SEEK_SET) == 0, __LINE__);
+  myassert(database_set_blob_from_fd(database, "dedup", "d", in) == ERROR_OK, __LINE__);
+  myassert(blobRefcount(database, "c") == 2, __LINE__);
+  myassert(database_get_blob(database, "dedup", "d", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+  close(in);
+  unlink("dedup.in");
+
+  /* the last reference removes the content */
+  myassert(database_set_int64(database, "dedup", "a", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(database, "dedup", "c", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(database, "dedup", "d", 1) == ERROR_OK, __LINE__);
+  sqlite3_stmt* stmt = NULL;
+  myassert(sqlite3_prepare_v2(database->db, "SELECT count(*) FROM BlobContent;", -1, &stmt, NULL) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_step(stmt) == SQLITE_ROW, __LINE__);
+  count = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  myassert(count == 0, __LINE__);
+
+  myassert(sqlite3_exec(database->db, "DELETE FROM ValueInt64 WHERE id IN (SELECT id FROM KeyInfo WHERE domain IS NULL AND key = 'blob-dedup'); DELETE FROM KeyInfo WHERE domain IS NULL AND key = 'blob-dedup';", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+}
+
+/* ************************************************************************** */
+void DatabaseBlobDirectories()
+{
+  database_handle_t* database = NULL;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char *value = NULL;
+  size_t size = 0;
+  char path[4096];
+
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database->blobdir >= 0, __LINE__);
+  myassert(database_set_blob(database, "dirs", "a", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+
+  /* the cached domain directory vanishes behind our back */
+  snprintf(path, sizeof(path), "%s/dirs/a", database->blobpath);
+  myassert(unlink(path) == 0, __LINE__);
+  snprintf(path, sizeof(path), "%s/dirs", database->blobpath);
+  myassert(rmdir(path) == 0, __LINE__);
+  myassert(database_set_blob(database, "dirs", "a", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_get_blob(database, "dirs", "a", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* symlinks are never followed */
+  snprintf(path, sizeof(path), "%s/dirs/a", database->blobpath);
+  myassert(unlink(path) == 0, __LINE__);
+  myassert(symlink("/etc/passwd", path) == 0, __LINE__);
+  value = NULL;
+  myassert(database_get_blob(database, "dirs", "a", &value, &size) == ERROR_DATABASE_INVALID, __LINE__);
+  myassert(value == NULL, __LINE__);
+  myassert(unlink(path) == 0, __LINE__);
+
+  myassert(database_set_int64(database, "dirs", "a", 42) == ERROR_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+}
+
+/* ************************************************************************** */
+void blobPath(database_handle_t* database, const char* key, char* path, size_t size)
+{
+  sqlite3_stmt* stmt = NULL;
+  path[0] = '\0';
+  sqlite3_prepare_v2(database->db, "SELECT path FROM ValueBlob JOIN KeyInfo ON ValueBlob.id = KeyInfo.id WHERE domain = 'fanout' AND key = :key;", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":key"), key, -1, SQLITE_STATIC);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    snprintf(path, size, "%s", (const char*)sqlite3_column_text(stmt, 0));
+  sqlite3_finalize(stmt);
+}
 
+void DatabaseBlobFanout()
+{
+  database_handle_t* database = NULL;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char *value = NULL;
+  size_t size = 0;
+  size_t migrated = 0;
+  char path[256];
+
+  /* legacy layout */
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database->fanout == 0, __LINE__);
+  myassert(database_set_blob(database, "fanout", "legacy", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  blobPath(database, "legacy", path, sizeof(path));
+  myassert(strcmp(path, "fanout/legacy") == 0, __LINE__);
+  myassert(database_migrate_blobs(NULL, &migrated) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_migrate_blobs(database, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(sqlite3_exec(database->db, "INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-fanout', 'Int64'); INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 2);", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  /* two levels of hash directories */
+  database = NULL;
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database->fanout == 2, __LINE__);
+  myassert(database_set_blob(database, "fanout", "hashed", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  blobPath(database, "hashed", path, sizeof(path));
+  myassert(strlen(path) == strlen("fanout/ab/cd/hashed") && path[9] == '/' && path[12] == '/', __LINE__);
+  myassert(strcmp(path + 13, "hashed") == 0, __LINE__);
+
+  /* the legacy blob is still readable */
+  myassert(database_get_blob(database, "fanout", "legacy", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+
+  myassert(database_migrate_blobs(database, &migrated) == ERROR_OK, __LINE__);
+  myassert(migrated >= 1, __LINE__);
+  blobPath(database, "legacy", path, sizeof(path));
+  myassert(strncmp(path, "fanout/", 7) == 0 && strcmp(path + 13, "legacy") == 0, __LINE__);
+  myassert(database_get_blob(database, "fanout", "legacy", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* nothing left to do */
+  myassert(database_migrate_blobs(database, &migrated) == ERROR_OK, __LINE__);
+  myassert(migrated == 0, __LINE__);
+
+  myassert(database_set_int64(database, "fanout", "legacy", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(database, "fanout", "hashed", 1) == ERROR_OK, __LINE__);
+  myassert(sqlite3_exec(database->db, "DELETE FROM ValueInt64 WHERE id IN (SELECT id FROM KeyInfo WHERE domain IS NULL AND key = 'blob-fanout'); DELETE FROM KeyInfo WHERE domain IS NULL AND key = 'blob-fanout';", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  /* blobs written by earlier tests move back into the flat layout */
+  database = NULL;
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_migrate_blobs(database, &migrated) == ERROR_OK, __LINE__);
+  myassert(migrated >= 1, __LINE__);
+  myassert(database_migrate_blobs(database, &migrated) == ERROR_OK, __LINE__);
+  myassert(migrated == 0, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+}
 
+/* ************************************************************************** */
+void DatabaseDurability()
+{
+  database_handle_t* database = NULL;
+  registry_t* registry = NULL;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char *value = NULL;
+  size_t size = 0;
+
+  myassert(database_open(&database, "mydb.sqlite?durability=bogus") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_open(&database, "mydb.sqlite?unknown=full") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_open(&database, "mydb.sqlite?durability") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_open(&database, "nodb.sqlite?durability=full") == ERROR_DATABASE_OPEN, __LINE__);
+
+  myassert(database_open(&database, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database->durability == DATABASE_DURABILITY_NORMAL, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  database = NULL;
+  myassert(database_open(&database, "mydb.sqlite?durability=relaxed") == ERROR_OK, __LINE__);
+  myassert(database->durability == DATABASE_DURABILITY_RELAXED, __LINE__);
+  myassert(database_set_blob(database, "durability", "relaxed", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  database = NULL;
+  myassert(database_open(&database, "mydb.sqlite?durability=normal&durability=full") == ERROR_OK, __LINE__);
+  myassert(database->durability == DATABASE_DURABILITY_FULL, __LINE__);
+  myassert(database_set_blob(database, "durability", "full", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_get_blob(database, "durability", "relaxed", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_set_int64(database, "durability", "relaxed", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(database, "durability", "full", 1) == ERROR_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  /* options pass through the registry identifier */
+  myassert(registry_open(&registry, "file://mydb.sqlite?durability=relaxed|hmac://key", "durability") == ERROR_OK, __LINE__);
+  myassert(registry_set_int64(registry, "int", 42) == ERROR_OK, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+  registry = NULL;
+  myassert(registry_open(&registry, "file://mydb.sqlite?durability=none", "durability") == ERROR_INVALID_ARGUMENTS, __LINE__);
+}
+
+/* ************************************************************************** */
+int64_t pragmaValue(database_handle_t* database, const char* statement)
+{
+  sqlite3_stmt* stmt = NULL;
+  int64_t value = -1;
+  sqlite3_prepare_v2(database->db, statement, -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    value = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return value;
+}
+
+void DatabaseSchemaFingerprint()
+{
+  database_handle_t* database = NULL;
+
+  /* work on a copy, the schema gets broken on purpose */
+  int in = open("mydb.sqlite", O_RDONLY);
+  int out = open("fingerprint.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  myassert(in >= 0 && out >= 0, __LINE__);
+  myassert(file_copy(in, out, -1, NULL) == ERROR_OK, __LINE__);
+  close(in);
+  close(out);
+
+  /* the first open checks and stamps the schema */
+  myassert(database_open(&database, "fingerprint.sqlite?durability=relaxed") == ERROR_OK, __LINE__);
+  int64_t version = pragmaValue(database, "PRAGMA schema_version;");
+  myassert(pragmaValue(database, "PRAGMA application_id;") == 0x52656769, __LINE__);
+  myassert(pragmaValue(database, "PRAGMA user_version;") == version, __LINE__);
+
+  /* unrelated schema changes only force a new check */
+  myassert(sqlite3_exec(database->db, "CREATE TABLE Unrelated (x INTEGER);", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(pragmaValue(database, "PRAGMA user_version;") != pragmaValue(database, "PRAGMA schema_version;"), __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+
+  database = NULL;
+  myassert(database_open(&database, "fingerprint.sqlite?durability=relaxed") == ERROR_OK, __LINE__);
+  myassert(pragmaValue(database, "PRAGMA user_version;") == pragmaValue(database, "PRAGMA schema_version;"), __LINE__);
+
+  /* a broken schema is still detected after it has been stamped */
+  myassert(sqlite3_exec(database->db, "ALTER TABLE ValueBlob RENAME COLUMN path TO file;", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(database) == ERROR_OK, __LINE__);
+  database = NULL;
+  myassert(database_open(&database, "fingerprint.sqlite?durability=relaxed") == ERROR_DATABASE_INVALID, __LINE__);
+
+  unlink("fingerprint.sqlite");
+  unlink("fingerprint.sqlite-wal");
+  unlink("fingerprint.sqlite-shm");
+}
+
+/* ************************************************************************** */
+void* sharingWorker(void* context)
+{
+  registry_t* registry = context;
+  int64_t value = 0;
+  int64_t i = 0;
+  size_t failures = 0;
+  for(; i < 200; i++){
+    if(registry_set_int64(registry, "thread", i) != ERROR_OK ||
+       registry_get_int64(registry, "thread", &value) != ERROR_OK || value != i)
+      failures++;
+  }
+  return (void*)failures;
+}
+
+unsigned char sendChunk(channel_t* channel, const char* key, int64_t offset,
+                        int64_t final, const char* chunk)
+{
+  data_store_t ds;
+  unsigned char* data = NULL;
+  size_t size = 0;
+  unsigned char packettype = PACKET_INVALID;
+  if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+     data_store_write_byte(&ds, PACKET_SET_BLOB_CHUNK) != ERROR_OK ||
+     bpack(&ds, "ssllb", "sharing1", key, offset, final, strlen(chunk), chunk) != ERROR_OK ||
+     simple_memory_buffer_get_data(&ds, &data) != ERROR_OK ||
+     simple_memory_buffer_get_size(&ds, &size) != ERROR_OK ||
+     channel_client_write_bytes(channel, data, size) != ERROR_OK){
+    simple_memory_buffer_free(&ds);
+    return PACKET_INVALID;
+  }
+  simple_memory_buffer_free(&ds);
+
+  if(channel_client_read_bytes(channel, &data, &size) != ERROR_OK)
+    return PACKET_INVALID;
+  if(simple_memory_buffer_new(&ds, data, size) == ERROR_OK)
+    data_store_read_byte(&ds, &packettype);
+  simple_memory_buffer_free(&ds);
+  freeMemory(data);
+  return packettype;
+}
+
+void ServerSharing()
+{
+  registry_t* first = NULL;
+  registry_t* second = NULL;
+  registry_t* third = NULL;
+  server_t* server1 = NULL;
+  server_t* server2 = NULL;
+  server_t* server3 = NULL;
+  int64_t value = 0;
+
+  myassert(server_acquire(NULL, "mydb.sqlite") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(server_acquire(&server1, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(server_release(NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  /* different spellings of the same file share one server */
+  myassert(registry_open(&first, "file://mydb.sqlite", "sharing1") == ERROR_OK, __LINE__);
+  myassert(registry_open(&second, "file://../examples/mydb.sqlite", "sharing2") == ERROR_OK, __LINE__);
+  myassert(registry_open(&third, "file://mydb.sqlite?durability=relaxed", "sharing1") == ERROR_OK, __LINE__);
+  myassert(channel_with_server_get_server(registry_get_channel(first), &server1) == ERROR_OK, __LINE__);
+  myassert(channel_with_server_get_server(registry_get_channel(second), &server2) == ERROR_OK, __LINE__);
+  myassert(channel_with_server_get_server(registry_get_channel(third), &server3) == ERROR_OK, __LINE__);
+  myassert(server1 == server2, __LINE__);
+  myassert(server1 != server3, __LINE__);
+
+  /* domains stay separated */
+  myassert(registry_set_int64(first, "int", 1) == ERROR_OK, __LINE__);
+  myassert(registry_set_int64(second, "int", 2) == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(third, "int", &value) == ERROR_OK, __LINE__);
+  myassert(value == 1, __LINE__);
+
+  /* handles sharing a server may be used from different threads */
+  pthread_t threads[2];
+  void* failures[2] = {NULL, NULL};
+  myassert(pthread_create(&threads[0], NULL, sharingWorker, first) == 0, __LINE__);
+  myassert(pthread_create(&threads[1], NULL, sharingWorker, second) == 0, __LINE__);
+  myassert(pthread_join(threads[0], &failures[0]) == 0 && failures[0] == NULL, __LINE__);
+  myassert(pthread_join(threads[1], &failures[1]) == 0 && failures[1] == NULL, __LINE__);
+
+  /* chunked uploads of two channels on one server don't mix */
+  channel_t* upload1 = NULL;
+  channel_t* upload2 = NULL;
+  unsigned char* blob = NULL;
+  size_t blob_size = 0;
+  myassert(channel_with_server_new(&upload1, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(channel_with_server_new(&upload2, "./mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(channel_with_server_get_server(upload2, &server3) == ERROR_OK && server3 == server1, __LINE__);
+  myassert(sendChunk(upload1, "upload1", 0, 0, "first ") == PACKET_OK, __LINE__);
+  myassert(sendChunk(upload2, "upload2", 0, 0, "second ") == PACKET_OK, __LINE__);
+  myassert(sendChunk(upload1, "upload1", 6, 0, "chunk ") == PACKET_OK, __LINE__);
+  myassert(sendChunk(upload2, "upload2", 7, 0, "chunk ") == PACKET_OK, __LINE__);
+  myassert(sendChunk(upload1, "upload1", 12, 1, "of one") == PACKET_OK, __LINE__);
+  myassert(sendChunk(upload2, "upload2", 13, 1, "of two") == PACKET_OK, __LINE__);
+  myassert(channel_free(upload1) == ERROR_OK, __LINE__);
+  myassert(channel_free(upload2) == ERROR_OK, __LINE__);
+  myassert(registry_get_blob(first, "upload1", &blob, &blob_size) == ERROR_OK, __LINE__);
+  myassert(blob_size == 18 && memcmp(blob, "first chunk of one", 18) == 0, __LINE__);
+  freeMemory(blob);
+  myassert(registry_get_blob(first, "upload2", &blob, &blob_size) == ERROR_OK, __LINE__);
+  myassert(blob_size == 19 && memcmp(blob, "second chunk of two", 19) == 0, __LINE__);
+  freeMemory(blob);
+
+  /* the server survives until its last user is gone */
+  myassert(registry_close(first) == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(second, "int", &value) == ERROR_OK, __LINE__);
+  myassert(value == 2, __LINE__);
+  myassert(registry_close(second) == ERROR_OK, __LINE__);
+  myassert(registry_close(third) == ERROR_OK, __LINE__);
+
+  myassert(server_acquire(&server1, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(server_acquire(&server2, "./mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(server1 == server2, __LINE__);
+
+  /* a shared server outlives a shutdown, by packet or by call */
+  data_store_t ds;
+  unsigned char* data = NULL;
+  size_t size = 0;
+  unsigned char* response = NULL;
+  size_t response_size = 0;
+  unsigned char packettype = PACKET_INVALID;
+  myassert(simple_memory_buffer_new(&ds, NULL, 0) == ERROR_OK, __LINE__);
+  myassert(data_store_write_byte(&ds, PACKET_SHUTDOWN) == ERROR_OK, __LINE__);
+  myassert(bpack(&ds, "ss", "sharing1", "shutdown") == ERROR_OK, __LINE__);
+  myassert(simple_memory_buffer_get_data(&ds, &data) == ERROR_OK, __LINE__);
+  myassert(simple_memory_buffer_get_size(&ds, &size) == ERROR_OK, __LINE__);
+  myassert(server_process(server1, data, size, &response, &response_size) == ERROR_OK, __LINE__);
+  myassert(simple_memory_buffer_free(&ds) == ERROR_OK, __LINE__);
+  myassert(simple_memory_buffer_new(&ds, response, response_size) == ERROR_OK, __LINE__);
+  myassert(data_store_read_byte(&ds, &packettype) == ERROR_OK && packettype == PACKET_ERROR, __LINE__);
+  myassert(simple_memory_buffer_free(&ds) == ERROR_OK, __LINE__);
+  freeMemory(response);
+  myassert(server_shutdown(server1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  myassert(server_release(server2) == ERROR_OK, __LINE__);
+  myassert(server_release(server1) == ERROR_OK, __LINE__);
+  myassert(server_acquire(&server1, "nodb.sqlite") == ERROR_DATABASE_OPEN, __LINE__);
+}
+
+/* ************************************************************************** */
+void RegistryDomainView()
+{
+  registry_t* registry = NULL;
+  registry_t* view = NULL;
+  registry_t* nested = NULL;
+  int64_t value = 0;
+  char* svalue = NULL;
+
+  myassert(registry_open(&registry, "file://mydb.sqlite|hmac://viewkey", "view1") == ERROR_OK, __LINE__);
+  myassert(registry_domain_view(NULL, "view2", &view) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(view == NULL, __LINE__);
+  myassert(registry_domain_view(registry, NULL, &view) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_domain_view(registry, "", &view) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_domain_view(registry, "view2", NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  myassert(registry_domain_view(registry, "view2", &view) == ERROR_OK, __LINE__);
+  myassert(registry_domain_view(view, "view3", &nested) == ERROR_OK, __LINE__);
+  myassert(registry_get_channel(view) == registry_get_channel(registry), __LINE__);
+  myassert(registry_get_channel(nested) == registry_get_channel(registry), __LINE__);
+
+  /* one channel, three domains */
+  myassert(registry_set_int64(registry, "int", 1) == ERROR_OK, __LINE__);
+  myassert(registry_set_int64(view, "int", 2) == ERROR_OK, __LINE__);
+  myassert(registry_set_string(nested, "int", "three") == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_OK && value == 1, __LINE__);
+  myassert(registry_get_int64(view, "int", &value) == ERROR_OK && value == 2, __LINE__);
+  myassert(registry_get_string(nested, "int", &svalue) == ERROR_OK, __LINE__);
+  myassert(svalue != NULL && strcmp(svalue, "three") == 0, __LINE__);
+  freeMemory(svalue);
+
+  /* the owner outlives its views */
+  myassert(registry_close(registry) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_close(view) == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_OK && value == 1, __LINE__);
+  myassert(registry_close(nested) == ERROR_OK, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+}
+
+/* ************************************************************************** */
+void MemoryEngine()
+{
+  registry_t* registry = NULL;
+  registry_t* other = NULL;
+  database_engine_t* engine = NULL;
+  int64_t value = 0;
+  double dvalue = 0.0;
+  char* svalue = NULL;
+  unsigned char* bvalue = NULL;
+  size_t bsize = 0;
+  size_t count = 0;
+  size_t size = 0;
+  char* keys = NULL;
+  int type = 0;
+
+  myassert(registry_open(&registry, "mem://", "memory") == ERROR_REGISTRY_UNKNOWN_IDENTIFIER, __LINE__);
+  myassert(registry_open(&registry, "mem://cache?durability=fast", "memory") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_open(&registry, "mem://cache|hmac://memkey", "memory") == ERROR_OK, __LINE__);
+  myassert(registry_open(&other, "mem://cache", "memory") == ERROR_OK, __LINE__);
+
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_REGISTRY_NO_SUCH_KEY, __LINE__);
+  myassert(registry_set_int64(registry, "int", 42) == ERROR_OK, __LINE__);
+  myassert(registry_set_double(registry, "double", 4.2) == ERROR_OK, __LINE__);
+  myassert(registry_set_string(registry, "string", "fortytwo") == ERROR_OK, __LINE__);
+  myassert(registry_set_blob(registry, "blob", (const unsigned char*)"\0\1\2", 3) == ERROR_OK, __LINE__);
+
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(registry_get_double(registry, "double", &dvalue) == ERROR_OK && dvalue == 4.2, __LINE__);
+  myassert(registry_get_string(registry, "string", &svalue) == ERROR_OK, __LINE__);
+  myassert(svalue != NULL && strcmp(svalue, "fortytwo") == 0, __LINE__);
+  freeMemory(svalue);
+  myassert(registry_get_blob(registry, "blob", &bvalue, &bsize) == ERROR_OK, __LINE__);
+  myassert(bsize == 3 && memcmp(bvalue, "\0\1\2", 3) == 0, __LINE__);
+  freeMemory(bvalue);
+  myassert(registry_get_int64(registry, "string", &value) != ERROR_OK, __LINE__);
+  myassert(registry_key_get_value_type(registry, "double", &type) == ERROR_OK && type == DATABASE_TYPE_DOUBLE, __LINE__);
+
+  /* a new value replaces one of any type */
+  myassert(registry_set_int64(registry, "string", 7) == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "string", &value) == ERROR_OK && value == 7, __LINE__);
+
+  /* enumeration is sorted like SQLite's */
+  myassert(registry_enum_keys(registry, "*", &count, &size, &keys) == ERROR_OK, __LINE__);
+  myassert(count == 4 && size == 23 && memcmp(keys, "blob\0double\0int\0string\0", 23) == 0, __LINE__);
+  freeMemory(keys);
+  myassert(registry_enum_keys(registry, "?n*", &count, &size, &keys) == ERROR_OK, __LINE__);
+  myassert(count == 1 && strcmp(keys, "int") == 0, __LINE__);
+  freeMemory(keys);
+
+  /* the same name in the same process is the same store */
+  myassert(registry_get_int64(other, "int", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(registry_close(other) == ERROR_OK, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+  myassert(registry_open(&registry, "mem://cache", "memory") == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_REGISTRY_NO_SUCH_KEY, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  /* the engine on its own, chunks are sliced from the whole blob */
+  myassert(database_engine_open(&engine, "mem://engine") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_blob(engine, "memory", "blob", (const unsigned char*)"abcdef", 6) == ERROR_OK, __LINE__);
+  myassert(database_engine_get_blob_chunk(engine, "memory", "blob", 4, 8, &bvalue, &bsize, &size) == ERROR_OK, __LINE__);
+  myassert(bsize == 2 && size == 6 && memcmp(bvalue, "ef", 2) == 0, __LINE__);
+  freeMemory(bvalue);
+  myassert(database_engine_get_blob_chunk(engine, "memory", "blob", 7, 8, &bvalue, &bsize, &size) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_set_int64(engine, "", "int", 1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+}
+
+/* ************************************************************************** */
+void LogEngine()
+{
+  database_engine_t* engine = NULL;
+  database_engine_t* other_engine = NULL;
+  registry_t* registry = NULL;
+  registry_t* other = NULL;
+  server_t* server1 = NULL;
+  server_t* server2 = NULL;
+  int64_t value = 0;
+  double dvalue = 0.0;
+  char* svalue = NULL;
+  unsigned char* bvalue = NULL;
+  size_t bsize = 0;
+  size_t count = 0;
+  size_t size = 0;
+  char* keys = NULL;
+  database_value_type_t type = DATABASE_TYPE_INT64;
+  struct stat sb;
+
+  unlink("test.log");
+  unlink("test.log.index");
+  myassert(database_engine_open(&engine, "log://test.log?durability=fast") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&engine, "log://test.log?durability=full") == ERROR_OK, __LINE__);
+  myassert(database_engine_get_int64(engine, "log", "int", &value) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+  myassert(database_engine_set_int64(engine, "log", "int", 1) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "log", "int", 42) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_double(engine, "log", "double", 4.2) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_string(engine, "log", "string", "fortytwo") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_blob(engine, "log", "blob", (const unsigned char*)"\0\1\2", 3) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "", "int", 1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_get_double(engine, "log", "int", &dvalue) == ERROR_DATABASE_TYPE_MISMATCH, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* reopened from the checkpoint */
+  myassert(database_engine_open(&engine, "log://test.log") == ERROR_OK, __LINE__);
+  myassert(database_engine_get_int64(engine, "log", "int", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(database_engine_get_double(engine, "log", "double", &dvalue) == ERROR_OK && dvalue == 4.2, __LINE__);
+  myassert(database_engine_get_string(engine, "log", "string", &svalue) == ERROR_OK, __LINE__);
+  myassert(svalue != NULL && strcmp(svalue, "fortytwo") == 0, __LINE__);
+  freeMemory(svalue);
+  myassert(database_engine_get_type(engine, "log", "blob", &type) == ERROR_OK && type == DATABASE_TYPE_BLOB, __LINE__);
+  myassert(database_engine_get_blob(engine, "log", "blob", &bvalue, &bsize) == ERROR_OK, __LINE__);
+  myassert(bsize == 3 && memcmp(bvalue, "\0\1\2", 3) == 0, __LINE__);
+  freeMemory(bvalue);
+  myassert(database_engine_enum_keys(engine, "log", "*i*", &count, &size, &keys) == ERROR_OK, __LINE__);
+  myassert(count == 2 && size == 11 && memcmp(keys, "int\0string\0", 11) == 0, __LINE__);
+  freeMemory(keys);
+  myassert(database_engine_set_string(engine, "log", "string", "after checkpoint") == ERROR_OK, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* without a checkpoint the log is replayed, a torn record is cut off */
+  myassert(stat("test.log", &sb) == 0, __LINE__);
+  off_t logsize = sb.st_size;
+  int fd = open("test.log", O_WRONLY | O_APPEND);
+  myassert(fd >= 0 && write(fd, "\x20\0\0\0torn", 8) == 8, __LINE__);
+  close(fd);
+  unlink("test.log.index");
+  myassert(database_engine_open(&engine, "log://test.log") == ERROR_OK, __LINE__);
+  myassert(stat("test.log", &sb) == 0 && sb.st_size == logsize, __LINE__);
+  myassert(database_engine_get_int64(engine, "log", "int", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(database_engine_get_string(engine, "log", "string", &svalue) == ERROR_OK, __LINE__);
+  myassert(svalue != NULL && strcmp(svalue, "after checkpoint") == 0, __LINE__);
+  freeMemory(svalue);
+
+  /* compaction keeps only the latest records */
+  myassert(database_log_compact(NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_log_compact(engine) == ERROR_OK, __LINE__);
+  myassert(stat("test.log", &sb) == 0 && sb.st_size < logsize, __LINE__);
+  myassert(database_engine_get_blob_chunk(engine, "log", "blob", 1, 8, &bvalue, &bsize, &size) == ERROR_OK, __LINE__);
+  myassert(bsize == 2 && size == 3 && memcmp(bvalue, "\1\2", 2) == 0, __LINE__);
+  freeMemory(bvalue);
+
+  /* and runs on its own once most of the log is garbage */
+  unsigned char* big = NULL;
+  myassert(requestMemory((void**)&big, 256 * 1024) == ERROR_OK, __LINE__);
+  memset(big, 'x', 256 * 1024);
+  int i = 0;
+  for(; i < 16; i++)
+    myassert(database_engine_set_blob(engine, "log", "big", big, 256 * 1024) == ERROR_OK, __LINE__);
+  freeMemory(big);
+  myassert(stat("test.log", &sb) == 0 && sb.st_size < 2 * 1024 * 1024, __LINE__);
+  myassert(database_engine_get_blob(engine, "log", "big", &bvalue, &bsize) == ERROR_OK, __LINE__);
+  myassert(bsize == 256 * 1024 && bvalue[bsize - 1] == 'x', __LINE__);
+  freeMemory(bvalue);
+  myassert(database_engine_get_int64(engine, "log", "int", &value) == ERROR_OK && value == 42, __LINE__);
+
+  /* a second engine on the same log is refused, also in the same process */
+  myassert(database_engine_open(&other_engine, "log://test.log?durability=relaxed") == ERROR_DATABASE_OPEN, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* through the registry, different spellings share the log */
+  myassert(registry_open(&registry, "log://", "log") == ERROR_REGISTRY_UNKNOWN_IDENTIFIER, __LINE__);
+  myassert(registry_open(&registry, "log://test.log", "log") == ERROR_OK, __LINE__);
+  myassert(registry_open(&other, "log://./test.log", "log") == ERROR_OK, __LINE__);
+  myassert(channel_with_server_get_server(registry_get_channel(registry), &server1) == ERROR_OK, __LINE__);
+  myassert(channel_with_server_get_server(registry_get_channel(other), &server2) == ERROR_OK, __LINE__);
+  myassert(server1 == server2, __LINE__);
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(registry_set_int64(other, "int", 43) == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_OK && value == 43, __LINE__);
+  myassert(registry_close(other) == ERROR_OK, __LINE__);
+  other = NULL;
+  myassert(registry_open(&other, "log://test.log?durability=relaxed", "log") != ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "int", &value) == ERROR_OK && value == 43, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+  unlink("test.log");
+  unlink("test.log.index");
+}
+
+/* ************************************************************************** */
+void ShardedEngine()
+{
+  database_engine_t* engine = NULL;
+  database_handle_t* shard[2] = {NULL, NULL};
+  registry_t* registry = NULL;
+  char* identifier = NULL;
+  database_options_t options;
+  char domain[2] = "a";
+  int64_t value = 0;
+  unsigned int selected = 0;
+  int used[2] = {0, 0};
+
+  /* two shards, both copies of the test database */
+  mkdir("shards", 0777);
+  int i = 0;
+  for(; i < 2; i++){
+    char path[32];
+    sprintf(path, "shards/shard-%d.sqlite", i);
+    int from = open("mydb.sqlite", O_RDONLY);
+    int to = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+    close(from);
+    close(to);
+  }
+
+  myassert(database_options_parse("shards?shards=0", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("shards?shards=65", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("shards?durability=relaxed&shards=2", &options) == ERROR_OK, __LINE__);
+  myassert(options.shards == 2, __LINE__);
+  myassert(database_options_format(&options, &identifier) == ERROR_OK, __LINE__);
+  myassert(strcmp(identifier, "shards?durability=relaxed&shards=2") == 0, __LINE__);
+  freeMemory(identifier);
+  database_options_free(&options);
+
+  myassert(database_open(&shard[0], "mydb.sqlite?shards=2") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&engine, "shards?shards=3") == ERROR_DATABASE_OPEN, __LINE__);
+  myassert(database_engine_open(&engine, "shards?shards=1") == ERROR_DATABASE_INVALID, __LINE__);
+  myassert(database_engine_open(&engine, "shards?durability=relaxed") == ERROR_OK, __LINE__);
+
+  /* every domain lives in exactly one shard */
+  for(i = 0; i < 8; i++){
+    domain[0] = 'a' + i;
+    myassert(database_engine_set_int64(engine, domain, "sharded", i) == ERROR_OK, __LINE__);
+  }
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  myassert(database_engine_open(&engine, "shards?shards=2") == ERROR_OK, __LINE__);
+  myassert(database_open(&shard[0], "shards/shard-0.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_open(&shard[1], "shards/shard-1.sqlite") == ERROR_OK, __LINE__);
+  for(i = 0; i < 8; i++){
+    domain[0] = 'a' + i;
+    myassert(database_engine_get_int64(engine, domain, "sharded", &value) == ERROR_OK && value == i, __LINE__);
+    myassert(database_sharded_select(engine, domain, &selected) == ERROR_OK && selected < 2, __LINE__);
+    myassert(database_get_int64(shard[selected], domain, "sharded", &value) == ERROR_OK && value == i, __LINE__);
+    myassert(database_get_int64(shard[1 - selected], domain, "sharded", &value) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+    used[selected] = 1;
+  }
+  myassert(used[0] && used[1], __LINE__);
+  myassert(database_sharded_select(NULL, "a", &selected) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_set_int64(engine, NULL, "sharded", 1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_close(shard[0]) == ERROR_OK, __LINE__);
+  myassert(database_close(shard[1]) == ERROR_OK, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* the registry passes the directory through */
+  myassert(registry_open(&registry, "file://shards|hmac://shardkey", "c") == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "sharded", &value) == ERROR_OK && value == 2, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  unlink("shards/shard-0.sqlite");
+  unlink("shards/shard-1.sqlite");
+  rmdir("shards");
+}
+
+/* ************************************************************************** */
+void ReadOnlyDatabase()
+{
+  database_handle_t* db = NULL;
+  database_engine_t* engine = NULL;
+  registry_t* registry = NULL;
+  char* identifier = NULL;
+  database_options_t options;
+  int64_t value = 0;
+  size_t migrated = 0;
+
+  myassert(database_options_parse("snapshot.sqlite?mode=ro", &options) == ERROR_OK, __LINE__);
+  myassert(options.readonly == 1 && options.immutable == 0 && options.mmap_size == -1, __LINE__);
+  database_options_free(&options);
+  myassert(database_options_parse("snapshot.sqlite?immutable=1&mode=rw", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("snapshot.sqlite?mode=readonly", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("snapshot.sqlite?mmap_size=0100", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("snapshot.sqlite?immutable=1&mmap_size=0", &options) == ERROR_OK, __LINE__);
+  myassert(options.readonly == 1 && options.immutable == 1 && options.mmap_size == 0, __LINE__);
+  myassert(database_options_format(&options, &identifier) == ERROR_OK, __LINE__);
+  myassert(strcmp(identifier, "snapshot.sqlite?immutable=1&mmap_size=0") == 0, __LINE__);
+  freeMemory(identifier);
+  database_options_free(&options);
+
+  /* a snapshot of the test database with one known value */
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("snapshot.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+  myassert(database_open(&db, "snapshot.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_set_int64(db, "snapshot", "value", 42) == ERROR_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  myassert(database_open_readonly(&db, "snapshot.sqlite?mmap_size=65536") == ERROR_OK, __LINE__);
+  myassert(database_get_int64(db, "snapshot", "value", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(database_set_int64(db, "snapshot", "value", 1) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_set_string(db, "snapshot", "string", "x") == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_set_blob(db, "snapshot", "blob", (unsigned char*)"x", 1) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_migrate_blobs(db, &migrated) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  myassert(database_open(&db, "snapshot.sqlite?immutable=1") == ERROR_OK, __LINE__);
+  myassert(database_get_int64(db, "snapshot", "value", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(database_set_double(db, "snapshot", "value", 1.0) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* only the SQLite engines can be read-only */
+  myassert(database_engine_open(&engine, "mem://snapshot?mode=ro") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&engine, "log://snapshot.log?mode=ro") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&engine, "snapshot.sqlite?mode=ro") == ERROR_OK, __LINE__);
+  myassert(engine->readonly == 1, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* the server refuses sets, reads still work */
+  myassert(registry_open(&registry, "file://snapshot.sqlite?mode=ro", "snapshot") == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "value", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(registry_set_int64(registry, "value", 1) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(registry_set_string(registry, "string", "x") == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(registry_get_int64(registry, "value", &value) == ERROR_OK && value == 42, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  unlink("snapshot.sqlite");
+  unlink("snapshot.sqlite-wal");
+  unlink("snapshot.sqlite-shm");
+}
+
+/* ************************************************************************** */
+void SnapshotFormat()
+{
+  database_engine_t* engine = NULL;
+  snapshot_t* snapshot = NULL;
+  char* domains = NULL;
+  size_t count = 0;
+  size_t size = 0;
+  uint64_t generation = 0;
+  int64_t integer = 0;
+  double dob = 0.0;
+  const char* string = NULL;
+  const unsigned char* blob = NULL;
+  int type = -1;
+
+  myassert(database_engine_open(&engine, "mem://snapshot") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "config", "workers", 16) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_double(engine, "config", "ratio", 0.25) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_string(engine, "config", "name", "snapshot") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_blob(engine, "config", "key", (unsigned char*)"\0\1\2", 3) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_blob(engine, "config", "empty", NULL, 0) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "alpha", "workers", 1) == ERROR_OK, __LINE__);
+
+  myassert(database_engine_enum_domains(engine, &count, &size, &domains) == ERROR_OK, __LINE__);
+  myassert(count == 2 && size == 13 && memcmp(domains, "alpha\0config", 13) == 0, __LINE__);
+  freeMemory(domains);
+
+  unlink("test.snapshot");
+  myassert(database_snapshot_compile(engine, "", "test.snapshot") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_snapshot_compile(engine, NULL, "test.snapshot") == ERROR_OK, __LINE__);
+  myassert(snapshot_open(&snapshot, "test.snapshot") == ERROR_OK, __LINE__);
+  myassert(snapshot_generation(snapshot, &generation) == ERROR_OK && generation == 1, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "config", "workers", &integer) == ERROR_OK && integer == 16, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "alpha", "workers", &integer) == ERROR_OK && integer == 1, __LINE__);
+  myassert(snapshot_get_double(snapshot, "config", "ratio", &dob) == ERROR_OK && dob == 0.25, __LINE__);
+  myassert(snapshot_get_string(snapshot, "config", "name", &string) == ERROR_OK && strcmp(string, "snapshot") == 0, __LINE__);
+  myassert(snapshot_get_blob(snapshot, "config", "key", &blob, &size) == ERROR_OK && size == 3 && memcmp(blob, "\0\1\2", 3) == 0, __LINE__);
+  myassert(snapshot_get_blob(snapshot, "config", "empty", &blob, &size) == ERROR_OK && size == 0, __LINE__);
+  myassert(snapshot_get_type(snapshot, "config", "ratio", &type) == ERROR_OK && type == DATABASE_TYPE_DOUBLE, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "config", "name", &integer) == ERROR_DATABASE_TYPE_MISMATCH, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "config", "missing", &integer) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "beta", "workers", &integer) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "config", "", &integer) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(snapshot_close(snapshot) == ERROR_OK, __LINE__);
+
+  /* recompiling bumps the generation, only the domain is left */
+  myassert(database_snapshot_compile(engine, "config", "test.snapshot") == ERROR_OK, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+  myassert(snapshot_open(&snapshot, "test.snapshot") == ERROR_OK, __LINE__);
+  myassert(snapshot_generation(snapshot, &generation) == ERROR_OK && generation == 2, __LINE__);
+  myassert(snapshot_get_string(snapshot, "config", "name", &string) == ERROR_OK && strcmp(string, "snapshot") == 0, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "alpha", "workers", &integer) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+  myassert(snapshot_close(snapshot) == ERROR_OK, __LINE__);
+
+  /* a flipped byte behind the values fails the checksum */
+  int fd = open("test.snapshot", O_RDWR);
+  off_t end = lseek(fd, 0, SEEK_END);
+  unsigned char byte = 0;
+  myassert(pread(fd, &byte, 1, end - 1) == 1, __LINE__);
+  byte ^= 0xff;
+  myassert(pwrite(fd, &byte, 1, end - 1) == 1, __LINE__);
+  close(fd);
+  myassert(snapshot_open(&snapshot, "test.snapshot") == ERROR_DATABASE_INVALID, __LINE__);
+  myassert(snapshot_open(&snapshot, "mydb.sqlite") == ERROR_DATABASE_INVALID, __LINE__);
+  myassert(snapshot_open(&snapshot, "missing.snapshot") == ERROR_DATABASE_OPEN, __LINE__);
+
+  /* the damaged header still counts, an SQLite database leaves out the
+     settings */
+  myassert(database_engine_open(&engine, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "snapshot", "value", 7) == ERROR_OK, __LINE__);
+  myassert(database_snapshot_compile(engine, NULL, "test.snapshot") == ERROR_OK, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+  myassert(snapshot_open(&snapshot, "test.snapshot") == ERROR_OK, __LINE__);
+  myassert(snapshot_generation(snapshot, &generation) == ERROR_OK && generation == 3, __LINE__);
+  myassert(snapshot_get_int64(snapshot, "snapshot", "value", &integer) == ERROR_OK && integer == 7, __LINE__);
+  myassert(snapshot_close(snapshot) == ERROR_OK, __LINE__);
+
+  unlink("test.snapshot");
+}
+
+/* ************************************************************************** */
+void DomainMirror()
+{
+  database_handle_t* db = NULL;
+  database_engine_t* engine = NULL;
+  database_engine_t* other = NULL;
+  database_options_t options;
+  char* identifier = NULL;
+  char* svalue = NULL;
+  unsigned char* bvalue = NULL;
+  size_t bsize = 0;
+  size_t count = 0;
+  size_t size = 0;
+  char* keys = NULL;
+  int64_t value = 0;
+  int mirrored = -1;
+
+  myassert(database_options_parse("mirror.sqlite?mirror=1048577", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("mirror.sqlite?durability=relaxed&mirror=3", &options) == ERROR_OK, __LINE__);
+  myassert(options.mirror == 3, __LINE__);
+  myassert(database_options_format(&options, &identifier) == ERROR_OK, __LINE__);
+  myassert(strcmp(identifier, "mirror.sqlite?durability=relaxed&mirror=3") == 0, __LINE__);
+  freeMemory(identifier);
+  database_options_free(&options);
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("mirror.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  myassert(database_open(&db, "mirror.sqlite?mirror=3") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&other, "mirror.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(other, "small", "a", 1) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_string(other, "small", "b", "two") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_blob(other, "small", "c", (unsigned char*)"\0\1", 2) == ERROR_OK, __LINE__);
+  int i = 0;
+  for(; i < 4; i++){
+    char key[2] = {'a' + i, '\0'};
+    myassert(database_engine_set_int64(other, "large", key, i) == ERROR_OK, __LINE__);
+  }
+
+  myassert(database_engine_open(&engine, "mirror.sqlite?mirror=3") == ERROR_OK, __LINE__);
+  myassert(database_mirror_mirrored(other, "small", &mirrored) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_mirror_mirrored(engine, "small", &mirrored) == ERROR_OK && mirrored == 1, __LINE__);
+  myassert(database_mirror_mirrored(engine, "large", &mirrored) == ERROR_OK && mirrored == 0, __LINE__);
+  myassert(database_engine_get_int64(engine, "small", "a", &value) == ERROR_OK && value == 1, __LINE__);
+  myassert(database_engine_get_string(engine, "small", "b", &svalue) == ERROR_OK, __LINE__);
+  myassert(svalue != NULL && strcmp(svalue, "two") == 0, __LINE__);
+  freeMemory(svalue);
+  myassert(database_engine_get_blob(engine, "small", "c", &bvalue, &bsize) == ERROR_OK, __LINE__);
+  myassert(bsize == 2 && memcmp(bvalue, "\0\1", 2) == 0, __LINE__);
+  freeMemory(bvalue);
+  myassert(database_engine_get_int64(engine, "small", "b", &value) == ERROR_DATABASE_TYPE_MISMATCH, __LINE__);
+  myassert(database_engine_get_int64(engine, "small", "missing", &value) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+  myassert(database_engine_enum_keys(engine, "small", "*", &count, &size, &keys) == ERROR_OK, __LINE__);
+  myassert(count == 3 && size == 6 && memcmp(keys, "a\0b\0c", 6) == 0, __LINE__);
+  freeMemory(keys);
+
+  /* writes go through, reads of the mirrored domain don't see anybody else */
+  myassert(database_engine_set_int64(engine, "small", "a", 10) == ERROR_OK, __LINE__);
+  myassert(database_engine_get_int64(other, "small", "a", &value) == ERROR_OK && value == 10, __LINE__);
+  myassert(database_engine_set_int64(other, "small", "a", 11) == ERROR_OK, __LINE__);
+  myassert(database_engine_get_int64(engine, "small", "a", &value) == ERROR_OK && value == 10, __LINE__);
+  myassert(database_engine_set_int64(other, "large", "a", 11) == ERROR_OK, __LINE__);
+  myassert(database_engine_get_int64(engine, "large", "a", &value) == ERROR_OK && value == 11, __LINE__);
+
+  /* a fourth key is one too many */
+  myassert(database_engine_set_int64(engine, "small", "d", 4) == ERROR_OK, __LINE__);
+  myassert(database_mirror_mirrored(engine, "small", &mirrored) == ERROR_OK && mirrored == 0, __LINE__);
+  myassert(database_engine_get_int64(engine, "small", "a", &value) == ERROR_OK && value == 11, __LINE__);
+  myassert(database_engine_get_int64(engine, "small", "d", &value) == ERROR_OK && value == 4, __LINE__);
+
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+  myassert(database_engine_close(other) == ERROR_OK, __LINE__);
+
+  /* any engine can be mirrored */
+  myassert(database_engine_open(&engine, "mem://mirror?mirror=2") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "memory", "a", 1) == ERROR_OK, __LINE__);
+  myassert(database_engine_get_int64(engine, "memory", "a", &value) == ERROR_OK && value == 1, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  unlink("mirror.sqlite");
+  unlink("mirror.sqlite-wal");
+  unlink("mirror.sqlite-shm");
+}
+
+/* ************************************************************************** */
+void DatabaseTuning()
+{
+  database_handle_t* db = NULL;
+  database_engine_t* engine = NULL;
+  registry_t* registry = NULL;
+  database_options_t options;
+  char* identifier = NULL;
+  char* settings = NULL;
+
+  myassert(database_options_parse("tuning.sqlite?cache_size=0", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("tuning.sqlite?cache_size=-", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("tuning.sqlite?journal=off", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("tuning.sqlite?synchronous=NORMAL", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("tuning.sqlite?busy_timeout=3600001", &options) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_options_parse("tuning.sqlite?temp_store=memory&cache_size=-4096&busy_timeout=250&synchronous=extra&journal=truncate", &options) == ERROR_OK, __LINE__);
+  myassert(options.cache_size == -4096 && options.busy_timeout == 250, __LINE__);
+  myassert(options.journal == DATABASE_JOURNAL_TRUNCATE && options.synchronous == DATABASE_SYNCHRONOUS_EXTRA, __LINE__);
+  myassert(database_options_format(&options, &identifier) == ERROR_OK, __LINE__);
+  myassert(strcmp(identifier, "tuning.sqlite?cache_size=-4096&journal=truncate&synchronous=extra&temp_store=memory&busy_timeout=250") == 0, __LINE__);
+  freeMemory(identifier);
+  database_options_free(&options);
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("tuning.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  /* the defaults follow durability=normal */
+  myassert(database_open(&db, "tuning.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_get_settings(db, &settings) == ERROR_OK, __LINE__);
+  myassert(strncmp(settings, "journal=wal&synchronous=normal&", 31) == 0, __LINE__);
+  freeMemory(settings);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  myassert(database_open(&db, "tuning.sqlite?durability=full&journal=truncate&synchronous=extra&cache_size=-4096&mmap_size=65536&temp_store=memory&busy_timeout=250") == ERROR_OK, __LINE__);
+  myassert(database_get_settings(db, &settings) == ERROR_OK, __LINE__);
+  myassert(strcmp(settings, "journal=truncate&synchronous=extra&cache_size=-4096&mmap_size=65536&temp_store=memory&busy_timeout=250") == 0, __LINE__);
+  freeMemory(settings);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* engines without SQLite have nothing to report */
+  myassert(database_engine_open(&engine, "mem://tuning") == ERROR_OK, __LINE__);
+  myassert(database_engine_get_settings(engine, &settings) == ERROR_OK && strlen(settings) == 0, __LINE__);
+  freeMemory(settings);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  myassert(registry_open(&registry, "file://tuning.sqlite?cache_size=500&synchronous=off|hmac://key", "tuning") == ERROR_OK, __LINE__);
+  myassert(registry_get_settings(registry, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_get_settings(registry, &settings) == ERROR_OK, __LINE__);
+  myassert(settings != NULL && strstr(settings, "&synchronous=off&cache_size=500&") != NULL, __LINE__);
+  freeMemory(settings);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+  myassert(registry_open(&registry, "file://tuning.sqlite?temp_store=disk", "tuning") == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  unlink("tuning.sqlite");
+  unlink("tuning.sqlite-wal");
+  unlink("tuning.sqlite-shm");
+}
+
+void* busyWriter(void* context)
+{
+  database_handle_t* db = context;
+  int64_t i = 0;
+  size_t failures = 0;
+  for(; i < 100; i++){
+    if(database_set_int64(db, "busy", "writer", i) != ERROR_OK)
+      failures++;
+  }
+  return (void*)failures;
+}
+
+void* busyRelease(void* context)
+{
+  usleep(100000);
+  return (void*)(size_t)sqlite3_exec(context, "COMMIT;", NULL, NULL, NULL);
+}
+
+void DatabaseBusy()
+{
+  database_handle_t* db = NULL;
+  database_handle_t* other = NULL;
+  pthread_t threads[2];
+  void* result = NULL;
+  registry_t* registry = NULL;
+  sqlite3* lock = NULL;
+  database_busy_stats_t stats;
+  char* settings = NULL;
+  int64_t value = 0;
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("busy.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  myassert(database_open(&db, "busy.sqlite?busy_timeout=50") == ERROR_OK, __LINE__);
+  myassert(database_get_busy_stats(NULL, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_get_busy_stats(db, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_get_busy_stats(db, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.waits == 0 && stats.retries == 0 && stats.timeouts == 0, __LINE__);
+  myassert(database_get_settings(db, &settings) == ERROR_OK, __LINE__);
+  myassert(strstr(settings, "&busy_timeout=50") != NULL, __LINE__);
+  freeMemory(settings);
+  myassert(database_set_int64(db, "busy", "before", 1) == ERROR_OK, __LINE__);
+
+  /* a second connection holds the write lock */
+  myassert(sqlite3_open("busy.sqlite", &lock) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_exec(lock, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_set_int64(db, "busy", "locked", 2) == ERROR_DATABASE_BUSY, __LINE__);
+  myassert(database_get_busy_stats(db, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.waits >= 1 && stats.timeouts >= 1, __LINE__);
+  /* the backoff keeps the number of attempts low */
+  myassert(stats.retries >= 3 && stats.retries <= 50, __LINE__);
+  myassert(stats.waited_us >= 40000 && stats.waited_us <= 60000, __LINE__);
+  /* reading isn't blocked by a writer */
+  myassert(database_get_int64(db, "busy", "before", &value) == ERROR_OK && value == 1, __LINE__);
+  myassert(sqlite3_exec(lock, "ROLLBACK;", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+
+  myassert(database_set_int64(db, "busy", "locked", 2) == ERROR_OK, __LINE__);
+  myassert(database_get_int64(db, "busy", "locked", &value) == ERROR_OK && value == 2, __LINE__);
+  uint64_t timeouts = stats.timeouts;
+  myassert(database_get_busy_stats(db, &stats) == ERROR_OK && stats.timeouts == timeouts, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* a second writer waits for the first one and then succeeds */
+  myassert(database_open(&db, "busy.sqlite?busy_timeout=2000") == ERROR_OK, __LINE__);
+  myassert(database_open(&other, "busy.sqlite?busy_timeout=2000") == ERROR_OK, __LINE__);
+  myassert(sqlite3_exec(lock, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(pthread_create(&threads[0], NULL, busyRelease, lock) == 0, __LINE__);
+  myassert(database_set_int64(db, "busy", "waited", 4) == ERROR_OK, __LINE__);
+  myassert(pthread_join(threads[0], &result) == 0 && result == (void*)SQLITE_OK, __LINE__);
+  myassert(database_get_busy_stats(db, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.waits >= 1 && stats.timeouts == 0, __LINE__);
+  myassert(database_get_int64(other, "busy", "waited", &value) == ERROR_OK && value == 4, __LINE__);
+
+  /* two connections writing the same key never see an unhandled lock */
+  myassert(pthread_create(&threads[0], NULL, busyWriter, db) == 0, __LINE__);
+  myassert(pthread_create(&threads[1], NULL, busyWriter, other) == 0, __LINE__);
+  myassert(pthread_join(threads[0], &result) == 0 && result == NULL, __LINE__);
+  myassert(pthread_join(threads[1], &result) == 0 && result == NULL, __LINE__);
+  myassert(database_get_int64(db, "busy", "writer", &value) == ERROR_OK && value == 99, __LINE__);
+  myassert(database_close(other) == ERROR_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* the registry passes the error on */
+  myassert(registry_open(&registry, "file://busy.sqlite?busy_timeout=20", "busy") == ERROR_OK, __LINE__);
+  myassert(sqlite3_exec(lock, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(registry_set_int64(registry, "locked", 3) == ERROR_DATABASE_BUSY, __LINE__);
+  myassert(sqlite3_exec(lock, "ROLLBACK;", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(registry_set_int64(registry, "locked", 3) == ERROR_OK, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+  sqlite3_close(lock);
+
+  unlink("busy.sqlite");
+  unlink("busy.sqlite-wal");
+  unlink("busy.sqlite-shm");
+}
+
+void DatabaseHeap()
+{
+  database_handle_t* db = NULL;
+  database_heap_config_t config;
+  database_heap_stats_t stats;
+  char* value = NULL;
+  char key[16];
+
+  memset(&config, 0, sizeof(database_heap_config_t));
+  config.page_size = 1000;
+  config.pages = 64;
+  myassert(database_heap_configure(NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_heap_configure(&config) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  config.page_size = 4096;
+  config.pages = 0;
+  myassert(database_heap_configure(&config) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  config.pages = 64;
+  config.lookaside_size = 256;
+  myassert(database_heap_configure(&config) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  config.lookaside_slots = 32;
+  config.limit = -1;
+  myassert(database_heap_configure(&config) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  config.limit = 16 * 1024 * 1024;
+  config.huge_pages = 1;
+  myassert(database_heap_get_stats(NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("heap.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  /* SQLite can't be reconfigured under an open database */
+  myassert(database_open(&db, "heap.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_heap_configure(&config) == ERROR_DATABASE_OPEN, __LINE__);
+  myassert(database_heap_reset() == ERROR_DATABASE_OPEN, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  myassert(database_heap_configure(&config) == ERROR_OK, __LINE__);
+  myassert(database_heap_get_stats(&stats) == ERROR_OK, __LINE__);
+  myassert(stats.limit == 16 * 1024 * 1024 && stats.pages_used == 0, __LINE__);
+
+  myassert(database_open(&db, "heap.sqlite") == ERROR_OK, __LINE__);
+  int i = 0;
+  for(; i < 100; i++){
+    snprintf(key, sizeof(key), "key%d", i);
+    myassert(database_set_string(db, "heap", key, "a value that fills the pages") == ERROR_OK, __LINE__);
+  }
+  myassert(database_get_string(db, "heap", "key42", &value) == ERROR_OK, __LINE__);
+  myassert(value != NULL && strcmp(value, "a value that fills the pages") == 0, __LINE__);
+  freeMemory(value);
+
+  /* pages come from the arena, the rest from requestMemory */
+  myassert(database_heap_get_stats(&stats) == ERROR_OK, __LINE__);
+  myassert(stats.pages_used > 0 && stats.pages_used <= 64, __LINE__);
+  myassert(stats.used > 0 && stats.highwater >= stats.used, __LINE__);
+  myassert(stats.used <= stats.limit, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* the defaults are back after a reset */
+  myassert(database_heap_reset() == ERROR_OK, __LINE__);
+  myassert(database_heap_get_stats(&stats) == ERROR_OK, __LINE__);
+  myassert(stats.limit == 0 && stats.pages_used == 0 && stats.huge_pages == 0, __LINE__);
+  myassert(database_open(&db, "heap.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_get_string(db, "heap", "key99", &value) == ERROR_OK, __LINE__);
+  freeMemory(value);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  unlink("heap.sqlite");
+  unlink("heap.sqlite-wal");
+  unlink("heap.sqlite-shm");
+}
+
+void ServerMemory()
+{
+  server_t* server = NULL;
+  registry_t* registry = NULL;
+  char* value = NULL;
+  char key[16];
+  size_t released = 0;
+  int cached = 0;
+  int highwater = 0;
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("release.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  myassert(server_init(&server, "release.sqlite") == ERROR_OK, __LINE__);
+  sqlite3* sqlite = ((database_handle_t*)server->db->data)->db;
+  int i = 0;
+  for(; i < 200; i++){
+    snprintf(key, sizeof(key), "key%d", i);
+    myassert(database_engine_set_string(server->db, "release", key, "a value that fills the page cache of SQLite") == ERROR_OK, __LINE__);
+  }
+
+  myassert(server_release_memory(NULL, &released) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(server_release_memory(server, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(server_set_memory_limit(NULL, 1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(server_release_memory(server, &released) == ERROR_OK && released > 0, __LINE__);
+  /* nothing is lost */
+  myassert(database_engine_get_string(server->db, "release", "key150", &value) == ERROR_OK, __LINE__);
+  myassert(strcmp(value, "a value that fills the page cache of SQLite") == 0, __LINE__);
+  freeMemory(value);
+
+  /* a process beyond its soft limit releases every 256th packet */
+  unsigned char* data = NULL;
+  size_t size = 0;
+  unsigned char* response = NULL;
+  size_t response_size = 0;
+  data_store_t ds;
+  myassert(simple_memory_buffer_new(&ds, NULL, 0) == ERROR_OK, __LINE__);
+  myassert(data_store_write_byte(&ds, PACKET_GET_STRING) == ERROR_OK, __LINE__);
+  myassert(bpack(&ds, "ss", "release", "key199") == ERROR_OK, __LINE__);
+  myassert(simple_memory_buffer_get_data(&ds, &data) == ERROR_OK, __LINE__);
+  myassert(simple_memory_buffer_get_size(&ds, &size) == ERROR_OK, __LINE__);
+  myassert(server_set_memory_limit(server, 1) == ERROR_OK, __LINE__);
+  for(i = 0; i < 255; i++){
+    myassert(server_process(server, data, size, &response, &response_size) == ERROR_OK, __LINE__);
+    freeMemory(response);
+  }
+  myassert(sqlite3_db_status(sqlite, SQLITE_DBSTATUS_CACHE_USED, &cached, &highwater, 0) == SQLITE_OK, __LINE__);
+  int before = cached;
+  myassert(server_process(server, data, size, &response, &response_size) == ERROR_OK, __LINE__);
+  freeMemory(response);
+  myassert(sqlite3_db_status(sqlite, SQLITE_DBSTATUS_CACHE_USED, &cached, &highwater, 0) == SQLITE_OK, __LINE__);
+  myassert(cached < before, __LINE__);
+  myassert(simple_memory_buffer_free(&ds) == ERROR_OK, __LINE__);
+  myassert(server_shutdown(server) == ERROR_OK, __LINE__);
+
+  /* clients ask with PACKET_RELEASE_MEMORY, also through a mirror */
+  myassert(registry_open(&registry, "file://release.sqlite?mirror=256|hmac://key", "release") == ERROR_OK, __LINE__);
+  myassert(registry_get_string(registry, "key7", &value) == ERROR_OK, __LINE__);
+  freeMemory(value);
+  myassert(registry_release_memory(registry, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_release_memory(registry, &released) == ERROR_OK, __LINE__);
+  myassert(registry_get_string(registry, "key7", &value) == ERROR_OK, __LINE__);
+  myassert(strcmp(value, "a value that fills the page cache of SQLite") == 0, __LINE__);
+  freeMemory(value);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  myassert(registry_open(&registry, "mem://release", "release") == ERROR_OK, __LINE__);
+  myassert(registry_release_memory(registry, &released) == ERROR_OK && released == 0, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  unlink("release.sqlite");
+  unlink("release.sqlite-wal");
+  unlink("release.sqlite-shm");
+}
+
+int removeEntry(const char* path, const struct stat* sb, int flag, struct FTW* ftw)
+{
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+int countBackup(const database_backup_progress_t* progress, void* context)
+{
+  (void)progress;
+  (*(int*)context)++;
+  return 0;
+}
+
+int abortBackup(const database_backup_progress_t* progress, void* context)
+{
+  (void)progress;
+  (void)context;
+  return 1;
+}
+
+void DatabaseBackup()
+{
+  database_handle_t* db = NULL;
+  database_handle_t* copy = NULL;
+  database_engine_t* engine = NULL;
+  registry_t* registry = NULL;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char* value = NULL;
+  char* string = NULL;
+  size_t size = 0;
+  int64_t integer = 0;
+  int calls = 0;
+  int64_t pages = 0;
+  int64_t blobs = -1;
+  char path[4096];
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("original.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  /* a long string spreads over enough pages for several batches */
+  char* large = NULL;
+  myassert(requestMemory((void**)&large, 512 * 1024) == ERROR_OK, __LINE__);
+  memset(large, 'x', 512 * 1024 - 1);
+  large[512 * 1024 - 1] = '\0';
+  myassert(database_open(&db, "original.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_set_int64(db, "backup", "number", 42) == ERROR_OK, __LINE__);
+  myassert(database_set_string(db, "backup", "large", large) == ERROR_OK, __LINE__);
+  myassert(database_set_blob(db, "backup", "picture", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+
+  myassert(database_backup(NULL, "backup.sqlite", NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_backup(db, NULL, NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_backup(db, "", NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_backup(db, "backup.sqlite", countBackup, &calls) == ERROR_OK, __LINE__);
+  myassert(calls > 2, __LINE__);
+  myassert(access("backup.sqlite" DATABASE_BACKUP_TEMPORARY, F_OK) != 0, __LINE__);
+
+  /* the backup keeps its blob when the original changes */
+  myassert(database_set_int64(db, "backup", "picture", 1) == ERROR_OK, __LINE__);
+  myassert(database_open(&copy, "backup.sqlite") == ERROR_OK, __LINE__);
+  myassert(strstr(copy->blobpath, "backup.sqlite" DATABASE_BACKUP_BLOBS) != NULL, __LINE__);
+  myassert(database_get_int64(copy, "backup", "number", &integer) == ERROR_OK && integer == 42, __LINE__);
+  myassert(database_get_string(copy, "backup", "large", &string) == ERROR_OK, __LINE__);
+  myassert(string != NULL && strcmp(string, large) == 0, __LINE__);
+  freeMemory(string);
+  myassert(database_get_blob(copy, "backup", "picture", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_set_int64(copy, "backup", "picture", 1) == ERROR_OK, __LINE__);
+  myassert(database_close(copy) == ERROR_OK, __LINE__);
+  freeMemory(large);
+
+  /* an aborted backup leaves nothing behind */
+  myassert(database_backup(db, "aborted.sqlite", abortBackup, NULL) == ERROR_DATABASE_ABORTED, __LINE__);
+  myassert(access("aborted.sqlite", F_OK) != 0, __LINE__);
+  myassert(access("aborted.sqlite" DATABASE_BACKUP_TEMPORARY, F_OK) != 0, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* engines without a database file have nothing to back up */
+  myassert(database_engine_open(&engine, "mem://backup") == ERROR_OK, __LINE__);
+  myassert(database_engine_backup(engine, "memory.sqlite", NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* clients ask the server with PACKET_BACKUP, but only for a file name */
+  myassert(mkdir("backup.d", 0777) == 0, __LINE__);
+  from = open("original.sqlite", O_RDONLY);
+  to = open("backup.d/original.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+  myassert(registry_open(&registry, "file://backup.d/original.sqlite", "backup") == ERROR_OK, __LINE__);
+  myassert(registry_backup(registry, NULL, NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_backup(registry, "../registry.sqlite", NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_backup(registry, "/tmp/registry.sqlite", NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_backup(registry, "..", NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(access("backup.d/" SERVER_BACKUP_DIRECTORY, F_OK) != 0, __LINE__);
+  myassert(registry_backup(registry, "registry.sqlite", &pages, &blobs) == ERROR_OK, __LINE__);
+  myassert(pages > 0 && blobs >= 0, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+  /* next to the database, not in the working directory */
+  myassert(access("registry.sqlite", F_OK) != 0, __LINE__);
+  myassert(access(SERVER_BACKUP_DIRECTORY, F_OK) != 0, __LINE__);
+  myassert(database_open(&copy, "backup.d/" SERVER_BACKUP_DIRECTORY "/registry.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_get_int64(copy, "backup", "number", &integer) == ERROR_OK && integer == 42, __LINE__);
+  myassert(database_close(copy) == ERROR_OK, __LINE__);
+
+  const char* names[2] = {"original.sqlite", "backup.sqlite"};
+  int i = 0;
+  for(; i < 2; i++){
+    unlink(names[i]);
+    snprintf(path, sizeof(path), "%s-wal", names[i]);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s-shm", names[i]);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s" DATABASE_BACKUP_BLOBS, names[i]);
+    nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+  nftw("backup.d", removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void ChangelogFollower()
+{
+  database_engine_t* engine = NULL;
+  database_engine_t* other = NULL;
+  database_follower_t* follower = NULL;
+  database_handle_t* db = NULL;
+  registry_t* registry = NULL;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char* value = NULL;
+  char* string = NULL;
+  size_t size = 0;
+  size_t applied = 0;
+  int64_t integer = 0;
+  double dob = 0.0;
+  char path[4096];
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("primary.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+
+  /* only writable SQLite based engines record their changes */
+  myassert(database_engine_open(&engine, "mem://primary?changelog=1") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&engine, "primary.sqlite?changelog=1&mode=ro") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_open(&engine, "primary.sqlite?changelog=2") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_open(&db, "primary.sqlite?changelog=1") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_changelog_new(&engine, "primary.sqlite") == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  myassert(database_engine_open(&engine, "primary.sqlite?changelog=1") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "follow", "number", 42) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_string(engine, "follow", "string", "first") == ERROR_OK, __LINE__);
+
+  /* the follower starts from a backup with a blob-path of its own */
+  myassert(database_engine_backup(engine, "follower.sqlite", NULL, NULL) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_double(engine, "follow", "double", 4.2) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_blob(engine, "follow", "blob", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_engine_set_string(engine, "follow", "string", "second") == ERROR_OK, __LINE__);
+  /* failed sets are not recorded */
+  myassert(database_engine_set_int64(engine, "", "number", 1) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  myassert(database_follower_open(NULL, "primary.sqlite" DATABASE_CHANGELOG_SUFFIX, "follower.sqlite") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_follower_open(&follower, "missing" DATABASE_CHANGELOG_SUFFIX, "follower.sqlite") == ERROR_DATABASE_OPEN, __LINE__);
+  myassert(database_follower_open(&follower, "primary.sqlite", "follower.sqlite") == ERROR_DATABASE_INVALID, __LINE__);
+  myassert(database_follower_open(&follower, "primary.sqlite" DATABASE_CHANGELOG_SUFFIX, "follower.sqlite?mode=ro") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_follower_open(&follower, "primary.sqlite" DATABASE_CHANGELOG_SUFFIX, "follower.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_follower_poll(NULL, &applied) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_follower_poll(follower, &applied) == ERROR_OK && applied == 5, __LINE__);
+  myassert(database_follower_poll(follower, &applied) == ERROR_OK && applied == 0, __LINE__);
+
+  /* readers of the follower never touch the primary */
+  myassert(registry_open(&registry, "file://follower.sqlite?mode=ro", "follow") == ERROR_OK, __LINE__);
+  myassert(registry_get_int64(registry, "number", &integer) == ERROR_OK && integer == 42, __LINE__);
+  myassert(registry_get_double(registry, "double", &dob) == ERROR_OK && dob == 4.2, __LINE__);
+  myassert(registry_get_string(registry, "string", &string) == ERROR_OK, __LINE__);
+  myassert(string != NULL && strcmp(string, "second") == 0, __LINE__);
+  freeMemory(string);
+  myassert(registry_get_blob(registry, "blob", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  /* a second writer appends behind the first, a reopened follower goes on
+     where it stopped */
+  myassert(database_follower_close(follower) == ERROR_OK, __LINE__);
+  myassert(database_engine_open(&other, "primary.sqlite?changelog=1") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(other, "follow", "number", 43) == ERROR_OK, __LINE__);
+  myassert(database_engine_close(other) == ERROR_OK, __LINE__);
+  myassert(database_follower_open(&follower, "primary.sqlite" DATABASE_CHANGELOG_SUFFIX, "follower.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_follower_poll(follower, &applied) == ERROR_OK && applied == 1, __LINE__);
+  myassert(database_follower_close(follower) == ERROR_OK, __LINE__);
+
+  /* a torn record is cut off by the next writer */
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+  int fd = open("primary.sqlite" DATABASE_CHANGELOG_SUFFIX, O_WRONLY | O_APPEND);
+  myassert(fd >= 0 && write(fd, "torn", 4) == 4, __LINE__);
+  close(fd);
+  myassert(database_engine_open(&engine, "primary.sqlite?changelog=1") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "follow", "number", 44) == ERROR_OK, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* a new change log is followed from its start */
+  unlink("primary.sqlite" DATABASE_CHANGELOG_SUFFIX);
+  myassert(database_follower_open(&follower, "primary.sqlite" DATABASE_CHANGELOG_SUFFIX, "mem://follower") == ERROR_DATABASE_OPEN, __LINE__);
+  myassert(database_engine_open(&engine, "primary.sqlite?changelog=1") == ERROR_OK, __LINE__);
+  myassert(database_engine_set_int64(engine, "follow", "number", 45) == ERROR_OK, __LINE__);
+  myassert(database_follower_open(&follower, "primary.sqlite" DATABASE_CHANGELOG_SUFFIX, "follower.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_follower_poll(follower, &applied) == ERROR_OK && applied == 1, __LINE__);
+  myassert(database_follower_close(follower) == ERROR_OK, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  myassert(database_open(&db, "follower.sqlite?mode=ro") == ERROR_OK, __LINE__);
+  myassert(database_get_int64(db, "follow", "number", &integer) == ERROR_OK && integer == 45, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  const char* names[6] = {"primary.sqlite", "primary.sqlite" DATABASE_CHANGELOG_SUFFIX,
+                          "follower.sqlite", "follower.sqlite" DATABASE_FOLLOWER_POSITION_SUFFIX,
+                          "primary.sqlite-wal", "primary.sqlite-shm"};
+  int i = 0;
+  for(; i < 6; i++)
+    unlink(names[i]);
+  unlink("follower.sqlite-wal");
+  unlink("follower.sqlite-shm");
+  snprintf(path, sizeof(path), "follower.sqlite" DATABASE_BACKUP_BLOBS);
+  nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void DatabaseMaintenance()
+{
+  database_handle_t* db = NULL;
+  database_handle_t* readonly = NULL;
+  database_engine_t* engine = NULL;
+  server_t* server = NULL;
+  registry_t* registry = NULL;
+  sqlite3_stmt* statement = NULL;
+  database_maintenance_t budget;
+  database_maintenance_stats_t stats;
+  int64_t freed = -1;
+  int64_t orphans = -1;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char* value = NULL;
+  size_t size = 0;
+  char path[4096];
+
+  /* a backup has a blob-path of its own, nothing else keeps files there */
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("untidy.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+  myassert(database_open(&db, "untidy.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_backup(db, "tidy.sqlite", NULL, NULL) == ERROR_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+  myassert(database_open(&db, "tidy.sqlite") == ERROR_OK, __LINE__);
+
+  memset(&budget, 0, sizeof(database_maintenance_t));
+  myassert(database_maintain(NULL, &budget, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_maintain(db, NULL, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_maintain(db, &budget, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  budget.pages = -1;
+  myassert(database_maintain(db, &budget, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  /* converted once, the next call finds it done */
+  budget.pages = 0;
+  budget.convert = 1;
+  myassert(database_maintain(db, &budget, &stats) == ERROR_OK, __LINE__);
+  myassert(database_maintain(db, &budget, &stats) == ERROR_OK, __LINE__);
+  myassert(sqlite3_prepare_v2(db->db, "PRAGMA auto_vacuum;", -1, &statement, NULL) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_int(statement, 0) == 2, __LINE__);
+  sqlite3_finalize(statement);
+
+  /* a type change leaves the pages of the long string free */
+  char* large = NULL;
+  myassert(requestMemory((void**)&large, 256 * 1024) == ERROR_OK, __LINE__);
+  memset(large, 'x', 256 * 1024 - 1);
+  large[256 * 1024 - 1] = '\0';
+  myassert(database_set_string(db, "tidy", "large", large) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(db, "tidy", "large", 1) == ERROR_OK, __LINE__);
+  freeMemory(large);
+  budget.convert = 0;
+  budget.pages = 4;
+  myassert(database_maintain(db, &budget, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.pages_freed == 4 && stats.free_pages > 0, __LINE__);
+  budget.pages = 1000000;
+  budget.optimize = 1;
+  myassert(database_maintain(db, &budget, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.pages_freed > 0 && stats.free_pages == 0 && stats.optimized == 1, __LINE__);
+
+  /* a file without a row is kept during its grace period */
+  myassert(database_set_blob(db, "tidy", "picture", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  snprintf(path, sizeof(path), "%s/orphan", db->blobpath);
+  to = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(to >= 0 && write(to, bvalue, sizeof(bvalue)) == (ssize_t)sizeof(bvalue), __LINE__);
+  close(to);
+  budget.pages = 0;
+  budget.optimize = 0;
+  budget.blobs = 1000000;
+  budget.grace = 3600;
+  myassert(database_maintain(db, &budget, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.blobs_checked > 1 && stats.blobs_removed == 0, __LINE__);
+  myassert(access(path, F_OK) == 0, __LINE__);
+
+  /* one file per call until the walk starts over */
+  uint64_t checked = 0;
+  uint64_t removed = 0;
+  int calls = 0;
+  budget.blobs = 1;
+  budget.grace = 0;
+  do{
+    myassert(database_maintain(db, &budget, &stats) == ERROR_OK, __LINE__);
+    checked += stats.blobs_checked;
+    removed += stats.blobs_removed;
+  }while(stats.blobs_checked > 0 && ++calls < 10000);
+  myassert(checked > 1 && removed == 1, __LINE__);
+  myassert(access(path, F_OK) != 0, __LINE__);
+  myassert(database_get_blob(db, "tidy", "picture", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  myassert(database_open_readonly(&readonly, "tidy.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_maintain(readonly, &budget, &stats) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_close(readonly) == ERROR_OK, __LINE__);
+
+  /* engines without a database file have nothing to maintain */
+  myassert(database_engine_open(&engine, "mem://tidy") == ERROR_OK, __LINE__);
+  myassert(database_engine_maintain(engine, &budget, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_engine_close(engine) == ERROR_OK, __LINE__);
+
+  /* the server waits for a quiet moment */
+  memset(&budget, 0, sizeof(database_maintenance_t));
+  budget.optimize = 1;
+  myassert(server_init(&server, "tidy.sqlite") == ERROR_OK, __LINE__);
+  myassert(server_maintain(NULL, &budget, 0, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(server_maintain(server, &budget, 3600, &stats) == ERROR_OK && stats.optimized == 0, __LINE__);
+  myassert(server_maintain(server, &budget, 0, &stats) == ERROR_OK && stats.optimized == 1, __LINE__);
+  myassert(server_shutdown(server) == ERROR_OK, __LINE__);
+
+  /* clients ask for a step whenever it suits them */
+  myassert(database_open(&db, "tidy.sqlite") == ERROR_OK, __LINE__);
+  snprintf(path, sizeof(path), "%s/orphan", db->blobpath);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+  to = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(to >= 0 && write(to, bvalue, sizeof(bvalue)) == (ssize_t)sizeof(bvalue), __LINE__);
+  close(to);
+  struct utimbuf old;
+  old.actime = old.modtime = time(NULL) - 2 * SERVER_MAINTENANCE_GRACE;
+  myassert(utime(path, &old) == 0, __LINE__);
+  myassert(registry_open(&registry, "file://tidy.sqlite", "tidy") == ERROR_OK, __LINE__);
+  myassert(registry_maintain(NULL, 0, 0, NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_maintain(registry, -1, 0, NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_maintain(registry, 0, -1, NULL, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(registry_maintain(registry, 1000000, 1000000, &freed, &orphans) == ERROR_OK, __LINE__);
+  myassert(freed == 0 && orphans == 1, __LINE__);
+  myassert(access(path, F_OK) != 0, __LINE__);
+  myassert(registry_maintain(registry, 0, 0, NULL, NULL) == ERROR_OK, __LINE__);
+  myassert(registry_close(registry) == ERROR_OK, __LINE__);
+
+  const char* names[2] = {"untidy.sqlite", "tidy.sqlite"};
+  int i = 0;
+  for(; i < 2; i++){
+    unlink(names[i]);
+    snprintf(path, sizeof(path), "%s-wal", names[i]);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s-shm", names[i]);
+    unlink(path);
+  }
+  nftw("tidy.sqlite" DATABASE_BACKUP_BLOBS, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void DatabaseRecovery()
+{
+  database_handle_t* db = NULL;
+  database_handle_t* readonly = NULL;
+  sqlite3_stmt* statement = NULL;
+  database_recovery_t recovery;
+  database_recovery_stats_t stats;
+  database_value_type_t type;
+  unsigned char bvalue[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char* value = NULL;
+  size_t size = 0;
+  char path[4096];
+  char stray[4096];
+  char deep[4096];
+
+  int from = open("mydb.sqlite", O_RDONLY);
+  int to = open("crashed.sqlite", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  myassert(file_copy(from, to, -1, NULL) == ERROR_OK, __LINE__);
+  close(from);
+  close(to);
+  myassert(database_open(&db, "crashed.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_backup(db, "recovered.sqlite", NULL, NULL) == ERROR_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+  myassert(database_open(&db, "recovered.sqlite") == ERROR_OK, __LINE__);
+
+  /* a row whose file is gone and files no row knows */
+  myassert(database_set_blob(db, "recovery", "kept", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(database_set_blob(db, "recovery", "gone", bvalue, sizeof(bvalue)) == ERROR_OK, __LINE__);
+  myassert(sqlite3_prepare_v2(db->db, "SELECT ValueBlob.`path` FROM ValueBlob INNER JOIN KeyInfo ON KeyInfo.`id` = ValueBlob.`id` WHERE KeyInfo.`domain` = 'recovery' AND KeyInfo.`key` = 'gone';", -1, &statement, NULL) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_step(statement) == SQLITE_ROW, __LINE__);
+  snprintf(path, sizeof(path), "%s/%s", db->blobpath, (const char*)sqlite3_column_text(statement, 0));
+  sqlite3_finalize(statement);
+  myassert(unlink(path) == 0, __LINE__);
+  snprintf(stray, sizeof(stray), "%s/stray", db->blobpath);
+  to = open(stray, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  close(to);
+  snprintf(deep, sizeof(deep), "%s/strays", db->blobpath);
+  mkdir(deep, 0777);
+  snprintf(deep, sizeof(deep), "%s/strays/deep", db->blobpath);
+  to = open(deep, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  close(to);
+
+  memset(&recovery, 0, sizeof(database_recovery_t));
+  myassert(database_recover(NULL, &recovery, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_recover(db, NULL, &stats) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_recover(db, &recovery, NULL) == ERROR_INVALID_ARGUMENTS, __LINE__);
+
+  /* a check changes nothing */
+  recovery.threads = 4;
+  myassert(database_recover(db, &recovery, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.rows > 1 && stats.files == stats.rows + 1, __LINE__);
+  myassert(stats.missing == 1 && stats.orphans == 2, __LINE__);
+  myassert(stats.repaired == 0 && stats.quarantined == 0, __LINE__);
+  myassert(access(stray, F_OK) == 0 && access(deep, F_OK) == 0, __LINE__);
+
+  myassert(database_open_readonly(&readonly, "recovered.sqlite") == ERROR_OK, __LINE__);
+  recovery.threads = 0;
+  myassert(database_recover(readonly, &recovery, &stats) == ERROR_OK && stats.missing == 1, __LINE__);
+  recovery.repair = 1;
+  myassert(database_recover(readonly, &recovery, &stats) == ERROR_DATABASE_READONLY, __LINE__);
+  myassert(database_close(readonly) == ERROR_OK, __LINE__);
+
+  /* files keep their path in the quarantine */
+  recovery.threads = 1;
+  recovery.quarantine = 1;
+  myassert(database_recover(db, &recovery, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.missing == 1 && stats.repaired == 1, __LINE__);
+  myassert(stats.orphans == 2 && stats.quarantined == 2, __LINE__);
+  myassert(access(stray, F_OK) != 0 && access(deep, F_OK) != 0, __LINE__);
+  snprintf(deep, sizeof(deep), "%s/" DATABASE_RECOVERY_QUARANTINE "/strays/deep", db->blobpath);
+  myassert(access(deep, F_OK) == 0, __LINE__);
+  myassert(database_get_type(db, "recovery", "gone", &type) == ERROR_DATABASE_NO_SUCH_KEY, __LINE__);
+  myassert(database_get_blob(db, "recovery", "kept", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(bvalue) && memcmp(value, bvalue, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_recover(db, &recovery, &stats) == ERROR_OK, __LINE__);
+  myassert(stats.missing == 0 && stats.orphans == 0, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  /* startup mode */
+  to = open(stray, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  close(to);
+  myassert(database_open_readonly(&readonly, "recovered.sqlite?recover=1") == ERROR_INVALID_ARGUMENTS, __LINE__);
+  myassert(database_open(&db, "recovered.sqlite?recover=1") == ERROR_OK, __LINE__);
+  myassert(access(stray, F_OK) != 0, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+
+  const char* names[2] = {"crashed.sqlite", "recovered.sqlite"};
+  int i = 0;
+  for(; i < 2; i++){
+    unlink(names[i]);
+    snprintf(path, sizeof(path), "%s-wal", names[i]);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s-shm", names[i]);
+    unlink(path);
+  }
+  nftw("recovered.sqlite" DATABASE_BACKUP_BLOBS, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* ************************************************************************** */
+void BlobReplacement()
+{
+  database_handle_t* db = NULL;
+  sqlite3_stmt* statement = NULL;
+  unsigned char first[] = {0x42, 0x21, 0x13, 0x23};
+  unsigned char second[] = {0x01, 0x02, 0x03};
+  unsigned char* value = NULL;
+  size_t size = 0;
+  char path[4096];
+  char directory[4096];
+  struct stat before;
+  struct stat after;
+
+  myassert(database_open(&db, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_set_blob(db, "replace", "value", first, sizeof(first)) == ERROR_OK, __LINE__);
+  myassert(sqlite3_prepare_v2(db->db, "SELECT ValueBlob.`path` FROM ValueBlob INNER JOIN KeyInfo ON KeyInfo.`id` = ValueBlob.`id` WHERE KeyInfo.`domain` = 'replace' AND KeyInfo.`key` = 'value';", -1, &statement, NULL) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_step(statement) == SQLITE_ROW, __LINE__);
+  snprintf(path, sizeof(path), "%s/%s", db->blobpath, (const char*)sqlite3_column_text(statement, 0));
+  sqlite3_finalize(statement);
+
+  /* a reader of the old file keeps all of the old content */
+  int reader = open(path, O_RDONLY);
+  myassert(reader >= 0 && fstat(reader, &before) == 0, __LINE__);
+  myassert(database_set_blob(db, "replace", "value", second, sizeof(second)) == ERROR_OK, __LINE__);
+  myassert(stat(path, &after) == 0 && after.st_ino != before.st_ino, __LINE__);
+  myassert(pread(reader, directory, sizeof(directory), 0) == (ssize_t)sizeof(first), __LINE__);
+  myassert(memcmp(directory, first, sizeof(first)) == 0, __LINE__);
+  close(reader);
+  myassert(database_get_blob(db, "replace", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(second) && memcmp(value, second, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* the same from a file descriptor */
+  int fds[2];
+  myassert(pipe(fds) == 0, __LINE__);
+  myassert(write(fds[1], first, sizeof(first)) == (ssize_t)sizeof(first), __LINE__);
+  close(fds[1]);
+  myassert(database_set_blob_from_fd(db, "replace", "value", fds[0]) == ERROR_OK, __LINE__);
+  close(fds[0]);
+  myassert(stat(path, &before) == 0 && before.st_ino != after.st_ino, __LINE__);
+  myassert(database_get_blob(db, "replace", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(first) && memcmp(value, first, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* no temporary file is left next to the blob */
+  snprintf(directory, sizeof(directory), "%s", path);
+  *strrchr(directory, '/') = '\0';
+  DIR* entries = opendir(directory);
+  struct dirent* entry = NULL;
+  int left = 0;
+  myassert(entries != NULL, __LINE__);
+  while(entries != NULL && (entry = readdir(entries)) != NULL)
+    left += strncmp(entry->d_name, "tmp ", 4) == 0;
+  if(entries != NULL)
+    closedir(entries);
+  myassert(left == 0, __LINE__);
+
+  /* a failed update leaves the old blob alone */
+  int empty = open("/dev/null", O_WRONLY);
+  myassert(database_set_blob_from_fd(db, "replace", "value", empty) == ERROR_DATABASE_IO, __LINE__);
+  close(empty);
+  myassert(database_get_blob(db, "replace", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(first) && memcmp(value, first, size) == 0, __LINE__);
+  freeMemory(value);
+
+  myassert(database_set_int64(db, "replace", "value", 1) == ERROR_OK, __LINE__);
+  myassert(access(path, F_OK) != 0, __LINE__);
+
+  /* a blob written over a value of another type is renamed into place */
+  myassert(database_set_blob(db, "replace", "value", first, sizeof(first)) == ERROR_OK, __LINE__);
+  myassert(database_get_blob(db, "replace", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(first) && memcmp(value, first, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_set_int64(db, "replace", "value", 1) == ERROR_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+}
+
+/* ************************************************************************** */
+void ValueCompression()
+{
+  database_handle_t* db = NULL;
+  database_handle_t* readonly = NULL;
+  sqlite3_stmt* statement = NULL;
+  char text[8192];
+  unsigned char noise[4096];
+  unsigned char* value = NULL;
+  char* string = NULL;
+  size_t size = 0;
+  size_t total = 0;
+  size_t length = 0;
+  char path[4096];
+  struct stat sb;
+
+  while(length < sizeof(text) - 64)
+    length += snprintf(text + length, sizeof(text) - length,
+                       "{\"key%u\": \"value\", \"enabled\": true},\n", (unsigned int)(length % 97));
+  uint32_t state = 2463534242u;
+  size_t i = 0;
+  for(; i < sizeof(noise); i++){
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    noise[i] = state >> 24;
+  }
+
+  /* the codec on its own */
+  unsigned char packed[8192];
+  unsigned char restored[8192];
+  myassert(codec_compress((unsigned char*)text, length, packed, sizeof(packed), &size) == ERROR_OK, __LINE__);
+  myassert(size < length / 4, __LINE__);
+  myassert(codec_decompress(packed, size, restored, sizeof(restored), &total) == ERROR_OK, __LINE__);
+  myassert(total == length && memcmp(restored, text, length) == 0, __LINE__);
+  myassert(codec_decompress(packed, size, restored, 100, &total) == ERROR_OK && total == 100, __LINE__);
+  myassert(codec_decompress(packed, size / 2, restored, sizeof(restored), &total) == ERROR_DATABASE_INVALID, __LINE__);
+  myassert(codec_compress(noise, sizeof(noise), packed, sizeof(noise) - 1, &size) == ERROR_EOF, __LINE__);
+
+  myassert(database_open(&db, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(db->codecs == 0 || db->compress == 0, __LINE__);
+  myassert(sqlite3_exec(db->db, "INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'value-compress', 'Int64'); INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 256);", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+  db = NULL;
+  myassert(database_open(&db, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(db->codecs == 1 && db->compress == 256, __LINE__);
+
+  /* long strings are stored compressed, short ones as they are */
+  myassert(database_set_string(db, "compress", "long", text) == ERROR_OK, __LINE__);
+  myassert(database_set_string(db, "compress", "short", "short") == ERROR_OK, __LINE__);
+  myassert(sqlite3_prepare_v2(db->db, "SELECT typeof(ValueString.`value`), ValueString.`codec` FROM ValueString INNER JOIN KeyInfo ON KeyInfo.`id` = ValueString.`id` WHERE KeyInfo.`domain` = 'compress' ORDER BY KeyInfo.`key`;", -1, &statement, NULL) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_step(statement) == SQLITE_ROW, __LINE__);
+  myassert(strcmp((const char*)sqlite3_column_text(statement, 0), "blob") == 0 && sqlite3_column_int(statement, 1) == 1, __LINE__);
+  myassert(sqlite3_step(statement) == SQLITE_ROW, __LINE__);
+  myassert(strcmp((const char*)sqlite3_column_text(statement, 0), "text") == 0 && sqlite3_column_int(statement, 1) == 0, __LINE__);
+  sqlite3_finalize(statement);
+  myassert(database_get_string(db, "compress", "long", &string) == ERROR_OK, __LINE__);
+  myassert(strcmp(string, text) == 0, __LINE__);
+  freeMemory(string);
+
+  /* blobs, read whole, in chunks and into a file descriptor */
+  myassert(database_set_blob(db, "compress", "blob", (unsigned char*)text, length) == ERROR_OK, __LINE__);
+  myassert(sqlite3_prepare_v2(db->db, "SELECT ValueBlob.`path`, ValueBlob.`codec` FROM ValueBlob INNER JOIN KeyInfo ON KeyInfo.`id` = ValueBlob.`id` WHERE KeyInfo.`domain` = 'compress' AND KeyInfo.`key` = 'blob';", -1, &statement, NULL) == SQLITE_OK, __LINE__);
+  myassert(sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_int(statement, 1) == 1, __LINE__);
+  snprintf(path, sizeof(path), "%s/%s", db->blobpath, (const char*)sqlite3_column_text(statement, 0));
+  sqlite3_finalize(statement);
+  myassert(stat(path, &sb) == 0 && (size_t)sb.st_size < length / 4, __LINE__);
+  myassert(database_get_blob(db, "compress", "blob", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == length && memcmp(value, text, length) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_get_blob_chunk(db, "compress", "blob", 1000, 500, &value, &size, &total) == ERROR_OK, __LINE__);
+  myassert(size == 500 && total == length && memcmp(value, text + 1000, 500) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_get_blob_chunk(db, "compress", "blob", length, 500, &value, &size, &total) == ERROR_OK && size == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_get_blob_chunk(db, "compress", "blob", length + 1, 500, &value, &size, &total) == ERROR_INVALID_ARGUMENTS, __LINE__);
+  int fd = open("compressed.out", O_RDWR | O_CREAT | O_TRUNC, 0666);
+  myassert(database_get_blob_to_fd(db, "compress", "blob", fd, &size) == ERROR_OK && size == length, __LINE__);
+  myassert(pread(fd, restored, sizeof(restored), 0) == (ssize_t)length && memcmp(restored, text, length) == 0, __LINE__);
+  close(fd);
+  unlink("compressed.out");
+
+  /* data that doesn't shrink is stored as it is */
+  myassert(database_set_blob(db, "compress", "blob", noise, sizeof(noise)) == ERROR_OK, __LINE__);
+  myassert(stat(path, &sb) == 0 && (size_t)sb.st_size == sizeof(noise), __LINE__);
+  myassert(database_get_blob(db, "compress", "blob", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(noise) && memcmp(value, noise, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* a read-only handle reads what the other one wrote */
+  myassert(database_set_blob(db, "compress", "blob", (unsigned char*)text, length) == ERROR_OK, __LINE__);
+  myassert(database_open_readonly(&readonly, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(database_get_string(readonly, "compress", "long", &string) == ERROR_OK, __LINE__);
+  myassert(strcmp(string, text) == 0, __LINE__);
+  freeMemory(string);
+  myassert(database_get_blob(readonly, "compress", "blob", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == length && memcmp(value, text, length) == 0, __LINE__);
+  freeMemory(value);
+  myassert(database_close(readonly) == ERROR_OK, __LINE__);
+
+  myassert(database_set_string(db, "compress", "long", "short") == ERROR_OK, __LINE__);
+  myassert(database_get_string(db, "compress", "long", &string) == ERROR_OK, __LINE__);
+  myassert(strcmp(string, "short") == 0, __LINE__);
+  freeMemory(string);
+
+  myassert(database_set_int64(db, "compress", "long", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(db, "compress", "short", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(db, "compress", "blob", 1) == ERROR_OK, __LINE__);
+  myassert(sqlite3_exec(db->db, "DELETE FROM ValueInt64 WHERE id IN (SELECT id FROM KeyInfo WHERE domain IS NULL AND key = 'value-compress'); DELETE FROM KeyInfo WHERE domain IS NULL AND key = 'value-compress';", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+}
+
+int findHotBlobs(const char* directory, const char* prefix, char* found,
+                 size_t found_size, off_t* total)
+{
+  DIR* entries = opendir(directory);
+  struct dirent* entry = NULL;
+  struct stat sb;
+  char path[4096];
+  int count = 0;
+  *total = 0;
+  while(entries != NULL && (entry = readdir(entries)) != NULL){
+    snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+    if(lstat(path, &sb) != 0 || !S_ISREG(sb.st_mode))
+      continue;
+    *total += sb.st_size;
+    if(strncmp(entry->d_name, prefix, strlen(prefix)) == 0){
+      snprintf(found, found_size, "%s", path);
+      count++;
+    }
+  }
+  if(entries != NULL)
+    closedir(entries);
+  return count;
+}
+
+void BlobHotTier()
+{
+  database_handle_t* db = NULL;
+  unsigned char first[1000];
+  unsigned char second[1000];
+  unsigned char big[4096];
+  unsigned char* value = NULL;
+  size_t size = 0;
+  char hot[4096];
+  char directory[8192];
+  char found[8192];
+  char statement[8192];
+  size_t length = 0;
+  off_t total = 0;
+  memset(first, 'a', sizeof(first));
+  memset(second, 'b', sizeof(second));
+  memset(big, 'c', sizeof(big));
+
+  myassert(getcwd(hot, sizeof(hot) - 16) != NULL, __LINE__);
+  strcat(hot, "/hot-tier");
+  snprintf(directory, sizeof(directory), "%s/hot", hot);
+  myassert(mkdir(hot, 0777) == 0, __LINE__);
+
+  /* a hot tier that isn't a directory fails the open */
+  myassert(database_open(&db, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(db->hotdir < 0 && db->hot_size == 0, __LINE__);
+  snprintf(statement, sizeof(statement), "INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-hot-path', 'String'); INSERT INTO ValueString(id, value) VALUES(last_insert_rowid(), '%s/missing'); INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-hot-size', 'Int64'); INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 16384);", hot);
+  myassert(sqlite3_exec(db->db, statement, NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+  db = NULL;
+  myassert(database_open(&db, "mydb.sqlite") == ERROR_DATABASE_INVALID, __LINE__);
+
+  sqlite3* raw = NULL;
+  myassert(sqlite3_open("mydb.sqlite", &raw) == SQLITE_OK, __LINE__);
+  snprintf(statement, sizeof(statement), "UPDATE ValueString SET value = '%s' WHERE id IN (SELECT id FROM KeyInfo WHERE domain IS NULL AND key = 'blob-hot-path');", hot);
+  myassert(sqlite3_exec(raw, statement, NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  sqlite3_close(raw);
+  myassert(database_open(&db, "mydb.sqlite") == ERROR_OK, __LINE__);
+  myassert(db->hotdir >= 0 && db->hot_size == 16384, __LINE__);
+
+  /* a write puts the blob into the hot tier, reads are served from there */
+  myassert(database_set_blob(db, "hot", "value", first, sizeof(first)) == ERROR_OK, __LINE__);
+  myassert(findHotBlobs(directory, "value@", found, sizeof(found), &total) == 1, __LINE__);
+  int fd = open(found, O_WRONLY);
+  myassert(fd >= 0 && pwrite(fd, second, 10, 0) == 10, __LINE__);
+  close(fd);
+  myassert(database_get_blob(db, "hot", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(first) && memcmp(value, second, 10) == 0 &&
+           memcmp(value + 10, first + 10, size - 10) == 0, __LINE__);
+  freeMemory(value);
+
+  /* a new version never finds the old copy */
+  myassert(database_set_blob(db, "hot", "value", second, sizeof(second)) == ERROR_OK, __LINE__);
+  myassert(findHotBlobs(directory, "value@", found, sizeof(found), &total) == 2, __LINE__);
+  myassert(database_get_blob(db, "hot", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(second) && memcmp(value, second, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* a lost copy is read from disk and copied again */
+  myassert(nftw(directory, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0, __LINE__);
+  myassert(database_get_blob(db, "hot", "value", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(second) && memcmp(value, second, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(findHotBlobs(directory, "value@", found, sizeof(found), &total) == 1, __LINE__);
+  myassert(database_get_blob_chunk(db, "hot", "value", 100, 10, &value, &size, &length) == ERROR_OK, __LINE__);
+  myassert(size == 10 && length == sizeof(second) && memcmp(value, second, size) == 0, __LINE__);
+  freeMemory(value);
+
+  /* large blobs stay on disk */
+  myassert(database_set_blob(db, "hot", "big", big, sizeof(big)) == ERROR_OK, __LINE__);
+  myassert(database_get_blob(db, "hot", "big", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(big) && memcmp(value, big, size) == 0, __LINE__);
+  freeMemory(value);
+  myassert(findHotBlobs(directory, "big@", found, sizeof(found), &total) == 0, __LINE__);
+
+  /* the least recently used blobs are evicted once it is full */
+  char key[16];
+  int i = 0;
+  for(; i < 30; i++){
+    snprintf(key, sizeof(key), "key%d", i);
+    myassert(database_set_blob(db, "hot", key, first, sizeof(first)) == ERROR_OK, __LINE__);
+    if(i % 5 == 0){
+      myassert(database_get_blob(db, "hot", "value", &value, &size) == ERROR_OK, __LINE__);
+      freeMemory(value);
+    }
+  }
+  myassert(findHotBlobs(directory, "key29@", found, sizeof(found), &total) == 1, __LINE__);
+  myassert(total <= 16384 && db->hot_used <= 16384, __LINE__);
+  myassert(findHotBlobs(directory, "key0@", found, sizeof(found), &total) == 0, __LINE__);
+  myassert(findHotBlobs(directory, "value@", found, sizeof(found), &total) == 1, __LINE__);
+  myassert(database_get_blob(db, "hot", "key0", &value, &size) == ERROR_OK, __LINE__);
+  myassert(size == sizeof(first) && memcmp(value, first, size) == 0, __LINE__);
+  freeMemory(value);
+
+  for(i = 0; i < 30; i++){
+    snprintf(key, sizeof(key), "key%d", i);
+    myassert(database_set_int64(db, "hot", key, 1) == ERROR_OK, __LINE__);
+  }
+  myassert(database_set_int64(db, "hot", "value", 1) == ERROR_OK, __LINE__);
+  myassert(database_set_int64(db, "hot", "big", 1) == ERROR_OK, __LINE__);
+  myassert(sqlite3_exec(db->db, "DELETE FROM ValueString WHERE id IN (SELECT id FROM KeyInfo WHERE domain IS NULL AND key = 'blob-hot-path'); DELETE FROM ValueInt64 WHERE id IN (SELECT id FROM KeyInfo WHERE domain IS NULL AND key = 'blob-hot-size'); DELETE FROM KeyInfo WHERE domain IS NULL AND key IN ('blob-hot-path', 'blob-hot-size');", NULL, NULL, NULL) == SQLITE_OK, __LINE__);
+  myassert(database_close(db) == ERROR_OK, __LINE__);
+  myassert(nftw(hot, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0, __LINE__);
+}
@@ -0,0 +1,41 @@
+/** @brief Hashing
+ *
+ * This file contains the FNV-1a hash shared by the modules of 'the registry'.
+ *
+ * @file hash.c
+ */
+
+#include "hash.h"
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** prime of the 32 bit FNV-1a hash */
+#define HASH_FNV1A_PRIME 16777619u
+
+/** prime of the 64 bit FNV-1a hash */
+#define HASH_FNV1A64_PRIME 1099511628211u
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+uint32_t
+hash_fnv1a(uint32_t hash, const void* data, size_t size)
+{
+  const unsigned char* byte = data;
+  size_t i = 0;
+  for(; i < size; i++)
+    hash = (hash ^ byte[i]) * HASH_FNV1A_PRIME;
+  return hash;
+}
+
+/* -------------------------------------------------------------------------- */
+uint64_t
+hash_fnv1a64(uint64_t hash, const void* data, size_t size)
+{
+  const unsigned char* byte = data;
+  size_t i = 0;
+  for(; i < size; i++)
+    hash = (hash ^ byte[i]) * HASH_FNV1A64_PRIME;
+  return hash;
+}
@@ -0,0 +1,44 @@
+#ifndef HASH_H
+#define HASH_H
+
+/** @brief Hashing
+ *
+ * This file contains the FNV-1a hash shared by the modules of 'the registry'.
+ * Every function continues a hash, so data spread over several buffers is
+ * hashed by passing the result of one call to the next.
+ *
+ * @file hash.h
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** offset basis of the 32 bit FNV-1a hash */
+#define HASH_FNV1A_BASIS 2166136261u
+
+/** offset basis of the 64 bit FNV-1a hash */
+#define HASH_FNV1A64_BASIS 14695981039346656037u
+
+/**
+ * Continues the 32 bit FNV-1a hash @a hash over @a size bytes of @a data.
+ *
+ * @param[in] hash @ref HASH_FNV1A_BASIS or the hash of the preceding data
+ * @param[in] data The data
+ * @param[in] size Size of the data
+ *
+ * @return The hash including @a data
+ */
+uint32_t hash_fnv1a(uint32_t hash, const void* data, size_t size);
+
+/**
+ * Continues the 64 bit FNV-1a hash @a hash over @a size bytes of @a data.
+ *
+ * @param[in] hash @ref HASH_FNV1A64_BASIS or the hash of the preceding data
+ * @param[in] data The data
+ * @param[in] size Size of the data
+ *
+ * @return The hash including @a data
+ */
+uint64_t hash_fnv1a64(uint64_t hash, const void* data, size_t size);
+
+#endif // HASH_H
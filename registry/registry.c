@@ -16,14 +16,19 @@
 #include "../communication/simple-memory-buffer.h"
 #include "../communication/bpack.h"
 #include "../communication/datastore.h"
+#include "../server/server.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
 
 /* Typedefs and Defines */
 /* -------------------------------------------------------------------------- */
 #define DELIMITER '|'
 #define FILE "file://"
+#define MEM "mem://"
+#define LOG "log://"
 #define HMAC "hmac://"
 
 
@@ -31,6 +36,9 @@
 /* -------------------------------------------------------------------------- */
 void checkDelimiterAndSetToTerminator(char **id, uint64_t *position, 
                                       uint64_t size, int8_t *delimiter);
+int exchangePacket(registry_t* handle, data_store_t* ds, data_store_t* res_ds,
+                   unsigned char* packettype);
+int translateError(int64_t errorcode);
 
 
 /* Implementation */
@@ -58,6 +66,8 @@ registry_open(registry_t** handle, const char* identifier, const char* domain)
   (*handle)->domain = NULL;
   (*handle)->channel = NULL;
   (*handle)->endpoint = NULL;
+  (*handle)->parent = NULL;
+  (*handle)->views = 0;
 
   /* dublicating identifier */
   char *id = NULL;
@@ -73,7 +83,7 @@ registry_open(registry_t** handle, const char* identifier, const char* domain)
   char protocol[8] = {'\0'};
   uint64_t position = 0;
 
-  if(size < 15){
+  if(size < 7){
     freeMemory(*handle);
     *handle = NULL;
     freeMemory(id);
@@ -83,11 +93,16 @@ registry_open(registry_t** handle, const char* identifier, const char* domain)
   memcpy(protocol, id, 7);
   protocol[7] = '\0';
 
-  /* check if file:// */ 
+  /* check if file://, mem:// or log://, the server needs the scheme of the latter */ 
   int8_t delimiter = 0;
+  const char* database = id + 7;
   if(strncmp(protocol, FILE, 7) == 0){
     position += 7;
     checkDelimiterAndSetToTerminator(&id, &position, size, &delimiter);
+  }else if(strncmp(protocol, MEM, 6) == 0 || strncmp(protocol, LOG, 6) == 0){
+    position += 6;
+    database = id;
+    checkDelimiterAndSetToTerminator(&id, &position, size, &delimiter);
   }else{
     freeMemory(*handle);
     *handle = NULL;
@@ -96,7 +111,7 @@ registry_open(registry_t** handle, const char* identifier, const char* domain)
   }
 
   channel_t *channel = NULL;
-  int8_t channel_ok = channel_with_server_new(&channel, id + 7);
+  int8_t channel_ok = channel_with_server_new(&channel, database);
   if(channel_ok != ERROR_OK){ 
     freeMemory(*handle);
     *handle = NULL;
@@ -105,7 +120,7 @@ registry_open(registry_t** handle, const char* identifier, const char* domain)
   }
 
   uint64_t start_position = 0;
-  /* There is something beyond file://<path> */ 
+  /* There is something beyond file://<path>, mem://<name> or log://<path> */ 
 
   /* create channel-endpoint-connector */
   int8_t endpoint_existing = 0;
@@ -243,6 +258,18 @@ registry_close(registry_t* handle)
   if(handle == NULL || handle->channel == NULL || handle->domain == NULL)
     return ERROR_INVALID_ARGUMENTS;
 
+  /* views only own their domain */
+  if(handle->parent != NULL){
+    handle->parent->views--;
+    freeMemory(handle->domain);
+    freeMemory(handle);
+    return ERROR_OK;
+  }
+
+  /* the channel is still used by views */
+  if(handle->views > 0)
+    return ERROR_INVALID_ARGUMENTS;
+
   /* clean up channel */
   if(channel_free(handle->channel) != ERROR_OK){
     freeMemory(handle->domain);
@@ -259,6 +286,40 @@ registry_close(registry_t* handle)
   return ERROR_OK;
 }
 
+/* -------------------------------------------------------------------------- */
+int
+registry_domain_view(registry_t* handle, const char* domain, registry_t** view)
+{
+  if(view == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+  *view = NULL;
+  if(handle == NULL || handle->channel == NULL || domain == NULL || strlen(domain) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* views of views hang off the owner of the channel */
+  registry_t* owner = handle->parent != NULL ? handle->parent : handle;
+
+  registry_t* result = NULL;
+  if(requestMemory((void**)&result, sizeof(registry_t)) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  size_t size_domain = strlen(domain);
+  if(requestMemory((void**)&result->domain, size_domain + 1) != ERROR_OK){
+    freeMemory(result);
+    return ERROR_MEMORY;
+  }
+  memcpy(result->domain, domain, size_domain + 1);
+
+  result->channel = owner->channel;
+  result->endpoint = owner->endpoint;
+  result->parent = owner;
+  result->views = 0;
+  owner->views++;
+
+  *view = result;
+  return ERROR_OK;
+}
+
 /* -------------------------------------------------------------------------- */
 int
 registry_get_int64(registry_t* handle, const char* key, int64_t* value)
@@ -405,6 +466,10 @@ registry_set_int64(registry_t* handle, const char* key, int64_t value)
         ret = ERROR_UNKNOWN;
       if(errorcode == ERROR_DATABASE_INVALID)
         ret =  ERROR_REGISTRY_INVALID_STATE;
+      else if(errorcode == ERROR_DATABASE_READONLY)
+        ret =  ERROR_DATABASE_READONLY;
+      else if(errorcode == ERROR_DATABASE_BUSY)
+        ret = ERROR_DATABASE_BUSY;
       else 
         ret = ERROR_UNKNOWN; break;
 
@@ -560,6 +625,10 @@ registry_set_double(registry_t* handle, const char* key, double value)
         ret = ERROR_UNKNOWN;
       if(errorcode == ERROR_DATABASE_INVALID)
         ret = ERROR_REGISTRY_INVALID_STATE;
+      else if(errorcode == ERROR_DATABASE_READONLY)
+        ret = ERROR_DATABASE_READONLY;
+      else if(errorcode == ERROR_DATABASE_BUSY)
+        ret = ERROR_DATABASE_BUSY;
       else 
         ret = ERROR_UNKNOWN; break;
 
@@ -715,6 +784,10 @@ registry_set_string(registry_t* handle, const char* key, const char* value)
         ret = ERROR_UNKNOWN;
       if(errorcode == ERROR_DATABASE_INVALID)
         ret = ERROR_REGISTRY_INVALID_STATE;
+      else if(errorcode == ERROR_DATABASE_READONLY)
+        ret = ERROR_DATABASE_READONLY;
+      else if(errorcode == ERROR_DATABASE_BUSY)
+        ret = ERROR_DATABASE_BUSY;
       else 
         ret = ERROR_UNKNOWN; break;
 
@@ -873,6 +946,10 @@ registry_set_blob(registry_t* handle, const char* key,
         ret = ERROR_UNKNOWN;
       if(errorcode == ERROR_DATABASE_INVALID)
         ret = ERROR_REGISTRY_INVALID_STATE;
+      else if(errorcode == ERROR_DATABASE_READONLY)
+        ret = ERROR_DATABASE_READONLY;
+      else if(errorcode == ERROR_DATABASE_BUSY)
+        ret = ERROR_DATABASE_BUSY;
       else 
         ret = ERROR_UNKNOWN; break;
 
@@ -884,6 +961,246 @@ registry_set_blob(registry_t* handle, const char* key,
   return ret;
 }
 
+/* -------------------------------------------------------------------------- */
+int
+registry_get_blob_to_fd(registry_t* handle, const char* key, int fd, size_t* size)
+{
+  if(handle == NULL || handle->domain == NULL || strlen(handle->domain) == 0 || 
+     handle->channel == NULL || key == NULL || strlen(key) == 0 || fd < 0 ||
+     size == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *size = 0;
+
+  /* own server without intermediate channels - let the kernel copy the file */
+  server_t *server = NULL;
+  if(handle->endpoint == NULL && 
+     channel_with_server_get_server(handle->channel, &server) == ERROR_OK)
+    return translateError(server_get_blob_to_fd(server, handle->domain, key, 
+                                                 fd, size));
+
+  /* otherwise request the blob chunk by chunk */
+  int64_t offset = 0;
+  int64_t total = 0;
+  do{
+    data_store_t ds;
+    if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+       data_store_write_byte(&ds, PACKET_GET_BLOB_CHUNK) != ERROR_OK ||
+       bpack(&ds, "ssll", handle->domain, key, offset, 
+             (int64_t)REGISTRY_BLOB_CHUNK_SIZE) != ERROR_OK){
+      simple_memory_buffer_free(&ds);
+      return ERROR_UNKNOWN;
+    }
+
+    unsigned char packettype = '\0';
+    data_store_t res_ds;
+    if(exchangePacket(handle, &ds, &res_ds, &packettype) != ERROR_OK)
+      return ERROR_UNKNOWN;
+
+    /* handling data */
+    int ret = ERROR_OK;
+    int64_t errorcode = ERROR_OK;
+    unsigned char *chunk = NULL;
+    size_t chunk_size = 0;
+    switch(packettype){
+      case PACKET_ERROR:
+        if(bunpack(&res_ds, "l", &errorcode) != ERROR_OK)
+          ret = ERROR_UNKNOWN;
+        else
+          ret = translateError(errorcode);
+        break;
+      case PACKET_BLOB_CHUNK:
+        if(bunpack(&res_ds, "lb", &total, &chunk_size, &chunk) != ERROR_OK){
+          ret = ERROR_UNKNOWN; break;
+        }
+        /* the blob must not shrink below the requested offset */
+        if(chunk_size == 0 && offset < total){
+          ret = ERROR_UNKNOWN; break;
+        }
+
+        size_t written = 0;
+        while(written < chunk_size){
+          ssize_t w = write(fd, chunk + written, chunk_size - written);
+          if(w < 0){
+            if(errno == EINTR || errno == EAGAIN)
+              continue;
+            ret = ERROR_UNKNOWN;
+            break;
+          }
+          written += w;
+        }
+        offset += chunk_size;
+        break;
+      default: ret = ERROR_UNKNOWN;
+    }
+    free(chunk);
+
+    if(simple_memory_buffer_free(&res_ds) != ERROR_OK)
+      ret = ERROR_UNKNOWN;
+    if(ret != ERROR_OK)
+      return ret;
+  }while(offset < total);
+
+  *size = offset;
+  return ERROR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+registry_set_blob_from_fd(registry_t* handle, const char* key, int fd)
+{
+  if(handle == NULL || handle->domain == NULL || strlen(handle->domain) == 0 || 
+     handle->channel == NULL || key == NULL || strlen(key) == 0 || fd < 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* own server without intermediate channels - let the kernel copy the file */
+  server_t *server = NULL;
+  if(handle->endpoint == NULL && 
+     channel_with_server_get_server(handle->channel, &server) == ERROR_OK)
+    return translateError(server_set_blob_from_fd(server, handle->domain, key,
+                                                  fd));
+
+  /* otherwise send the blob chunk by chunk, the server stages it on disk */
+  unsigned char *chunk = NULL;
+  if(requestMemory((void**)&chunk, REGISTRY_BLOB_CHUNK_SIZE) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  int64_t offset = 0;
+  int64_t final = 0;
+  while(final == 0){
+    /* fill the whole chunk, short reads happen on pipes and sockets */
+    size_t chunk_size = 0;
+    while(chunk_size < REGISTRY_BLOB_CHUNK_SIZE){
+      ssize_t r = read(fd, chunk + chunk_size, REGISTRY_BLOB_CHUNK_SIZE - chunk_size);
+      if(r < 0){
+        if(errno == EINTR || errno == EAGAIN)
+          continue;
+        freeMemory(chunk);
+        return ERROR_UNKNOWN;
+      }
+      if(r == 0){
+        final = 1;
+        break;
+      }
+      chunk_size += r;
+    }
+
+    data_store_t ds;
+    if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+       data_store_write_byte(&ds, PACKET_SET_BLOB_CHUNK) != ERROR_OK ||
+       bpack(&ds, "ssllb", handle->domain, key, offset, final, chunk_size, 
+             chunk) != ERROR_OK){
+      simple_memory_buffer_free(&ds);
+      freeMemory(chunk);
+      return ERROR_UNKNOWN;
+    }
+
+    unsigned char packettype = '\0';
+    data_store_t res_ds;
+    if(exchangePacket(handle, &ds, &res_ds, &packettype) != ERROR_OK){
+      freeMemory(chunk);
+      return ERROR_UNKNOWN;
+    }
+
+    /* handling data */
+    int ret = ERROR_OK;
+    int64_t errorcode = ERROR_OK;
+    switch(packettype){
+      case PACKET_OK: break;
+      case PACKET_ERROR:
+        if(bunpack(&res_ds, "l", &errorcode) != ERROR_OK)
+          ret = ERROR_UNKNOWN;
+        else
+          ret = translateError(errorcode);
+        break;
+      default: ret = ERROR_UNKNOWN;
+    }
+
+    if(simple_memory_buffer_free(&res_ds) != ERROR_OK)
+      ret = ERROR_UNKNOWN;
+    if(ret != ERROR_OK){
+      freeMemory(chunk);
+      return ret;
+    }
+    offset += chunk_size;
+  }
+
+  freeMemory(chunk);
+  return ERROR_OK;
+}
+
+/**
+ * sends a packed request and receives the response, the request datastore is
+ * freed in any case
+ *
+ * @param[in] handle the registry
+ * @param[in] ds datastore containing the request
+ * @param[out] res_ds datastore containing the response, has to be freed on
+ *   success
+ * @param[out] packettype type of the response
+ */
+int
+exchangePacket(registry_t* handle, data_store_t* ds, data_store_t* res_ds,
+               unsigned char* packettype)
+{
+  /* send package */
+  unsigned char *data = NULL;
+  size_t size = 0;
+  if(simple_memory_buffer_get_data(ds, &data) != ERROR_OK ||
+     simple_memory_buffer_get_size(ds, &size) != ERROR_OK){
+    simple_memory_buffer_free(ds);
+    return ERROR_UNKNOWN;
+  }
+
+  int retval = ERROR_OK;
+  while((retval = channel_client_write_bytes(handle->channel, data, size)) == ERROR_CHANNEL_BUSY);
+
+  if(simple_memory_buffer_free(ds) != ERROR_OK || retval != ERROR_OK)
+    return ERROR_UNKNOWN;
+
+  /* receive response */
+  unsigned char *res_data = NULL;
+  size_t res_size = 0;
+  while((retval = channel_client_read_bytes(handle->channel, &res_data, &res_size)) == ERROR_CHANNEL_BUSY);
+
+  if(retval != ERROR_OK)
+    return ERROR_UNKNOWN;
+
+  /* unpack package */
+  if(simple_memory_buffer_new(res_ds, res_data, res_size) != ERROR_OK){
+    freeMemory(res_data);
+    return ERROR_UNKNOWN;
+  }
+  freeMemory(res_data);
+
+  if(data_store_read_byte(res_ds, packettype) != ERROR_OK){
+    simple_memory_buffer_free(res_ds);
+    return ERROR_UNKNOWN;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * maps an error code of the server to the error codes of the registry
+ *
+ * @param[in] errorcode error code returned by the server
+ */
+int
+translateError(int64_t errorcode)
+{
+  switch(errorcode){
+    case ERROR_OK: return ERROR_OK;
+    case ERROR_INVALID_ARGUMENTS: return ERROR_INVALID_ARGUMENTS;
+    case ERROR_MEMORY: return ERROR_MEMORY;
+    case ERROR_DATABASE_INVALID: return ERROR_REGISTRY_INVALID_STATE;
+    case ERROR_DATABASE_NO_SUCH_KEY: return ERROR_REGISTRY_NO_SUCH_KEY;
+    case ERROR_DATABASE_READONLY: return ERROR_DATABASE_READONLY;
+    case ERROR_DATABASE_BUSY: return ERROR_DATABASE_BUSY;
+    default: return ERROR_UNKNOWN;
+  }
+}
+
 /* -------------------------------------------------------------------------- */
 int
 registry_enum_keys(registry_t* handle, const char* pattern, size_t* count, 
@@ -1056,6 +1373,203 @@ registry_key_get_value_type(registry_t* handle, const char* key, int* type)
   return ret;
 }
 
+/* -------------------------------------------------------------------------- */
+int
+registry_get_settings(registry_t* handle, char** settings)
+{
+  if(handle == NULL || handle->domain == NULL || strlen(handle->domain) == 0 || 
+     handle->channel == NULL || settings == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* pack package, the key is not used */
+  data_store_t ds;
+  if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+     data_store_write_byte(&ds, PACKET_GET_SETTINGS) != ERROR_OK ||
+     bpack(&ds, "ss", handle->domain, "settings") != ERROR_OK){
+    simple_memory_buffer_free(&ds);
+    return ERROR_UNKNOWN;
+  }
+
+  unsigned char packettype = '\0';
+  data_store_t res_ds;
+  if(exchangePacket(handle, &ds, &res_ds, &packettype) != ERROR_OK)
+    return ERROR_UNKNOWN;
+
+  /* handling data */
+  int ret = ERROR_OK;
+  int64_t errorcode = ERROR_OK;
+  switch(packettype){
+    case PACKET_ERROR:
+      if(bunpack(&res_ds, "l", &errorcode) != ERROR_OK)
+        ret = ERROR_UNKNOWN;
+      else
+        ret = translateError(errorcode);
+      break;
+    case PACKET_SETTINGS:
+      if(bunpack(&res_ds, "s", settings) != ERROR_OK)
+        ret = ERROR_UNKNOWN;
+      break;
+    default: ret = ERROR_UNKNOWN;
+  }
+
+  if(simple_memory_buffer_free(&res_ds) != ERROR_OK)
+    ret = ERROR_UNKNOWN;
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+registry_release_memory(registry_t* handle, size_t* released)
+{
+  if(handle == NULL || handle->domain == NULL || strlen(handle->domain) == 0 || 
+     handle->channel == NULL || released == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* pack package, the key is not used */
+  data_store_t ds;
+  if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+     data_store_write_byte(&ds, PACKET_RELEASE_MEMORY) != ERROR_OK ||
+     bpack(&ds, "ss", handle->domain, "memory") != ERROR_OK){
+    simple_memory_buffer_free(&ds);
+    return ERROR_UNKNOWN;
+  }
+
+  unsigned char packettype = '\0';
+  data_store_t res_ds;
+  if(exchangePacket(handle, &ds, &res_ds, &packettype) != ERROR_OK)
+    return ERROR_UNKNOWN;
+
+  /* handling data */
+  int ret = ERROR_OK;
+  int64_t errorcode = ERROR_OK;
+  int64_t bytes = 0;
+  switch(packettype){
+    case PACKET_ERROR:
+      if(bunpack(&res_ds, "l", &errorcode) != ERROR_OK)
+        ret = ERROR_UNKNOWN;
+      else
+        ret = translateError(errorcode);
+      break;
+    case PACKET_RELEASED: 
+      if(bunpack(&res_ds, "l", &bytes) != ERROR_OK)
+        ret = ERROR_UNKNOWN;
+      else
+        *released = bytes;
+      break;
+    default: ret = ERROR_UNKNOWN;
+  }
+
+  if(simple_memory_buffer_free(&res_ds) != ERROR_OK)
+    ret = ERROR_UNKNOWN;
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+registry_backup(registry_t* handle, const char* path, int64_t* pages,
+                int64_t* blobs)
+{
+  if(handle == NULL || handle->domain == NULL || strlen(handle->domain) == 0 || 
+     handle->channel == NULL || path == NULL || strlen(path) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* pack package, the path goes where the key would */
+  data_store_t ds;
+  if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+     data_store_write_byte(&ds, PACKET_BACKUP) != ERROR_OK ||
+     bpack(&ds, "ss", handle->domain, path) != ERROR_OK){
+    simple_memory_buffer_free(&ds);
+    return ERROR_UNKNOWN;
+  }
+
+  unsigned char packettype = '\0';
+  data_store_t res_ds;
+  if(exchangePacket(handle, &ds, &res_ds, &packettype) != ERROR_OK)
+    return ERROR_UNKNOWN;
+
+  /* handling data */
+  int ret = ERROR_OK;
+  int64_t errorcode = ERROR_OK;
+  int64_t copied_pages = 0;
+  int64_t copied_blobs = 0;
+  switch(packettype){
+    case PACKET_ERROR:
+      if(bunpack(&res_ds, "l", &errorcode) != ERROR_OK)
+        ret = ERROR_UNKNOWN;
+      else
+        ret = translateError(errorcode);
+      break;
+    case PACKET_BACKED_UP:
+      if(bunpack(&res_ds, "ll", &copied_pages, &copied_blobs) != ERROR_OK){
+        ret = ERROR_UNKNOWN;
+        break;
+      }
+      if(pages != NULL)
+        *pages = copied_pages;
+      if(blobs != NULL)
+        *blobs = copied_blobs;
+      break;
+    default: ret = ERROR_UNKNOWN;
+  }
+
+  if(simple_memory_buffer_free(&res_ds) != ERROR_OK)
+    ret = ERROR_UNKNOWN;
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+registry_maintain(registry_t* handle, int64_t pages, int64_t blobs,
+                  int64_t* pages_freed, int64_t* blobs_removed)
+{
+  if(handle == NULL || handle->domain == NULL || strlen(handle->domain) == 0 || 
+     handle->channel == NULL || pages < 0 || blobs < 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* pack package, the key is not used */
+  data_store_t ds;
+  if(simple_memory_buffer_new(&ds, NULL, 0) != ERROR_OK ||
+     data_store_write_byte(&ds, PACKET_MAINTAIN) != ERROR_OK ||
+     bpack(&ds, "ssll", handle->domain, "maintenance", pages, blobs) != ERROR_OK){
+    simple_memory_buffer_free(&ds);
+    return ERROR_UNKNOWN;
+  }
+
+  unsigned char packettype = '\0';
+  data_store_t res_ds;
+  if(exchangePacket(handle, &ds, &res_ds, &packettype) != ERROR_OK)
+    return ERROR_UNKNOWN;
+
+  /* handling data */
+  int ret = ERROR_OK;
+  int64_t errorcode = ERROR_OK;
+  int64_t freed = 0;
+  int64_t removed = 0;
+  switch(packettype){
+    case PACKET_ERROR:
+      if(bunpack(&res_ds, "l", &errorcode) != ERROR_OK)
+        ret = ERROR_UNKNOWN;
+      else
+        ret = translateError(errorcode);
+      break;
+    case PACKET_MAINTAINED:
+      if(bunpack(&res_ds, "ll", &freed, &removed) != ERROR_OK){
+        ret = ERROR_UNKNOWN;
+        break;
+      }
+      if(pages_freed != NULL)
+        *pages_freed = freed;
+      if(blobs_removed != NULL)
+        *blobs_removed = removed;
+      break;
+    default: ret = ERROR_UNKNOWN;
+  }
+
+  if(simple_memory_buffer_free(&res_ds) != ERROR_OK)
+    ret = ERROR_UNKNOWN;
+  return ret;
+}
+
 /* -------------------------------------------------------------------------- */
 channel_t*
 registry_get_channel(registry_t* handle)
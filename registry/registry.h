@@ -28,6 +28,9 @@ extern "C" {
 
 typedef struct registry_s registry_t;
 
+/** Size of the chunks used to stream blobs over a channel */
+#define REGISTRY_BLOB_CHUNK_SIZE (64 * 1024)
+
 /**
  * Open a connection to the registry.
  *
@@ -37,6 +40,11 @@ typedef struct registry_s registry_t;
  *   describes which registry implementation is used:
  *
  *    * file://<path> - create a channel_with_server instance
+ *    * mem://<name>  - create a channel_with_server instance on top of an
+ *                      in-memory database that is lost once the last handle
+ *                      using it is closed, useful for tests and caches
+ *    * log://<path>  - create a channel_with_server instance on top of an
+ *                      append-only log at path, for write-heavy domains
  *    * hmac://<key>  - create a channel_hmac instance
  *
  *  They can be seperated by |, e.g. file://<path>|hmac://<key> creates a
@@ -47,6 +55,16 @@ typedef struct registry_s registry_t;
  *  the identifer: file://<path>|hmac://<key>|hmac://<key> is valid and creates
  *  a chain of one channel_with_server instance and two channel_hmac instances.
  *
+ *  mem://<name> and log://<path> may take the place of file://<path>
+ *  everywhere. The path of file:// may carry database options, e.g.
+ *  file://<path>?durability=relaxed, see @ref database_open. A directory
+ *  of shards or file://<path>?shards=N spreads the domains over several
+ *  databases, see @ref database_sharded_new. Read-only snapshots are opened
+ *  with file://<path>?mode=ro or ?immutable=1, every set then fails with
+ *  @ref ERROR_DATABASE_READONLY. SQLite itself is tuned with e.g.
+ *  file://<path>?cache_size=-8192&journal=wal&busy_timeout=500, @ref
+ *  registry_get_settings tells what is in effect.
+ *
  *  To put the channel-hmac and channel-with-server instances together, please
  *  have a look at channel-endpoint-connector.
  *
@@ -69,6 +87,10 @@ int registry_open(registry_t** handle, const char* identifier,
 /**
  * Closes the given connection to registry.
  *
+ * Closing a view only releases the view. A handle returned by @ref
+ * registry_open can't be closed while views of it are open, @ref
+ * ERROR_INVALID_ARGUMENTS is returned in this case.
+ *
  * @param[in] handle A registry handle. If the handle is @a NULL, this function
  *   is a no-op and returns @ref ERROR_INVALID_ARGUMENTS.
  *
@@ -78,6 +100,25 @@ int registry_open(registry_t** handle, const char* identifier,
  */
 int registry_close(registry_t* handle);
 
+/**
+ * Creates a view of a registry bound to another domain.
+ *
+ * The view shares the channel stack and thus the server and the database
+ * connection of @a handle, only the domain differs. It can be used with every
+ * registry function like a handle returned by @ref registry_open and has to be
+ * closed with @ref registry_close before @a handle is closed. Creating a view
+ * of a view is the same as creating it of the original handle.
+ *
+ * @param[in] handle A valid registry handle or view.
+ * @param[in] domain The domain of the view, any non-empty string.
+ * @param[out] view Pointer to the view, set to @a NULL on failure.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int registry_domain_view(registry_t* handle, const char* domain, registry_t** view);
+
 /**
  * Retrieve a signed 64-bit integer value from the registry.
  *
@@ -101,6 +142,8 @@ int registry_get_int64(registry_t* handle, const char* key, int64_t* value);
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_READONLY The database is read-only
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
  * @return @ref ERROR_UNKNOWN An unspecified error occurred
  */
@@ -129,6 +172,8 @@ int registry_get_double(registry_t* handle, const char* key, double* value);
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_READONLY The database is read-only
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
  * @return @ref ERROR_UNKNOWN An unspecified error occurred
  */
@@ -158,6 +203,8 @@ int registry_get_string(registry_t* handle, const char* key, char** value);
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_READONLY The database is read-only
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
  * @return @ref ERROR_UNKNOWN An unspecified error occurred
  */
@@ -187,11 +234,51 @@ int registry_get_blob(registry_t* handle, const char* key, unsigned char** value
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_READONLY The database is read-only
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
  * @return @ref ERROR_UNKNOWN An unspecified error occurred
  */
 int registry_set_blob(registry_t* handle, const char* key, const unsigned char* value, size_t size);
 
+/** Write a blob value from the registry to a file descriptor.
+ *
+ * The blob is written at the current position of @a fd and is never held in
+ * memory as a whole. If the registry talks to its own server without any
+ * intermediate channel the kernel copies the blob file directly, otherwise the
+ * blob is transferred in chunks of @ref REGISTRY_BLOB_CHUNK_SIZE bytes.
+ *
+ * @param[in] handle A valid registry handle.
+ * @param[in] key The key name of the value that should be retrieved.
+ * @param[in] fd Writable file descriptor.
+ * @param[out] size Number of bytes written to @a fd.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_REGISTRY_NO_SUCH_KEY Given key does not exist
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_UNKNOWN An unspecified error occurred
+ */
+int registry_get_blob_to_fd(registry_t* handle, const char* key, int fd, size_t* size);
+
+/** Set a blob value in the registry from a file descriptor.
+ *
+ * Everything from the current position of @a fd up to end of file is stored,
+ * see @ref registry_get_blob_to_fd for how the data is transferred.
+ *
+ * @param[in] handle A valid registry handle.
+ * @param[in] key The key name of the value that should be set.
+ * @param[in] fd Readable file descriptor.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_READONLY The database is read-only
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_UNKNOWN An unspecified error occurred
+ */
+int registry_set_blob_from_fd(registry_t* handle, const char* key, int fd);
+
 /** Enumerate keys according to a pattern.
  *
  * The keys are returned in one large string that is separated by @a 0s. For
@@ -226,6 +313,83 @@ int registry_enum_keys(registry_t* handle, const char* pattern, size_t* count, s
  */
 int registry_key_get_value_type(registry_t* handle, const char* key, int* type);
 
+/**
+ * Retrieves the settings SQLite uses for the database of the registry, see
+ * @ref database_get_settings. Databases that are not SQLite based report an
+ * empty string.
+ *
+ * @param[in] handle A valid registry handle.
+ * @param[out] settings The settings, e.g. journal=wal&synchronous=normal&...
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_UNKNOWN An unspecified error occurred
+ */
+int registry_get_settings(registry_t* handle, char** settings);
+
+/**
+ * Asks the server of the registry to give back the memory it only holds to
+ * be faster, see @ref server_release_memory. Nothing stored is lost.
+ *
+ * @param[in] handle A valid registry handle.
+ * @param[out] released Bytes SQLite's page cache gave back
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_UNKNOWN An unspecified error occurred
+ */
+int registry_release_memory(registry_t* handle, size_t* released);
+
+/**
+ * Asks the server of the registry to back up its database while it keeps
+ * serving, see @ref server_backup. The backup is written by the server to
+ * @a path inside its @ref SERVER_BACKUP_DIRECTORY, which is in the directory of
+ * the database file: /srv/registry.sqlite is backed up to /srv/backups/@a path
+ * whatever the working directory. The server answers once the backup is done,
+ * so its progress is only reported as the steps it took.
+ *
+ * @param[in] handle A valid registry handle.
+ * @param[in] path File name of the backup, without any '/' or leading '.'
+ * @param[out] pages Pages of the database copied, may be NULL
+ * @param[out] blobs Blob files copied, may be NULL
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed,
+ *  e.g. @a path isn't a plain file name
+ * @return @ref ERROR_UNKNOWN An unspecified error occurred, e.g. the backup
+ *  couldn't be written
+ */
+int registry_backup(registry_t* handle, const char* path, int64_t* pages,
+                    int64_t* blobs);
+
+/**
+ * Asks the server of the registry for one bounded step of maintenance, see
+ * @ref server_maintain. The server gives back up to @a pages free pages,
+ * runs PRAGMA optimize and checks up to @a blobs blob files for a row, files
+ * younger than SERVER_MAINTENANCE_GRACE seconds are kept. The step runs at
+ * once, when to call it is left to the application, e.g. while it is idle.
+ *
+ * @param[in] handle A valid registry handle.
+ * @param[in] pages Free pages to give back
+ * @param[in] blobs Blob files to check, the next call continues after them
+ * @param[out] pages_freed Pages given back to the file system, may be NULL
+ * @param[out] blobs_removed Blob files without a row removed, may be NULL
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_REGISTRY_INVALID_STATE Corrupt database
+ * @return @ref ERROR_DATABASE_READONLY The database is opened read-only
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  the database isn't SQLite based
+ * @return @ref ERROR_UNKNOWN An unspecified error occurred
+ */
+int registry_maintain(registry_t* handle, int64_t pages, int64_t blobs,
+                      int64_t* pages_freed, int64_t* blobs_removed);
+
 /**
  * Returns the channel object from the registry handle.
  *
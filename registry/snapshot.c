@@ -0,0 +1,343 @@
+/** @brief Compiled snapshots of the registry
+ *
+ * This file contains the reader of the snapshots of 'the registry'.
+ *
+ * @file snapshot.c
+ */
+
+#ifndef MMAP
+#define MMAP
+#define _XOPEN_SOURCE 500
+#include <features.h>
+#endif // MMAP
+
+#include "snapshot.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../hash.h"
+#include "../server/database.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+struct snapshot_s {
+  const unsigned char *base;        /* the mapped file             */
+  size_t size;                      /* size of the mapping         */
+  const snapshot_entry_t *entries;  /* the sorted entry table      */
+  uint64_t count;                   /* number of entries           */
+  uint64_t generation;              /* generation of the snapshot  */
+};
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int checkSnapshot(snapshot_t* snapshot);
+int checkSnapshotEntry(snapshot_t* snapshot, const snapshot_header_t* header,
+                       const snapshot_entry_t* entry);
+int compareSnapshotEntry(snapshot_t* snapshot, const snapshot_entry_t* entry,
+                         const char* domain, const char* key);
+int findSnapshotEntry(snapshot_t* snapshot, const char* domain,
+                      const char* key, uint32_t type,
+                      const snapshot_entry_t** entry);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+snapshot_open(snapshot_t** snapshot, const char* path)
+{
+  if(snapshot == NULL || path == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return ERROR_DATABASE_OPEN;
+
+  struct stat sb;
+  if(fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)){
+    close(fd);
+    return ERROR_DATABASE_OPEN;
+  }
+  if((uint64_t)sb.st_size < sizeof(snapshot_header_t)){
+    close(fd);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  /* the mapping keeps the file alive, the descriptor isn't needed anymore */
+  void* base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)
+    return ERROR_DATABASE_OPEN;
+
+  if(requestMemory((void**)snapshot, sizeof(snapshot_t)) != ERROR_OK){
+    munmap(base, sb.st_size);
+    return ERROR_MEMORY;
+  }
+  (*snapshot)->base = base;
+  (*snapshot)->size = sb.st_size;
+
+  int ret = checkSnapshot(*snapshot);
+  if(ret != ERROR_OK){
+    snapshot_close(*snapshot);
+    return ret;
+  }
+
+  return ERROR_OK;
+}
+
+int
+snapshot_close(snapshot_t* snapshot)
+{
+  if(snapshot == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  munmap((void*)snapshot->base, snapshot->size);
+  freeMemory(snapshot);
+  return ERROR_OK;
+}
+
+int
+snapshot_generation(snapshot_t* snapshot, uint64_t* generation)
+{
+  if(snapshot == NULL || generation == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *generation = snapshot->generation;
+  return ERROR_OK;
+}
+
+int
+snapshot_get_type(snapshot_t* snapshot, const char* domain, const char* key,
+                  int* type)
+{
+  if(type == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  const snapshot_entry_t* entry = NULL;
+  int ret = findSnapshotEntry(snapshot, domain, key, UINT32_MAX, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *type = entry->type;
+  return ERROR_OK;
+}
+
+int
+snapshot_get_int64(snapshot_t* snapshot, const char* domain, const char* key,
+                   int64_t* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  const snapshot_entry_t* entry = NULL;
+  int ret = findSnapshotEntry(snapshot, domain, key, DATABASE_TYPE_INT64, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  memcpy(value, &entry->value, sizeof(int64_t));
+  return ERROR_OK;
+}
+
+int
+snapshot_get_double(snapshot_t* snapshot, const char* domain, const char* key,
+                    double* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  const snapshot_entry_t* entry = NULL;
+  int ret = findSnapshotEntry(snapshot, domain, key, DATABASE_TYPE_DOUBLE, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  memcpy(value, &entry->value, sizeof(double));
+  return ERROR_OK;
+}
+
+int
+snapshot_get_string(snapshot_t* snapshot, const char* domain, const char* key,
+                    const char** value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  const snapshot_entry_t* entry = NULL;
+  int ret = findSnapshotEntry(snapshot, domain, key, DATABASE_TYPE_STRING, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *value = (const char*)snapshot->base + entry->value;
+  return ERROR_OK;
+}
+
+int
+snapshot_get_blob(snapshot_t* snapshot, const char* domain, const char* key,
+                  const unsigned char** value, size_t* size)
+{
+  if(value == NULL || size == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  const snapshot_entry_t* entry = NULL;
+  int ret = findSnapshotEntry(snapshot, domain, key, DATABASE_TYPE_BLOB, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *value = snapshot->base + entry->value;
+  *size = entry->size;
+  return ERROR_OK;
+}
+
+/**
+ * checks the header, the checksum and every entry of a mapped snapshot, so
+ * lookups never have to check an offset again
+ *
+ * @param[in] snapshot The snapshot with base and size set
+ */
+int
+checkSnapshot(snapshot_t* snapshot)
+{
+  snapshot_header_t header;
+  memcpy(&header, snapshot->base, sizeof(snapshot_header_t));
+
+  if(memcmp(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0 ||
+     header.names < sizeof(snapshot_header_t) || header.names > header.table ||
+     header.table > snapshot->size || header.table % 8 != 0 ||
+     header.count > (snapshot->size - header.table) / sizeof(snapshot_entry_t) ||
+     header.table + header.count * sizeof(snapshot_entry_t) != snapshot->size)
+    return ERROR_DATABASE_INVALID;
+
+  /* FNV-1a over names and entry table */
+  uint64_t checksum = hash_fnv1a64(HASH_FNV1A64_BASIS, snapshot->base + header.names,
+                                   snapshot->size - header.names);
+  if(checksum != header.checksum)
+    return ERROR_DATABASE_INVALID;
+
+  snapshot->entries = (const snapshot_entry_t*)(snapshot->base + header.table);
+  snapshot->count = header.count;
+  snapshot->generation = header.generation;
+
+  /* binary search needs strictly ascending entries */
+  uint64_t entry = 0;
+  for(; entry < snapshot->count; entry++){
+    const snapshot_entry_t* current = &snapshot->entries[entry];
+    if(checkSnapshotEntry(snapshot, &header, current) != ERROR_OK)
+      return ERROR_DATABASE_INVALID;
+    if(entry > 0){
+      const char* name = (const char*)snapshot->base + current->name;
+      if(compareSnapshotEntry(snapshot, current - 1, name,
+                              name + current->domain_size + 1) >= 0)
+        return ERROR_DATABASE_INVALID;
+    }
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * checks that name and value of an entry lie inside their parts of the file
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] header The header of the snapshot
+ * @param[in] entry The entry
+ */
+int
+checkSnapshotEntry(snapshot_t* snapshot, const snapshot_header_t* header,
+                   const snapshot_entry_t* entry)
+{
+  uint64_t name_size = (uint64_t)entry->domain_size + entry->key_size + 2;
+  if(entry->domain_size == 0 || entry->key_size == 0 || entry->reserved != 0 ||
+     entry->name < header->names || entry->name > header->table ||
+     name_size > header->table - entry->name)
+    return ERROR_DATABASE_INVALID;
+
+  const char* domain = (const char*)snapshot->base + entry->name;
+  const char* key = domain + entry->domain_size + 1;
+  if(memchr(domain, '\0', entry->domain_size + 1) != domain + entry->domain_size ||
+     memchr(key, '\0', entry->key_size + 1) != key + entry->key_size)
+    return ERROR_DATABASE_INVALID;
+
+  switch(entry->type){
+    case DATABASE_TYPE_INT64:
+    case DATABASE_TYPE_DOUBLE:
+      return entry->size == 0 ? ERROR_OK : ERROR_DATABASE_INVALID;
+
+    case DATABASE_TYPE_STRING:
+      if(entry->size == 0)
+        return ERROR_DATABASE_INVALID;
+      /* fall through */
+    case DATABASE_TYPE_BLOB:
+      if(entry->value < sizeof(snapshot_header_t) || entry->value > header->names ||
+         entry->size > header->names - entry->value)
+        return ERROR_DATABASE_INVALID;
+      if(entry->type == DATABASE_TYPE_STRING &&
+         memchr(snapshot->base + entry->value, '\0', entry->size) !=
+         snapshot->base + entry->value + entry->size - 1)
+        return ERROR_DATABASE_INVALID;
+      return ERROR_OK;
+
+    default:
+      return ERROR_DATABASE_INVALID;
+  }
+}
+
+/**
+ * compares an entry with a domain, key pair like strcmp(3)
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] entry The entry
+ * @param[in] domain The domain
+ * @param[in] key The key
+ */
+int
+compareSnapshotEntry(snapshot_t* snapshot, const snapshot_entry_t* entry,
+                     const char* domain, const char* key)
+{
+  const char* name = (const char*)snapshot->base + entry->name;
+  int result = strcmp(name, domain);
+  if(result != 0)
+    return result;
+  return strcmp(name + entry->domain_size + 1, key);
+}
+
+/**
+ * looks up the entry of a domain, key pair by binary search
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The expected type, UINT32_MAX for any
+ * @param[out] entry The entry
+ */
+int
+findSnapshotEntry(snapshot_t* snapshot, const char* domain, const char* key,
+                  uint32_t type, const snapshot_entry_t** entry)
+{
+  if(snapshot == NULL || domain == NULL || key == NULL || strlen(domain) == 0 ||
+     strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  uint64_t low = 0;
+  uint64_t high = snapshot->count;
+  while(low < high){
+    uint64_t middle = low + (high - low) / 2;
+    int result = compareSnapshotEntry(snapshot, &snapshot->entries[middle],
+                                      domain, key);
+    if(result == 0){
+      *entry = &snapshot->entries[middle];
+      if(type != UINT32_MAX && (*entry)->type != type)
+        return ERROR_DATABASE_TYPE_MISMATCH;
+      return ERROR_OK;
+    }
+    if(result < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return ERROR_DATABASE_NO_SUCH_KEY;
+}
@@ -0,0 +1,177 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/** @brief Compiled snapshots of the registry
+ *
+ * A snapshot is a single immutable file holding the values of one domain or
+ * of a whole database, written by @ref database_snapshot_compile. Readers map
+ * it into memory and look values up by binary search, without a server, an
+ * SQLite connection or a single allocation. Since the file is never modified,
+ * any number of processes share its pages in the page cache.
+ *
+ * The file consists of
+ *
+ *    * the header, see @ref snapshot_header_t
+ *    * the values of strings (including their NUL) and blobs, back to back
+ *    * the names: domain and key of every entry, each terminated by a NUL
+ *    * the entry table, see @ref snapshot_entry_t, sorted by domain and then
+ *      key as compared by strcmp(3), 8-byte aligned
+ *
+ * All numbers are stored in the byte order of the machine that compiled the
+ * snapshot. The checksum covers the names and the entry table, @ref
+ * snapshot_open checks it together with every offset once, so the lookups
+ * can trust the file afterwards.
+ *
+ * Strings and blobs handed out point into the mapping and stay valid until
+ * @ref snapshot_close.
+ *
+ * @file snapshot.h
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** First bytes of every snapshot, the last one is the format version */
+#define SNAPSHOT_MAGIC "RSNP\0\0\0\1"
+#define SNAPSHOT_MAGIC_SIZE 8
+
+typedef struct snapshot_header_s {
+  unsigned char magic[SNAPSHOT_MAGIC_SIZE]; /* SNAPSHOT_MAGIC               */
+  uint64_t generation;              /* bumped by every compile of the file */
+  uint64_t count;                   /* number of entries                   */
+  uint64_t names;                   /* offset of the names                 */
+  uint64_t table;                   /* offset of the entry table           */
+  uint64_t checksum;                /* FNV-1a of names and entry table     */
+} snapshot_header_t;
+
+typedef struct snapshot_entry_s {
+  uint64_t name;                    /* offset of "domain\0key\0"           */
+  uint32_t domain_size;             /* length of the domain without NUL    */
+  uint32_t key_size;                /* length of the key without NUL       */
+  uint32_t type;                    /* database_value_type_t               */
+  uint32_t reserved;                /* 0                                   */
+  uint64_t value;                   /* int64 or double bits, else offset   */
+  uint64_t size;                    /* size of a string or blob            */
+} snapshot_entry_t;
+
+typedef struct snapshot_s snapshot_t;
+
+/**
+ * Maps a snapshot and checks it.
+ *
+ * @param[out] snapshot The snapshot, has to be closed with @ref
+ *  snapshot_close
+ * @param[in] path Path to the snapshot
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_OPEN The file can't be opened or mapped
+ * @return @ref ERROR_DATABASE_INVALID The file is not a valid snapshot
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int snapshot_open(snapshot_t** snapshot, const char* path);
+
+/**
+ * Unmaps a snapshot, all strings and blobs handed out become invalid.
+ *
+ * @param[in] snapshot The snapshot
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int snapshot_close(snapshot_t* snapshot);
+
+/**
+ * Returns the generation of a snapshot, it grows with every compile of the
+ * same file.
+ *
+ * @param[in] snapshot The snapshot
+ * @param[out] generation The generation
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int snapshot_generation(snapshot_t* snapshot, uint64_t* generation);
+
+/**
+ * Returns the type of a value, one of the values of database_value_type_t.
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] type The type
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_NO_SUCH_KEY The domain, key pair does not exist
+ */
+int snapshot_get_type(snapshot_t* snapshot, const char* domain,
+    const char* key, int* type);
+
+/**
+ * Returns a signed 64-bit integer value.
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] value The value
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_NO_SUCH_KEY The domain, key pair does not exist
+ * @return @ref ERROR_DATABASE_TYPE_MISMATCH The value has another type
+ */
+int snapshot_get_int64(snapshot_t* snapshot, const char* domain,
+    const char* key, int64_t* value);
+
+/**
+ * Returns a double value.
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] value The value
+ *
+ * @return the error codes of @ref snapshot_get_int64
+ */
+int snapshot_get_double(snapshot_t* snapshot, const char* domain,
+    const char* key, double* value);
+
+/**
+ * Returns a string value. The string points into the snapshot and must not
+ * be freed.
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] value The NUL-terminated string
+ *
+ * @return the error codes of @ref snapshot_get_int64
+ */
+int snapshot_get_string(snapshot_t* snapshot, const char* domain,
+    const char* key, const char** value);
+
+/**
+ * Returns a blob value. The blob points into the snapshot and must not be
+ * freed.
+ *
+ * @param[in] snapshot The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] value The blob
+ * @param[out] size The size of the blob
+ *
+ * @return the error codes of @ref snapshot_get_int64
+ */
+int snapshot_get_blob(snapshot_t* snapshot, const char* domain,
+    const char* key, const unsigned char** value, size_t* size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // SNAPSHOT_H
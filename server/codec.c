@@ -0,0 +1,305 @@
+/** @brief Compression of stored values
+ *
+ * This file contains the codec used for long strings and blobs of 'the
+ * registry'.
+ *
+ * @file codec.c
+ */
+
+#include "codec.h"
+#include "../errors.h"
+#include <string.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** shortest match worth a sequence */
+#define CODEC_MIN_MATCH 4
+/** largest offset of a match */
+#define CODEC_WINDOW 65535
+/** the hash table has 2^CODEC_HASH_BITS entries */
+#define CODEC_HASH_BITS 12
+/** every 2^CODEC_SKIP_SHIFT misses the search takes a longer step */
+#define CODEC_SKIP_SHIFT 5
+
+typedef struct codec_writer_s {
+  unsigned char *data;              /* the destination         */
+  size_t size;                      /* bytes written so far    */
+  size_t capacity;                  /* size of the destination */
+} codec_writer_t;
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+size_t codecMatchLength(const unsigned char* match, const unsigned char* current,
+                        const unsigned char* end);
+int writeCodecSequence(codec_writer_t* writer, const unsigned char* literals,
+                       size_t literal_length, size_t offset, size_t match_length);
+int writeCodecLength(codec_writer_t* writer, size_t length);
+int readCodecLength(const unsigned char* source, size_t size, size_t* position,
+                    size_t* length);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+codec_compress(const unsigned char* source, size_t size,
+               unsigned char* destination, size_t capacity, size_t* written)
+{
+  if(source == NULL || destination == NULL || written == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+  if(capacity < CODEC_HEADER_SIZE)
+    return ERROR_EOF;
+
+  codec_writer_t writer;
+  writer.data = destination;
+  writer.size = CODEC_HEADER_SIZE;
+  writer.capacity = capacity;
+  uint64_t original = size;
+  unsigned int i = 0;
+  for(; i < CODEC_HEADER_SIZE; i++)
+    destination[i] = (original >> (8 * i)) & 0xff;
+
+  size_t table[1 << CODEC_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  size_t anchor = 0;
+  size_t position = 0;
+  size_t misses = 0;
+  while(position + CODEC_MIN_MATCH <= size){
+    uint32_t sequence = 0;
+    uint32_t previous = 0;
+    memcpy(&sequence, source + position, sizeof(uint32_t));
+    uint32_t hash = (sequence * 2654435761u) >> (32 - CODEC_HASH_BITS);
+    size_t candidate = table[hash];
+    table[hash] = position;
+    if(candidate < position && position - candidate <= CODEC_WINDOW)
+      memcpy(&previous, source + candidate, sizeof(uint32_t));
+
+    if(candidate >= position || position - candidate > CODEC_WINDOW ||
+       previous != sequence){
+      position += 1 + (misses++ >> CODEC_SKIP_SHIFT);
+      continue;
+    }
+
+    size_t length = CODEC_MIN_MATCH +
+      codecMatchLength(source + candidate + CODEC_MIN_MATCH,
+                       source + position + CODEC_MIN_MATCH, source + size);
+    /* the literals before the match may be its start */
+    while(position > anchor && candidate > 0 &&
+          source[position - 1] == source[candidate - 1]){
+      position--;
+      candidate--;
+      length++;
+    }
+
+    if(writeCodecSequence(&writer, source + anchor, position - anchor,
+                          position - candidate, length) != ERROR_OK)
+      return ERROR_EOF;
+    position += length;
+    anchor = position;
+    misses = 0;
+  }
+
+  if(writeCodecSequence(&writer, source + anchor, size - anchor, 0, 0) != ERROR_OK)
+    return ERROR_EOF;
+
+  *written = writer.size;
+  return ERROR_OK;
+}
+
+int
+codec_decompress(const unsigned char* source, size_t size,
+                 unsigned char* destination, size_t capacity, size_t* written)
+{
+  if(source == NULL || written == NULL || (destination == NULL && capacity > 0))
+    return ERROR_INVALID_ARGUMENTS;
+
+  size_t original = 0;
+  int error = codec_size(source, size, &original);
+  if(error != ERROR_OK)
+    return error;
+
+  size_t limit = original < capacity ? original : capacity;
+  size_t position = CODEC_HEADER_SIZE;
+  size_t done = 0;
+  while(position < size){
+    unsigned char token = source[position++];
+    size_t literal_length = token >> 4;
+    if(literal_length == 15 &&
+       readCodecLength(source, size, &position, &literal_length) != ERROR_OK)
+      return ERROR_DATABASE_INVALID;
+    if(literal_length > size - position || literal_length > original - done)
+      return ERROR_DATABASE_INVALID;
+
+    size_t copy = literal_length < limit - done ? literal_length : limit - done;
+    memcpy(destination + done, source + position, copy);
+    position += literal_length;
+    done += copy;
+    if(done == limit || position == size)
+      break;
+
+    if(size - position < 2)
+      return ERROR_DATABASE_INVALID;
+    size_t offset = source[position] | ((size_t)source[position + 1] << 8);
+    position += 2;
+    size_t match_length = (token & 15) + CODEC_MIN_MATCH;
+    if(match_length == 15 + CODEC_MIN_MATCH &&
+       readCodecLength(source, size, &position, &match_length) != ERROR_OK)
+      return ERROR_DATABASE_INVALID;
+    if(offset == 0 || offset > done || match_length > original - done)
+      return ERROR_DATABASE_INVALID;
+
+    /* an overlapping match repeats its own output byte by byte */
+    copy = match_length < limit - done ? match_length : limit - done;
+    if(offset >= copy)
+      memcpy(destination + done, destination + done - offset, copy);
+    else{
+      size_t i = 0;
+      for(; i < copy; i++)
+        destination[done + i] = destination[done + i - offset];
+    }
+    done += copy;
+  }
+
+  /* all of it has to be there and nothing more */
+  if(limit == original && (done != original || position != size))
+    return ERROR_DATABASE_INVALID;
+
+  *written = done;
+  return ERROR_OK;
+}
+
+int
+codec_size(const unsigned char* source, size_t size, size_t* original)
+{
+  if(source == NULL || original == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+  if(size < CODEC_HEADER_SIZE)
+    return ERROR_DATABASE_INVALID;
+
+  uint64_t length = 0;
+  unsigned int i = 0;
+  for(; i < CODEC_HEADER_SIZE; i++)
+    length |= (uint64_t)source[i] << (8 * i);
+  /* no byte of a sequence stands for more than 255 bytes of the original */
+  if(length > SIZE_MAX || length / 255 > size)
+    return ERROR_DATABASE_INVALID;
+
+  *original = length;
+  return ERROR_OK;
+}
+
+/**
+ * counts the bytes two positions have in common, eight bytes at a time
+ *
+ * @param[in] match The earlier position
+ * @param[in] current The later position
+ * @param[in] end End of the data
+ */
+size_t
+codecMatchLength(const unsigned char* match, const unsigned char* current,
+                 const unsigned char* end)
+{
+  const unsigned char* start = current;
+  while(end - current >= 8){
+    uint64_t a = 0;
+    uint64_t b = 0;
+    memcpy(&a, match, sizeof(uint64_t));
+    memcpy(&b, current, sizeof(uint64_t));
+    if(a != b)
+      break;
+    match += 8;
+    current += 8;
+  }
+  while(current < end && *match == *current){
+    match++;
+    current++;
+  }
+  return current - start;
+}
+
+/**
+ * appends a sequence, a match length of 0 writes the last sequence
+ *
+ * @param[in] writer The destination
+ * @param[in] literals The literals
+ * @param[in] literal_length Number of literals
+ * @param[in] offset Distance back to the match
+ * @param[in] match_length Length of the match, at least 4 or 0
+ */
+int
+writeCodecSequence(codec_writer_t* writer, const unsigned char* literals,
+                   size_t literal_length, size_t offset, size_t match_length)
+{
+  if(writer->size >= writer->capacity)
+    return ERROR_EOF;
+
+  size_t match_token = match_length == 0 ? 0 : match_length - CODEC_MIN_MATCH;
+  writer->data[writer->size++] =
+    ((literal_length < 15 ? literal_length : 15) << 4) |
+    (match_token < 15 ? match_token : 15);
+  if(literal_length >= 15 && writeCodecLength(writer, literal_length - 15) != ERROR_OK)
+    return ERROR_EOF;
+
+  if(literal_length > writer->capacity - writer->size)
+    return ERROR_EOF;
+  memcpy(writer->data + writer->size, literals, literal_length);
+  writer->size += literal_length;
+  if(match_length == 0)
+    return ERROR_OK;
+
+  if(writer->capacity - writer->size < 2)
+    return ERROR_EOF;
+  writer->data[writer->size++] = offset & 0xff;
+  writer->data[writer->size++] = offset >> 8;
+  if(match_token >= 15 && writeCodecLength(writer, match_token - 15) != ERROR_OK)
+    return ERROR_EOF;
+
+  return ERROR_OK;
+}
+
+/**
+ * appends the rest of a length that didn't fit into the token
+ *
+ * @param[in] writer The destination
+ * @param[in] length The rest of the length
+ */
+int
+writeCodecLength(codec_writer_t* writer, size_t length)
+{
+  for(;;){
+    if(writer->size >= writer->capacity)
+      return ERROR_EOF;
+    if(length < 255){
+      writer->data[writer->size++] = length;
+      return ERROR_OK;
+    }
+    writer->data[writer->size++] = 255;
+    length -= 255;
+  }
+}
+
+/**
+ * adds the rest of a length that didn't fit into the token
+ *
+ * @param[in] source The compressed data
+ * @param[in] size Size of @a source
+ * @param[in,out] position Position of the rest, moved behind it
+ * @param[in,out] length The length from the token
+ */
+int
+readCodecLength(const unsigned char* source, size_t size, size_t* position,
+                size_t* length)
+{
+  unsigned char byte = 255;
+  while(byte == 255){
+    if(*position >= size)
+      return ERROR_DATABASE_INVALID;
+    byte = source[(*position)++];
+    if(*length > SIZE_MAX - byte)
+      return ERROR_DATABASE_INVALID;
+    *length += byte;
+  }
+  return ERROR_OK;
+}
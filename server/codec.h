@@ -0,0 +1,93 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+/** @brief Compression of stored values
+ *
+ * A small LZ77 codec in the spirit of LZ4 for strings and blobs, mostly text
+ * and configuration data. The compressed form starts with the size of the
+ * original data as 64-bit little endian integer, followed by sequences of
+ * literals and matches:
+ *
+ *  - a token, literal length in the high and match length - 4 in the low
+ *    nibble, 15 meaning that bytes of 255 and one below follow and are added
+ *  - the literals
+ *  - the offset of the match as 16-bit little endian integer and the
+ *    remaining match length as above
+ *
+ * The last sequence only holds literals and ends with the input. Matches are
+ * found through a hash table of 4 byte prefixes and extended eight bytes at a
+ * time, data that doesn't repeat is skipped in growing steps.
+ *
+ * @file codec.h
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** Codec of a value stored as it is */
+#define CODEC_NONE 0
+/** Codec of a value compressed by @ref codec_compress */
+#define CODEC_LZ 1
+
+/** Size of the header holding the size of the original data */
+#define CODEC_HEADER_SIZE 8
+
+/**
+ * Compresses @a size bytes of @a source into @a destination.
+ *
+ * @param[in] source The data
+ * @param[in] size Size of @a source
+ * @param[out] destination Buffer of @a capacity bytes
+ * @param[in] capacity Size of @a destination
+ * @param[out] written Size of the compressed data
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_EOF The compressed data doesn't fit into @a capacity
+ *   bytes, e.g. because @a source doesn't compress
+ */
+int codec_compress(const unsigned char* source, size_t size,
+                   unsigned char* destination, size_t capacity,
+                   size_t* written);
+
+/**
+ * Decompresses data written by @ref codec_compress. If @a capacity is smaller
+ * than the original data only its first @a capacity bytes are restored.
+ *
+ * @param[in] source The compressed data
+ * @param[in] size Size of @a source
+ * @param[out] destination Buffer of @a capacity bytes
+ * @param[in] capacity Size of @a destination
+ * @param[out] written Number of bytes restored
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_INVALID @a source is corrupt
+ */
+int codec_decompress(const unsigned char* source, size_t size,
+                     unsigned char* destination, size_t capacity,
+                     size_t* written);
+
+/**
+ * Reads the size of the original data from compressed data.
+ *
+ * @param[in] source The compressed data
+ * @param[in] size Size of @a source
+ * @param[out] original Size of the original data
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_INVALID @a source is too short or the size
+ *   can't be right
+ */
+int codec_size(const unsigned char* source, size_t size, size_t* original);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // CODEC_H
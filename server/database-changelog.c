@@ -0,0 +1,933 @@
+/** @brief Change log and followers
+ *
+ * This file contains the storage engine of 'the registry' that records every
+ * change of another engine in a change log and the follower that applies
+ * such a log to a database of its own.
+ *
+ * @file database-changelog.c
+ */
+
+#ifndef CHANGELOG
+#define CHANGELOG
+#define _XOPEN_SOURCE 700
+#include <features.h>
+#endif // CHANGELOG
+
+#include "database-engine.h"
+#include "database-options.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../hash.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** first bytes of a change log, followed by its 64-bit generation */
+#define CHANGES_MAGIC "RCHG\0\0\0\1"
+#define CHANGES_MAGIC_SIZE 8
+#define CHANGES_HEADER_SIZE (CHANGES_MAGIC_SIZE + 8)
+/** checksum, domain size, key size, type and value size of a record */
+#define CHANGES_RECORD_HEADER_SIZE 24
+/** generation of the change log and offset of the next change */
+#define FOLLOWER_POSITION_SIZE 16
+
+typedef struct changelog_engine_s {
+  database_engine_t *backing;       /* the engine that stores the values */
+  int fd;                           /* the change log                    */
+  database_durability_t durability; /* durability of the handle          */
+} changelog_engine_t;
+
+/** a record of the change log, domain, key and value are NUL-terminated */
+typedef struct change_s {
+  uint32_t checksum;                /* FNV-1a of the rest of the record */
+  uint32_t domain_size;             /* size of the domain               */
+  uint32_t key_size;                /* size of the key                  */
+  uint32_t type;                    /* database_value_type_t            */
+  uint64_t size;                    /* size of the value                */
+  uint64_t end;                     /* offset behind the record         */
+  char *domain;                     /* domain\0key\0value\0             */
+  char *key;                        /* points into domain               */
+  unsigned char *value;             /* points into domain               */
+} change_t;
+
+struct database_follower_s {
+  database_engine_t *engine;        /* the follower's database          */
+  char *changelog;                  /* path of the change log           */
+  char *position;                   /* position file, NULL if none      */
+  int fd;                           /* the change log                   */
+  dev_t device;                     /* identity of the opened log       */
+  ino_t inode;
+  uint64_t generation;              /* generation of the opened log     */
+  uint64_t offset;                  /* first change not applied yet     */
+};
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int readChanges(int fd, unsigned char* buffer, size_t size, uint64_t offset);
+int writeChanges(int fd, const unsigned char* buffer, size_t size,
+                 uint64_t offset);
+int lockChanges(int fd, short type);
+int appendChange(changelog_engine_t* changelog, const char* domain,
+                 const char* key, database_value_type_t type,
+                 const void* value, size_t size);
+int recordChange(database_engine_t* engine, const char* domain,
+                 const char* key, database_value_type_t type,
+                 const void* value, size_t size);
+int applyChange(database_engine_t* engine, const char* domain,
+                const char* key, uint32_t type, const void* value,
+                size_t size);
+int readChangeHeader(int fd, uint64_t offset, uint64_t size, change_t* change);
+int readChange(int fd, uint64_t offset, uint64_t size, change_t* change);
+int openChanges(const char* path, int flags, int* fd, uint64_t* generation);
+int repairChanges(int fd);
+int buildSuffixedPath(const char* path, const char* suffix, char** result);
+int reopenFollowed(database_follower_t* follower);
+int saveFollowerPosition(database_follower_t* follower);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+static int
+changelog_close(database_engine_t* engine)
+{
+  changelog_engine_t* changelog = engine->data;
+  int ret = database_engine_close(changelog->backing);
+  close(changelog->fd);
+  freeMemory(changelog);
+  freeMemory(engine);
+  return ret;
+}
+
+static int
+changelog_get_type(database_engine_t* engine, const char* domain,
+                   const char* key, database_value_type_t* type)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_type(changelog->backing, domain, key, type);
+}
+
+static int
+changelog_enum_keys(database_engine_t* engine, const char* domain,
+                    const char* pattern, size_t* count, size_t* size,
+                    char** keys)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_enum_keys(changelog->backing, domain, pattern, count,
+                                   size, keys);
+}
+
+static int
+changelog_enum_domains(database_engine_t* engine, size_t* count, size_t* size,
+                       char** domains)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_enum_domains(changelog->backing, count, size, domains);
+}
+
+static int
+changelog_get_int64(database_engine_t* engine, const char* domain,
+                    const char* key, int64_t* value)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_int64(changelog->backing, domain, key, value);
+}
+
+static int
+changelog_set_int64(database_engine_t* engine, const char* domain,
+                    const char* key, int64_t value)
+{
+  return recordChange(engine, domain, key, DATABASE_TYPE_INT64, &value,
+                      sizeof(int64_t));
+}
+
+static int
+changelog_get_double(database_engine_t* engine, const char* domain,
+                     const char* key, double* value)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_double(changelog->backing, domain, key, value);
+}
+
+static int
+changelog_set_double(database_engine_t* engine, const char* domain,
+                     const char* key, double value)
+{
+  return recordChange(engine, domain, key, DATABASE_TYPE_DOUBLE, &value,
+                      sizeof(double));
+}
+
+static int
+changelog_get_string(database_engine_t* engine, const char* domain,
+                     const char* key, char** value)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_string(changelog->backing, domain, key, value);
+}
+
+static int
+changelog_set_string(database_engine_t* engine, const char* domain,
+                     const char* key, const char* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return recordChange(engine, domain, key, DATABASE_TYPE_STRING, value,
+                      strlen(value));
+}
+
+static int
+changelog_get_blob(database_engine_t* engine, const char* domain,
+                   const char* key, unsigned char** value, size_t* size)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_blob(changelog->backing, domain, key, value, size);
+}
+
+static int
+changelog_set_blob(database_engine_t* engine, const char* domain,
+                   const char* key, const unsigned char* value, size_t size)
+{
+  return recordChange(engine, domain, key, DATABASE_TYPE_BLOB, value, size);
+}
+
+static int
+changelog_get_blob_chunk(database_engine_t* engine, const char* domain,
+                         const char* key, size_t offset, size_t length,
+                         unsigned char** value, size_t* size, size_t* total)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_blob_chunk(changelog->backing, domain, key,
+                                        offset, length, value, size, total);
+}
+
+static int
+changelog_get_blob_to_fd(database_engine_t* engine, const char* domain,
+                         const char* key, int fd, size_t* size)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_blob_to_fd(changelog->backing, domain, key, fd,
+                                        size);
+}
+
+static int
+changelog_get_settings(database_engine_t* engine, char** settings)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_get_settings(changelog->backing, settings);
+}
+
+static int
+changelog_release_memory(database_engine_t* engine, size_t* released)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_release_memory(changelog->backing, released);
+}
+
+static int
+changelog_backup(database_engine_t* engine, const char* path,
+                 database_backup_callback_t callback, void* context)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_backup(changelog->backing, path, callback, context);
+}
+
+/* maintenance never changes a value, there is nothing to record */
+static int
+changelog_maintain(database_engine_t* engine, const database_maintenance_t* budget,
+                   database_maintenance_stats_t* stats)
+{
+  changelog_engine_t* changelog = engine->data;
+  return database_engine_maintain(changelog->backing, budget, stats);
+}
+
+int
+database_changelog_new(database_engine_t** engine, const char* identifier)
+{
+  if(engine == NULL || identifier == NULL ||
+     strncmp(identifier, DATABASE_ENGINE_MEMORY, strlen(DATABASE_ENGINE_MEMORY)) == 0 ||
+     strncmp(identifier, DATABASE_ENGINE_LOG, strlen(DATABASE_ENGINE_LOG)) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_options_t options;
+  int ret = database_options_parse(identifier, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* the backing engine gets every option but changelog=1 */
+  char* path = NULL;
+  char* backing_identifier = NULL;
+  database_durability_t durability = options.durability;
+  if(!options.changelog || options.readonly)
+    ret = ERROR_INVALID_ARGUMENTS;
+  if(ret == ERROR_OK)
+    ret = buildSuffixedPath(options.path, DATABASE_CHANGELOG_SUFFIX, &path);
+  options.changelog = 0;
+  if(ret == ERROR_OK)
+    ret = database_options_format(&options, &backing_identifier);
+  database_options_free(&options);
+  if(ret != ERROR_OK){
+    freeMemory(path);
+    return ret;
+  }
+
+  changelog_engine_t* changelog = NULL;
+  if(requestMemory((void**)&changelog, sizeof(changelog_engine_t)) != ERROR_OK){
+    freeMemory(path);
+    freeMemory(backing_identifier);
+    return ERROR_MEMORY;
+  }
+  changelog->backing = NULL;
+  changelog->fd = -1;
+  changelog->durability = durability;
+
+  ret = database_engine_open(&changelog->backing, backing_identifier);
+  freeMemory(backing_identifier);
+  uint64_t generation = 0;
+  if(ret == ERROR_OK)
+    ret = openChanges(path, O_RDWR | O_CREAT, &changelog->fd, &generation);
+  freeMemory(path);
+  if(ret == ERROR_OK)
+    ret = repairChanges(changelog->fd);
+  if(ret == ERROR_OK &&
+     requestMemory((void**)engine, sizeof(database_engine_t)) != ERROR_OK)
+    ret = ERROR_MEMORY;
+  if(ret != ERROR_OK){
+    if(changelog->backing != NULL)
+      database_engine_close(changelog->backing);
+    if(changelog->fd >= 0)
+      close(changelog->fd);
+    freeMemory(changelog);
+    return ret;
+  }
+
+  (*engine)->close = changelog_close;
+  (*engine)->get_type = changelog_get_type;
+  (*engine)->enum_keys = changelog_enum_keys;
+  (*engine)->enum_domains = changelog_enum_domains;
+  (*engine)->get_int64 = changelog_get_int64;
+  (*engine)->set_int64 = changelog_set_int64;
+  (*engine)->get_double = changelog_get_double;
+  (*engine)->set_double = changelog_set_double;
+  (*engine)->get_string = changelog_get_string;
+  (*engine)->set_string = changelog_set_string;
+  (*engine)->get_blob = changelog_get_blob;
+  (*engine)->set_blob = changelog_set_blob;
+  (*engine)->get_blob_chunk = changelog_get_blob_chunk;
+  (*engine)->get_blob_to_fd = changelog_get_blob_to_fd;
+  /* a streamed blob is recorded from memory like any other */
+  (*engine)->set_blob_from_fd = NULL;
+  (*engine)->get_settings = changelog_get_settings;
+  (*engine)->release_memory = changelog_release_memory;
+  (*engine)->backup = changelog_backup;
+  (*engine)->maintain = changelog_maintain;
+  (*engine)->readonly = 0;
+  (*engine)->data = changelog;
+
+  return ERROR_OK;
+}
+
+int
+database_follower_open(database_follower_t** follower, const char* changelog,
+                       const char* identifier)
+{
+  if(follower == NULL || changelog == NULL || identifier == NULL ||
+     strlen(changelog) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_options_t options;
+  int ret = database_options_parse(identifier, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(requestMemory((void**)follower, sizeof(database_follower_t)) != ERROR_OK){
+    database_options_free(&options);
+    return ERROR_MEMORY;
+  }
+  database_follower_t* opened = *follower;
+  opened->engine = NULL;
+  opened->changelog = NULL;
+  opened->position = NULL;
+  opened->fd = -1;
+  opened->offset = CHANGES_HEADER_SIZE;
+
+  /* a memory engine starts empty, it has no position to keep */
+  ret = buildSuffixedPath(changelog, "", &opened->changelog);
+  if(ret == ERROR_OK && strncmp(options.path, DATABASE_ENGINE_MEMORY,
+                                strlen(DATABASE_ENGINE_MEMORY)) != 0)
+    ret = buildSuffixedPath(options.path, DATABASE_FOLLOWER_POSITION_SUFFIX,
+                            &opened->position);
+  database_options_free(&options);
+  if(ret == ERROR_OK)
+    ret = reopenFollowed(opened);
+  if(ret == ERROR_OK)
+    ret = database_engine_open(&opened->engine, identifier);
+  if(ret == ERROR_OK && opened->engine->readonly)
+    ret = ERROR_INVALID_ARGUMENTS;
+  if(ret != ERROR_OK){
+    database_follower_close(opened);
+    *follower = NULL;
+    return ret;
+  }
+
+  /* the position only counts for the log it was written for */
+  unsigned char position[FOLLOWER_POSITION_SIZE];
+  int fd = opened->position == NULL ? -1 : open(opened->position, O_RDONLY);
+  if(fd >= 0 && readChanges(fd, position, FOLLOWER_POSITION_SIZE, 0) == ERROR_OK){
+    uint64_t generation = 0;
+    uint64_t offset = 0;
+    memcpy(&generation, position, 8);
+    memcpy(&offset, position + 8, 8);
+    if(generation == opened->generation && offset >= CHANGES_HEADER_SIZE)
+      opened->offset = offset;
+  }
+  if(fd >= 0)
+    close(fd);
+
+  return ERROR_OK;
+}
+
+int
+database_follower_poll(database_follower_t* follower, size_t* applied)
+{
+  if(follower == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(applied != NULL)
+    *applied = 0;
+  int ret = reopenFollowed(follower);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* between two appends the log ends with a complete record, everything
+     before that end never changes again */
+  struct stat sb;
+  if(lockChanges(follower->fd, F_RDLCK) != ERROR_OK)
+    return ERROR_DATABASE_IO;
+  int stated = fstat(follower->fd, &sb);
+  lockChanges(follower->fd, F_UNLCK);
+  if(stated != 0)
+    return ERROR_DATABASE_IO;
+
+  /* a log cut short after a crash is applied again from its start */
+  uint64_t size = sb.st_size;
+  if(follower->offset > size)
+    follower->offset = CHANGES_HEADER_SIZE;
+
+  uint64_t start = follower->offset;
+  while(ret == ERROR_OK && follower->offset < size){
+    change_t change;
+    ret = readChange(follower->fd, follower->offset, size, &change);
+    if(ret == ERROR_EOF){
+      ret = ERROR_OK;
+      break;
+    }
+    if(ret != ERROR_OK)
+      break;
+
+    ret = applyChange(follower->engine, change.domain, change.key, change.type,
+                      change.value, change.size);
+    freeMemory(change.domain);
+    if(ret != ERROR_OK)
+      break;
+
+    follower->offset = change.end;
+    if(applied != NULL)
+      (*applied)++;
+  }
+
+  /* changes applied before an error are kept */
+  if(follower->offset != start){
+    int saved = saveFollowerPosition(follower);
+    if(ret == ERROR_OK)
+      ret = saved;
+  }
+  return ret;
+}
+
+int
+database_follower_close(database_follower_t* follower)
+{
+  if(follower == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  int ret = ERROR_OK;
+  if(follower->engine != NULL)
+    ret = database_engine_close(follower->engine);
+  if(follower->fd >= 0)
+    close(follower->fd);
+  freeMemory(follower->changelog);
+  freeMemory(follower->position);
+  freeMemory(follower);
+  return ret;
+}
+
+/**
+ * reads exactly size bytes at offset
+ *
+ * @param[in] fd The file
+ * @param[out] buffer Buffer of at least @a size bytes
+ * @param[in] size Number of bytes to read
+ * @param[in] offset Offset of the first byte
+ */
+int
+readChanges(int fd, unsigned char* buffer, size_t size, uint64_t offset)
+{
+  size_t done = 0;
+  while(done < size){
+    ssize_t got = pread(fd, buffer + done, size - done, offset + done);
+    if(got < 0 && errno == EINTR)
+      continue;
+    if(got < 0)
+      return ERROR_DATABASE_IO;
+    if(got == 0)
+      return ERROR_EOF;
+    done += got;
+  }
+  return ERROR_OK;
+}
+
+/**
+ * writes exactly size bytes at offset
+ *
+ * @param[in] fd The file
+ * @param[in] buffer The data
+ * @param[in] size Number of bytes to write
+ * @param[in] offset Offset of the first byte
+ */
+int
+writeChanges(int fd, const unsigned char* buffer, size_t size, uint64_t offset)
+{
+  size_t done = 0;
+  while(done < size){
+    ssize_t written = pwrite(fd, buffer + done, size - done, offset + done);
+    if(written < 0 && errno == EINTR)
+      continue;
+    if(written < 0)
+      return ERROR_DATABASE_IO;
+    done += written;
+  }
+  return ERROR_OK;
+}
+
+/**
+ * takes, waiting for it, or drops a lock on the whole change log
+ *
+ * @param[in] fd The change log
+ * @param[in] type F_RDLCK, F_WRLCK or F_UNLCK
+ */
+int
+lockChanges(int fd, short type)
+{
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  while(fcntl(fd, F_SETLKW, &lock) != 0){
+    if(errno != EINTR)
+      return ERROR_DATABASE_IO;
+  }
+  return ERROR_OK;
+}
+
+/**
+ * appends one record to the change log with a single write, the caller holds
+ * the write lock
+ *
+ * @param[in] changelog The change log engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The type of the value
+ * @param[in] value The value
+ * @param[in] size The size of the value
+ */
+int
+appendChange(changelog_engine_t* changelog, const char* domain,
+             const char* key, database_value_type_t type, const void* value,
+             size_t size)
+{
+  struct stat sb;
+  if(fstat(changelog->fd, &sb) != 0)
+    return ERROR_DATABASE_IO;
+
+  uint32_t domain_size = strlen(domain);
+  uint32_t key_size = strlen(key);
+  uint32_t record_type = type;
+  uint64_t value_size = size;
+  size_t total = CHANGES_RECORD_HEADER_SIZE + domain_size + key_size + size;
+
+  unsigned char* record = NULL;
+  if(requestMemory((void**)&record, total) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  unsigned char* position = record + 4;
+  memcpy(position, &domain_size, 4);
+  memcpy(position + 4, &key_size, 4);
+  memcpy(position + 8, &record_type, 4);
+  memcpy(position + 12, &value_size, 8);
+  position = record + CHANGES_RECORD_HEADER_SIZE;
+  memcpy(position, domain, domain_size);
+  memcpy(position + domain_size, key, key_size);
+  if(size > 0)
+    memcpy(position + domain_size + key_size, value, size);
+  uint32_t checksum = hash_fnv1a(HASH_FNV1A_BASIS, record + 4, total - 4);
+  memcpy(record, &checksum, 4);
+
+  int ret = writeChanges(changelog->fd, record, total, sb.st_size);
+  freeMemory(record);
+  if(ret == ERROR_OK && changelog->durability == DATABASE_DURABILITY_FULL &&
+     fdatasync(changelog->fd) != 0)
+    ret = ERROR_DATABASE_IO;
+  if(ret != ERROR_OK){
+    /* followers must never see a partial record */
+    if(ftruncate(changelog->fd, sb.st_size) != 0)
+      return ERROR_DATABASE_IO;
+    return ret;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * changes a value of the backing engine and records the change, both under
+ * the write lock of the change log
+ *
+ * @param[in] engine The change log engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The type of the value
+ * @param[in] value The value, strings NUL-terminated
+ * @param[in] size The size of the value, strings without their NUL
+ */
+int
+recordChange(database_engine_t* engine, const char* domain, const char* key,
+             database_value_type_t type, const void* value, size_t size)
+{
+  changelog_engine_t* changelog = engine->data;
+  if(lockChanges(changelog->fd, F_WRLCK) != ERROR_OK)
+    return ERROR_DATABASE_IO;
+
+  int ret = applyChange(changelog->backing, domain, key, type, value, size);
+  if(ret == ERROR_OK)
+    ret = appendChange(changelog, domain, key, type, value, size);
+
+  lockChanges(changelog->fd, F_UNLCK);
+  return ret;
+}
+
+/**
+ * hands a value to the setter of its type
+ *
+ * @param[in] engine The engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The type of the value
+ * @param[in] value The value, strings NUL-terminated
+ * @param[in] size The size of the value, strings without their NUL
+ */
+int
+applyChange(database_engine_t* engine, const char* domain, const char* key,
+            uint32_t type, const void* value, size_t size)
+{
+  int64_t integer = 0;
+  double dob = 0.0;
+  switch(type){
+    case DATABASE_TYPE_INT64:
+      if(size != sizeof(int64_t))
+        return ERROR_DATABASE_INVALID;
+      memcpy(&integer, value, sizeof(int64_t));
+      return database_engine_set_int64(engine, domain, key, integer);
+
+    case DATABASE_TYPE_DOUBLE:
+      if(size != sizeof(double))
+        return ERROR_DATABASE_INVALID;
+      memcpy(&dob, value, sizeof(double));
+      return database_engine_set_double(engine, domain, key, dob);
+
+    case DATABASE_TYPE_STRING:
+      return database_engine_set_string(engine, domain, key, value);
+
+    case DATABASE_TYPE_BLOB:
+      return database_engine_set_blob(engine, domain, key, value, size);
+
+    default:
+      return ERROR_DATABASE_INVALID;
+  }
+}
+
+/**
+ * reads the header of the record at offset and checks that its sizes fit
+ * into the log
+ *
+ * @param[in] fd The change log
+ * @param[in] offset Offset of the record
+ * @param[in] size Size of the log
+ * @param[out] change The record without domain, key and value
+ *
+ * @return @ref ERROR_EOF if the record is incomplete
+ */
+int
+readChangeHeader(int fd, uint64_t offset, uint64_t size, change_t* change)
+{
+  unsigned char header[CHANGES_RECORD_HEADER_SIZE];
+  if(size < offset || size - offset < CHANGES_RECORD_HEADER_SIZE)
+    return ERROR_EOF;
+  int ret = readChanges(fd, header, CHANGES_RECORD_HEADER_SIZE, offset);
+  if(ret != ERROR_OK)
+    return ret;
+
+  memcpy(&change->checksum, header, 4);
+  memcpy(&change->domain_size, header + 4, 4);
+  memcpy(&change->key_size, header + 8, 4);
+  memcpy(&change->type, header + 12, 4);
+  memcpy(&change->size, header + 16, 8);
+  if(change->domain_size == 0 || change->key_size == 0 ||
+     change->type > DATABASE_TYPE_BLOB)
+    return ERROR_DATABASE_INVALID;
+
+  uint64_t rest = size - offset - CHANGES_RECORD_HEADER_SIZE;
+  if((uint64_t)change->domain_size + change->key_size > rest ||
+     change->size > rest - change->domain_size - change->key_size)
+    return ERROR_EOF;
+
+  change->end = offset + CHANGES_RECORD_HEADER_SIZE + change->domain_size +
+                change->key_size + change->size;
+  change->domain = NULL;
+  change->key = NULL;
+  change->value = NULL;
+  return ERROR_OK;
+}
+
+/**
+ * reads and checks the record at offset
+ *
+ * @param[in] fd The change log
+ * @param[in] offset Offset of the record
+ * @param[in] size Size of the log
+ * @param[out] change The record, its domain has to be freed
+ *
+ * @return @ref ERROR_EOF if the record is incomplete
+ */
+int
+readChange(int fd, uint64_t offset, uint64_t size, change_t* change)
+{
+  int ret = readChangeHeader(fd, offset, size, change);
+  if(ret != ERROR_OK)
+    return ret;
+
+  uint64_t data_size = (uint64_t)change->domain_size + change->key_size + change->size;
+  if(requestMemory((void**)&change->domain, data_size + 3) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  /* domain\0key\0value\0 */
+  change->key = change->domain + change->domain_size + 1;
+  change->value = (unsigned char*)change->key + change->key_size + 1;
+  uint64_t position = offset + CHANGES_RECORD_HEADER_SIZE;
+  if((ret = readChanges(fd, (unsigned char*)change->domain, change->domain_size, position)) != ERROR_OK ||
+     (ret = readChanges(fd, (unsigned char*)change->key, change->key_size,
+                        position + change->domain_size)) != ERROR_OK ||
+     (ret = readChanges(fd, change->value, change->size,
+                        position + change->domain_size + change->key_size)) != ERROR_OK){
+    freeMemory(change->domain);
+    return ret;
+  }
+  change->domain[change->domain_size] = '\0';
+  change->key[change->key_size] = '\0';
+  change->value[change->size] = '\0';
+
+  unsigned char header[CHANGES_RECORD_HEADER_SIZE - 4];
+  memcpy(header, &change->domain_size, 4);
+  memcpy(header + 4, &change->key_size, 4);
+  memcpy(header + 8, &change->type, 4);
+  memcpy(header + 12, &change->size, 8);
+  uint32_t sum = hash_fnv1a(HASH_FNV1A_BASIS, header, sizeof(header));
+  sum = hash_fnv1a(sum, (unsigned char*)change->domain, change->domain_size);
+  sum = hash_fnv1a(sum, (unsigned char*)change->key, change->key_size);
+  sum = hash_fnv1a(sum, change->value, change->size);
+  if(sum != change->checksum || strlen(change->domain) != change->domain_size ||
+     strlen(change->key) != change->key_size){
+    freeMemory(change->domain);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * opens a change log and reads its generation, an empty log created by a
+ * writer gets its header first
+ *
+ * @param[in] path Path of the change log
+ * @param[in] flags O_RDONLY for followers, O_RDWR | O_CREAT for writers
+ * @param[out] fd The change log
+ * @param[out] generation Generation of the log
+ */
+int
+openChanges(const char* path, int flags, int* fd, uint64_t* generation)
+{
+  *fd = open(path, flags, 0666);
+  struct stat sb;
+  if(*fd < 0 || fstat(*fd, &sb) != 0 || !S_ISREG(sb.st_mode)){
+    if(*fd >= 0)
+      close(*fd);
+    *fd = -1;
+    return ERROR_DATABASE_OPEN;
+  }
+
+  /* the header is written under the lock, so two writers agree on it */
+  int writer = (flags & O_CREAT) != 0;
+  if(writer && lockChanges(*fd, F_WRLCK) != ERROR_OK){
+    close(*fd);
+    *fd = -1;
+    return ERROR_DATABASE_IO;
+  }
+
+  int ret = ERROR_OK;
+  unsigned char header[CHANGES_HEADER_SIZE];
+  if(writer && fstat(*fd, &sb) == 0 && sb.st_size == 0){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    *generation = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+    memcpy(header, CHANGES_MAGIC, CHANGES_MAGIC_SIZE);
+    memcpy(header + CHANGES_MAGIC_SIZE, generation, 8);
+    ret = writeChanges(*fd, header, CHANGES_HEADER_SIZE, 0);
+  }else if(readChanges(*fd, header, CHANGES_HEADER_SIZE, 0) != ERROR_OK ||
+           memcmp(header, CHANGES_MAGIC, CHANGES_MAGIC_SIZE) != 0){
+    ret = ERROR_DATABASE_INVALID;
+  }else{
+    memcpy(generation, header + CHANGES_MAGIC_SIZE, 8);
+  }
+
+  if(writer)
+    lockChanges(*fd, F_UNLCK);
+  if(ret != ERROR_OK){
+    close(*fd);
+    *fd = -1;
+  }
+  return ret;
+}
+
+/**
+ * cuts off what a writer that crashed left behind: an incomplete record or
+ * a last record that fails its checksum
+ *
+ * @param[in] fd The change log
+ */
+int
+repairChanges(int fd)
+{
+  if(lockChanges(fd, F_WRLCK) != ERROR_OK)
+    return ERROR_DATABASE_IO;
+
+  struct stat sb;
+  int ret = fstat(fd, &sb) == 0 ? ERROR_OK : ERROR_DATABASE_IO;
+
+  /* only the headers are read, only the last record can be torn */
+  uint64_t offset = CHANGES_HEADER_SIZE;
+  uint64_t last = offset;
+  change_t change;
+  while(ret == ERROR_OK &&
+        readChangeHeader(fd, offset, sb.st_size, &change) == ERROR_OK){
+    last = offset;
+    offset = change.end;
+  }
+  if(ret == ERROR_OK && offset != last){
+    if(readChange(fd, last, sb.st_size, &change) == ERROR_OK)
+      freeMemory(change.domain);
+    else
+      offset = last;
+  }
+
+  if(ret == ERROR_OK && offset < (uint64_t)sb.st_size &&
+     ftruncate(fd, offset) != 0)
+    ret = ERROR_DATABASE_IO;
+  lockChanges(fd, F_UNLCK);
+  return ret;
+}
+
+/**
+ * appends a suffix to a path
+ *
+ * @param[in] path The path
+ * @param[in] suffix The suffix
+ * @param[out] result The path, has to be freed
+ */
+int
+buildSuffixedPath(const char* path, const char* suffix, char** result)
+{
+  size_t size = strlen(path) + strlen(suffix) + 1;
+  if(requestMemory((void**)result, size) != ERROR_OK)
+    return ERROR_MEMORY;
+  snprintf(*result, size, "%s%s", path, suffix);
+  return ERROR_OK;
+}
+
+/**
+ * opens the change log again if it has been replaced since it was opened, a
+ * new generation is applied from its start
+ *
+ * @param[in] follower The follower
+ */
+int
+reopenFollowed(database_follower_t* follower)
+{
+  /* a vanished log keeps the old one, it can't grow anymore */
+  struct stat sb;
+  if(stat(follower->changelog, &sb) != 0)
+    return follower->fd >= 0 ? ERROR_OK : ERROR_DATABASE_OPEN;
+  if(follower->fd >= 0 && sb.st_dev == follower->device &&
+     sb.st_ino == follower->inode)
+    return ERROR_OK;
+
+  int fd = -1;
+  uint64_t generation = 0;
+  int ret = openChanges(follower->changelog, O_RDONLY, &fd, &generation);
+  if(ret != ERROR_OK)
+    return ret;
+  if(fstat(fd, &sb) != 0){
+    close(fd);
+    return ERROR_DATABASE_IO;
+  }
+
+  if(follower->fd >= 0){
+    close(follower->fd);
+    if(generation != follower->generation)
+      follower->offset = CHANGES_HEADER_SIZE;
+  }
+  follower->fd = fd;
+  follower->device = sb.st_dev;
+  follower->inode = sb.st_ino;
+  follower->generation = generation;
+  return ERROR_OK;
+}
+
+/**
+ * writes generation and offset of the follower next to its database
+ *
+ * @param[in] follower The follower
+ */
+int
+saveFollowerPosition(database_follower_t* follower)
+{
+  if(follower->position == NULL)
+    return ERROR_OK;
+
+  unsigned char position[FOLLOWER_POSITION_SIZE];
+  memcpy(position, &follower->generation, 8);
+  memcpy(position + 8, &follower->offset, 8);
+
+  int fd = open(follower->position, O_WRONLY | O_CREAT, 0666);
+  if(fd < 0)
+    return ERROR_DATABASE_IO;
+  int ret = writeChanges(fd, position, FOLLOWER_POSITION_SIZE, 0);
+  if(close(fd) != 0 && ret == ERROR_OK)
+    ret = ERROR_DATABASE_IO;
+  return ret;
+}
@@ -0,0 +1,409 @@
+/** @brief Storage engine interface
+ *
+ * This file contains the dispatch between the server of 'the registry' and
+ * its storage engines.
+ *
+ * @file database-engine.c
+ */
+
+#include "database-engine.h"
+#include "database-options.h"
+#include "file-copy.h"
+#include "../errors.h"
+#include "../memory.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int readWholeFile(int fd, unsigned char** value, size_t* size);
+int shardedIdentifier(const char* identifier);
+int mirroredIdentifier(const char* identifier);
+int recordedIdentifier(const char* identifier);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+database_engine_open(database_engine_t** engine, const char* identifier)
+{
+  if(engine == NULL || identifier == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* the mirror opens the engine below it through here again */
+  if(mirroredIdentifier(identifier))
+    return database_mirror_new(engine, identifier);
+  if(recordedIdentifier(identifier))
+    return database_changelog_new(engine, identifier);
+  if(strncmp(identifier, DATABASE_ENGINE_MEMORY,
+             strlen(DATABASE_ENGINE_MEMORY)) == 0)
+    return database_memory_new(engine, identifier);
+  if(strncmp(identifier, DATABASE_ENGINE_LOG, strlen(DATABASE_ENGINE_LOG)) == 0)
+    return database_log_new(engine, identifier);
+  if(shardedIdentifier(identifier))
+    return database_sharded_new(engine, identifier);
+
+  return database_sqlite_new(engine, identifier);
+}
+
+int
+database_engine_close(database_engine_t* engine)
+{
+  if(engine == NULL || engine->close == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->close(engine);
+}
+
+int
+database_engine_get_type(database_engine_t* engine, const char* domain,
+                         const char* key, database_value_type_t* type)
+{
+  if(engine == NULL || engine->get_type == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->get_type(engine, domain, key, type);
+}
+
+int
+database_engine_enum_keys(database_engine_t* engine, const char* domain,
+                          const char* pattern, size_t* count, size_t* size,
+                          char** keys)
+{
+  if(engine == NULL || engine->enum_keys == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->enum_keys(engine, domain, pattern, count, size, keys);
+}
+
+int
+database_engine_enum_domains(database_engine_t* engine, size_t* count,
+                             size_t* size, char** domains)
+{
+  if(engine == NULL || engine->enum_domains == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->enum_domains(engine, count, size, domains);
+}
+
+int
+database_engine_get_int64(database_engine_t* engine, const char* domain,
+                          const char* key, int64_t* value)
+{
+  if(engine == NULL || engine->get_int64 == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->get_int64(engine, domain, key, value);
+}
+
+int
+database_engine_set_int64(database_engine_t* engine, const char* domain,
+                          const char* key, int64_t value)
+{
+  if(engine == NULL || engine->set_int64 == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->set_int64(engine, domain, key, value);
+}
+
+int
+database_engine_get_double(database_engine_t* engine, const char* domain,
+                           const char* key, double* value)
+{
+  if(engine == NULL || engine->get_double == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->get_double(engine, domain, key, value);
+}
+
+int
+database_engine_set_double(database_engine_t* engine, const char* domain,
+                           const char* key, double value)
+{
+  if(engine == NULL || engine->set_double == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->set_double(engine, domain, key, value);
+}
+
+int
+database_engine_get_string(database_engine_t* engine, const char* domain,
+                           const char* key, char** value)
+{
+  if(engine == NULL || engine->get_string == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->get_string(engine, domain, key, value);
+}
+
+int
+database_engine_set_string(database_engine_t* engine, const char* domain,
+                           const char* key, const char* value)
+{
+  if(engine == NULL || engine->set_string == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->set_string(engine, domain, key, value);
+}
+
+int
+database_engine_get_blob(database_engine_t* engine, const char* domain,
+                         const char* key, unsigned char** value, size_t* size)
+{
+  if(engine == NULL || engine->get_blob == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->get_blob(engine, domain, key, value, size);
+}
+
+int
+database_engine_set_blob(database_engine_t* engine, const char* domain,
+                         const char* key, const unsigned char* value,
+                         size_t size)
+{
+  if(engine == NULL || engine->set_blob == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->set_blob(engine, domain, key, value, size);
+}
+
+int
+database_engine_get_blob_chunk(database_engine_t* engine, const char* domain,
+                               const char* key, size_t offset, size_t length,
+                               unsigned char** value, size_t* size,
+                               size_t* total)
+{
+  if(engine == NULL || value == NULL || size == NULL || total == NULL ||
+     length == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(engine->get_blob_chunk != NULL)
+    return engine->get_blob_chunk(engine, domain, key, offset, length, value,
+                                  size, total);
+
+  unsigned char* blob = NULL;
+  size_t blob_size = 0;
+  int ret = database_engine_get_blob(engine, domain, key, &blob, &blob_size);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *total = blob_size;
+  if(offset > blob_size){
+    freeMemory(blob);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  *size = blob_size - offset;
+  if(*size > length)
+    *size = length;
+
+  /* always hand out a valid buffer, even for the last empty chunk */
+  if(requestMemory((void**)value, *size + 1) != ERROR_OK){
+    freeMemory(blob);
+    return ERROR_MEMORY;
+  }
+  if(*size > 0)
+    memcpy(*value, blob + offset, *size);
+
+  freeMemory(blob);
+  return ERROR_OK;
+}
+
+int
+database_engine_get_blob_to_fd(database_engine_t* engine, const char* domain,
+                               const char* key, int fd, size_t* size)
+{
+  if(engine == NULL || fd < 0 || size == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(engine->get_blob_to_fd != NULL)
+    return engine->get_blob_to_fd(engine, domain, key, fd, size);
+
+  unsigned char* blob = NULL;
+  size_t blob_size = 0;
+  int ret = database_engine_get_blob(engine, domain, key, &blob, &blob_size);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *size = 0;
+  while(*size < blob_size){
+    ssize_t written = write(fd, blob + *size, blob_size - *size);
+    if(written < 0){
+      if(errno == EINTR || errno == EAGAIN)
+        continue;
+      freeMemory(blob);
+      return ERROR_DATABASE_IO;
+    }
+    *size += written;
+  }
+
+  freeMemory(blob);
+  return ERROR_OK;
+}
+
+int
+database_engine_set_blob_from_fd(database_engine_t* engine, const char* domain,
+                                 const char* key, int fd)
+{
+  if(engine == NULL || fd < 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(engine->set_blob_from_fd != NULL)
+    return engine->set_blob_from_fd(engine, domain, key, fd);
+
+  unsigned char* blob = NULL;
+  size_t blob_size = 0;
+  int ret = readWholeFile(fd, &blob, &blob_size);
+  if(ret != ERROR_OK)
+    return ret;
+
+  ret = database_engine_set_blob(engine, domain, key, blob, blob_size);
+  freeMemory(blob);
+  return ret;
+}
+
+int
+database_engine_get_settings(database_engine_t* engine, char** settings)
+{
+  if(engine == NULL || settings == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(engine->get_settings != NULL)
+    return engine->get_settings(engine, settings);
+
+  if(requestMemory((void**)settings, 1) != ERROR_OK)
+    return ERROR_MEMORY;
+  (*settings)[0] = '\0';
+  return ERROR_OK;
+}
+
+int
+database_engine_release_memory(database_engine_t* engine, size_t* released)
+{
+  if(engine == NULL || released == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *released = 0;
+  if(engine->release_memory != NULL)
+    return engine->release_memory(engine, released);
+  return ERROR_OK;
+}
+
+int
+database_engine_backup(database_engine_t* engine, const char* path,
+                       database_backup_callback_t callback, void* context)
+{
+  if(engine == NULL || path == NULL || engine->backup == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->backup(engine, path, callback, context);
+}
+
+int
+database_engine_maintain(database_engine_t* engine,
+                         const database_maintenance_t* budget,
+                         database_maintenance_stats_t* stats)
+{
+  if(engine == NULL || budget == NULL || stats == NULL || engine->maintain == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return engine->maintain(engine, budget, stats);
+}
+
+/**
+ * reads everything from the current position of a file descriptor up to end
+ * of file into memory
+ *
+ * @param[in] fd The file descriptor
+ * @param[out] value The data, has to be freed even if @a size is 0
+ * @param[out] size Number of bytes read
+ */
+int
+readWholeFile(int fd, unsigned char** value, size_t* size)
+{
+  size_t capacity = FILE_COPY_BUFFER_SIZE;
+  if(requestMemory((void**)value, capacity) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  *size = 0;
+  while(42){
+    if(*size == capacity){
+      capacity *= 2;
+      if(editMemory((void**)value, capacity) != ERROR_OK){
+        *value = NULL;
+        return ERROR_MEMORY;
+      }
+    }
+
+    ssize_t got = read(fd, *value + *size, capacity - *size);
+    if(got < 0){
+      if(errno == EINTR || errno == EAGAIN)
+        continue;
+      freeMemory(*value);
+      *value = NULL;
+      return ERROR_DATABASE_IO;
+    }
+    if(got == 0)
+      break;
+    *size += got;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * checks whether an identifier asks for shards or names a directory, anything
+ * unparsable is left to database_open to reject
+ *
+ * @param[in] identifier The database identifier
+ */
+int
+shardedIdentifier(const char* identifier)
+{
+  database_options_t options;
+  if(database_options_parse(identifier, &options) != ERROR_OK)
+    return 0;
+
+  struct stat sb;
+  int sharded = options.shards != 0 ||
+                (stat(options.path, &sb) == 0 && S_ISDIR(sb.st_mode));
+  database_options_free(&options);
+  return sharded;
+}
+
+/**
+ * checks whether an identifier asks for a mirror
+ *
+ * @param[in] identifier The database identifier
+ */
+int
+mirroredIdentifier(const char* identifier)
+{
+  database_options_t options;
+  if(database_options_parse(identifier, &options) != ERROR_OK)
+    return 0;
+
+  int mirrored = options.mirror != 0;
+  database_options_free(&options);
+  return mirrored;
+}
+
+/**
+ * checks whether an identifier asks for a change log
+ *
+ * @param[in] identifier The database identifier
+ */
+int
+recordedIdentifier(const char* identifier)
+{
+  database_options_t options;
+  if(database_options_parse(identifier, &options) != ERROR_OK)
+    return 0;
+
+  int recorded = options.changelog;
+  database_options_free(&options);
+  return recorded;
+}
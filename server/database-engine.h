@@ -0,0 +1,577 @@
+#ifndef DATABASE_ENGINE_H
+#define DATABASE_ENGINE_H
+
+/** @brief Storage engine interface
+ *
+ * The server does not talk to a specific database but to a storage engine.
+ * Like a @ref channel_t an engine is a set of function pointers plus engine
+ * specific data. Every function has the semantics, arguments and error codes
+ * of its counterpart in database.h, e.g. @a get_int64 behaves like @ref
+ * database_get_int64.
+ *
+ * @ref database_engine_open picks the engine from the database identifier:
+ *
+ *    * mem://name - @ref database_memory_new, values live in memory only and
+ *                   are lost once the engine is closed
+ *    * log://path - @ref database_log_new, values are appended to a log file
+ *    * a directory or shards=N - @ref database_sharded_new, the domains are
+ *                   spread over several SQLite databases
+ *    * everything else is a path to an SQLite database, see @ref
+ *                   database_sqlite_new and @ref database_open
+ *
+ * Any of them can be opened with mirror=N, @ref database_mirror_new then
+ * keeps its domains of at most N keys in memory. The SQLite based ones can be
+ * opened with changelog=1, @ref database_changelog_new then records their
+ * changes for followers, see @ref database_follower_open.
+ *
+ * Only the SQLite based engines can be opened with mode=ro or immutable=1,
+ * the memory and log engines reject both.
+ *
+ * @a get_blob_chunk, @a get_blob_to_fd and @a set_blob_from_fd may be NULL.
+ * The wrappers then fall back to @a get_blob and @a set_blob and hold the
+ * whole blob in memory. @a get_settings is NULL for engines without SQLite
+ * below them, they have nothing to tune. @a release_memory is NULL for
+ * engines whose memory holds the values themselves, @a backup and @a
+ * maintain for engines without a database file to copy or clean up.
+ *
+ * @file database-engine.h
+ */
+
+#include "database.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** Scheme of identifiers that select the memory engine */
+#define DATABASE_ENGINE_MEMORY "mem://"
+
+/** Scheme of identifiers that select the log engine */
+#define DATABASE_ENGINE_LOG "log://"
+
+/** Garbage the log engine accumulates at least before it compacts */
+#define DATABASE_LOG_COMPACT_MIN (1024 * 1024)
+
+/** Name of a shard inside the directory of a sharded database */
+#define DATABASE_SHARD_NAME "shard-%u.sqlite"
+
+/** Largest blob a domain may hold to be mirrored */
+#define DATABASE_MIRROR_BLOB_MAX (64 * 1024)
+
+/** Appended to the path of a database to get the path of its change log */
+#define DATABASE_CHANGELOG_SUFFIX ".changes"
+
+/** Appended to the path of a follower to get where it keeps its position */
+#define DATABASE_FOLLOWER_POSITION_SUFFIX ".position"
+
+/** A follower applying changes to a database of its own */
+typedef struct database_follower_s database_follower_t;
+
+typedef struct database_engine_s
+{
+  /** @see database_close, also frees the engine itself */
+  int (*close)(struct database_engine_s* engine);
+
+  /** @see database_get_type */
+  int (*get_type)(struct database_engine_s* engine, const char* domain,
+                  const char* key, database_value_type_t* type);
+
+  /** @see database_enum_keys */
+  int (*enum_keys)(struct database_engine_s* engine, const char* domain,
+                   const char* pattern, size_t* count, size_t* size, char** keys);
+
+  /** @see database_enum_domains */
+  int (*enum_domains)(struct database_engine_s* engine, size_t* count,
+                      size_t* size, char** domains);
+
+  /** @see database_get_int64 */
+  int (*get_int64)(struct database_engine_s* engine, const char* domain,
+                   const char* key, int64_t* value);
+
+  /** @see database_set_int64 */
+  int (*set_int64)(struct database_engine_s* engine, const char* domain,
+                   const char* key, int64_t value);
+
+  /** @see database_get_double */
+  int (*get_double)(struct database_engine_s* engine, const char* domain,
+                    const char* key, double* value);
+
+  /** @see database_set_double */
+  int (*set_double)(struct database_engine_s* engine, const char* domain,
+                    const char* key, double value);
+
+  /** @see database_get_string */
+  int (*get_string)(struct database_engine_s* engine, const char* domain,
+                    const char* key, char** value);
+
+  /** @see database_set_string */
+  int (*set_string)(struct database_engine_s* engine, const char* domain,
+                    const char* key, const char* value);
+
+  /** @see database_get_blob */
+  int (*get_blob)(struct database_engine_s* engine, const char* domain,
+                  const char* key, unsigned char** value, size_t* size);
+
+  /** @see database_set_blob */
+  int (*set_blob)(struct database_engine_s* engine, const char* domain,
+                  const char* key, const unsigned char* value, size_t size);
+
+  /** @see database_get_blob_chunk, optional */
+  int (*get_blob_chunk)(struct database_engine_s* engine, const char* domain,
+                        const char* key, size_t offset, size_t length,
+                        unsigned char** value, size_t* size, size_t* total);
+
+  /** @see database_get_blob_to_fd, optional */
+  int (*get_blob_to_fd)(struct database_engine_s* engine, const char* domain,
+                        const char* key, int fd, size_t* size);
+
+  /** @see database_set_blob_from_fd, optional */
+  int (*set_blob_from_fd)(struct database_engine_s* engine, const char* domain,
+                          const char* key, int fd);
+
+  /** @see database_get_settings, optional */
+  int (*get_settings)(struct database_engine_s* engine, char** settings);
+
+  /** @see database_release_memory, optional */
+  int (*release_memory)(struct database_engine_s* engine, size_t* released);
+
+  /** @see database_backup, optional */
+  int (*backup)(struct database_engine_s* engine, const char* path,
+                database_backup_callback_t callback, void* context);
+
+  /** @see database_maintain, optional */
+  int (*maintain)(struct database_engine_s* engine,
+                  const database_maintenance_t* budget,
+                  database_maintenance_stats_t* stats);
+
+  /**
+   * Not 0 if every set fails with @ref ERROR_DATABASE_READONLY, so callers
+   * can refuse writes before unpacking the value.
+   */
+  int readonly;
+
+  /**
+   * Engine specific data.
+   */
+  void* data;
+} database_engine_t;
+
+/**
+ * Opens the engine selected by @a identifier.
+ *
+ * @param[out] engine The engine, has to be closed with @ref
+ *  database_engine_close
+ * @param[in] identifier mem://name, log://path, the path of a shard directory
+ *  or of an SQLite database, all optionally followed by options, see @ref
+ *  database_open
+ *
+ * @return @ref ERROR_OK on success, otherwise the error of the engine's
+ *  constructor
+ */
+int database_engine_open(database_engine_t** engine, const char* identifier);
+
+/**
+ * Creates an engine on top of an SQLite database opened with @ref
+ * database_open.
+ *
+ * @param[out] engine The engine
+ * @param[in] path Path and options as accepted by @ref database_open
+ *
+ * @return @ref ERROR_OK on success, otherwise the error of @ref database_open
+ */
+int database_sqlite_new(database_engine_t** engine, const char* path);
+
+/**
+ * Creates an empty engine that keeps all values in a @ref keymap_t. Blobs
+ * are held in memory as well, nothing ever touches the disk. Options are
+ * validated like for SQLite but have no effect.
+ *
+ * @param[out] engine The engine
+ * @param[in] identifier mem://name, optionally followed by options
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  an option is unknown or has an invalid value.
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int database_memory_new(database_engine_t** engine, const char* identifier);
+
+/**
+ * Creates an engine that appends every set as one typed record to the log
+ * file at path, which is created if it does not exist. An index from domain
+ * and key to the latest record is kept in memory. It is checkpointed to
+ * path.index on close, so reopening only replays records appended after the
+ * checkpoint. Records that were cut short by a crash or fail their checksum
+ * end the log and are truncated.
+ *
+ * Once more than half of the log and at least @ref DATABASE_LOG_COMPACT_MIN
+ * bytes are overwritten records, the set that crossed the threshold rewrites
+ * the log with the live records only.
+ *
+ * The log is locked with fcntl(2), a second process fails to open it. With
+ * durability=full every record is fdatasync'ed, otherwise only checkpoints
+ * and compactions are synced.
+ *
+ * @param[out] engine The engine
+ * @param[in] identifier log://path, optionally followed by options
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  an option is unknown or has an invalid value.
+ * @return @ref ERROR_DATABASE_OPEN The log can't be opened or is locked.
+ * @return @ref ERROR_DATABASE_INVALID The file is not a log.
+ * @return @ref ERROR_DATABASE_IO Reading or truncating the log failed.
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int database_log_new(database_engine_t** engine, const char* identifier);
+
+/**
+ * Compacts the log of an engine created by @ref database_log_new right away.
+ *
+ * @param[in] engine The log engine
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS @a engine is not a log engine
+ * @return @ref ERROR_DATABASE_IO Writing the new log failed, the old one is
+ *  still in use
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int database_log_compact(database_engine_t* engine);
+
+/**
+ * Creates an engine that routes every domain to one of N SQLite databases by
+ * a hash of the domain's name. The databases are the files shard-0.sqlite up
+ * to shard-(N-1).sqlite inside the directory given as path, each of them a
+ * valid database as required by @ref database_open and opened with the same
+ * options. Every shard has its own connection and lock, so writers to
+ * different shards don't wait for each other. If blob-dedup is used, every
+ * shard needs a blob-path of its own.
+ *
+ * N is taken from the option shards=N or, if not given, from the shard files
+ * found in the directory. Since the routing depends on N it can't be changed
+ * once data has been written: a directory that contains more shards than
+ * requested is rejected.
+ *
+ * Every operation of the engine interface works on a single domain, so all
+ * of them are answered by exactly one shard, only close visits all of them.
+ *
+ * @param[out] engine The engine
+ * @param[in] identifier Path of the shard directory, optionally followed by
+ *  options
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  an option is unknown or has an invalid value.
+ * @return @ref ERROR_DATABASE_OPEN The directory or one of the shards does
+ *  not exist.
+ * @return @ref ERROR_DATABASE_INVALID The directory contains more shards than
+ *  requested or a shard is invalid.
+ * @return Any other error of @ref database_open.
+ */
+int database_sharded_new(database_engine_t** engine, const char* identifier);
+
+/**
+ * Tells which shard of an engine created by @ref database_sharded_new holds a
+ * domain.
+ *
+ * @param[in] engine The sharded engine
+ * @param[in] domain The domain
+ * @param[out] shard Number of the shard
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  @a engine is not a sharded engine
+ */
+int database_sharded_select(database_engine_t* engine, const char* domain,
+    unsigned int* shard);
+
+/**
+ * Creates an engine that mirrors small domains of another engine in memory.
+ * The identifier is opened with @ref database_engine_open after mirror=N has
+ * been removed from it.
+ *
+ * The first access to a domain loads all of its values, as long as it has at
+ * most N keys and no blob larger than @ref DATABASE_MIRROR_BLOB_MAX. Reads of
+ * such a domain never reach the backing engine, writes go to the backing
+ * engine first and update the mirror once they succeeded. A domain that
+ * outgrows N keys is passed through from then on, so are streamed blob reads.
+ *
+ * The mirror is only as fresh as the writes it sees: nobody but this engine
+ * may write to the backing database.
+ *
+ * @param[out] engine The engine
+ * @param[in] identifier Any identifier of @ref database_engine_open with
+ *  mirror=N among its options
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  mirror=N is missing
+ * @return @ref ERROR_MEMORY Out of memory
+ * @return Any error of @ref database_engine_open
+ */
+int database_mirror_new(database_engine_t** engine, const char* identifier);
+
+/**
+ * Tells whether an engine created by @ref database_mirror_new serves a domain
+ * from memory, loading it if it hasn't been accessed yet.
+ *
+ * @param[in] engine The mirroring engine
+ * @param[in] domain The domain
+ * @param[out] mirrored 1 if the domain is mirrored, 0 otherwise
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  @a engine is not a mirroring engine
+ */
+int database_mirror_mirrored(database_engine_t* engine, const char* domain,
+    int* mirrored);
+
+/**
+ * Creates an engine that appends every change of another engine to a change
+ * log, the path of the database followed by @ref DATABASE_CHANGELOG_SUFFIX.
+ * The identifier is opened with @ref database_engine_open after changelog=1
+ * has been removed from it. Reads go straight to the backing engine.
+ *
+ * A set holds a write lock on the change log from the change of the backing
+ * engine until its record is appended, so the records of several processes
+ * come in the order their changes were committed. A change that is written
+ * but can't be recorded fails with @ref ERROR_DATABASE_IO, followers miss it.
+ * Nobody but engines with changelog=1 may write to the backing database.
+ *
+ * @param[out] engine The engine
+ * @param[in] identifier The path of an SQLite database or of a shard
+ *  directory with changelog=1 among its options
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed,
+ *  changelog=1 is missing, the database is read-only or no SQLite database
+ * @return @ref ERROR_DATABASE_OPEN The change log can't be opened
+ * @return @ref ERROR_DATABASE_INVALID The file is not a change log
+ * @return @ref ERROR_MEMORY Out of memory
+ * @return Any error of @ref database_engine_open
+ */
+int database_changelog_new(database_engine_t** engine, const char* identifier);
+
+/**
+ * Opens a follower that applies the change log of a database opened with
+ * changelog=1 to a database of its own, e.g. one written by @ref
+ * database_backup. Read-only handles of the follower's database then never
+ * compete with the primary. Changes are applied in the order they were
+ * recorded and applying one twice does no harm, so a follower may start from
+ * any copy of the primary that is not newer than the change log.
+ *
+ * How far the change log has been applied is kept next to the follower's
+ * database, in its path followed by @ref DATABASE_FOLLOWER_POSITION_SUFFIX,
+ * so a follower opened again continues where it stopped. A change log that
+ * has been created anew is applied from its start.
+ *
+ * @param[out] follower The follower, has to be closed with @ref
+ *  database_follower_close
+ * @param[in] changelog Path of the change log
+ * @param[in] identifier The follower's database, any writable identifier of
+ *  @ref database_engine_open
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  the follower's database is read-only
+ * @return @ref ERROR_DATABASE_OPEN The change log can't be opened
+ * @return @ref ERROR_DATABASE_INVALID The file is not a change log
+ * @return @ref ERROR_MEMORY Out of memory
+ * @return Any error of @ref database_engine_open
+ */
+int database_follower_open(database_follower_t** follower,
+    const char* changelog, const char* identifier);
+
+/**
+ * Applies every change recorded since the last call and remembers the
+ * position. A record the primary is still writing is left for the next call.
+ *
+ * @param[in] follower The follower
+ * @param[out] applied Number of changes applied, may be NULL
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_INVALID A record is damaged
+ * @return @ref ERROR_DATABASE_IO Reading the change log or writing the
+ *  position failed
+ * @return @ref ERROR_MEMORY Out of memory
+ * @return Any error of the follower's engine, the change is retried by the
+ *  next call
+ */
+int database_follower_poll(database_follower_t* follower, size_t* applied);
+
+/**
+ * Closes a follower and its database.
+ *
+ * @param[in] follower The follower
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return Any error of @ref database_engine_close
+ */
+int database_follower_close(database_follower_t* follower);
+
+/**
+ * Wrapper around the engine's close.
+ *
+ * @see database_engine_t.close
+ */
+int database_engine_close(database_engine_t* engine);
+
+/**
+ * Wrapper around the engine's get_type.
+ *
+ * @see database_engine_t.get_type
+ */
+int database_engine_get_type(database_engine_t* engine, const char* domain,
+    const char* key, database_value_type_t* type);
+
+/**
+ * Wrapper around the engine's enum_keys.
+ *
+ * @see database_engine_t.enum_keys
+ */
+int database_engine_enum_keys(database_engine_t* engine, const char* domain,
+    const char* pattern, size_t* count, size_t* size, char** keys);
+
+/**
+ * Wrapper around the engine's enum_domains.
+ *
+ * @see database_engine_t.enum_domains
+ */
+int database_engine_enum_domains(database_engine_t* engine, size_t* count,
+    size_t* size, char** domains);
+
+/**
+ * Wrapper around the engine's get_int64.
+ *
+ * @see database_engine_t.get_int64
+ */
+int database_engine_get_int64(database_engine_t* engine, const char* domain,
+    const char* key, int64_t* value);
+
+/**
+ * Wrapper around the engine's set_int64.
+ *
+ * @see database_engine_t.set_int64
+ */
+int database_engine_set_int64(database_engine_t* engine, const char* domain,
+    const char* key, int64_t value);
+
+/**
+ * Wrapper around the engine's get_double.
+ *
+ * @see database_engine_t.get_double
+ */
+int database_engine_get_double(database_engine_t* engine, const char* domain,
+    const char* key, double* value);
+
+/**
+ * Wrapper around the engine's set_double.
+ *
+ * @see database_engine_t.set_double
+ */
+int database_engine_set_double(database_engine_t* engine, const char* domain,
+    const char* key, double value);
+
+/**
+ * Wrapper around the engine's get_string.
+ *
+ * @see database_engine_t.get_string
+ */
+int database_engine_get_string(database_engine_t* engine, const char* domain,
+    const char* key, char** value);
+
+/**
+ * Wrapper around the engine's set_string.
+ *
+ * @see database_engine_t.set_string
+ */
+int database_engine_set_string(database_engine_t* engine, const char* domain,
+    const char* key, const char* value);
+
+/**
+ * Wrapper around the engine's get_blob.
+ *
+ * @see database_engine_t.get_blob
+ */
+int database_engine_get_blob(database_engine_t* engine, const char* domain,
+    const char* key, unsigned char** value, size_t* size);
+
+/**
+ * Wrapper around the engine's set_blob.
+ *
+ * @see database_engine_t.set_blob
+ */
+int database_engine_set_blob(database_engine_t* engine, const char* domain,
+    const char* key, const unsigned char* value, size_t size);
+
+/**
+ * Wrapper around the engine's get_blob_chunk, slices the result of get_blob
+ * if the engine has none.
+ *
+ * @see database_engine_t.get_blob_chunk
+ */
+int database_engine_get_blob_chunk(database_engine_t* engine,
+    const char* domain, const char* key, size_t offset, size_t length,
+    unsigned char** value, size_t* size, size_t* total);
+
+/**
+ * Wrapper around the engine's get_blob_to_fd, writes the result of get_blob
+ * if the engine has none.
+ *
+ * @see database_engine_t.get_blob_to_fd
+ */
+int database_engine_get_blob_to_fd(database_engine_t* engine,
+    const char* domain, const char* key, int fd, size_t* size);
+
+/**
+ * Wrapper around the engine's set_blob_from_fd, reads @a fd into memory and
+ * passes it to set_blob if the engine has none.
+ *
+ * @see database_engine_t.set_blob_from_fd
+ */
+int database_engine_set_blob_from_fd(database_engine_t* engine,
+    const char* domain, const char* key, int fd);
+
+/**
+ * Wrapper around the engine's get_settings, hands out an empty string if the
+ * engine has none.
+ *
+ * @see database_engine_t.get_settings
+ */
+int database_engine_get_settings(database_engine_t* engine, char** settings);
+
+/**
+ * Wrapper around the engine's release_memory, releases nothing if the engine
+ * has none.
+ *
+ * @see database_engine_t.release_memory
+ */
+int database_engine_release_memory(database_engine_t* engine, size_t* released);
+
+/**
+ * Wrapper around the engine's backup, fails with @ref
+ * ERROR_INVALID_ARGUMENTS if the engine has none.
+ *
+ * @see database_engine_t.backup
+ */
+int database_engine_backup(database_engine_t* engine, const char* path,
+    database_backup_callback_t callback, void* context);
+
+/**
+ * Wrapper around the engine's maintain, fails with @ref
+ * ERROR_INVALID_ARGUMENTS if the engine has none.
+ *
+ * @see database_engine_t.maintain
+ */
+int database_engine_maintain(database_engine_t* engine,
+    const database_maintenance_t* budget, database_maintenance_stats_t* stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // DATABASE_ENGINE_H
@@ -0,0 +1,301 @@
+/** @brief Memory of SQLite
+ *
+ * This file contains the allocator and the memory configuration of SQLite
+ * for 'the registry'.
+ *
+ * @file database-heap.c
+ */
+
+#ifndef HUGETLB
+#define HUGETLB
+#define _GNU_SOURCE
+#include <features.h>
+#endif // HUGETLB
+
+#include "database-heap.h"
+#include "../errors.h"
+#include "../memory.h"
+#include <sqlite3.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** every allocation starts with its size, which keeps it 8 byte aligned */
+#define HEAP_HEADER_SIZE 8
+
+/** huge pages are assumed to be 2 MiB, the arena is rounded up to them */
+#define HEAP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/** the lookaside SQLite uses without a configuration */
+#define HEAP_LOOKASIDE_DEFAULT_SIZE 1200
+#define HEAP_LOOKASIDE_DEFAULT_SLOTS 100
+
+/** largest number of lookaside slots of a connection */
+#define HEAP_LOOKASIDE_SLOTS_MAX 65536
+
+typedef struct heap_state_s {
+  size_t handles;                   /* open database handles            */
+  int saved;                        /* original holds SQLite's allocator */
+  sqlite3_mem_methods original;     /* the allocator of SQLite          */
+  void *arena;                      /* mapped page cache, NULL if none  */
+  size_t arena_size;                /* size of the mapping              */
+  int huge_pages;                   /* the arena uses huge pages        */
+} heap_state_t;
+
+static heap_state_t heap = {0, 0, {0}, NULL, 0, 0};
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+static void* heap_malloc(int size);
+static void heap_free(void* memory);
+static void* heap_realloc(void* memory, int size);
+static int heap_size(void* memory);
+static int heap_roundup(int size);
+static int heap_init(void* data);
+static void heap_shutdown(void* data);
+int mapHeapArena(size_t size, int huge_pages);
+void unmapHeapArena(void);
+int checkHeapConfig(const database_heap_config_t* config);
+
+static const sqlite3_mem_methods heap_methods = {
+  heap_malloc, heap_free, heap_realloc, heap_size, heap_roundup, heap_init,
+  heap_shutdown, NULL
+};
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+database_heap_configure(const database_heap_config_t* config)
+{
+  if(config == NULL || checkHeapConfig(config) != ERROR_OK)
+    return ERROR_INVALID_ARGUMENTS;
+  if(heap.handles > 0)
+    return ERROR_DATABASE_OPEN;
+
+  /* SQLite only takes a configuration while it is shut down */
+  sqlite3_shutdown();
+  if(!heap.saved){
+    if(sqlite3_config(SQLITE_CONFIG_GETMALLOC, &heap.original) != SQLITE_OK)
+      return ERROR_DATABASE_INVALID;
+    heap.saved = 1;
+  }
+  unmapHeapArena();
+
+  /* a slot holds the page and SQLite's header of it */
+  int header = 0;
+  if(sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header) != SQLITE_OK)
+    return ERROR_DATABASE_INVALID;
+  size_t slot = (config->page_size + header + 7) & ~(size_t)7;
+  if(config->pages > 0 && mapHeapArena(slot * config->pages, config->huge_pages) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  if(sqlite3_config(SQLITE_CONFIG_MALLOC, &heap_methods) != SQLITE_OK ||
+     sqlite3_config(SQLITE_CONFIG_PAGECACHE, heap.arena,
+                    heap.arena != NULL ? (int)slot : 0,
+                    heap.arena != NULL ? (int)config->pages : 0) != SQLITE_OK ||
+     sqlite3_config(SQLITE_CONFIG_LOOKASIDE, (int)config->lookaside_size,
+                    (int)config->lookaside_slots) != SQLITE_OK ||
+     sqlite3_initialize() != SQLITE_OK){
+    database_heap_reset();
+    return ERROR_DATABASE_INVALID;
+  }
+
+  sqlite3_hard_heap_limit64(config->limit);
+  return ERROR_OK;
+}
+
+int
+database_heap_reset(void)
+{
+  if(heap.handles > 0)
+    return ERROR_DATABASE_OPEN;
+
+  sqlite3_shutdown();
+  int ret = ERROR_OK;
+  if(heap.saved &&
+     (sqlite3_config(SQLITE_CONFIG_MALLOC, &heap.original) != SQLITE_OK ||
+      sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0) != SQLITE_OK ||
+      sqlite3_config(SQLITE_CONFIG_LOOKASIDE, HEAP_LOOKASIDE_DEFAULT_SIZE,
+                     HEAP_LOOKASIDE_DEFAULT_SLOTS) != SQLITE_OK))
+    ret = ERROR_DATABASE_INVALID;
+  unmapHeapArena();
+
+  if(sqlite3_initialize() != SQLITE_OK)
+    return ERROR_DATABASE_INVALID;
+  sqlite3_hard_heap_limit64(0);
+  return ret;
+}
+
+int
+database_heap_get_stats(database_heap_stats_t* stats)
+{
+  if(stats == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  sqlite3_int64 current = 0;
+  sqlite3_int64 highwater = 0;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+  stats->used = current;
+  stats->highwater = highwater;
+  sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &current, &highwater, 0);
+  stats->pages_used = current;
+  sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &current, &highwater, 0);
+  stats->pages_overflow = current;
+  stats->limit = sqlite3_hard_heap_limit64(-1);
+  stats->huge_pages = heap.huge_pages;
+  return ERROR_OK;
+}
+
+void
+heapHandleOpened(void)
+{
+  heap.handles++;
+}
+
+void
+heapHandleClosed(void)
+{
+  if(heap.handles > 0)
+    heap.handles--;
+}
+
+static void*
+heap_malloc(int size)
+{
+  unsigned char* memory = NULL;
+  if(size < 0 ||
+     requestMemory((void**)&memory, HEAP_HEADER_SIZE + (size_t)size) != ERROR_OK)
+    return NULL;
+
+  uint64_t length = size;
+  memcpy(memory, &length, sizeof(uint64_t));
+  return memory + HEAP_HEADER_SIZE;
+}
+
+static void
+heap_free(void* memory)
+{
+  if(memory != NULL)
+    freeMemory((unsigned char*)memory - HEAP_HEADER_SIZE);
+}
+
+static void*
+heap_realloc(void* memory, int size)
+{
+  /* editMemory frees the old memory on failure, SQLite expects to keep it */
+  void* resized = heap_malloc(size);
+  if(resized == NULL)
+    return NULL;
+
+  int old_size = heap_size(memory);
+  memcpy(resized, memory, old_size < size ? old_size : size);
+  heap_free(memory);
+  return resized;
+}
+
+static int
+heap_size(void* memory)
+{
+  if(memory == NULL)
+    return 0;
+
+  uint64_t length = 0;
+  memcpy(&length, (unsigned char*)memory - HEAP_HEADER_SIZE, sizeof(uint64_t));
+  return (int)length;
+}
+
+static int
+heap_roundup(int size)
+{
+  return (size + 7) & ~7;
+}
+
+static int
+heap_init(void* data)
+{
+  (void)data;
+  return SQLITE_OK;
+}
+
+static void
+heap_shutdown(void* data)
+{
+  (void)data;
+}
+
+/**
+ * maps the page cache arena, with huge pages if asked for and possible
+ *
+ * @param[in] size Size of the arena
+ * @param[in] huge_pages Try huge pages first
+ */
+int
+mapHeapArena(size_t size, int huge_pages)
+{
+  void* arena = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if(huge_pages){
+    size_t rounded = (size + HEAP_HUGE_PAGE_SIZE - 1) & ~(size_t)(HEAP_HUGE_PAGE_SIZE - 1);
+    arena = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(arena != MAP_FAILED){
+      heap.huge_pages = 1;
+      size = rounded;
+    }
+  }
+#else
+  (void)huge_pages;
+#endif // MAP_HUGETLB
+  if(arena == MAP_FAILED)
+    arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+  if(arena == MAP_FAILED)
+    return ERROR_MEMORY;
+
+  heap.arena = arena;
+  heap.arena_size = size;
+  return ERROR_OK;
+}
+
+/**
+ * unmaps the page cache arena, SQLite must not use it anymore
+ */
+void
+unmapHeapArena(void)
+{
+  if(heap.arena != NULL)
+    munmap(heap.arena, heap.arena_size);
+  heap.arena = NULL;
+  heap.arena_size = 0;
+  heap.huge_pages = 0;
+}
+
+/**
+ * checks the sizes of a configuration against what SQLite accepts
+ *
+ * @param[in] config The configuration
+ */
+int
+checkHeapConfig(const database_heap_config_t* config)
+{
+  /* page sizes of SQLite are powers of two from 512 to 65536 */
+  if((config->page_size == 0) != (config->pages == 0) ||
+     config->pages > DATABASE_HEAP_PAGES_MAX)
+    return ERROR_INVALID_ARGUMENTS;
+  if(config->page_size != 0 &&
+     (config->page_size < 512 || config->page_size > 65536 ||
+      (config->page_size & (config->page_size - 1)) != 0))
+    return ERROR_INVALID_ARGUMENTS;
+
+  if((config->lookaside_size == 0) != (config->lookaside_slots == 0) ||
+     config->lookaside_size > DATABASE_HEAP_LOOKASIDE_SIZE_MAX ||
+     config->lookaside_slots > HEAP_LOOKASIDE_SLOTS_MAX ||
+     config->limit < 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return ERROR_OK;
+}
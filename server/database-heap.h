@@ -0,0 +1,93 @@
+#ifndef DATABASE_HEAP_H
+#define DATABASE_HEAP_H
+
+/** @brief Memory of SQLite
+ *
+ * Routes the allocations of SQLite through memory.h and hands it
+ * preallocated page cache and lookaside memory. The configuration is global
+ * to the process and can only be changed while no database is open, so it
+ * belongs before the first @ref server_init or @ref database_open.
+ *
+ * @file database-heap.h
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** Largest number of page cache slots */
+#define DATABASE_HEAP_PAGES_MAX (1024 * 1024)
+
+/** Largest lookaside slot, SQLite doesn't use bigger ones */
+#define DATABASE_HEAP_LOOKASIDE_SIZE_MAX 65528
+
+typedef struct database_heap_config_s {
+  size_t page_size;                 /* page size of the databases, 0 no page cache */
+  size_t pages;                     /* slots of the page cache arena */
+  size_t lookaside_size;            /* size of a lookaside slot, 0 no lookaside */
+  size_t lookaside_slots;           /* lookaside slots of every connection */
+  int64_t limit;                    /* hard limit of SQLite's heap, 0 none */
+  int huge_pages;                   /* map the page cache with huge pages */
+} database_heap_config_t;
+
+typedef struct database_heap_stats_s {
+  int64_t used;                     /* bytes SQLite allocated from the heap */
+  int64_t highwater;                /* most bytes ever allocated */
+  int64_t pages_used;               /* page cache slots in use */
+  int64_t pages_overflow;           /* page cache bytes that went to the heap */
+  int64_t limit;                    /* hard limit of the heap, 0 none */
+  int huge_pages;                   /* the arena is backed by huge pages */
+} database_heap_stats_t;
+
+/**
+ * Configures the memory of SQLite: every allocation goes through
+ * requestMemory and freeMemory, pages of databases with @a page_size come
+ * from one arena of @a pages slots and every connection gets @a
+ * lookaside_slots lookaside slots. Pages that don't fit into the arena
+ * still come from the heap. With @a huge_pages the arena is mapped with
+ * huge pages if the system has some, otherwise with normal ones. An
+ * allocation that would take the heap beyond @a limit fails.
+ *
+ * Calling it again replaces the previous configuration.
+ *
+ * @param[in] config The configuration
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_OPEN A database is still open
+ * @return @ref ERROR_MEMORY The arena couldn't be allocated
+ * @return @ref ERROR_DATABASE_INVALID SQLite refused the configuration
+ */
+int database_heap_configure(const database_heap_config_t* config);
+
+/**
+ * Gives SQLite back its own allocator and defaults and releases the arena.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_OPEN A database is still open
+ * @return @ref ERROR_DATABASE_INVALID SQLite refused the configuration
+ */
+int database_heap_reset(void);
+
+/**
+ * Reports the memory SQLite uses right now.
+ *
+ * @param[out] stats The statistics
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int database_heap_get_stats(database_heap_stats_t* stats);
+
+/* used by database.c to know when SQLite may be reconfigured */
+void heapHandleOpened(void);
+void heapHandleClosed(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // DATABASE_HEAP_H
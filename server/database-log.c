@@ -0,0 +1,990 @@
+/** @brief Log-structured storage engine
+ *
+ * This file contains the storage engine of 'the registry' that appends every
+ * value to a log file, used for write-heavy domains.
+ *
+ * @file database-log.c
+ */
+
+#ifndef LOGFILE
+#define LOGFILE
+#define _XOPEN_SOURCE 700
+#include <features.h>
+#endif // LOGFILE
+
+#include "database-engine.h"
+#include "database-options.h"
+#include "keymap.h"
+#include "file-copy.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../hash.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** first bytes of a log file, followed by its 64-bit generation */
+#define LOG_MAGIC "RLOG\0\0\0\1"
+/** first bytes of a checkpoint of the index */
+#define LOG_INDEX_MAGIC "RIDX\0\0\0\1"
+#define LOG_MAGIC_SIZE 8
+#define LOG_HEADER_SIZE (LOG_MAGIC_SIZE + 8)
+/** checksum, domain size, key size, type and value size of a record */
+#define LOG_RECORD_HEADER_SIZE 24
+/** magic, generation, covered log size, live bytes and number of entries */
+#define LOG_INDEX_HEADER_SIZE (LOG_MAGIC_SIZE + 4 * 8)
+/** domain size, key size, type, record offset and value size of an entry */
+#define LOG_INDEX_ENTRY_SIZE 28
+#define LOG_INDEX_SUFFIX ".index"
+#define LOG_INDEX_TEMPORARY_SUFFIX ".index.tmp"
+#define LOG_COMPACT_SUFFIX ".compact"
+
+/** where the current value of a domain, key pair is found in the log */
+typedef struct log_location_s {
+  uint64_t record;                  /* offset of the record   */
+  uint64_t value;                   /* offset of the value    */
+  uint64_t size;                    /* size of the value      */
+  uint32_t type;                    /* database_value_type_t  */
+} log_location_t;
+
+typedef struct log_engine_s {
+  keymap_t *index;                  /* domain, key to log_location_t */
+  char *path;                       /* path of the log file          */
+  int fd;                           /* the log file                  */
+  uint64_t generation;              /* bumped by every compaction    */
+  uint64_t end;                     /* size of the log               */
+  uint64_t live;                    /* bytes of referenced records   */
+  database_durability_t durability; /* durability of the handle      */
+} log_engine_t;
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int readLog(int fd, unsigned char* buffer, size_t size, uint64_t offset);
+int writeLog(int fd, const unsigned char* buffer, size_t size, uint64_t offset);
+int buildLogPath(const char* path, const char* suffix, char** result);
+int lockLog(int fd);
+int findLocation(log_engine_t* log, const char* domain, const char* key,
+                 database_value_type_t type, log_location_t* location);
+int indexRecord(log_engine_t* log, const char* domain, const char* key,
+                const log_location_t* location);
+int appendRecord(log_engine_t* log, const char* domain, const char* key,
+                 database_value_type_t type, const void* value, size_t size);
+int replayLog(log_engine_t* log, uint64_t offset);
+int loadCheckpoint(log_engine_t* log, uint64_t* covered);
+int writeCheckpoint(log_engine_t* log);
+int compactLog(log_engine_t* log);
+void closeLog(log_engine_t* log);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+static int
+log_close(database_engine_t* engine)
+{
+  /* a missing checkpoint only makes the next open slower */
+  writeCheckpoint(engine->data);
+  closeLog(engine->data);
+  freeMemory(engine);
+  return ERROR_OK;
+}
+
+static int
+log_get_type(database_engine_t* engine, const char* domain, const char* key,
+             database_value_type_t* type)
+{
+  if(type == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  log_location_t location;
+  int ret = findLocation(engine->data, domain, key, -1, &location);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *type = location.type;
+  return ERROR_OK;
+}
+
+static int
+log_enum_keys(database_engine_t* engine, const char* domain,
+              const char* pattern, size_t* count, size_t* size, char** keys)
+{
+  if(domain == NULL || strlen(domain) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  log_engine_t* log = engine->data;
+  return keymap_enum(log->index, domain, pattern, count, size, keys);
+}
+
+static int
+log_enum_domains(database_engine_t* engine, size_t* count, size_t* size,
+                 char** domains)
+{
+  log_engine_t* log = engine->data;
+  return keymap_domains(log->index, count, size, domains);
+}
+
+static int
+log_get_int64(database_engine_t* engine, const char* domain, const char* key,
+              int64_t* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  log_engine_t* log = engine->data;
+  log_location_t location;
+  int ret = findLocation(log, domain, key, DATABASE_TYPE_INT64, &location);
+  if(ret != ERROR_OK)
+    return ret;
+
+  return readLog(log->fd, (unsigned char*)value, sizeof(int64_t), location.value);
+}
+
+static int
+log_set_int64(database_engine_t* engine, const char* domain, const char* key,
+              int64_t value)
+{
+  return appendRecord(engine->data, domain, key, DATABASE_TYPE_INT64, &value,
+                      sizeof(int64_t));
+}
+
+static int
+log_get_double(database_engine_t* engine, const char* domain, const char* key,
+               double* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  log_engine_t* log = engine->data;
+  log_location_t location;
+  int ret = findLocation(log, domain, key, DATABASE_TYPE_DOUBLE, &location);
+  if(ret != ERROR_OK)
+    return ret;
+
+  return readLog(log->fd, (unsigned char*)value, sizeof(double), location.value);
+}
+
+static int
+log_set_double(database_engine_t* engine, const char* domain, const char* key,
+               double value)
+{
+  return appendRecord(engine->data, domain, key, DATABASE_TYPE_DOUBLE, &value,
+                      sizeof(double));
+}
+
+static int
+log_get_string(database_engine_t* engine, const char* domain, const char* key,
+               char** value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  log_engine_t* log = engine->data;
+  log_location_t location;
+  int ret = findLocation(log, domain, key, DATABASE_TYPE_STRING, &location);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(requestMemory((void**)value, location.size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  ret = readLog(log->fd, (unsigned char*)*value, location.size, location.value);
+  if(ret != ERROR_OK){
+    freeMemory(*value);
+    *value = NULL;
+    return ret;
+  }
+  (*value)[location.size] = '\0';
+  return ERROR_OK;
+}
+
+static int
+log_set_string(database_engine_t* engine, const char* domain, const char* key,
+               const char* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return appendRecord(engine->data, domain, key, DATABASE_TYPE_STRING, value,
+                      strlen(value));
+}
+
+static int
+log_get_blob_chunk(database_engine_t* engine, const char* domain,
+                   const char* key, size_t offset, size_t length,
+                   unsigned char** value, size_t* size, size_t* total)
+{
+  log_engine_t* log = engine->data;
+  log_location_t location;
+  int ret = findLocation(log, domain, key, DATABASE_TYPE_BLOB, &location);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *total = location.size;
+  if(offset > *total)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *size = *total - offset;
+  if(*size > length)
+    *size = length;
+
+  /* always hand out a valid buffer, even for empty blobs */
+  if(requestMemory((void**)value, *size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  ret = readLog(log->fd, *value, *size, location.value + offset);
+  if(ret != ERROR_OK){
+    freeMemory(*value);
+    *value = NULL;
+    return ret;
+  }
+  return ERROR_OK;
+}
+
+static int
+log_get_blob(database_engine_t* engine, const char* domain, const char* key,
+             unsigned char** value, size_t* size)
+{
+  if(value == NULL || size == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  size_t total = 0;
+  return log_get_blob_chunk(engine, domain, key, 0, SIZE_MAX, value, size,
+                            &total);
+}
+
+static int
+log_set_blob(database_engine_t* engine, const char* domain, const char* key,
+             const unsigned char* value, size_t size)
+{
+  if(value == NULL && size > 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return appendRecord(engine->data, domain, key, DATABASE_TYPE_BLOB, value, size);
+}
+
+int
+database_log_new(database_engine_t** engine, const char* identifier)
+{
+  if(engine == NULL || identifier == NULL ||
+     strncmp(identifier, DATABASE_ENGINE_LOG, strlen(DATABASE_ENGINE_LOG)) != 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_options_t options;
+  int ret = database_options_parse(identifier, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* replay, checkpoints and compaction all write */
+  if(options.readonly){
+    database_options_free(&options);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  log_engine_t* log = NULL;
+  if(requestMemory((void**)&log, sizeof(log_engine_t)) != ERROR_OK){
+    database_options_free(&options);
+    return ERROR_MEMORY;
+  }
+  log->index = NULL;
+  log->fd = -1;
+  log->generation = 1;
+  log->end = LOG_HEADER_SIZE;
+  log->live = 0;
+  log->durability = options.durability;
+
+  ret = buildLogPath(options.path + strlen(DATABASE_ENGINE_LOG), "", &log->path);
+  database_options_free(&options);
+  if(ret != ERROR_OK){
+    freeMemory(log);
+    return ret;
+  }
+
+  if(strlen(log->path) == 0){
+    closeLog(log);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  /* unlike an SQLite database a missing log simply starts empty */
+  log->fd = open(log->path, O_RDWR | O_CREAT, 0666);
+  struct stat sb;
+  if(log->fd < 0 || fstat(log->fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+     lockLog(log->fd) != ERROR_OK){
+    closeLog(log);
+    return ERROR_DATABASE_OPEN;
+  }
+
+  unsigned char header[LOG_HEADER_SIZE];
+  memcpy(header, LOG_MAGIC, LOG_MAGIC_SIZE);
+  if(sb.st_size == 0){
+    memcpy(header + LOG_MAGIC_SIZE, &log->generation, 8);
+    ret = writeLog(log->fd, header, LOG_HEADER_SIZE, 0);
+  }else if(sb.st_size < LOG_HEADER_SIZE ||
+           readLog(log->fd, header, LOG_HEADER_SIZE, 0) != ERROR_OK ||
+           memcmp(header, LOG_MAGIC, LOG_MAGIC_SIZE) != 0){
+    ret = ERROR_DATABASE_INVALID;
+  }else{
+    memcpy(&log->generation, header + LOG_MAGIC_SIZE, 8);
+  }
+
+  if(ret == ERROR_OK)
+    ret = keymap_new(&log->index);
+  if(ret != ERROR_OK){
+    closeLog(log);
+    return ret;
+  }
+
+  /* a usable checkpoint spares replaying the log from the start */
+  uint64_t covered = LOG_HEADER_SIZE;
+  if(loadCheckpoint(log, &covered) != ERROR_OK){
+    keymap_free(log->index);
+    log->index = NULL;
+    log->live = 0;
+    covered = LOG_HEADER_SIZE;
+    ret = keymap_new(&log->index);
+  }
+  if(ret == ERROR_OK)
+    ret = replayLog(log, covered);
+  if(ret != ERROR_OK){
+    closeLog(log);
+    return ret;
+  }
+
+  if(requestMemory((void**)engine, sizeof(database_engine_t)) != ERROR_OK){
+    closeLog(log);
+    return ERROR_MEMORY;
+  }
+
+  (*engine)->close = log_close;
+  (*engine)->get_type = log_get_type;
+  (*engine)->enum_keys = log_enum_keys;
+  (*engine)->enum_domains = log_enum_domains;
+  (*engine)->get_int64 = log_get_int64;
+  (*engine)->set_int64 = log_set_int64;
+  (*engine)->get_double = log_get_double;
+  (*engine)->set_double = log_set_double;
+  (*engine)->get_string = log_get_string;
+  (*engine)->set_string = log_set_string;
+  (*engine)->get_blob = log_get_blob;
+  (*engine)->set_blob = log_set_blob;
+  (*engine)->get_blob_chunk = log_get_blob_chunk;
+  (*engine)->get_blob_to_fd = NULL;
+  (*engine)->set_blob_from_fd = NULL;
+  (*engine)->get_settings = NULL;
+  (*engine)->release_memory = NULL;
+  (*engine)->backup = NULL;
+  (*engine)->maintain = NULL;
+  (*engine)->readonly = 0;
+  (*engine)->data = log;
+
+  return ERROR_OK;
+}
+
+int
+database_log_compact(database_engine_t* engine)
+{
+  if(engine == NULL || engine->close != log_close)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return compactLog(engine->data);
+}
+
+/**
+ * reads exactly size bytes at offset
+ *
+ * @param[in] fd The file
+ * @param[out] buffer Buffer of at least @a size bytes
+ * @param[in] size Number of bytes to read
+ * @param[in] offset Offset of the first byte
+ */
+int
+readLog(int fd, unsigned char* buffer, size_t size, uint64_t offset)
+{
+  size_t done = 0;
+  while(done < size){
+    ssize_t got = pread(fd, buffer + done, size - done, offset + done);
+    if(got < 0 && errno == EINTR)
+      continue;
+    if(got < 0)
+      return ERROR_DATABASE_IO;
+    if(got == 0)
+      return ERROR_EOF;
+    done += got;
+  }
+  return ERROR_OK;
+}
+
+/**
+ * writes exactly size bytes at offset
+ *
+ * @param[in] fd The file
+ * @param[in] buffer The data
+ * @param[in] size Number of bytes to write
+ * @param[in] offset Offset of the first byte
+ */
+int
+writeLog(int fd, const unsigned char* buffer, size_t size, uint64_t offset)
+{
+  size_t done = 0;
+  while(done < size){
+    ssize_t written = pwrite(fd, buffer + done, size - done, offset + done);
+    if(written < 0 && errno == EINTR)
+      continue;
+    if(written < 0)
+      return ERROR_DATABASE_IO;
+    done += written;
+  }
+  return ERROR_OK;
+}
+
+/**
+ * appends a suffix to the path of the log
+ *
+ * @param[in] path Path of the log
+ * @param[in] suffix The suffix
+ * @param[out] result The path, has to be freed
+ */
+int
+buildLogPath(const char* path, const char* suffix, char** result)
+{
+  size_t path_size = strlen(path);
+  size_t suffix_size = strlen(suffix);
+  if(requestMemory((void**)result, path_size + suffix_size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(*result, path, path_size);
+  memcpy(*result + path_size, suffix, suffix_size + 1);
+  return ERROR_OK;
+}
+
+/**
+ * takes an exclusive lock on the log, so no other engine can append behind
+ * the back of our index. flock(2) locks belong to the open file, unlike
+ * fcntl(2) locks they also keep out a second engine of the same process.
+ *
+ * @param[in] fd The log file
+ */
+int
+lockLog(int fd)
+{
+  return flock(fd, LOCK_EX | LOCK_NB) == 0 ? ERROR_OK : ERROR_DATABASE_OPEN;
+}
+
+/**
+ * looks up where the value of domain and key is stored
+ *
+ * @param[in] log The log engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The expected type, -1 accepts any type
+ * @param[out] location The location
+ */
+int
+findLocation(log_engine_t* log, const char* domain, const char* key,
+             database_value_type_t type, log_location_t* location)
+{
+  if(domain == NULL || key == NULL || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t* entry = NULL;
+  int ret = keymap_find(log->index, domain, key, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  memcpy(location, entry->value.bytes.data, sizeof(log_location_t));
+  if((int)type != -1 && location->type != (uint32_t)type)
+    return ERROR_DATABASE_TYPE_MISMATCH;
+
+  return ERROR_OK;
+}
+
+/**
+ * points the index entry of domain and key to a new record and keeps track
+ * of the bytes that are still referenced
+ *
+ * @param[in] log The log engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] location The location of the new record
+ */
+int
+indexRecord(log_engine_t* log, const char* domain, const char* key,
+            const log_location_t* location)
+{
+  log_location_t old;
+  int replaced = findLocation(log, domain, key, -1, &old) == ERROR_OK;
+
+  int ret = keymap_set(log->index, domain, key, DATABASE_TYPE_BLOB, location,
+                       sizeof(log_location_t));
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(replaced)
+    log->live -= old.value + old.size - old.record;
+  log->live += location->value + location->size - location->record;
+  return ERROR_OK;
+}
+
+/**
+ * appends one record and points the index to it. The record is written with
+ * a single write, the log is compacted once most of it is garbage.
+ *
+ * @param[in] log The log engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The type of the value
+ * @param[in] value The value
+ * @param[in] size The size of the value
+ */
+int
+appendRecord(log_engine_t* log, const char* domain, const char* key,
+             database_value_type_t type, const void* value, size_t size)
+{
+  if(domain == NULL || key == NULL || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  uint32_t domain_size = strlen(domain);
+  uint32_t key_size = strlen(key);
+  uint32_t record_type = type;
+  uint64_t value_size = size;
+  size_t total = LOG_RECORD_HEADER_SIZE + domain_size + key_size + size;
+
+  unsigned char* record = NULL;
+  if(requestMemory((void**)&record, total) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  unsigned char* position = record + 4;
+  memcpy(position, &domain_size, 4);
+  memcpy(position + 4, &key_size, 4);
+  memcpy(position + 8, &record_type, 4);
+  memcpy(position + 12, &value_size, 8);
+  position = record + LOG_RECORD_HEADER_SIZE;
+  memcpy(position, domain, domain_size);
+  memcpy(position + domain_size, key, key_size);
+  if(size > 0)
+    memcpy(position + domain_size + key_size, value, size);
+  uint32_t checksum = hash_fnv1a(HASH_FNV1A_BASIS, record + 4, total - 4);
+  memcpy(record, &checksum, 4);
+
+  int ret = writeLog(log->fd, record, total, log->end);
+  freeMemory(record);
+  if(ret == ERROR_OK && log->durability == DATABASE_DURABILITY_FULL &&
+     fdatasync(log->fd) != 0)
+    ret = ERROR_DATABASE_IO;
+  if(ret != ERROR_OK){
+    /* drop a partial record, replay would discard it anyway */
+    if(ftruncate(log->fd, log->end) != 0)
+      return ERROR_DATABASE_IO;
+    return ret;
+  }
+
+  log_location_t location;
+  location.record = log->end;
+  location.value = log->end + LOG_RECORD_HEADER_SIZE + domain_size + key_size;
+  location.size = size;
+  location.type = type;
+  log->end += total;
+
+  ret = indexRecord(log, domain, key, &location);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* failing to compact only costs disk space */
+  uint64_t garbage = log->end - LOG_HEADER_SIZE - log->live;
+  if(garbage > log->live && garbage >= DATABASE_LOG_COMPACT_MIN)
+    compactLog(log);
+
+  return ERROR_OK;
+}
+
+/**
+ * adds all records from offset up to the end of the log to the index. A
+ * record that is cut short or fails its checksum marks the end of the log,
+ * it and everything after it are truncated.
+ *
+ * @param[in] log The log engine
+ * @param[in] offset Offset of the first record
+ */
+int
+replayLog(log_engine_t* log, uint64_t offset)
+{
+  struct stat sb;
+  if(fstat(log->fd, &sb) != 0)
+    return ERROR_DATABASE_IO;
+
+  unsigned char* record = NULL;
+  size_t capacity = 0;
+  int ret = ERROR_OK;
+
+  while(offset < (uint64_t)sb.st_size){
+    unsigned char header[LOG_RECORD_HEADER_SIZE];
+    uint32_t checksum = 0;
+    uint32_t domain_size = 0;
+    uint32_t key_size = 0;
+    uint32_t type = 0;
+    uint64_t value_size = 0;
+
+    if((uint64_t)sb.st_size - offset < LOG_RECORD_HEADER_SIZE ||
+       readLog(log->fd, header, LOG_RECORD_HEADER_SIZE, offset) != ERROR_OK)
+      break;
+    memcpy(&checksum, header, 4);
+    memcpy(&domain_size, header + 4, 4);
+    memcpy(&key_size, header + 8, 4);
+    memcpy(&type, header + 12, 4);
+    memcpy(&value_size, header + 16, 8);
+
+    uint64_t rest = (uint64_t)sb.st_size - offset - LOG_RECORD_HEADER_SIZE;
+    if(domain_size == 0 || key_size == 0 || type > DATABASE_TYPE_BLOB ||
+       (uint64_t)domain_size + key_size > rest ||
+       value_size > rest - domain_size - key_size)
+      break;
+
+    /* domain and key are copied NUL-terminated, the value is only checked */
+    size_t needed = domain_size + key_size + 2;
+    if(needed > capacity){
+      if(editMemory((void**)&record, needed) != ERROR_OK){
+        record = NULL;
+        ret = ERROR_MEMORY;
+        break;
+      }
+      capacity = needed;
+    }
+    char* domain = (char*)record;
+    char* key = (char*)record + domain_size + 1;
+    if(readLog(log->fd, (unsigned char*)domain, domain_size,
+               offset + LOG_RECORD_HEADER_SIZE) != ERROR_OK ||
+       readLog(log->fd, (unsigned char*)key, key_size,
+               offset + LOG_RECORD_HEADER_SIZE + domain_size) != ERROR_OK)
+      break;
+    domain[domain_size] = '\0';
+    key[key_size] = '\0';
+    if(strlen(domain) != domain_size || strlen(key) != key_size)
+      break;
+
+    uint32_t sum = hash_fnv1a(HASH_FNV1A_BASIS, header + 4, LOG_RECORD_HEADER_SIZE - 4);
+    sum = hash_fnv1a(sum, (unsigned char*)domain, domain_size);
+    sum = hash_fnv1a(sum, (unsigned char*)key, key_size);
+    uint64_t value_offset = offset + LOG_RECORD_HEADER_SIZE + domain_size + key_size;
+    unsigned char chunk[4096];
+    uint64_t done = 0;
+    int readable = 1;
+    while(done < value_size){
+      size_t part = value_size - done < sizeof(chunk) ? value_size - done : sizeof(chunk);
+      if(readLog(log->fd, chunk, part, value_offset + done) != ERROR_OK){
+        readable = 0;
+        break;
+      }
+      sum = hash_fnv1a(sum, chunk, part);
+      done += part;
+    }
+    if(!readable || sum != checksum)
+      break;
+
+    log_location_t location;
+    location.record = offset;
+    location.value = value_offset;
+    location.size = value_size;
+    location.type = type;
+    ret = indexRecord(log, domain, key, &location);
+    if(ret != ERROR_OK)
+      break;
+
+    offset = value_offset + value_size;
+  }
+
+  freeMemory(record);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(offset < (uint64_t)sb.st_size && ftruncate(log->fd, offset) != 0)
+    return ERROR_DATABASE_IO;
+
+  log->end = offset;
+  return ERROR_OK;
+}
+
+/**
+ * loads the index from its checkpoint. The checkpoint is only used if it was
+ * written for the current generation of the log and the log still has all
+ * the records it covers.
+ *
+ * @param[in] log The log engine with an empty index
+ * @param[out] covered Offset of the first record not in the checkpoint
+ */
+int
+loadCheckpoint(log_engine_t* log, uint64_t* covered)
+{
+  char* path = NULL;
+  if(buildLogPath(log->path, LOG_INDEX_SUFFIX, &path) != ERROR_OK)
+    return ERROR_MEMORY;
+  int fd = open(path, O_RDONLY | O_NOFOLLOW);
+  freeMemory(path);
+  if(fd < 0)
+    return ERROR_DATABASE_OPEN;
+
+  struct stat sb;
+  struct stat lb;
+  unsigned char* data = NULL;
+  if(fstat(fd, &sb) != 0 || fstat(log->fd, &lb) != 0 || !S_ISREG(sb.st_mode) ||
+     sb.st_size < LOG_INDEX_HEADER_SIZE + 4 ||
+     requestMemory((void**)&data, sb.st_size) != ERROR_OK){
+    close(fd);
+    return ERROR_DATABASE_INVALID;
+  }
+  int ret = readLog(fd, data, sb.st_size, 0);
+  close(fd);
+
+  size_t size = sb.st_size;
+  uint32_t checksum = 0;
+  uint64_t generation = 0;
+  uint64_t count = 0;
+  if(ret == ERROR_OK){
+    memcpy(&checksum, data + size - 4, 4);
+    memcpy(&generation, data + LOG_MAGIC_SIZE, 8);
+    memcpy(covered, data + LOG_MAGIC_SIZE + 8, 8);
+    memcpy(&log->live, data + LOG_MAGIC_SIZE + 16, 8);
+    memcpy(&count, data + LOG_MAGIC_SIZE + 24, 8);
+    if(memcmp(data, LOG_INDEX_MAGIC, LOG_MAGIC_SIZE) != 0 ||
+       checksum != hash_fnv1a(HASH_FNV1A_BASIS, data + LOG_MAGIC_SIZE,
+                               size - LOG_MAGIC_SIZE - 4) ||
+       generation != log->generation || *covered < LOG_HEADER_SIZE ||
+       *covered > (uint64_t)lb.st_size)
+      ret = ERROR_DATABASE_INVALID;
+  }
+
+  size_t position = LOG_INDEX_HEADER_SIZE;
+  uint64_t i = 0;
+  for(; ret == ERROR_OK && i < count; i++){
+    uint32_t domain_size = 0;
+    uint32_t key_size = 0;
+    log_location_t location;
+    if(size - 4 - position < LOG_INDEX_ENTRY_SIZE){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+    memcpy(&domain_size, data + position, 4);
+    memcpy(&key_size, data + position + 4, 4);
+    memcpy(&location.type, data + position + 8, 4);
+    memcpy(&location.record, data + position + 12, 8);
+    memcpy(&location.size, data + position + 20, 8);
+    position += LOG_INDEX_ENTRY_SIZE;
+    if(domain_size == 0 || key_size == 0 ||
+       size - 4 - position < (size_t)domain_size + key_size + 2){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+
+    /* names are stored NUL-terminated */
+    char* domain = (char*)data + position;
+    char* key = domain + domain_size + 1;
+    if(domain[domain_size] != '\0' || key[key_size] != '\0' ||
+       strlen(domain) != domain_size || strlen(key) != key_size){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+    position += domain_size + key_size + 2;
+
+    location.value = location.record + LOG_RECORD_HEADER_SIZE + domain_size + key_size;
+    if(location.type > DATABASE_TYPE_BLOB || location.record < LOG_HEADER_SIZE ||
+       location.value + location.size > *covered){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+    ret = keymap_set(log->index, domain, key, DATABASE_TYPE_BLOB, &location,
+                     sizeof(log_location_t));
+  }
+
+  freeMemory(data);
+  return ret;
+}
+
+/**
+ * writes the index next to the log, so the next open only replays records
+ * appended afterwards
+ *
+ * @param[in] log The log engine
+ */
+int
+writeCheckpoint(log_engine_t* log)
+{
+  size_t size = LOG_INDEX_HEADER_SIZE + 4;
+  size_t i = 0;
+  keymap_entry_t* entry = NULL;
+  for(; i < log->index->size; i++){
+    for(entry = log->index->buckets[i]; entry != NULL; entry = entry->next)
+      size += LOG_INDEX_ENTRY_SIZE + strlen(entry->domain) + strlen(entry->key) + 2;
+  }
+
+  unsigned char* data = NULL;
+  if(requestMemory((void**)&data, size) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  uint64_t count = log->index->count;
+  memcpy(data, LOG_INDEX_MAGIC, LOG_MAGIC_SIZE);
+  memcpy(data + LOG_MAGIC_SIZE, &log->generation, 8);
+  memcpy(data + LOG_MAGIC_SIZE + 8, &log->end, 8);
+  memcpy(data + LOG_MAGIC_SIZE + 16, &log->live, 8);
+  memcpy(data + LOG_MAGIC_SIZE + 24, &count, 8);
+
+  size_t position = LOG_INDEX_HEADER_SIZE;
+  for(i = 0; i < log->index->size; i++){
+    for(entry = log->index->buckets[i]; entry != NULL; entry = entry->next){
+      log_location_t location;
+      memcpy(&location, entry->value.bytes.data, sizeof(log_location_t));
+      uint32_t domain_size = strlen(entry->domain);
+      uint32_t key_size = strlen(entry->key);
+      memcpy(data + position, &domain_size, 4);
+      memcpy(data + position + 4, &key_size, 4);
+      memcpy(data + position + 8, &location.type, 4);
+      memcpy(data + position + 12, &location.record, 8);
+      memcpy(data + position + 20, &location.size, 8);
+      position += LOG_INDEX_ENTRY_SIZE;
+      memcpy(data + position, entry->domain, domain_size + 1);
+      position += domain_size + 1;
+      memcpy(data + position, entry->key, key_size + 1);
+      position += key_size + 1;
+    }
+  }
+  uint32_t checksum = hash_fnv1a(HASH_FNV1A_BASIS, data + LOG_MAGIC_SIZE,
+                                  size - LOG_MAGIC_SIZE - 4);
+  memcpy(data + position, &checksum, 4);
+
+  /* written aside and renamed, a crash leaves either checkpoint intact */
+  char* temporary = NULL;
+  char* path = NULL;
+  if(buildLogPath(log->path, LOG_INDEX_TEMPORARY_SUFFIX, &temporary) != ERROR_OK ||
+     buildLogPath(log->path, LOG_INDEX_SUFFIX, &path) != ERROR_OK){
+    freeMemory(temporary);
+    freeMemory(data);
+    return ERROR_MEMORY;
+  }
+
+  int ret = ERROR_DATABASE_IO;
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0666);
+  if(fd >= 0){
+    ret = writeLog(fd, data, size, 0);
+    if(ret == ERROR_OK && log->durability != DATABASE_DURABILITY_RELAXED &&
+       fsync(fd) != 0)
+      ret = ERROR_DATABASE_IO;
+    if(close(fd) != 0)
+      ret = ERROR_DATABASE_IO;
+    if(ret == ERROR_OK && rename(temporary, path) != 0)
+      ret = ERROR_DATABASE_IO;
+    if(ret != ERROR_OK)
+      unlink(temporary);
+  }
+
+  freeMemory(temporary);
+  freeMemory(path);
+  freeMemory(data);
+  return ret;
+}
+
+/**
+ * rewrites the log with only the records the index still points to. The new
+ * log gets the next generation, so a checkpoint of the old one is never
+ * applied to it.
+ *
+ * @param[in] log The log engine
+ */
+int
+compactLog(log_engine_t* log)
+{
+  keymap_t* index = log->index;
+  uint64_t* offsets = NULL;
+  if(requestMemory((void**)&offsets, (index->count + 1) * sizeof(uint64_t)) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  char* path = NULL;
+  if(buildLogPath(log->path, LOG_COMPACT_SUFFIX, &path) != ERROR_OK){
+    freeMemory(offsets);
+    return ERROR_MEMORY;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0666);
+  if(fd < 0){
+    freeMemory(path);
+    freeMemory(offsets);
+    return ERROR_DATABASE_IO;
+  }
+
+  uint64_t generation = log->generation + 1;
+  unsigned char header[LOG_HEADER_SIZE];
+  memcpy(header, LOG_MAGIC, LOG_MAGIC_SIZE);
+  memcpy(header + LOG_MAGIC_SIZE, &generation, 8);
+  int ret = writeLog(fd, header, LOG_HEADER_SIZE, 0);
+
+  /* copy all live records first, the index is only touched on success */
+  uint64_t end = LOG_HEADER_SIZE;
+  size_t n = 0;
+  size_t i = 0;
+  keymap_entry_t* entry = NULL;
+  for(; ret == ERROR_OK && i < index->size; i++){
+    for(entry = index->buckets[i]; ret == ERROR_OK && entry != NULL; entry = entry->next){
+      log_location_t location;
+      memcpy(&location, entry->value.bytes.data, sizeof(log_location_t));
+      uint64_t length = location.value + location.size - location.record;
+      if(lseek(log->fd, location.record, SEEK_SET) < 0 ||
+         lseek(fd, end, SEEK_SET) < 0 ||
+         file_copy(log->fd, fd, length, NULL) != ERROR_OK)
+        ret = ERROR_DATABASE_IO;
+      offsets[n++] = end;
+      end += length;
+    }
+  }
+
+  if(ret == ERROR_OK && (fsync(fd) != 0 || lockLog(fd) != ERROR_OK ||
+                         rename(path, log->path) != 0))
+    ret = ERROR_DATABASE_IO;
+  if(ret != ERROR_OK){
+    close(fd);
+    unlink(path);
+    freeMemory(path);
+    freeMemory(offsets);
+    return ret;
+  }
+  freeMemory(path);
+
+  n = 0;
+  for(i = 0; i < index->size; i++){
+    for(entry = index->buckets[i]; entry != NULL; entry = entry->next){
+      log_location_t location;
+      memcpy(&location, entry->value.bytes.data, sizeof(log_location_t));
+      location.value = offsets[n] + (location.value - location.record);
+      location.record = offsets[n++];
+      memcpy(entry->value.bytes.data, &location, sizeof(log_location_t));
+    }
+  }
+  freeMemory(offsets);
+
+  close(log->fd);
+  log->fd = fd;
+  log->generation = generation;
+  log->end = end;
+  log->live = end - LOG_HEADER_SIZE;
+
+  /* without a checkpoint the next open simply replays the whole log */
+  writeCheckpoint(log);
+  return ERROR_OK;
+}
+
+/**
+ * frees the log engine's data
+ *
+ * @param[in] log The log engine
+ */
+void
+closeLog(log_engine_t* log)
+{
+  if(log->fd >= 0)
+    close(log->fd);
+  keymap_free(log->index);
+  freeMemory(log->path);
+  freeMemory(log);
+}
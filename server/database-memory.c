@@ -0,0 +1,267 @@
+/** @brief Memory storage engine
+ *
+ * This file contains the storage engine of 'the registry' that keeps all
+ * values in memory, used for tests and ephemeral domains.
+ *
+ * @file database-memory.c
+ */
+
+#include "database-engine.h"
+#include "database-options.h"
+#include "keymap.h"
+#include "../errors.h"
+#include "../memory.h"
+#include <string.h>
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int validName(const char* domain, const char* key);
+int lookupTyped(database_engine_t* engine, const char* domain, const char* key,
+                database_value_type_t type, keymap_entry_t** entry);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+static int
+memory_close(database_engine_t* engine)
+{
+  keymap_free(engine->data);
+  freeMemory(engine);
+  return ERROR_OK;
+}
+
+static int
+memory_get_type(database_engine_t* engine, const char* domain, const char* key,
+                database_value_type_t* type)
+{
+  if(!validName(domain, key) || type == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t* entry = NULL;
+  int ret = keymap_find(engine->data, domain, key, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *type = entry->type;
+  return ERROR_OK;
+}
+
+static int
+memory_enum_keys(database_engine_t* engine, const char* domain,
+                 const char* pattern, size_t* count, size_t* size, char** keys)
+{
+  if(domain == NULL || strlen(domain) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return keymap_enum(engine->data, domain, pattern, count, size, keys);
+}
+
+static int
+memory_enum_domains(database_engine_t* engine, size_t* count, size_t* size,
+                    char** domains)
+{
+  return keymap_domains(engine->data, count, size, domains);
+}
+
+static int
+memory_get_int64(database_engine_t* engine, const char* domain,
+                 const char* key, int64_t* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupTyped(engine, domain, key, DATABASE_TYPE_INT64, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *value = entry->value.integer;
+  return ERROR_OK;
+}
+
+static int
+memory_set_int64(database_engine_t* engine, const char* domain,
+                 const char* key, int64_t value)
+{
+  if(!validName(domain, key))
+    return ERROR_INVALID_ARGUMENTS;
+
+  return keymap_set(engine->data, domain, key, DATABASE_TYPE_INT64, &value, 0);
+}
+
+static int
+memory_get_double(database_engine_t* engine, const char* domain,
+                  const char* key, double* value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupTyped(engine, domain, key, DATABASE_TYPE_DOUBLE, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *value = entry->value.dob;
+  return ERROR_OK;
+}
+
+static int
+memory_set_double(database_engine_t* engine, const char* domain,
+                  const char* key, double value)
+{
+  if(!validName(domain, key))
+    return ERROR_INVALID_ARGUMENTS;
+
+  return keymap_set(engine->data, domain, key, DATABASE_TYPE_DOUBLE, &value, 0);
+}
+
+static int
+memory_get_string(database_engine_t* engine, const char* domain,
+                  const char* key, char** value)
+{
+  if(value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupTyped(engine, domain, key, DATABASE_TYPE_STRING, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(requestMemory((void**)value, entry->value.bytes.size) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(*value, entry->value.bytes.data, entry->value.bytes.size);
+  return ERROR_OK;
+}
+
+static int
+memory_set_string(database_engine_t* engine, const char* domain,
+                  const char* key, const char* value)
+{
+  if(!validName(domain, key) || value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  return keymap_set(engine->data, domain, key, DATABASE_TYPE_STRING, value, 0);
+}
+
+static int
+memory_get_blob(database_engine_t* engine, const char* domain, const char* key,
+                unsigned char** value, size_t* size)
+{
+  if(value == NULL || size == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupTyped(engine, domain, key, DATABASE_TYPE_BLOB, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* the stored copy carries a spare byte, so empty blobs get a buffer too */
+  if(requestMemory((void**)value, entry->value.bytes.size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(*value, entry->value.bytes.data, entry->value.bytes.size + 1);
+  *size = entry->value.bytes.size;
+  return ERROR_OK;
+}
+
+static int
+memory_set_blob(database_engine_t* engine, const char* domain, const char* key,
+                const unsigned char* value, size_t size)
+{
+  if(!validName(domain, key) || (value == NULL && size > 0))
+    return ERROR_INVALID_ARGUMENTS;
+
+  const unsigned char empty = '\0';
+  return keymap_set(engine->data, domain, key, DATABASE_TYPE_BLOB,
+                    value != NULL ? value : &empty, size);
+}
+
+int
+database_memory_new(database_engine_t** engine, const char* identifier)
+{
+  if(engine == NULL || identifier == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* nothing to tune, but a typo must fail like it does for SQLite. A
+     read-only memory engine would stay empty forever */
+  database_options_t options;
+  int ret = database_options_parse(identifier, &options);
+  if(ret != ERROR_OK)
+    return ret;
+  int readonly = options.readonly;
+  database_options_free(&options);
+  if(readonly)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_t* map = NULL;
+  ret = keymap_new(&map);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(requestMemory((void**)engine, sizeof(database_engine_t)) != ERROR_OK){
+    keymap_free(map);
+    return ERROR_MEMORY;
+  }
+
+  (*engine)->close = memory_close;
+  (*engine)->get_type = memory_get_type;
+  (*engine)->enum_keys = memory_enum_keys;
+  (*engine)->enum_domains = memory_enum_domains;
+  (*engine)->get_int64 = memory_get_int64;
+  (*engine)->set_int64 = memory_set_int64;
+  (*engine)->get_double = memory_get_double;
+  (*engine)->set_double = memory_set_double;
+  (*engine)->get_string = memory_get_string;
+  (*engine)->set_string = memory_set_string;
+  (*engine)->get_blob = memory_get_blob;
+  (*engine)->set_blob = memory_set_blob;
+  (*engine)->get_blob_chunk = NULL;
+  (*engine)->get_blob_to_fd = NULL;
+  (*engine)->set_blob_from_fd = NULL;
+  (*engine)->get_settings = NULL;
+  (*engine)->release_memory = NULL;
+  (*engine)->backup = NULL;
+  (*engine)->maintain = NULL;
+  (*engine)->readonly = 0;
+  (*engine)->data = map;
+
+  return ERROR_OK;
+}
+
+/**
+ * checks that domain and key are non-empty strings
+ *
+ * @param[in] domain The domain
+ * @param[in] key The key
+ */
+int
+validName(const char* domain, const char* key)
+{
+  return domain != NULL && key != NULL && strlen(domain) > 0 && strlen(key) > 0;
+}
+
+/**
+ * looks up the entry of domain and key and makes sure it has the given type
+ *
+ * @param[in] engine The memory engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The expected type
+ * @param[out] entry The entry
+ */
+int
+lookupTyped(database_engine_t* engine, const char* domain, const char* key,
+            database_value_type_t type, keymap_entry_t** entry)
+{
+  if(!validName(domain, key))
+    return ERROR_INVALID_ARGUMENTS;
+
+  int ret = keymap_find(engine->data, domain, key, entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if((*entry)->type != type)
+    return ERROR_DATABASE_TYPE_MISMATCH;
+
+  return ERROR_OK;
+}
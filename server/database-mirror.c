@@ -0,0 +1,628 @@
+/** @brief Mirroring storage engine
+ *
+ * This file contains the storage engine of 'the registry' that keeps small
+ * domains of another engine in memory.
+ *
+ * @file database-mirror.c
+ */
+
+#include "database-engine.h"
+#include "database-options.h"
+#include "keymap.h"
+#include "../errors.h"
+#include "../memory.h"
+#include <string.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** key of the per domain state inside mirror_engine_t.domains */
+#define MIRROR_STATE_KEY "keys"
+
+/** state of a domain that is too large to be mirrored */
+#define MIRROR_PASS_THROUGH -1
+
+typedef struct mirror_engine_s {
+  database_engine_t *backing;       /* the engine that stores the values */
+  keymap_t *values;                 /* values of all mirrored domains    */
+  keymap_t *domains;                /* key count or MIRROR_PASS_THROUGH  */
+  size_t limit;                     /* most keys of a mirrored domain    */
+} mirror_engine_t;
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int mirroredDomain(database_engine_t* engine, const char* domain);
+int loadMirrorDomain(mirror_engine_t* mirror, const char* domain,
+                     int64_t* state);
+int loadMirrorValue(mirror_engine_t* mirror, const char* domain,
+                    const char* key, int* fits);
+void forgetMirrorDomain(mirror_engine_t* mirror, const char* domain);
+void updateMirror(database_engine_t* engine, const char* domain,
+                  const char* key, database_value_type_t type,
+                  const void* value, size_t size);
+int lookupMirrored(database_engine_t* engine, const char* domain,
+                   const char* key, database_value_type_t type,
+                   keymap_entry_t** entry);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+static int
+mirror_close(database_engine_t* engine)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = database_engine_close(mirror->backing);
+  keymap_free(mirror->values);
+  keymap_free(mirror->domains);
+  freeMemory(mirror);
+  freeMemory(engine);
+  return ret;
+}
+
+static int
+mirror_get_type(database_engine_t* engine, const char* domain, const char* key,
+                database_value_type_t* type)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(type == NULL || !mirroredDomain(engine, domain))
+    return database_engine_get_type(mirror->backing, domain, key, type);
+
+  keymap_entry_t* entry = NULL;
+  int ret = keymap_find(mirror->values, domain, key, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *type = entry->type;
+  return ERROR_OK;
+}
+
+static int
+mirror_enum_keys(database_engine_t* engine, const char* domain,
+                 const char* pattern, size_t* count, size_t* size, char** keys)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(!mirroredDomain(engine, domain))
+    return database_engine_enum_keys(mirror->backing, domain, pattern, count,
+                                     size, keys);
+
+  return keymap_enum(mirror->values, domain, pattern, count, size, keys);
+}
+
+static int
+mirror_enum_domains(database_engine_t* engine, size_t* count, size_t* size,
+                    char** domains)
+{
+  /* empty domains aren't mirrored, the backing engine knows all of them */
+  mirror_engine_t* mirror = engine->data;
+  return database_engine_enum_domains(mirror->backing, count, size, domains);
+}
+
+static int
+mirror_get_int64(database_engine_t* engine, const char* domain,
+                 const char* key, int64_t* value)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(value == NULL || !mirroredDomain(engine, domain))
+    return database_engine_get_int64(mirror->backing, domain, key, value);
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupMirrored(engine, domain, key, DATABASE_TYPE_INT64, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *value = entry->value.integer;
+  return ERROR_OK;
+}
+
+static int
+mirror_set_int64(database_engine_t* engine, const char* domain,
+                 const char* key, int64_t value)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = database_engine_set_int64(mirror->backing, domain, key, value);
+  if(ret == ERROR_OK)
+    updateMirror(engine, domain, key, DATABASE_TYPE_INT64, &value, 0);
+  return ret;
+}
+
+static int
+mirror_get_double(database_engine_t* engine, const char* domain,
+                  const char* key, double* value)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(value == NULL || !mirroredDomain(engine, domain))
+    return database_engine_get_double(mirror->backing, domain, key, value);
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupMirrored(engine, domain, key, DATABASE_TYPE_DOUBLE, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  *value = entry->value.dob;
+  return ERROR_OK;
+}
+
+static int
+mirror_set_double(database_engine_t* engine, const char* domain,
+                  const char* key, double value)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = database_engine_set_double(mirror->backing, domain, key, value);
+  if(ret == ERROR_OK)
+    updateMirror(engine, domain, key, DATABASE_TYPE_DOUBLE, &value, 0);
+  return ret;
+}
+
+static int
+mirror_get_string(database_engine_t* engine, const char* domain,
+                  const char* key, char** value)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(value == NULL || !mirroredDomain(engine, domain))
+    return database_engine_get_string(mirror->backing, domain, key, value);
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupMirrored(engine, domain, key, DATABASE_TYPE_STRING, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(requestMemory((void**)value, entry->value.bytes.size) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(*value, entry->value.bytes.data, entry->value.bytes.size);
+  return ERROR_OK;
+}
+
+static int
+mirror_set_string(database_engine_t* engine, const char* domain,
+                  const char* key, const char* value)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = database_engine_set_string(mirror->backing, domain, key, value);
+  if(ret == ERROR_OK)
+    updateMirror(engine, domain, key, DATABASE_TYPE_STRING, value, 0);
+  return ret;
+}
+
+static int
+mirror_get_blob(database_engine_t* engine, const char* domain, const char* key,
+                unsigned char** value, size_t* size)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(value == NULL || size == NULL || !mirroredDomain(engine, domain))
+    return database_engine_get_blob(mirror->backing, domain, key, value, size);
+
+  keymap_entry_t* entry = NULL;
+  int ret = lookupMirrored(engine, domain, key, DATABASE_TYPE_BLOB, &entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* the stored copy carries a spare byte, so empty blobs get a buffer too */
+  if(requestMemory((void**)value, entry->value.bytes.size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(*value, entry->value.bytes.data, entry->value.bytes.size + 1);
+  *size = entry->value.bytes.size;
+  return ERROR_OK;
+}
+
+static int
+mirror_set_blob(database_engine_t* engine, const char* domain, const char* key,
+                const unsigned char* value, size_t size)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = database_engine_set_blob(mirror->backing, domain, key, value, size);
+  if(ret != ERROR_OK)
+    return ret;
+
+  const unsigned char empty = '\0';
+  if(size > DATABASE_MIRROR_BLOB_MAX)
+    forgetMirrorDomain(mirror, domain);
+  else
+    updateMirror(engine, domain, key, DATABASE_TYPE_BLOB,
+                 value != NULL ? value : &empty, size);
+  return ERROR_OK;
+}
+
+/* streamed blobs are large ones, they always come from the backing engine */
+static int
+mirror_get_blob_chunk(database_engine_t* engine, const char* domain,
+                      const char* key, size_t offset, size_t length,
+                      unsigned char** value, size_t* size, size_t* total)
+{
+  mirror_engine_t* mirror = engine->data;
+  return database_engine_get_blob_chunk(mirror->backing, domain, key, offset,
+                                        length, value, size, total);
+}
+
+static int
+mirror_get_blob_to_fd(database_engine_t* engine, const char* domain,
+                      const char* key, int fd, size_t* size)
+{
+  mirror_engine_t* mirror = engine->data;
+  return database_engine_get_blob_to_fd(mirror->backing, domain, key, fd, size);
+}
+
+static int
+mirror_set_blob_from_fd(database_engine_t* engine, const char* domain,
+                        const char* key, int fd)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = database_engine_set_blob_from_fd(mirror->backing, domain, key, fd);
+
+  /* the blob never passes through here, the next read loads the domain */
+  if(ret == ERROR_OK)
+    forgetMirrorDomain(mirror, domain);
+  return ret;
+}
+
+static int
+mirror_get_settings(database_engine_t* engine, char** settings)
+{
+  mirror_engine_t* mirror = engine->data;
+  return database_engine_get_settings(mirror->backing, settings);
+}
+
+static int
+mirror_release_memory(database_engine_t* engine, size_t* released)
+{
+  mirror_engine_t* mirror = engine->data;
+
+  /* every domain is loaded again by its next read */
+  keymap_t* values = NULL;
+  keymap_t* domains = NULL;
+  if(keymap_new(&values) != ERROR_OK || keymap_new(&domains) != ERROR_OK){
+    keymap_free(values);
+    return ERROR_MEMORY;
+  }
+  keymap_free(mirror->values);
+  keymap_free(mirror->domains);
+  mirror->values = values;
+  mirror->domains = domains;
+
+  return database_engine_release_memory(mirror->backing, released);
+}
+
+/* the mirrored domains are never newer than the backing engine */
+static int
+mirror_backup(database_engine_t* engine, const char* path,
+              database_backup_callback_t callback, void* context)
+{
+  mirror_engine_t* mirror = engine->data;
+  return database_engine_backup(mirror->backing, path, callback, context);
+}
+
+/* maintenance never changes a value, the mirrored domains stay valid */
+static int
+mirror_maintain(database_engine_t* engine, const database_maintenance_t* budget,
+                database_maintenance_stats_t* stats)
+{
+  mirror_engine_t* mirror = engine->data;
+  return database_engine_maintain(mirror->backing, budget, stats);
+}
+
+int
+database_mirror_new(database_engine_t** engine, const char* identifier)
+{
+  if(engine == NULL || identifier == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_options_t options;
+  int ret = database_options_parse(identifier, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* the backing engine gets every option but mirror=N */
+  size_t limit = options.mirror;
+  char* backing_identifier = NULL;
+  options.mirror = 0;
+  if(limit == 0)
+    ret = ERROR_INVALID_ARGUMENTS;
+  else
+    ret = database_options_format(&options, &backing_identifier);
+  database_options_free(&options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  mirror_engine_t* mirror = NULL;
+  if(requestMemory((void**)&mirror, sizeof(mirror_engine_t)) != ERROR_OK){
+    freeMemory(backing_identifier);
+    return ERROR_MEMORY;
+  }
+  mirror->backing = NULL;
+  mirror->values = NULL;
+  mirror->domains = NULL;
+  mirror->limit = limit;
+
+  ret = database_engine_open(&mirror->backing, backing_identifier);
+  freeMemory(backing_identifier);
+  if(ret == ERROR_OK)
+    ret = keymap_new(&mirror->values);
+  if(ret == ERROR_OK)
+    ret = keymap_new(&mirror->domains);
+  if(ret == ERROR_OK &&
+     requestMemory((void**)engine, sizeof(database_engine_t)) != ERROR_OK)
+    ret = ERROR_MEMORY;
+  if(ret != ERROR_OK){
+    if(mirror->backing != NULL)
+      database_engine_close(mirror->backing);
+    keymap_free(mirror->values);
+    keymap_free(mirror->domains);
+    freeMemory(mirror);
+    return ret;
+  }
+
+  (*engine)->close = mirror_close;
+  (*engine)->get_type = mirror_get_type;
+  (*engine)->enum_keys = mirror_enum_keys;
+  (*engine)->enum_domains = mirror_enum_domains;
+  (*engine)->get_int64 = mirror_get_int64;
+  (*engine)->set_int64 = mirror_set_int64;
+  (*engine)->get_double = mirror_get_double;
+  (*engine)->set_double = mirror_set_double;
+  (*engine)->get_string = mirror_get_string;
+  (*engine)->set_string = mirror_set_string;
+  (*engine)->get_blob = mirror_get_blob;
+  (*engine)->set_blob = mirror_set_blob;
+  (*engine)->get_blob_chunk = mirror_get_blob_chunk;
+  (*engine)->get_blob_to_fd = mirror_get_blob_to_fd;
+  (*engine)->set_blob_from_fd = mirror_set_blob_from_fd;
+  (*engine)->get_settings = mirror_get_settings;
+  (*engine)->release_memory = mirror_release_memory;
+  (*engine)->backup = mirror_backup;
+  (*engine)->maintain = mirror_maintain;
+  (*engine)->readonly = mirror->backing->readonly;
+  (*engine)->data = mirror;
+
+  return ERROR_OK;
+}
+
+int
+database_mirror_mirrored(database_engine_t* engine, const char* domain,
+                         int* mirrored)
+{
+  if(engine == NULL || engine->close != mirror_close || domain == NULL ||
+     strlen(domain) == 0 || mirrored == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *mirrored = mirroredDomain(engine, domain);
+  return ERROR_OK;
+}
+
+/**
+ * tells whether a domain is served from memory, loads it on first use
+ *
+ * @param[in] engine The mirroring engine
+ * @param[in] domain The domain
+ */
+int
+mirroredDomain(database_engine_t* engine, const char* domain)
+{
+  mirror_engine_t* mirror = engine->data;
+  if(domain == NULL || strlen(domain) == 0)
+    return 0;
+
+  keymap_entry_t* entry = NULL;
+  if(keymap_find(mirror->domains, domain, MIRROR_STATE_KEY, &entry) == ERROR_OK)
+    return entry->value.integer != MIRROR_PASS_THROUGH;
+
+  /* a failed load is retried on the next access */
+  int64_t state = MIRROR_PASS_THROUGH;
+  if(loadMirrorDomain(mirror, domain, &state) != ERROR_OK)
+    return 0;
+  if(keymap_set(mirror->domains, domain, MIRROR_STATE_KEY, DATABASE_TYPE_INT64,
+                &state, 0) != ERROR_OK){
+    forgetMirrorDomain(mirror, domain);
+    return 0;
+  }
+
+  return state != MIRROR_PASS_THROUGH;
+}
+
+/**
+ * copies all values of a domain into memory, unless the domain has too many
+ * keys or too large blobs
+ *
+ * @param[in] mirror The mirror
+ * @param[in] domain The domain
+ * @param[out] state Number of keys or MIRROR_PASS_THROUGH
+ */
+int
+loadMirrorDomain(mirror_engine_t* mirror, const char* domain, int64_t* state)
+{
+  size_t count = 0;
+  size_t size = 0;
+  char* keys = NULL;
+  int ret = database_engine_enum_keys(mirror->backing, domain, "*", &count,
+                                      &size, &keys);
+  if(ret != ERROR_OK){
+    freeMemory(keys);
+    return ret;
+  }
+
+  *state = MIRROR_PASS_THROUGH;
+  if(count > mirror->limit){
+    freeMemory(keys);
+    return ERROR_OK;
+  }
+
+  const char* key = keys;
+  int fits = 1;
+  size_t i = 0;
+  for(; ret == ERROR_OK && fits && i < count; i++){
+    ret = loadMirrorValue(mirror, domain, key, &fits);
+    key += strlen(key) + 1;
+  }
+  freeMemory(keys);
+
+  /* half a domain would answer with wrong ERROR_DATABASE_NO_SUCH_KEYs */
+  if(ret != ERROR_OK || !fits){
+    forgetMirrorDomain(mirror, domain);
+    return ret;
+  }
+
+  *state = count;
+  return ERROR_OK;
+}
+
+/**
+ * copies one value of the backing engine into memory
+ *
+ * @param[in] mirror The mirror
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] fits 0 if the value is a blob larger than DATABASE_MIRROR_BLOB_MAX
+ */
+int
+loadMirrorValue(mirror_engine_t* mirror, const char* domain, const char* key,
+                int* fits)
+{
+  database_value_type_t type;
+  int ret = database_engine_get_type(mirror->backing, domain, key, &type);
+  if(ret != ERROR_OK)
+    return ret;
+
+  int64_t integer = 0;
+  double dob = 0.0;
+  char* string = NULL;
+  unsigned char* blob = NULL;
+  size_t size = 0;
+  size_t total = 0;
+  switch(type){
+    case DATABASE_TYPE_INT64:
+      ret = database_engine_get_int64(mirror->backing, domain, key, &integer);
+      if(ret == ERROR_OK)
+        ret = keymap_set(mirror->values, domain, key, type, &integer, 0);
+      return ret;
+
+    case DATABASE_TYPE_DOUBLE:
+      ret = database_engine_get_double(mirror->backing, domain, key, &dob);
+      if(ret == ERROR_OK)
+        ret = keymap_set(mirror->values, domain, key, type, &dob, 0);
+      return ret;
+
+    case DATABASE_TYPE_STRING:
+      ret = database_engine_get_string(mirror->backing, domain, key, &string);
+      if(ret == ERROR_OK)
+        ret = keymap_set(mirror->values, domain, key, type, string, 0);
+      freeMemory(string);
+      return ret;
+
+    case DATABASE_TYPE_BLOB:
+      /* the first byte tells the size without reading the blob */
+      ret = database_engine_get_blob_chunk(mirror->backing, domain, key, 0, 1,
+                                           &blob, &size, &total);
+      freeMemory(blob);
+      blob = NULL;
+      if(ret != ERROR_OK)
+        return ret;
+      if(total > DATABASE_MIRROR_BLOB_MAX){
+        *fits = 0;
+        return ERROR_OK;
+      }
+
+      ret = database_engine_get_blob(mirror->backing, domain, key, &blob, &size);
+      if(ret == ERROR_OK)
+        ret = keymap_set(mirror->values, domain, key, type, blob, size);
+      freeMemory(blob);
+      return ret;
+
+    default:
+      return ERROR_DATABASE_TYPE_UNKNOWN;
+  }
+}
+
+/**
+ * drops the values and the state of a domain, the next access loads it again
+ *
+ * @param[in] mirror The mirror
+ * @param[in] domain The domain
+ */
+void
+forgetMirrorDomain(mirror_engine_t* mirror, const char* domain)
+{
+  if(domain == NULL || strlen(domain) == 0)
+    return;
+
+  keymap_remove(mirror->domains, domain, MIRROR_STATE_KEY);
+
+  size_t count = 0;
+  size_t size = 0;
+  char* keys = NULL;
+  if(keymap_enum(mirror->values, domain, "*", &count, &size, &keys) != ERROR_OK)
+    return;
+
+  const char* key = keys;
+  size_t i = 0;
+  for(; i < count; i++){
+    keymap_remove(mirror->values, domain, key);
+    key += strlen(key) + 1;
+  }
+  freeMemory(keys);
+}
+
+/**
+ * applies a value the backing engine accepted to a mirrored domain, a domain
+ * that outgrows the limit is passed through from now on
+ *
+ * @param[in] engine The mirroring engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The type of value
+ * @param[in] value The value, like for keymap_set
+ * @param[in] size Size of a blob
+ */
+void
+updateMirror(database_engine_t* engine, const char* domain, const char* key,
+             database_value_type_t type, const void* value, size_t size)
+{
+  mirror_engine_t* mirror = engine->data;
+  keymap_entry_t* state = NULL;
+  if(keymap_find(mirror->domains, domain, MIRROR_STATE_KEY, &state) != ERROR_OK ||
+     state->value.integer == MIRROR_PASS_THROUGH)
+    return;
+
+  keymap_entry_t* entry = NULL;
+  int64_t count = state->value.integer;
+  if(keymap_find(mirror->values, domain, key, &entry) != ERROR_OK)
+    count++;
+
+  if((uint64_t)count > mirror->limit){
+    int64_t pass = MIRROR_PASS_THROUGH;
+    forgetMirrorDomain(mirror, domain);
+    if(keymap_set(mirror->domains, domain, MIRROR_STATE_KEY, DATABASE_TYPE_INT64,
+                  &pass, 0) != ERROR_OK)
+      forgetMirrorDomain(mirror, domain);
+    return;
+  }
+
+  /* keymap_set leaves the old value on failure, which is stale now */
+  if(keymap_set(mirror->values, domain, key, type, value, size) != ERROR_OK){
+    forgetMirrorDomain(mirror, domain);
+    return;
+  }
+  state->value.integer = count;
+}
+
+/**
+ * looks up the entry of a mirrored value and makes sure it has the given type
+ *
+ * @param[in] engine The mirroring engine
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The expected type
+ * @param[out] entry The entry
+ */
+int
+lookupMirrored(database_engine_t* engine, const char* domain, const char* key,
+               database_value_type_t type, keymap_entry_t** entry)
+{
+  mirror_engine_t* mirror = engine->data;
+  int ret = keymap_find(mirror->values, domain, key, entry);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if((*entry)->type != type)
+    return ERROR_DATABASE_TYPE_MISMATCH;
+
+  return ERROR_OK;
+}
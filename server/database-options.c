@@ -0,0 +1,384 @@
+/** @brief Options of a database identifier
+ *
+ * This file contains the parser for the options that can be appended to the
+ * database path of 'the registry'.
+ *
+ * @file database-options.c
+ */
+
+#include "database-options.h"
+#include "../errors.h"
+#include "../memory.h"
+#include <string.h>
+#include <stdio.h>
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int parseOption(database_options_t* options, const char* key, size_t key_size,
+                const char* value, size_t value_size);
+int optionEquals(const char* value, size_t value_size, const char* expected);
+int parseDecimal(const char* value, size_t value_size, int64_t max,
+                 int64_t* result);
+int parseKeyword(const char* value, size_t value_size, const char** names,
+                 int count, int* result);
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+static const char* journal_names[] = DATABASE_JOURNAL_NAMES;
+static const char* synchronous_names[] = DATABASE_SYNCHRONOUS_NAMES;
+static const char* temp_store_names[] = DATABASE_TEMP_STORE_NAMES;
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+database_options_parse(const char* identifier, database_options_t* options)
+{
+  if(identifier == NULL || options == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  options->path = NULL;
+  options->durability = DATABASE_DURABILITY_NORMAL;
+  options->shards = 0;
+  options->readonly = -1;
+  options->immutable = 0;
+  options->mmap_size = -1;
+  options->mirror = 0;
+  options->changelog = 0;
+  options->recover = 0;
+  options->cache_size = 0;
+  options->journal = DATABASE_JOURNAL_DEFAULT;
+  options->synchronous = DATABASE_SYNCHRONOUS_DEFAULT;
+  options->temp_store = DATABASE_TEMP_STORE_DEFAULT;
+  options->busy_timeout = -1;
+
+  const char* query = strchr(identifier, '?');
+  size_t path_size = query == NULL ? strlen(identifier) : (size_t)(query - identifier);
+
+  if(requestMemory((void**)&options->path, path_size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(options->path, identifier, path_size);
+  options->path[path_size] = '\0';
+
+  /* key=value&key=value */
+  const char* option = query == NULL ? NULL : query + 1;
+  while(option != NULL){
+    const char* end = strchr(option, '&');
+    size_t option_size = end == NULL ? strlen(option) : (size_t)(end - option);
+    const char* equals = memchr(option, '=', option_size);
+
+    int error = ERROR_INVALID_ARGUMENTS;
+    if(equals != NULL)
+      error = parseOption(options, option, equals - option, equals + 1,
+                          option_size - (equals - option) - 1);
+    if(error != ERROR_OK){
+      database_options_free(options);
+      return error;
+    }
+
+    option = end == NULL ? NULL : end + 1;
+  }
+
+  /* an immutable file can't be written, mode=rw contradicts it */
+  if(options->immutable && options->readonly == 0){
+    database_options_free(options);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+  options->readonly = options->immutable || options->readonly == 1;
+
+  return ERROR_OK;
+}
+
+/**
+ * applies a single key=value option
+ *
+ * @param[in] options The options to modify
+ * @param[in] key The key, not NUL-terminated
+ * @param[in] key_size Length of the key
+ * @param[in] value The value, not NUL-terminated
+ * @param[in] value_size Length of the value
+ */
+int
+parseOption(database_options_t* options, const char* key, size_t key_size,
+            const char* value, size_t value_size)
+{
+  if(optionEquals(key, key_size, "durability")){
+    if(optionEquals(value, value_size, "full"))
+      options->durability = DATABASE_DURABILITY_FULL;
+    else if(optionEquals(value, value_size, "normal"))
+      options->durability = DATABASE_DURABILITY_NORMAL;
+    else if(optionEquals(value, value_size, "relaxed"))
+      options->durability = DATABASE_DURABILITY_RELAXED;
+    else
+      return ERROR_INVALID_ARGUMENTS;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "shards")){
+    int64_t shards = 0;
+    if(parseDecimal(value, value_size, DATABASE_SHARDS_MAX, &shards) != ERROR_OK ||
+       shards == 0)
+      return ERROR_INVALID_ARGUMENTS;
+    options->shards = shards;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "mode")){
+    if(optionEquals(value, value_size, "ro"))
+      options->readonly = 1;
+    else if(optionEquals(value, value_size, "rw"))
+      options->readonly = 0;
+    else
+      return ERROR_INVALID_ARGUMENTS;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "immutable")){
+    if(optionEquals(value, value_size, "1"))
+      options->immutable = 1;
+    else if(optionEquals(value, value_size, "0"))
+      options->immutable = 0;
+    else
+      return ERROR_INVALID_ARGUMENTS;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "mirror")){
+    int64_t mirror = 0;
+    if(parseDecimal(value, value_size, DATABASE_MIRROR_MAX, &mirror) != ERROR_OK)
+      return ERROR_INVALID_ARGUMENTS;
+    options->mirror = mirror;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "changelog")){
+    if(optionEquals(value, value_size, "1"))
+      options->changelog = 1;
+    else if(optionEquals(value, value_size, "0"))
+      options->changelog = 0;
+    else
+      return ERROR_INVALID_ARGUMENTS;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "recover")){
+    if(optionEquals(value, value_size, "1"))
+      options->recover = 1;
+    else if(optionEquals(value, value_size, "0"))
+      options->recover = 0;
+    else
+      return ERROR_INVALID_ARGUMENTS;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "mmap_size"))
+    return parseDecimal(value, value_size, DATABASE_MMAP_SIZE_MAX,
+                        &options->mmap_size);
+
+  /* negative sizes are KiB like in SQLite, an empty cache makes no sense */
+  if(optionEquals(key, key_size, "cache_size")){
+    int negative = value_size > 0 && value[0] == '-';
+    int64_t cache_size = 0;
+    if(parseDecimal(value + negative, value_size - negative,
+                    DATABASE_CACHE_SIZE_MAX, &cache_size) != ERROR_OK ||
+       cache_size == 0)
+      return ERROR_INVALID_ARGUMENTS;
+    options->cache_size = negative ? -cache_size : cache_size;
+    return ERROR_OK;
+  }
+
+  int keyword = 0;
+  if(optionEquals(key, key_size, "journal")){
+    if(parseKeyword(value, value_size, journal_names,
+                    sizeof(journal_names) / sizeof(char*), &keyword) != ERROR_OK)
+      return ERROR_INVALID_ARGUMENTS;
+    options->journal = keyword;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "synchronous")){
+    if(parseKeyword(value, value_size, synchronous_names,
+                    sizeof(synchronous_names) / sizeof(char*), &keyword) != ERROR_OK)
+      return ERROR_INVALID_ARGUMENTS;
+    options->synchronous = keyword;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "temp_store")){
+    if(parseKeyword(value, value_size, temp_store_names,
+                    sizeof(temp_store_names) / sizeof(char*), &keyword) != ERROR_OK)
+      return ERROR_INVALID_ARGUMENTS;
+    options->temp_store = keyword;
+    return ERROR_OK;
+  }
+
+  if(optionEquals(key, key_size, "busy_timeout"))
+    return parseDecimal(value, value_size, DATABASE_BUSY_TIMEOUT_MAX,
+                        &options->busy_timeout);
+
+  return ERROR_INVALID_ARGUMENTS;
+}
+
+/**
+ * compares a not NUL-terminated option string with a NUL-terminated one
+ *
+ * @param[in] value The option string
+ * @param[in] value_size Length of @a value
+ * @param[in] expected The NUL-terminated string
+ */
+int
+optionEquals(const char* value, size_t value_size, const char* expected)
+{
+  return strlen(expected) == value_size && strncmp(value, expected, value_size) == 0;
+}
+
+/**
+ * parses a plain decimal number, no sign and no leading zeros
+ *
+ * @param[in] value The option string
+ * @param[in] value_size Length of @a value
+ * @param[in] max Largest accepted number
+ * @param[out] result The number
+ */
+int
+parseDecimal(const char* value, size_t value_size, int64_t max,
+             int64_t* result)
+{
+  if(value_size == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  int64_t number = 0;
+  size_t i = 0;
+  for(; i < value_size; i++){
+    if(value[i] < '0' || value[i] > '9' || (i == 0 && value[i] == '0' &&
+       value_size > 1))
+      return ERROR_INVALID_ARGUMENTS;
+    number = number * 10 + (value[i] - '0');
+    if(number > max)
+      return ERROR_INVALID_ARGUMENTS;
+  }
+
+  *result = number;
+  return ERROR_OK;
+}
+
+/**
+ * looks up an option string in a table of names
+ *
+ * @param[in] value The option string
+ * @param[in] value_size Length of @a value
+ * @param[in] names The accepted names
+ * @param[in] count Number of names
+ * @param[out] result Index of the name
+ */
+int
+parseKeyword(const char* value, size_t value_size, const char** names,
+             int count, int* result)
+{
+  int i = 0;
+  for(; i < count; i++){
+    if(optionEquals(value, value_size, names[i])){
+      *result = i;
+      return ERROR_OK;
+    }
+  }
+
+  return ERROR_INVALID_ARGUMENTS;
+}
+
+int
+database_options_format(const database_options_t* options, char** identifier)
+{
+  if(options == NULL || options->path == NULL || identifier == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  const char* durability = NULL;
+  if(options->durability == DATABASE_DURABILITY_FULL)
+    durability = "full";
+  else if(options->durability == DATABASE_DURABILITY_RELAXED)
+    durability = "relaxed";
+
+  /* ?durability=relaxed&shards=64&mode=ro&immutable=1&mmap_size=1099511627776
+     &mirror=1048576&changelog=1&recover=1&cache_size=-1073741824&journal=truncate&synchronous=normal
+     &temp_store=memory&busy_timeout=3600000 */
+  size_t size = strlen(options->path) + 246;
+  if(requestMemory((void**)identifier, size) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  size_t used = strlen(options->path);
+  memcpy(*identifier, options->path, used + 1);
+  char separator = '?';
+  if(durability != NULL){
+    used += snprintf(*identifier + used, size - used, "%cdurability=%s",
+                     separator, durability);
+    separator = '&';
+  }
+  if(options->shards != 0){
+    used += snprintf(*identifier + used, size - used, "%cshards=%u", separator,
+                     options->shards);
+    separator = '&';
+  }
+  if(options->readonly && !options->immutable){
+    used += snprintf(*identifier + used, size - used, "%cmode=ro", separator);
+    separator = '&';
+  }
+  if(options->immutable){
+    used += snprintf(*identifier + used, size - used, "%cimmutable=1", separator);
+    separator = '&';
+  }
+  if(options->mmap_size >= 0){
+    used += snprintf(*identifier + used, size - used, "%cmmap_size=%lld",
+                     separator, (long long)options->mmap_size);
+    separator = '&';
+  }
+  if(options->mirror != 0){
+    used += snprintf(*identifier + used, size - used, "%cmirror=%lu", separator,
+                     (unsigned long)options->mirror);
+    separator = '&';
+  }
+  if(options->changelog){
+    used += snprintf(*identifier + used, size - used, "%cchangelog=1", separator);
+    separator = '&';
+  }
+  if(options->recover){
+    used += snprintf(*identifier + used, size - used, "%crecover=1", separator);
+    separator = '&';
+  }
+  if(options->cache_size != 0){
+    used += snprintf(*identifier + used, size - used, "%ccache_size=%lld",
+                     separator, (long long)options->cache_size);
+    separator = '&';
+  }
+  if(options->journal != DATABASE_JOURNAL_DEFAULT){
+    used += snprintf(*identifier + used, size - used, "%cjournal=%s", separator,
+                     journal_names[options->journal]);
+    separator = '&';
+  }
+  if(options->synchronous != DATABASE_SYNCHRONOUS_DEFAULT){
+    used += snprintf(*identifier + used, size - used, "%csynchronous=%s",
+                     separator, synchronous_names[options->synchronous]);
+    separator = '&';
+  }
+  if(options->temp_store != DATABASE_TEMP_STORE_DEFAULT){
+    used += snprintf(*identifier + used, size - used, "%ctemp_store=%s",
+                     separator, temp_store_names[options->temp_store]);
+    separator = '&';
+  }
+  if(options->busy_timeout >= 0)
+    snprintf(*identifier + used, size - used, "%cbusy_timeout=%lld", separator,
+             (long long)options->busy_timeout);
+
+  return ERROR_OK;
+}
+
+void
+database_options_free(database_options_t* options)
+{
+  if(options == NULL)
+    return;
+
+  freeMemory(options->path);
+  options->path = NULL;
+}
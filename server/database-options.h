@@ -0,0 +1,165 @@
+#ifndef DATABASE_OPTIONS_H
+#define DATABASE_OPTIONS_H
+
+/** @brief Options of a database identifier
+ *
+ * The path passed to @ref database_open may carry options after a '?', in the
+ * usual key=value form separated by '&', e.g.
+ *
+ *    /var/lib/registry.sqlite?durability=relaxed
+ *    /srv/snapshot.sqlite?mode=ro&immutable=1&mmap_size=268435456
+ *
+ * mode=ro opens the database read-only, every set fails with @ref
+ * ERROR_DATABASE_READONLY. immutable=1 additionally promises that nobody
+ * changes the file while it is open, so SQLite skips all locking and change
+ * detection, it implies mode=ro. mmap_size=N maps up to N bytes of the file,
+ * 0 turns memory mapped I/O off. mirror=N keeps every domain with at most N
+ * keys in memory, see @ref database_mirror_new. changelog=1 records every
+ * change in a change log next to the database for followers, see @ref
+ * database_changelog_new. recover=1 checks blob files and rows against each
+ * other while the database is opened, see @ref database_recover.
+ *
+ * The remaining options are handed to SQLite as they are:
+ *
+ *    * cache_size=N       - page cache of N pages, -N for N KiB
+ *    * journal=M          - journal_mode delete, truncate, persist, memory or
+ *                           wal
+ *    * synchronous=M      - off, normal, full or extra
+ *    * temp_store=M       - default, file or memory
+ *    * busy_timeout=N     - retry a locked database for up to N milliseconds,
+ *                           5000 if not given, 0 fails at once
+ *
+ * journal and synchronous replace what durability picks for the database,
+ * blob files are still synced as durability says. Both are ignored for
+ * read-only databases. @ref database_get_settings reports the values SQLite
+ * actually uses.
+ *
+ * Unknown keys and values are rejected so that a typo never silently falls
+ * back to the defaults.
+ *
+ * @file database-options.h
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef enum database_durability_e
+{
+  DATABASE_DURABILITY_NORMAL = 0,   /* synchronous=NORMAL in WAL mode, blob fdatasync */
+  DATABASE_DURABILITY_FULL,         /* synchronous=FULL, blob and directory fsync   */
+  DATABASE_DURABILITY_RELAXED       /* synchronous=OFF, no blob sync at all          */
+} database_durability_t;
+
+typedef enum database_journal_e
+{
+  DATABASE_JOURNAL_DEFAULT = 0,     /* as durability picks */
+  DATABASE_JOURNAL_DELETE,
+  DATABASE_JOURNAL_TRUNCATE,
+  DATABASE_JOURNAL_PERSIST,
+  DATABASE_JOURNAL_MEMORY,
+  DATABASE_JOURNAL_WAL
+} database_journal_t;
+
+/** Values of the journal option, indexed by database_journal_t */
+#define DATABASE_JOURNAL_NAMES \
+  {"default", "delete", "truncate", "persist", "memory", "wal"}
+
+typedef enum database_synchronous_e
+{
+  DATABASE_SYNCHRONOUS_DEFAULT = 0, /* as durability picks */
+  DATABASE_SYNCHRONOUS_OFF,
+  DATABASE_SYNCHRONOUS_NORMAL,
+  DATABASE_SYNCHRONOUS_FULL,
+  DATABASE_SYNCHRONOUS_EXTRA
+} database_synchronous_t;
+
+/** Values of the synchronous option, indexed by database_synchronous_t */
+#define DATABASE_SYNCHRONOUS_NAMES \
+  {"default", "off", "normal", "full", "extra"}
+
+typedef enum database_temp_store_e
+{
+  DATABASE_TEMP_STORE_DEFAULT = 0,  /* as SQLite was built */
+  DATABASE_TEMP_STORE_FILE,
+  DATABASE_TEMP_STORE_MEMORY
+} database_temp_store_t;
+
+/** Values of the temp_store option, indexed by database_temp_store_t */
+#define DATABASE_TEMP_STORE_NAMES {"default", "file", "memory"}
+
+/** Largest number of shards accepted by the shards option */
+#define DATABASE_SHARDS_MAX 64
+
+/** Largest value accepted by the mirror option */
+#define DATABASE_MIRROR_MAX (1024 * 1024)
+
+/** Largest value accepted by the mmap_size option */
+#define DATABASE_MMAP_SIZE_MAX ((int64_t)1 << 40)
+
+/** Largest absolute value accepted by the cache_size option */
+#define DATABASE_CACHE_SIZE_MAX ((int64_t)1 << 30)
+
+/** Largest value accepted by the busy_timeout option, one hour */
+#define DATABASE_BUSY_TIMEOUT_MAX 3600000
+
+typedef struct database_options_s {
+  char *path;                       /* path without the options */
+  database_durability_t durability; /* durability of the handle */
+  unsigned int shards;              /* number of shards, 0 if not given */
+  int readonly;                     /* mode=ro, no set is allowed  */
+  int immutable;                    /* immutable=1, implies readonly */
+  int64_t mmap_size;                /* PRAGMA mmap_size, -1 if not given */
+  size_t mirror;                    /* keys of a mirrored domain, 0 off */
+  int changelog;                    /* changelog=1, changes are recorded */
+  int recover;                      /* recover=1, blob files are checked */
+  int64_t cache_size;               /* PRAGMA cache_size, 0 if not given */
+  database_journal_t journal;       /* PRAGMA journal_mode */
+  database_synchronous_t synchronous; /* PRAGMA synchronous */
+  database_temp_store_t temp_store; /* PRAGMA temp_store */
+  int64_t busy_timeout;             /* milliseconds, -1 if not given */
+} database_options_t;
+
+/**
+ * Splits a database identifier into the path and its options. Options that
+ * are not given keep their default.
+ *
+ * @param[in] identifier Path to the database, optionally followed by options
+ * @param[out] options The parsed options, has to be released with @ref
+ *   database_options_free
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  an option is unknown or has an invalid value
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int database_options_parse(const char* identifier, database_options_t* options);
+
+/**
+ * Builds an identifier from a path and options, the inverse of @ref
+ * database_options_parse. Options that have their default are left out.
+ *
+ * @param[in] options The options, including the path
+ * @param[out] identifier The identifier, has to be freed
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int database_options_format(const database_options_t* options, char** identifier);
+
+/**
+ * Releases the memory held by parsed options.
+ *
+ * @param[in] options Options filled by @ref database_options_parse
+ */
+void database_options_free(database_options_t* options);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // DATABASE_OPTIONS_H
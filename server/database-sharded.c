@@ -0,0 +1,510 @@
+/** @brief Sharded storage engine
+ *
+ * This file contains the storage engine of 'the registry' that spreads the
+ * domains over several SQLite databases.
+ *
+ * @file database-sharded.c
+ */
+
+#ifndef SHARDS
+#define SHARDS
+#define _XOPEN_SOURCE 500
+#include <features.h>
+#endif // SHARDS
+
+#include "database-engine.h"
+#include "database-options.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../hash.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** enough for the name of shard DATABASE_SHARDS_MAX */
+#define SHARD_NAME_SIZE 32
+
+typedef struct sharded_engine_s {
+  database_engine_t **shards;       /* one SQLite engine per shard */
+  unsigned int count;               /* number of shards            */
+} sharded_engine_t;
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int buildShardPath(const char* directory, unsigned int shard, char** result);
+int shardExists(const char* directory, unsigned int shard);
+database_engine_t* selectShard(database_engine_t* engine, const char* domain);
+void closeShards(sharded_engine_t* sharded);
+int mergeShardDomains(char** lists, size_t* sizes, unsigned int count,
+                      size_t total, char** domains);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+static int
+sharded_close(database_engine_t* engine)
+{
+  sharded_engine_t* sharded = engine->data;
+  int ret = ERROR_OK;
+  unsigned int i = 0;
+  for(; i < sharded->count; i++){
+    int error = database_engine_close(sharded->shards[i]);
+    if(ret == ERROR_OK)
+      ret = error;
+  }
+  freeMemory(sharded->shards);
+  freeMemory(sharded);
+  freeMemory(engine);
+  return ret;
+}
+
+static int
+sharded_get_type(database_engine_t* engine, const char* domain,
+                 const char* key, database_value_type_t* type)
+{
+  return database_engine_get_type(selectShard(engine, domain), domain, key, type);
+}
+
+static int
+sharded_enum_keys(database_engine_t* engine, const char* domain,
+                  const char* pattern, size_t* count, size_t* size, char** keys)
+{
+  return database_engine_enum_keys(selectShard(engine, domain), domain, pattern,
+                                   count, size, keys);
+}
+
+static int
+sharded_enum_domains(database_engine_t* engine, size_t* count, size_t* size,
+                     char** domains)
+{
+  if(count == NULL || size == NULL || domains == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  sharded_engine_t* sharded = engine->data;
+  char** lists = NULL;
+  size_t* sizes = NULL;
+  if(requestMemory((void**)&lists, sharded->count * sizeof(char*)) != ERROR_OK)
+    return ERROR_MEMORY;
+  if(requestMemory((void**)&sizes, sharded->count * sizeof(size_t)) != ERROR_OK){
+    freeMemory(lists);
+    return ERROR_MEMORY;
+  }
+
+  /* a domain lives in exactly one shard, the lists never overlap */
+  *count = 0;
+  *size = 0;
+  *domains = NULL;
+  int ret = ERROR_OK;
+  unsigned int i = 0;
+  for(; i < sharded->count; i++){
+    size_t shard_count = 0;
+    lists[i] = NULL;
+    sizes[i] = 0;
+    if(ret == ERROR_OK)
+      ret = database_engine_enum_domains(sharded->shards[i], &shard_count,
+                                         &sizes[i], &lists[i]);
+    *count += shard_count;
+    *size += sizes[i];
+  }
+
+  if(ret == ERROR_OK)
+    ret = mergeShardDomains(lists, sizes, sharded->count, *size, domains);
+  if(ret != ERROR_OK){
+    *count = 0;
+    *size = 0;
+  }
+
+  for(i = 0; i < sharded->count; i++)
+    freeMemory(lists[i]);
+  freeMemory(lists);
+  freeMemory(sizes);
+  return ret;
+}
+
+static int
+sharded_get_int64(database_engine_t* engine, const char* domain,
+                  const char* key, int64_t* value)
+{
+  return database_engine_get_int64(selectShard(engine, domain), domain, key, value);
+}
+
+static int
+sharded_set_int64(database_engine_t* engine, const char* domain,
+                  const char* key, int64_t value)
+{
+  return database_engine_set_int64(selectShard(engine, domain), domain, key, value);
+}
+
+static int
+sharded_get_double(database_engine_t* engine, const char* domain,
+                   const char* key, double* value)
+{
+  return database_engine_get_double(selectShard(engine, domain), domain, key, value);
+}
+
+static int
+sharded_set_double(database_engine_t* engine, const char* domain,
+                   const char* key, double value)
+{
+  return database_engine_set_double(selectShard(engine, domain), domain, key, value);
+}
+
+static int
+sharded_get_string(database_engine_t* engine, const char* domain,
+                   const char* key, char** value)
+{
+  return database_engine_get_string(selectShard(engine, domain), domain, key, value);
+}
+
+static int
+sharded_set_string(database_engine_t* engine, const char* domain,
+                   const char* key, const char* value)
+{
+  return database_engine_set_string(selectShard(engine, domain), domain, key, value);
+}
+
+static int
+sharded_get_blob(database_engine_t* engine, const char* domain,
+                 const char* key, unsigned char** value, size_t* size)
+{
+  return database_engine_get_blob(selectShard(engine, domain), domain, key,
+                                  value, size);
+}
+
+static int
+sharded_set_blob(database_engine_t* engine, const char* domain,
+                 const char* key, const unsigned char* value, size_t size)
+{
+  return database_engine_set_blob(selectShard(engine, domain), domain, key,
+                                  value, size);
+}
+
+static int
+sharded_get_blob_chunk(database_engine_t* engine, const char* domain,
+                       const char* key, size_t offset, size_t length,
+                       unsigned char** value, size_t* size, size_t* total)
+{
+  return database_engine_get_blob_chunk(selectShard(engine, domain), domain,
+                                        key, offset, length, value, size, total);
+}
+
+static int
+sharded_get_blob_to_fd(database_engine_t* engine, const char* domain,
+                       const char* key, int fd, size_t* size)
+{
+  return database_engine_get_blob_to_fd(selectShard(engine, domain), domain,
+                                        key, fd, size);
+}
+
+static int
+sharded_set_blob_from_fd(database_engine_t* engine, const char* domain,
+                         const char* key, int fd)
+{
+  return database_engine_set_blob_from_fd(selectShard(engine, domain), domain,
+                                          key, fd);
+}
+
+/* every shard is opened with the same options */
+static int
+sharded_get_settings(database_engine_t* engine, char** settings)
+{
+  sharded_engine_t* sharded = engine->data;
+  return database_engine_get_settings(sharded->shards[0], settings);
+}
+
+static int
+sharded_release_memory(database_engine_t* engine, size_t* released)
+{
+  sharded_engine_t* sharded = engine->data;
+  int ret = ERROR_OK;
+  unsigned int shard = 0;
+  for(; shard < sharded->count; shard++){
+    size_t shard_released = 0;
+    int shard_ret = database_engine_release_memory(sharded->shards[shard],
+                                                   &shard_released);
+    *released += shard_released;
+    if(shard_ret != ERROR_OK)
+      ret = shard_ret;
+  }
+  return ret;
+}
+
+/* the backup is a shard directory of its own, one shard after the other */
+static int
+sharded_backup(database_engine_t* engine, const char* path,
+               database_backup_callback_t callback, void* context)
+{
+  sharded_engine_t* sharded = engine->data;
+  if(mkdir(path, 0777) != 0 && errno != EEXIST)
+    return ERROR_DATABASE_IO;
+
+  int ret = ERROR_OK;
+  unsigned int shard = 0;
+  for(; ret == ERROR_OK && shard < sharded->count; shard++){
+    char* shard_path = NULL;
+    ret = buildShardPath(path, shard, &shard_path);
+    if(ret == ERROR_OK)
+      ret = database_engine_backup(sharded->shards[shard], shard_path,
+                                   callback, context);
+    freeMemory(shard_path);
+  }
+  return ret;
+}
+
+/* every shard gets the whole budget, the stats are summed up */
+static int
+sharded_maintain(database_engine_t* engine, const database_maintenance_t* budget,
+                 database_maintenance_stats_t* stats)
+{
+  sharded_engine_t* sharded = engine->data;
+  memset(stats, 0, sizeof(database_maintenance_stats_t));
+
+  int ret = ERROR_OK;
+  unsigned int shard = 0;
+  for(; ret == ERROR_OK && shard < sharded->count; shard++){
+    database_maintenance_stats_t shard_stats;
+    ret = database_engine_maintain(sharded->shards[shard], budget, &shard_stats);
+    if(ret != ERROR_OK)
+      break;
+    stats->pages_freed += shard_stats.pages_freed;
+    stats->free_pages += shard_stats.free_pages;
+    stats->blobs_checked += shard_stats.blobs_checked;
+    stats->blobs_removed += shard_stats.blobs_removed;
+    stats->optimized |= shard_stats.optimized;
+  }
+  return ret;
+}
+
+int
+database_sharded_new(database_engine_t** engine, const char* identifier)
+{
+  if(engine == NULL || identifier == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_options_t options;
+  int ret = database_options_parse(identifier, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  struct stat sb;
+  if(stat(options.path, &sb) != 0 || !S_ISDIR(sb.st_mode)){
+    database_options_free(&options);
+    return ERROR_DATABASE_OPEN;
+  }
+
+  /* without shards=N the directory tells how many there are */
+  unsigned int count = options.shards;
+  if(count == 0){
+    while(count < DATABASE_SHARDS_MAX && shardExists(options.path, count))
+      count++;
+  }
+
+  /* routing depends on the count, a different one would lose domains */
+  if(count == 0 || !shardExists(options.path, count - 1)){
+    database_options_free(&options);
+    return ERROR_DATABASE_OPEN;
+  }
+  if(shardExists(options.path, count)){
+    database_options_free(&options);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  sharded_engine_t* sharded = NULL;
+  if(requestMemory((void**)&sharded, sizeof(sharded_engine_t)) != ERROR_OK){
+    database_options_free(&options);
+    return ERROR_MEMORY;
+  }
+  sharded->count = 0;
+  if(requestMemory((void**)&sharded->shards, count * sizeof(database_engine_t*)) != ERROR_OK){
+    freeMemory(sharded);
+    database_options_free(&options);
+    return ERROR_MEMORY;
+  }
+
+  /* every shard is a database of its own with the same options */
+  database_options_t shard = options;
+  shard.shards = 0;
+  for(; sharded->count < count; sharded->count++){
+    char* path = NULL;
+    char* shard_identifier = NULL;
+    ret = buildShardPath(options.path, sharded->count, &path);
+    if(ret == ERROR_OK){
+      shard.path = path;
+      ret = database_options_format(&shard, &shard_identifier);
+      freeMemory(path);
+    }
+    if(ret == ERROR_OK)
+      ret = database_sqlite_new(&sharded->shards[sharded->count], shard_identifier);
+    freeMemory(shard_identifier);
+    if(ret != ERROR_OK)
+      break;
+  }
+  int readonly = options.readonly;
+  database_options_free(&options);
+
+  if(ret == ERROR_OK &&
+     requestMemory((void**)engine, sizeof(database_engine_t)) != ERROR_OK)
+    ret = ERROR_MEMORY;
+  if(ret != ERROR_OK){
+    closeShards(sharded);
+    return ret;
+  }
+
+  (*engine)->close = sharded_close;
+  (*engine)->get_type = sharded_get_type;
+  (*engine)->enum_keys = sharded_enum_keys;
+  (*engine)->enum_domains = sharded_enum_domains;
+  (*engine)->get_int64 = sharded_get_int64;
+  (*engine)->set_int64 = sharded_set_int64;
+  (*engine)->get_double = sharded_get_double;
+  (*engine)->set_double = sharded_set_double;
+  (*engine)->get_string = sharded_get_string;
+  (*engine)->set_string = sharded_set_string;
+  (*engine)->get_blob = sharded_get_blob;
+  (*engine)->set_blob = sharded_set_blob;
+  (*engine)->get_blob_chunk = sharded_get_blob_chunk;
+  (*engine)->get_blob_to_fd = sharded_get_blob_to_fd;
+  (*engine)->set_blob_from_fd = sharded_set_blob_from_fd;
+  (*engine)->get_settings = sharded_get_settings;
+  (*engine)->release_memory = sharded_release_memory;
+  (*engine)->backup = sharded_backup;
+  (*engine)->maintain = sharded_maintain;
+  (*engine)->readonly = readonly;
+  (*engine)->data = sharded;
+
+  return ERROR_OK;
+}
+
+int
+database_sharded_select(database_engine_t* engine, const char* domain,
+                        unsigned int* shard)
+{
+  if(engine == NULL || engine->close != sharded_close || domain == NULL ||
+     strlen(domain) == 0 || shard == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  sharded_engine_t* sharded = engine->data;
+  database_engine_t* selected = selectShard(engine, domain);
+  for(*shard = 0; sharded->shards[*shard] != selected; (*shard)++);
+  return ERROR_OK;
+}
+
+/**
+ * builds the path of a shard inside the shard directory
+ *
+ * @param[in] directory The shard directory
+ * @param[in] shard Number of the shard
+ * @param[out] result The path, has to be freed
+ */
+int
+buildShardPath(const char* directory, unsigned int shard, char** result)
+{
+  size_t size = strlen(directory) + SHARD_NAME_SIZE;
+  if(requestMemory((void**)result, size) != ERROR_OK)
+    return ERROR_MEMORY;
+  snprintf(*result, size, "%s/" DATABASE_SHARD_NAME, directory, shard);
+  return ERROR_OK;
+}
+
+/**
+ * checks whether a shard directory contains a shard
+ *
+ * @param[in] directory The shard directory
+ * @param[in] shard Number of the shard
+ */
+int
+shardExists(const char* directory, unsigned int shard)
+{
+  char* path = NULL;
+  if(buildShardPath(directory, shard, &path) != ERROR_OK)
+    return 0;
+
+  struct stat sb;
+  int exists = stat(path, &sb) == 0;
+  freeMemory(path);
+  return exists;
+}
+
+/**
+ * picks the shard of a domain by the FNV-1a hash of its name. Invalid
+ * domains go to the first shard, which rejects them like every database.
+ *
+ * @param[in] engine The sharded engine
+ * @param[in] domain The domain
+ */
+database_engine_t*
+selectShard(database_engine_t* engine, const char* domain)
+{
+  sharded_engine_t* sharded = engine->data;
+  if(domain == NULL)
+    return sharded->shards[0];
+
+  uint32_t hash = hash_fnv1a(HASH_FNV1A_BASIS, domain, strlen(domain));
+  return sharded->shards[hash % sharded->count];
+}
+
+/**
+ * merges the sorted domain lists of all shards into one sorted list
+ *
+ * @param[in] lists The domains of every shard, separated by \c 0s
+ * @param[in] sizes Size of every list
+ * @param[in] count Number of lists
+ * @param[in] total Sum of all sizes
+ * @param[out] domains The merged domains, NULL if there are none
+ */
+int
+mergeShardDomains(char** lists, size_t* sizes, unsigned int count,
+                  size_t total, char** domains)
+{
+  *domains = NULL;
+  if(total == 0)
+    return ERROR_OK;
+
+  size_t* used = NULL;
+  if(requestMemory((void**)&used, count * sizeof(size_t)) != ERROR_OK)
+    return ERROR_MEMORY;
+  if(requestMemory((void**)domains, total) != ERROR_OK){
+    freeMemory(used);
+    return ERROR_MEMORY;
+  }
+  memset(used, 0, count * sizeof(size_t));
+
+  /* always take the smallest head of all lists */
+  size_t position = 0;
+  while(position < total){
+    unsigned int next = count;
+    unsigned int i = 0;
+    for(; i < count; i++){
+      if(used[i] < sizes[i] && (next == count ||
+         strcmp(lists[i] + used[i], lists[next] + used[next]) < 0))
+        next = i;
+    }
+    size_t length = strlen(lists[next] + used[next]) + 1;
+    memcpy(*domains + position, lists[next] + used[next], length);
+    position += length;
+    used[next] += length;
+  }
+
+  freeMemory(used);
+  return ERROR_OK;
+}
+
+/**
+ * closes the shards opened so far and frees the engine data
+ *
+ * @param[in] sharded The engine data
+ */
+void
+closeShards(sharded_engine_t* sharded)
+{
+  unsigned int i = 0;
+  for(; i < sharded->count; i++)
+    database_engine_close(sharded->shards[i]);
+  freeMemory(sharded->shards);
+  freeMemory(sharded);
+}
@@ -0,0 +1,344 @@
+/** @brief Compiling snapshots
+ *
+ * This file contains the compiler of the snapshots of 'the registry'.
+ *
+ * @file database-snapshot.c
+ */
+
+#ifndef PWRITE
+#define PWRITE
+#define _XOPEN_SOURCE 500
+#include <features.h>
+#endif // PWRITE
+
+#include "database-snapshot.h"
+#include "../registry/snapshot.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../hash.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+typedef struct snapshot_writer_s {
+  int fd;                           /* the temporary snapshot           */
+  uint64_t position;                /* end of the values written so far */
+  snapshot_entry_t *entries;        /* entries, names relative to names */
+  uint64_t count;                   /* number of entries                */
+  char *names;                      /* domain\0key\0 of every entry     */
+  size_t names_size;                /* size of names                    */
+} snapshot_writer_t;
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int compileDomain(database_engine_t* engine, snapshot_writer_t* writer,
+                  const char* domain);
+int compileValue(database_engine_t* engine, snapshot_writer_t* writer,
+                 const char* domain, const char* key);
+int appendSnapshotEntry(snapshot_writer_t* writer, const char* domain,
+                        const char* key, snapshot_entry_t* entry);
+int finishSnapshot(snapshot_writer_t* writer, uint64_t generation);
+int writeSnapshotData(int fd, const void* data, size_t size);
+uint64_t previousGeneration(const char* path);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+database_snapshot_compile(database_engine_t* engine, const char* domain,
+                          const char* path)
+{
+  if(engine == NULL || path == NULL || strlen(path) == 0 ||
+     (domain != NULL && strlen(domain) == 0))
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* one domain or all of them, in both cases separated by 0s */
+  size_t count = 0;
+  size_t size = 0;
+  char* domains = NULL;
+  int ret = ERROR_OK;
+  if(domain != NULL){
+    count = 1;
+    size = strlen(domain) + 1;
+    if(requestMemory((void**)&domains, size) != ERROR_OK)
+      return ERROR_MEMORY;
+    memcpy(domains, domain, size);
+  }else{
+    ret = database_engine_enum_domains(engine, &count, &size, &domains);
+    if(ret != ERROR_OK)
+      return ret;
+  }
+
+  char* temporary = NULL;
+  size_t temporary_size = strlen(path) + sizeof(DATABASE_SNAPSHOT_TEMPORARY);
+  if(requestMemory((void**)&temporary, temporary_size) != ERROR_OK){
+    freeMemory(domains);
+    return ERROR_MEMORY;
+  }
+  snprintf(temporary, temporary_size, "%s" DATABASE_SNAPSHOT_TEMPORARY, path);
+
+  snapshot_writer_t writer;
+  writer.position = sizeof(snapshot_header_t);
+  writer.entries = NULL;
+  writer.count = 0;
+  writer.names = NULL;
+  writer.names_size = 0;
+  writer.fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(writer.fd < 0 || lseek(writer.fd, writer.position, SEEK_SET) < 0)
+    ret = ERROR_DATABASE_IO;
+
+  /* sorted domains with sorted keys give a sorted entry table */
+  const char* current = domains;
+  size_t i = 0;
+  for(; ret == ERROR_OK && i < count; i++){
+    ret = compileDomain(engine, &writer, current);
+    current += strlen(current) + 1;
+  }
+  freeMemory(domains);
+
+  if(ret == ERROR_OK)
+    ret = finishSnapshot(&writer, previousGeneration(path) + 1);
+  if(writer.fd >= 0 && close(writer.fd) != 0 && ret == ERROR_OK)
+    ret = ERROR_DATABASE_IO;
+  freeMemory(writer.entries);
+  freeMemory(writer.names);
+
+  /* readers of the old generation keep their mapping of the old file */
+  if(ret == ERROR_OK && rename(temporary, path) != 0)
+    ret = ERROR_DATABASE_IO;
+  if(ret != ERROR_OK)
+    unlink(temporary);
+  freeMemory(temporary);
+  return ret;
+}
+
+/**
+ * appends all values of a domain to the snapshot
+ *
+ * @param[in] engine The engine
+ * @param[in] writer The snapshot
+ * @param[in] domain The domain
+ */
+int
+compileDomain(database_engine_t* engine, snapshot_writer_t* writer,
+              const char* domain)
+{
+  size_t count = 0;
+  size_t size = 0;
+  char* keys = NULL;
+  int ret = database_engine_enum_keys(engine, domain, "*", &count, &size, &keys);
+  if(ret != ERROR_OK){
+    freeMemory(keys);
+    return ret;
+  }
+
+  const char* key = keys;
+  size_t i = 0;
+  for(; ret == ERROR_OK && i < count; i++){
+    ret = compileValue(engine, writer, domain, key);
+    key += strlen(key) + 1;
+  }
+
+  freeMemory(keys);
+  return ret;
+}
+
+/**
+ * appends a value to the snapshot, numbers go into the entry, strings and
+ * blobs behind the values written so far
+ *
+ * @param[in] engine The engine
+ * @param[in] writer The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ */
+int
+compileValue(database_engine_t* engine, snapshot_writer_t* writer,
+             const char* domain, const char* key)
+{
+  database_value_type_t type;
+  int ret = database_engine_get_type(engine, domain, key, &type);
+  if(ret != ERROR_OK)
+    return ret;
+
+  snapshot_entry_t entry;
+  memset(&entry, 0, sizeof(snapshot_entry_t));
+  entry.type = type;
+
+  int64_t integer = 0;
+  double dob = 0.0;
+  char* string = NULL;
+  size_t size = 0;
+  switch(type){
+    case DATABASE_TYPE_INT64:
+      ret = database_engine_get_int64(engine, domain, key, &integer);
+      memcpy(&entry.value, &integer, sizeof(int64_t));
+      break;
+
+    case DATABASE_TYPE_DOUBLE:
+      ret = database_engine_get_double(engine, domain, key, &dob);
+      memcpy(&entry.value, &dob, sizeof(double));
+      break;
+
+    case DATABASE_TYPE_STRING:
+      ret = database_engine_get_string(engine, domain, key, &string);
+      if(ret != ERROR_OK)
+        break;
+      size = strlen(string) + 1;
+      ret = writeSnapshotData(writer->fd, string, size);
+      freeMemory(string);
+      break;
+
+    case DATABASE_TYPE_BLOB:
+      /* straight from the engine into the file */
+      ret = database_engine_get_blob_to_fd(engine, domain, key, writer->fd, &size);
+      break;
+
+    default:
+      return ERROR_DATABASE_TYPE_UNKNOWN;
+  }
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(type == DATABASE_TYPE_STRING || type == DATABASE_TYPE_BLOB){
+    entry.value = writer->position;
+    entry.size = size;
+    writer->position += size;
+  }
+
+  return appendSnapshotEntry(writer, domain, key, &entry);
+}
+
+/**
+ * appends an entry and its name to the writer
+ *
+ * @param[in] writer The snapshot
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] entry The entry, its name is filled in
+ */
+int
+appendSnapshotEntry(snapshot_writer_t* writer, const char* domain,
+                    const char* key, snapshot_entry_t* entry)
+{
+  size_t domain_size = strlen(domain);
+  size_t key_size = strlen(key);
+  if(domain_size > UINT32_MAX || key_size > UINT32_MAX)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(editMemory((void**)&writer->entries,
+                (writer->count + 1) * sizeof(snapshot_entry_t)) != ERROR_OK){
+    writer->entries = NULL;
+    return ERROR_MEMORY;
+  }
+  if(editMemory((void**)&writer->names,
+                writer->names_size + domain_size + key_size + 2) != ERROR_OK){
+    writer->names = NULL;
+    return ERROR_MEMORY;
+  }
+
+  entry->name = writer->names_size;
+  entry->domain_size = domain_size;
+  entry->key_size = key_size;
+  memcpy(writer->names + writer->names_size, domain, domain_size + 1);
+  memcpy(writer->names + writer->names_size + domain_size + 1, key, key_size + 1);
+  writer->names_size += domain_size + key_size + 2;
+  writer->entries[writer->count++] = *entry;
+  return ERROR_OK;
+}
+
+/**
+ * writes names, entry table and header behind the values and syncs the file
+ *
+ * @param[in] writer The snapshot
+ * @param[in] generation The generation of the snapshot
+ */
+int
+finishSnapshot(snapshot_writer_t* writer, uint64_t generation)
+{
+  snapshot_header_t header;
+  memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+  header.generation = generation;
+  header.count = writer->count;
+  header.names = writer->position;
+  header.table = (header.names + writer->names_size + 7) & ~(uint64_t)7;
+
+  uint64_t i = 0;
+  for(; i < writer->count; i++)
+    writer->entries[i].name += header.names;
+
+  const unsigned char padding[8] = {0};
+  size_t padding_size = header.table - header.names - writer->names_size;
+  size_t table_size = writer->count * sizeof(snapshot_entry_t);
+
+  /* FNV-1a over everything behind the values */
+  header.checksum = HASH_FNV1A64_BASIS;
+  const unsigned char* parts[3] = {(const unsigned char*)writer->names, padding,
+                                   (const unsigned char*)writer->entries};
+  size_t sizes[3] = {writer->names_size, padding_size, table_size};
+  unsigned int part = 0;
+  for(; part < 3; part++)
+    header.checksum = hash_fnv1a64(header.checksum, parts[part], sizes[part]);
+
+  for(part = 0; part < 3; part++){
+    if(sizes[part] > 0 && writeSnapshotData(writer->fd, parts[part], sizes[part]) != ERROR_OK)
+      return ERROR_DATABASE_IO;
+  }
+  if(pwrite(writer->fd, &header, sizeof(snapshot_header_t), 0) !=
+     (ssize_t)sizeof(snapshot_header_t) || fsync(writer->fd) != 0)
+    return ERROR_DATABASE_IO;
+
+  return ERROR_OK;
+}
+
+/**
+ * writes all of data at the current position of fd
+ *
+ * @param[in] fd The file descriptor
+ * @param[in] data The data
+ * @param[in] size The size of data
+ */
+int
+writeSnapshotData(int fd, const void* data, size_t size)
+{
+  const unsigned char* position = data;
+  while(size > 0){
+    ssize_t written = write(fd, position, size);
+    if(written < 0){
+      if(errno == EINTR)
+        continue;
+      return ERROR_DATABASE_IO;
+    }
+    position += written;
+    size -= written;
+  }
+  return ERROR_OK;
+}
+
+/**
+ * reads the generation of an existing snapshot, 0 if there is none
+ *
+ * @param[in] path Path of the snapshot
+ */
+uint64_t
+previousGeneration(const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return 0;
+
+  snapshot_header_t header;
+  ssize_t length = pread(fd, &header, sizeof(snapshot_header_t), 0);
+  close(fd);
+  if(length != (ssize_t)sizeof(snapshot_header_t) ||
+     memcmp(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+    return 0;
+
+  return header.generation;
+}
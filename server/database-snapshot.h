@@ -0,0 +1,46 @@
+#ifndef DATABASE_SNAPSHOT_H
+#define DATABASE_SNAPSHOT_H
+
+/** @brief Compiling snapshots
+ *
+ * Writes the values of a storage engine into a snapshot file, the format is
+ * described in registry/snapshot.h. The snapshot is written next to its
+ * destination and renamed over it once complete, so readers that still map
+ * the previous generation keep a consistent file.
+ *
+ * @file database-snapshot.h
+ */
+
+#include "database-engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** Suffix of the file a snapshot is written to before the rename */
+#define DATABASE_SNAPSHOT_TEMPORARY ".tmp"
+
+/**
+ * Compiles one domain or all domains of an engine into a snapshot. If @a
+ * path already is a snapshot, the new one gets its generation plus one,
+ * otherwise generation 1.
+ *
+ * @param[in] engine The engine
+ * @param[in] domain The domain, NULL for all domains
+ * @param[in] path Path of the snapshot
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_IO Writing the snapshot failed
+ * @return @ref ERROR_MEMORY Out of memory
+ * @return Any error code of the engine's enum_domains, enum_keys and get
+ *  functions
+ */
+int database_snapshot_compile(database_engine_t* engine, const char* domain,
+    const char* path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // DATABASE_SNAPSHOT_H
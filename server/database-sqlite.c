@@ -0,0 +1,191 @@
+/** @brief SQLite storage engine
+ *
+ * This file adapts the SQLite database of 'the registry' to the storage
+ * engine interface.
+ *
+ * @file database-sqlite.c
+ */
+
+#include "database-engine.h"
+#include "database.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../datastructure.h"
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+static int
+sqlite_close(database_engine_t* engine)
+{
+  int ret = database_close(engine->data);
+  freeMemory(engine);
+  return ret;
+}
+
+static int
+sqlite_get_type(database_engine_t* engine, const char* domain, const char* key,
+                database_value_type_t* type)
+{
+  return database_get_type(engine->data, domain, key, type);
+}
+
+static int
+sqlite_enum_keys(database_engine_t* engine, const char* domain,
+                 const char* pattern, size_t* count, size_t* size, char** keys)
+{
+  return database_enum_keys(engine->data, domain, pattern, count, size, keys);
+}
+
+static int
+sqlite_enum_domains(database_engine_t* engine, size_t* count, size_t* size,
+                    char** domains)
+{
+  return database_enum_domains(engine->data, count, size, domains);
+}
+
+static int
+sqlite_get_int64(database_engine_t* engine, const char* domain, const char* key,
+                 int64_t* value)
+{
+  return database_get_int64(engine->data, domain, key, value);
+}
+
+static int
+sqlite_set_int64(database_engine_t* engine, const char* domain, const char* key,
+                 int64_t value)
+{
+  return database_set_int64(engine->data, domain, key, value);
+}
+
+static int
+sqlite_get_double(database_engine_t* engine, const char* domain,
+                  const char* key, double* value)
+{
+  return database_get_double(engine->data, domain, key, value);
+}
+
+static int
+sqlite_set_double(database_engine_t* engine, const char* domain,
+                  const char* key, double value)
+{
+  return database_set_double(engine->data, domain, key, value);
+}
+
+static int
+sqlite_get_string(database_engine_t* engine, const char* domain,
+                  const char* key, char** value)
+{
+  return database_get_string(engine->data, domain, key, value);
+}
+
+static int
+sqlite_set_string(database_engine_t* engine, const char* domain,
+                  const char* key, const char* value)
+{
+  return database_set_string(engine->data, domain, key, value);
+}
+
+static int
+sqlite_get_blob(database_engine_t* engine, const char* domain, const char* key,
+                unsigned char** value, size_t* size)
+{
+  return database_get_blob(engine->data, domain, key, value, size);
+}
+
+static int
+sqlite_set_blob(database_engine_t* engine, const char* domain, const char* key,
+                const unsigned char* value, size_t size)
+{
+  return database_set_blob(engine->data, domain, key, value, size);
+}
+
+static int
+sqlite_get_blob_chunk(database_engine_t* engine, const char* domain,
+                      const char* key, size_t offset, size_t length,
+                      unsigned char** value, size_t* size, size_t* total)
+{
+  return database_get_blob_chunk(engine->data, domain, key, offset, length,
+                                 value, size, total);
+}
+
+static int
+sqlite_get_blob_to_fd(database_engine_t* engine, const char* domain,
+                      const char* key, int fd, size_t* size)
+{
+  return database_get_blob_to_fd(engine->data, domain, key, fd, size);
+}
+
+static int
+sqlite_set_blob_from_fd(database_engine_t* engine, const char* domain,
+                        const char* key, int fd)
+{
+  return database_set_blob_from_fd(engine->data, domain, key, fd);
+}
+
+static int
+sqlite_get_settings(database_engine_t* engine, char** settings)
+{
+  return database_get_settings(engine->data, settings);
+}
+
+static int
+sqlite_release_memory(database_engine_t* engine, size_t* released)
+{
+  return database_release_memory(engine->data, released);
+}
+
+static int
+sqlite_backup(database_engine_t* engine, const char* path,
+              database_backup_callback_t callback, void* context)
+{
+  return database_backup(engine->data, path, callback, context);
+}
+
+static int
+sqlite_maintain(database_engine_t* engine, const database_maintenance_t* budget,
+                database_maintenance_stats_t* stats)
+{
+  return database_maintain(engine->data, budget, stats);
+}
+
+int
+database_sqlite_new(database_engine_t** engine, const char* path)
+{
+  if(engine == NULL || path == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_handle_t* db = NULL;
+  int ret = database_open(&db, path);
+  if(ret != ERROR_OK)
+    return ret;
+
+  if(requestMemory((void**)engine, sizeof(database_engine_t)) != ERROR_OK){
+    database_close(db);
+    return ERROR_MEMORY;
+  }
+
+  (*engine)->close = sqlite_close;
+  (*engine)->get_type = sqlite_get_type;
+  (*engine)->enum_keys = sqlite_enum_keys;
+  (*engine)->enum_domains = sqlite_enum_domains;
+  (*engine)->get_int64 = sqlite_get_int64;
+  (*engine)->set_int64 = sqlite_set_int64;
+  (*engine)->get_double = sqlite_get_double;
+  (*engine)->set_double = sqlite_set_double;
+  (*engine)->get_string = sqlite_get_string;
+  (*engine)->set_string = sqlite_set_string;
+  (*engine)->get_blob = sqlite_get_blob;
+  (*engine)->set_blob = sqlite_set_blob;
+  (*engine)->get_blob_chunk = sqlite_get_blob_chunk;
+  (*engine)->get_blob_to_fd = sqlite_get_blob_to_fd;
+  (*engine)->set_blob_from_fd = sqlite_set_blob_from_fd;
+  (*engine)->get_settings = sqlite_get_settings;
+  (*engine)->release_memory = sqlite_release_memory;
+  (*engine)->backup = sqlite_backup;
+  (*engine)->maintain = sqlite_maintain;
+  (*engine)->readonly = db->readonly;
+  (*engine)->data = db;
+
+  return ERROR_OK;
+}
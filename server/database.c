@@ -5,13 +5,15 @@
  * @file database.c
  */
 
-#ifndef REALPATH
-#define REALPATH
-#define _XOPEN_SOURCE 500
+#ifndef OPENAT
+#define OPENAT
+#define _XOPEN_SOURCE 700
 #include <features.h>
-#endif // REALPATH
+#endif // OPENAT
 
 #include "database.h"
+#include "database-options.h"
+#include "database-heap.h"
 #include "../errors.h"
 #include <sqlite3.h>
 #include <string.h>
@@ -20,93 +22,410 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include "../memory.h"
+#include "../hash.h"
 #include "../datastructure.h"
+#include "file-copy.h"
+#include "codec.h"
+#include "../communication/crypto/sha1.h"
+#include "../communication/crypto/sha1_impl.h"
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+
+/* directory of the content-addressed blob store inside the blob-path */
+#define BLOB_CONTENT_DIRECTORY ".sha1"
+/* PRAGMA application_id of a database whose schema has been checked */
+#define DATABASE_APPLICATION_ID 0x52656769
+/* maximal number of hash directories between domain and key */
+#define BLOB_FANOUT_MAX 4
+/* start of the name of a blob file being written, escaped keys have no space */
+#define BLOB_TEMPORARY_PREFIX "tmp "
+/* size of .sha1/ab/cdef... including the NUL */
+#define BLOB_CONTENT_PATH_SIZE (sizeof(BLOB_CONTENT_DIRECTORY) + 2 * SHA1HashSize + 2)
+/* milliseconds a locked database is retried if busy_timeout isn't given */
+#define DATABASE_BUSY_TIMEOUT_DEFAULT 5000
+/* first and longest sleep in microseconds between two attempts */
+#define DATABASE_BUSY_BACKOFF_MIN 100
+#define DATABASE_BUSY_BACKOFF_MAX 20000
+/* PRAGMA auto_vacuum of a database giving back pages on request */
+#define DATABASE_AUTO_VACUUM_INCREMENTAL 2
+/* a blob file larger than this part of the hot tier is always read from disk */
+#define BLOB_HOT_SHARE 8
+/* an eviction empties the hot tier down to this percentage of its size */
+#define BLOB_HOT_LOW_WATER 75
+
+/* a walk through the blob-path collecting files for the orphan check */
+typedef struct blob_walk_s {
+  sqlite3_stmt *insert;                   /* INSERT into BlobCandidate */
+  uint64_t skip;                          /* files checked by earlier calls */
+  uint64_t seen;                          /* files seen by this walk */
+  uint64_t limit;                         /* files this call checks */
+  time_t before;                          /* files changed later are kept */
+  char path[PATH_MAX];                    /* path relative to the blob-path */
+} blob_walk_t;
+
+/* the directories of the blob-path shared by the threads of a recovery */
+typedef struct recovery_walk_s {
+  int blobdir;                            /* O_DIRECTORY fd of blobpath */
+  pthread_mutex_t lock;                   /* guards everything below */
+  pthread_cond_t wake;                    /* directories queued or walk done */
+  char **directories;                     /* directories left to read */
+  size_t queued;                          /* number of directories */
+  size_t capacity;                        /* slots of directories */
+  unsigned int reading;                   /* threads reading a directory */
+  int error;                              /* first error of a thread */
+} recovery_walk_t;
+
+/* a file of the hot tier an eviction may remove */
+typedef struct hot_file_s {
+  int64_t used;                           /* last access in ns */
+  uint64_t size;                          /* size of the file */
+  size_t name;                            /* offset of its path in names */
+} hot_file_t;
+
+/* a walk through the hot tier collecting its files for an eviction */
+typedef struct hot_walk_s {
+  hot_file_t *files;                      /* the files found */
+  size_t count;                           /* number of files */
+  size_t capacity;                        /* slots of files */
+  char *names;                            /* path\0path\0... */
+  size_t names_size;                      /* bytes used in names */
+  size_t names_capacity;                  /* size of names */
+  uint64_t total;                         /* bytes of all files */
+  char path[PATH_MAX];                    /* path relative to the hot tier */
+} hot_walk_t;
+
+/* the files one thread of a recovery found */
+typedef struct recovery_worker_s {
+  recovery_walk_t *walk;                  /* the shared walk */
+  pthread_t thread;                       /* the thread */
+  char *names;                            /* path\0path\0... */
+  size_t names_size;                      /* bytes used in names */
+  size_t names_capacity;                  /* size of names */
+  uint64_t count;                         /* number of paths */
+} recovery_worker_t;
 
 
 
-int check_blob_path(const char* blobpath, const char* referencepath);
 int removeReferencedBlobFile(database_handle_t* handle, const char* domain, const char* key);
+int lookupBlobFile(database_handle_t* handle, const char* domain, const char* key,
+                   int* result, int* codec);
+int selectBlobPath(database_handle_t* handle, const char* domain, const char* key,
+                   char** result, int* codec);
+int openBlobDirectory(database_handle_t* handle, const char* path, int create,
+                      int* result, const char** name);
+void forgetBlobDirectories(database_handle_t* handle);
+int descendDirectory(int root, char* directory, int create, int* result);
+int openHotBlobFile(database_handle_t* handle, const char* path, int* result);
+int buildHotBlobName(const char* path, const struct stat* sb, char** result);
+int openHotDirectory(database_handle_t* handle, const char* path, int create,
+                     int* result, const char** name);
+void storeHotBlob(database_handle_t* handle, const char* hot, int from,
+                  const unsigned char* value, size_t size);
+void evictHotBlobs(database_handle_t* handle);
+int walkHotDirectory(hot_walk_t* walk, int fd, size_t length);
+int addHotFile(hot_walk_t* walk, const struct stat* sb);
+int compareHotFiles(const void* first, const void* second);
+int openBlobFile(database_handle_t* handle, const char* path, int flags,
+                 int* result);
+int readBlobFile(int fd, unsigned char* value, size_t size, size_t offset);
+int writeBlobFile(int fd, const unsigned char* value, size_t size);
+int buildBlobPath(database_handle_t* handle, const char* domain, const char* key,
+                  char** result);
+int createBlobTemporary(database_handle_t* handle, const char* path,
+                        char** result, int* file);
+int storeBlobReference(database_handle_t* handle, const char* domain,
+                       const char* key, char* path, const char* temporary,
+                       int codec);
+int replaceBlobReference(database_handle_t* handle, const char* domain,
+                         const char* key, char* path, const char* temporary,
+                         int codec);
+int releaseBlobFile(database_handle_t* handle, const char* blobpath);
+int dropBlobFile(database_handle_t* handle, const char* blobpath, int* orphaned);
+void removeReleasedFile(database_handle_t* handle, const char* blobpath);
+int parseContentPath(const char* blobpath, char* digest);
+void discardBlobFile(database_handle_t* handle, const char* path);
+int readIntegerSetting(database_handle_t* handle, const char* name, int64_t* value);
+int readStringSetting(database_handle_t* handle, const char* name, char** value);
+int runDigestStatement(database_handle_t* handle, const char* statement,
+                       const char* digest, int64_t* result);
+int buildContentPath(database_handle_t* handle, const char* digest, char* path);
+int acquireBlobContent(database_handle_t* handle, const char* digest,
+                       const char* path, const unsigned char* value,
+                       size_t size, const char* staged, int* created);
+int dropBlobContent(database_handle_t* handle, const char* digest,
+                    int* orphaned);
+int storeDeduplicated(database_handle_t* handle, const char* domain,
+                      const char* key, const unsigned char* value, size_t size,
+                      const char* staged, const uint8_t* sum);
+int stageContent(database_handle_t* handle, int fd, char** result, uint8_t* sum);
+int openDatabase(database_handle_t** handle, const char* path,
+                 const database_options_t* options);
+int buildImmutableUri(const char* path, char** result);
+int applyTuning(database_handle_t* dbhandle, const database_options_t* options);
+int getValueType(database_handle_t* handle, const char* domain, const char* key,
+                 database_value_type_t* type);
+int enumKeys(database_handle_t* handle, const char* domain, const char* pattern,
+             size_t* count, size_t* size, char** keys);
+int enumDomains(database_handle_t* handle, size_t* count, size_t* size,
+                char** domains);
+int getInt64(database_handle_t* handle, const char* domain, const char* key,
+             int64_t* value);
+int setInt64(database_handle_t* handle, const char* domain, const char* key,
+             int64_t value);
+int getDouble(database_handle_t* handle, const char* domain, const char* key,
+              double* value);
+int setDouble(database_handle_t* handle, const char* domain, const char* key,
+              double value);
+int getString(database_handle_t* handle, const char* domain, const char* key,
+              char** value);
+int setString(database_handle_t* handle, const char* domain, const char* key,
+              const char* value);
+int storeString(database_handle_t* handle, const char* domain, const char* key,
+                const char* value, const unsigned char* packed,
+                size_t packed_size);
+int getBlob(database_handle_t* handle, const char* domain, const char* key,
+            unsigned char** value, size_t* size);
+int setBlob(database_handle_t* handle, const char* domain, const char* key,
+            const unsigned char* value, size_t size);
+int getBlobToFd(database_handle_t* handle, const char* domain, const char* key,
+                int fd, size_t* size);
+int setBlobFromFd(database_handle_t* handle, const char* domain, const char* key,
+                  int fd);
+int getBlobChunk(database_handle_t* handle, const char* domain, const char* key,
+                 size_t offset, size_t length, unsigned char** value,
+                 size_t* size, size_t* total);
+int migrateBlobs(database_handle_t* handle, size_t* migrated);
+int busyHandler(void* data, int count);
+void startBusy(database_handle_t* handle);
+int finishBusy(database_handle_t* handle, int ret);
+int runTransactionStatement(database_handle_t* handle, const char* statement);
+int beginTransaction(database_handle_t* handle, const char* statement);
+int beginWrite(database_handle_t* handle);
+int stepError(int retval);
+int readPragma(database_handle_t* handle, const char* statement, char* result,
+               size_t size);
+int checkSchema(database_handle_t* dbhandle);
+int schemaFingerprintMatches(database_handle_t* dbhandle);
+void stampSchemaFingerprint(database_handle_t* dbhandle);
+int prepareCodecColumns(database_handle_t* dbhandle);
+int hasCodecColumns(database_handle_t* dbhandle);
+int packValue(database_handle_t* handle, const unsigned char* value, size_t size,
+              unsigned char** result, size_t* result_size);
+int bindStringValue(sqlite3_stmt* ppStmt, int parameterIndex, const char* value,
+                    const unsigned char* packed, size_t packed_size);
+int bindCodec(sqlite3_stmt* ppStmt, int codec);
+int unpackString(const unsigned char* packed, size_t size, int codec,
+                 char** value);
+int unpackBlobFile(int fd, int codec, size_t length, unsigned char** value,
+                   size_t* size, size_t* total);
+int backupPages(database_handle_t* handle, sqlite3* target,
+                database_backup_callback_t callback, void* context,
+                database_backup_progress_t* progress);
+int pointBackupBlobs(sqlite3* target, const char* blobpath);
+int backupBlobs(database_handle_t* handle, sqlite3* target, const char* blobpath,
+                database_backup_callback_t callback, void* context,
+                database_backup_progress_t* progress);
+int backupBlobFile(database_handle_t* handle, database_handle_t* copy,
+                   const char* path, database_backup_progress_t* progress);
+int maintainDatabase(database_handle_t* handle,
+                     const database_maintenance_t* budget,
+                     database_maintenance_stats_t* stats);
+int runMaintenanceStatement(database_handle_t* handle, const char* statement);
+int convertAutoVacuum(database_handle_t* handle);
+int vacuumPages(database_handle_t* handle, int64_t pages,
+                database_maintenance_stats_t* stats);
+int collectBlobs(database_handle_t* handle, const database_maintenance_t* budget,
+                 database_maintenance_stats_t* stats);
+int walkBlobDirectory(blob_walk_t* walk, int fd, size_t length);
+int removeOrphanedBlobs(database_handle_t* handle, time_t before,
+                        database_maintenance_stats_t* stats);
+int recoverBlobs(database_handle_t* handle, const database_recovery_t* recovery,
+                 database_recovery_stats_t* stats);
+int walkRecoveryBlobs(database_handle_t* handle, unsigned int threads,
+                      recovery_worker_t** workers, const char*** files,
+                      database_recovery_stats_t* stats);
+void* runRecoveryWorker(void* data);
+int readRecoveryDirectory(recovery_worker_t* worker, const char* path);
+int queueRecoveryDirectory(recovery_walk_t* walk, const char* path);
+int addRecoveryFile(recovery_worker_t* worker, const char* path);
+int compareRecoveryFiles(const void* first, const void* second);
+int mergeRecoveryRows(database_handle_t* handle, const database_recovery_t* recovery,
+                      const char** files, database_recovery_stats_t* stats);
+int quarantineBlobFile(database_handle_t* handle, database_handle_t* quarantine,
+                       const char* path);
+int deleteRecoveryRows(database_handle_t* handle, const int64_t* ids,
+                       uint64_t count);
+int syncBlobFile(database_handle_t* handle, int fd, const char* path);
+int migrateBlobFile(database_handle_t* handle, int64_t id, const char* domain,
+                    const char* key, const char* blobpath, int* moved);
 
 int begin(database_handle_t* handle){
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
-  if(sqlite3_prepare_v2(handle->db, "BEGIN;", -1, &ppStmt, pzTail) != SQLITE_OK){
-    return ERROR_DATABASE_INVALID;
-  }
+  return beginTransaction(handle, "BEGIN;");
+}
 
-  while (42){
-      int retval = sqlite3_step(ppStmt);
+int beginWrite(database_handle_t* handle){
+  return beginTransaction(handle, "BEGIN IMMEDIATE;");
+}
 
-      if(retval == SQLITE_DONE){    
-        break;
-      }
-      else if(retval == SQLITE_BUSY){
-        continue;
-      }
-      else {
-        return ERROR_DATABASE_INVALID;
-      } 
-  }
+int commit(database_handle_t* handle){
+  /* a joined transaction is ended by its outermost caller */
+  if(handle->transaction > 1){
+    handle->transaction--;
+    return ERROR_OK;
+  }
+  handle->transaction = 0;
+
+  int ret = runTransactionStatement(handle, "COMMIT;");
+  /* a failed COMMIT leaves the transaction open */
+  if(ret != ERROR_OK && !handle->readonly && !sqlite3_get_autocommit(handle->db))
+    runTransactionStatement(handle, "ROLLBACK;");
+  return ret;
+}
 
-  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
-    return ERROR_DATABASE_INVALID;
+int rollback(database_handle_t* handle){
+  if(handle->transaction > 1){
+    handle->transaction--;
+    return ERROR_OK;
   }
-  return ERROR_OK;
+  handle->transaction = 0;
+  return runTransactionStatement(handle, "ROLLBACK;");
 }
 
-int commit(database_handle_t* handle){
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
-  if(sqlite3_prepare_v2(handle->db, "COMMIT;", -1, &ppStmt, pzTail) != SQLITE_OK){
-    return ERROR_DATABASE_INVALID;
+/**
+ * starts a transaction with @a statement or joins the one already running on
+ * the handle. A joined transaction is only ended by the outermost commit or
+ * rollback, whose caller has to roll back if a joined part failed.
+ *
+ * @param[in] handle The database handle
+ * @param[in] statement BEGIN or BEGIN IMMEDIATE
+ */
+int
+beginTransaction(database_handle_t* handle, const char* statement)
+{
+  if(handle->transaction > 0){
+    handle->transaction++;
+    return ERROR_OK;
   }
 
-  while (42){
-      int retval = sqlite3_step(ppStmt);
+  int ret = runTransactionStatement(handle, statement);
+  if(ret == ERROR_OK)
+    handle->transaction = 1;
+  return ret;
+}
 
-      if(retval == SQLITE_DONE){    
-        break;
-      }
-      else if(retval == SQLITE_BUSY){
-        continue;
-      }
-      else {
-        return ERROR_DATABASE_INVALID;
-      } 
-  }
+/**
+ * runs BEGIN, COMMIT or ROLLBACK, waiting for locks is left to busyHandler
+ *
+ * @param[in] handle The database handle
+ * @param[in] statement The statement
+ */
+int
+runTransactionStatement(database_handle_t* handle, const char* statement)
+{
+  if(handle->readonly)
+    return ERROR_OK;
 
-  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
+  sqlite3_stmt *ppStmt = NULL;
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, NULL) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
     return ERROR_DATABASE_INVALID;
   }
+
+  int retval = sqlite3_step(ppStmt);
+  sqlite3_finalize(ppStmt);
+  if(retval != SQLITE_DONE)
+    return stepError(retval);
   return ERROR_OK;
 }
 
-int rollback(database_handle_t* handle){
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
-  if(sqlite3_prepare_v2(handle->db, "ROLLBACK;", -1, &ppStmt, pzTail) != SQLITE_OK){
-    return ERROR_DATABASE_INVALID;
-  }
+/**
+ * maps a result of sqlite3_step other than SQLITE_ROW or SQLITE_DONE to an
+ * error, a lock busyHandler gave up on is reported as busy
+ *
+ * @param[in] retval The result of sqlite3_step
+ */
+int
+stepError(int retval)
+{
+  if(retval == SQLITE_BUSY || retval == SQLITE_LOCKED)
+    return ERROR_DATABASE_BUSY;
+  return ERROR_DATABASE_INVALID;
+}
 
-  while (42){
-      int retval = sqlite3_step(ppStmt);
+/**
+ * busy handler of SQLite, sleeps with an exponential backoff until the
+ * deadline of the handle has passed
+ *
+ * @param[in] data The database handle
+ * @param[in] count Number of times the handler ran for this lock
+ */
+int
+busyHandler(void* data, int count)
+{
+  database_handle_t* handle = data;
+  struct timespec current;
+  clock_gettime(CLOCK_MONOTONIC, &current);
+  int64_t now = (int64_t)current.tv_sec * 1000000 + current.tv_nsec / 1000;
+  if(count == 0){
+    handle->busy_start = now;
+    handle->busy_stats.waits++;
+  }
+
+  int64_t remaining = handle->busy_timeout * 1000 - (now - handle->busy_start);
+  if(remaining <= 0){
+    handle->busy_stats.timeouts++;
+    handle->busy_expired = 1;
+    return 0;
+  }
+
+  int64_t backoff = DATABASE_BUSY_BACKOFF_MIN;
+  int i = 0;
+  for(; i < count && backoff < DATABASE_BUSY_BACKOFF_MAX; i++)
+    backoff *= 2;
+  if(backoff > DATABASE_BUSY_BACKOFF_MAX)
+    backoff = DATABASE_BUSY_BACKOFF_MAX;
+  if(backoff > remaining)
+    backoff = remaining;
+
+  struct timespec pause;
+  pause.tv_sec = backoff / 1000000;
+  pause.tv_nsec = (backoff % 1000000) * 1000;
+  nanosleep(&pause, NULL);
+  handle->busy_stats.retries++;
+  handle->busy_stats.waited_us += backoff;
+  return 1;
+}
 
-      if(retval == SQLITE_DONE){    
-        break;
-      }
-      else if(retval == SQLITE_BUSY){
-        continue;
-      }
-      else {
-        return ERROR_DATABASE_INVALID;
-      } 
-  }
+/**
+ * starts a call of the API, a timeout of an earlier call is forgotten
+ *
+ * @param[in] handle The database handle, may be NULL
+ */
+void
+startBusy(database_handle_t* handle)
+{
+  if(handle != NULL)
+    handle->busy_expired = 0;
+}
 
-  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
-    return ERROR_DATABASE_INVALID;
-  }
-  return ERROR_OK;
+/**
+ * finishes a call of the API, a failure after the busy handler gave up is
+ * reported as a locked database instead of an invalid one
+ *
+ * @param[in] handle The database handle, may be NULL
+ * @param[in] ret The result of the call
+ */
+int
+finishBusy(database_handle_t* handle, int ret)
+{
+  if(handle != NULL && handle->busy_expired && ret == ERROR_DATABASE_INVALID)
+    return ERROR_DATABASE_BUSY;
+  return ret;
 }
 
 int
@@ -116,6 +435,61 @@ database_open(database_handle_t** handle, const char* path)
   if(handle == NULL || path == NULL)
     return ERROR_INVALID_ARGUMENTS;
 
+  /* path?key=value&... */
+  database_options_t options;
+  int error = database_options_parse(path, &options);
+  if(error != ERROR_OK)
+    return error;
+
+  /* a single database can't be sharded, mirrored or record its changes, see
+     database_sharded_new, database_mirror_new and database_changelog_new */
+  if(options.shards != 0 || options.mirror != 0 || options.changelog){
+    database_options_free(&options);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  error = openDatabase(handle, options.path, &options);
+  database_options_free(&options);
+  return error;
+}
+
+int
+database_open_readonly(database_handle_t** handle, const char* path)
+{
+  if(handle == NULL || path == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  database_options_t options;
+  int error = database_options_parse(path, &options);
+  if(error != ERROR_OK)
+    return error;
+
+  if(options.shards != 0 || options.mirror != 0 || options.changelog){
+    database_options_free(&options);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  options.readonly = 1;
+  error = openDatabase(handle, options.path, &options);
+  database_options_free(&options);
+  return error;
+}
+
+/**
+ * opens and checks the database, applies the options
+ *
+ * @param[out] handle Pointer to the database handle
+ * @param[in] path Path to the database without options
+ * @param[in] options The options of the handle
+ */
+int
+openDatabase(database_handle_t** handle, const char* path,
+             const database_options_t* options)
+{
+  /* recovery repairs, a read-only handle can't */
+  if(options->recover && options->readonly)
+    return ERROR_INVALID_ARGUMENTS;
+
   /* check if path is a regular file */
   struct stat sb;
   if(stat(path, &sb) != 0){
@@ -141,12 +515,48 @@ database_open(database_handle_t** handle, const char* path)
   if(dbhandle == NULL){
     return ERROR_MEMORY; 
   }
+  dbhandle->blobpath = NULL;
+  dbhandle->dedup = 0;
+  dbhandle->fanout = 0;
+  dbhandle->compress = 0;
+  dbhandle->codecs = 0;
+  dbhandle->durability = options->durability;
+  dbhandle->readonly = options->readonly;
+  dbhandle->blobdir = -1;
+  dbhandle->hotdir = -1;
+  dbhandle->hot_size = 0;
+  dbhandle->hot_used = -1;
+  dbhandle->nextdirectory = 0;
+  dbhandle->busy_timeout = options->busy_timeout >= 0 ? options->busy_timeout :
+                           DATABASE_BUSY_TIMEOUT_DEFAULT;
+  dbhandle->busy_expired = 0;
+  memset(&dbhandle->busy_stats, 0, sizeof(database_busy_stats_t));
+  dbhandle->maintenance_cursor = 0;
+  dbhandle->transaction = 0;
+  unsigned int slot = 0;
+  for(slot = 0; slot < DATABASE_DIRECTORY_CACHE_SIZE; slot++){
+    dbhandle->directories[slot].name = NULL;
+    dbhandle->directories[slot].fd = -1;
+  }
 
   // opens the database defined in path with read/write access
   // database must already exist otherwise an error occur
   // handle is null if not enough memory exists otherwise no error occurs
   // use default sqlite3_vfs object
-  if(sqlite3_open_v2(path, &dbhandle->db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK){
+  // immutable databases are opened by URI, that is the only way to tell
+  // SQLite to skip locking and change detection
+  int flags = options->readonly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+  char* uri = NULL;
+  if(options->immutable){
+    if(buildImmutableUri(path, &uri) != ERROR_OK){
+      freeMemory(dbhandle);
+      return ERROR_MEMORY;
+    }
+    flags |= SQLITE_OPEN_URI;
+  }
+  int opened = sqlite3_open_v2(uri != NULL ? uri : path, &dbhandle->db, flags, NULL);
+  freeMemory(uri);
+  if(opened != SQLITE_OK){
     //printf("%s\n", sqlite3_errmsg(dbhandle->db));
     sqlite3_close(dbhandle->db);
     freeMemory(dbhandle);
@@ -159,103 +569,398 @@ database_open(database_handle_t** handle, const char* path)
     return ERROR_MEMORY;
   }
 
-  /* check if database is in a well defined state */
-  const char* type = NULL;
-  int notnull = 0, primarykey = 0, autoinc = 0;
-
-  /** Datatypes */
-  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
-                                   NULL,           /* Database name */
-                                   "Datatypes",    /* Table name */
-                                   "type",         /* Column name */
-                                   &type,          /* OUT: data type */
-                                   NULL,           /* OUT: sequence name */
-                                   &notnull,       /* OUT: true if not null constraint */
-                                   &primarykey,    /* OUT: true if private key */
-                                   &autoinc)       /* OUT: true if auto inc */
-                                   != SQLITE_OK){
+  /* before the first query, so that already waits for locks */
+  if(applyTuning(dbhandle, options) != ERROR_OK){
     sqlite3_close(dbhandle->db);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
-  if(strcmp(type, "TEXT") != 0 ||
-     notnull == 0 ||
-     primarykey == 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
-    return ERROR_DATABASE_INVALID;
+
+  /* check if database is in a well defined state, the full check is skipped
+     if the schema hasn't changed since it passed the last time */
+  if(!schemaFingerprintMatches(dbhandle)){
+    if(checkSchema(dbhandle) != ERROR_OK){
+      sqlite3_close(dbhandle->db);
+      freeMemory(dbhandle);
+      return ERROR_DATABASE_INVALID;
+    }
+    if(!dbhandle->readonly)
+      stampSchemaFingerprint(dbhandle);
   }
-  notnull = 0; primarykey = 0; autoinc = 0;
 
-  /** KeyInfo */
-  /* id */
-  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
-                                   NULL,           /* Database name */
-                                   "KeyInfo",      /* Table name */
-                                   "id",           /* Column name */
-                                   &type,          /* OUT: data type */
-                                   NULL,           /* OUT: sequence name */
-                                   &notnull,       /* OUT: true if not null constraint */
-                                   &primarykey,    /* OUT: true if private key */
-                                   &autoinc)       /* OUT: true if auto inc */
-                                   != SQLITE_OK){
+  /* check if the blob-path is an absolute path and is a directory */
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  char* statement = "SELECT ValueString.`value` as `value` FROM KeyInfo INNER JOIN ValueString ON KeyInfo.`id` = ValueString.`id`WHERE KeyInfo.`datatype` = 'String' AND KeyInfo.`key`= 'blob-path';";
+
+  begin(dbhandle);
+
+  if(sqlite3_prepare_v2(dbhandle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
+    //printf("prepare: %s\n", sqlite3_errmsg(dbhandle->db));
+    sqlite3_finalize(ppStmt);
+    rollback(dbhandle);
     sqlite3_close(dbhandle->db);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
-  if(strcmp(type, "INTEGER") != 0 ||
-     notnull == 0 ||
-     primarykey == 0 ||
-     autoinc == 0){
+
+  while (42){
+      int retval = sqlite3_step(ppStmt);
+
+      if(retval == SQLITE_ROW){    
+        if(sqlite3_column_type(ppStmt, 0) != SQLITE3_TEXT){
+          sqlite3_finalize(ppStmt);
+          rollback(dbhandle);
+          sqlite3_close(dbhandle->db);
+          freeMemory(dbhandle);
+          return ERROR_DATABASE_INVALID;
+        } 
+
+        char * dbentry = NULL;
+        dbentry = (char*)sqlite3_column_text(ppStmt, 0); 
+        if(requestMemory((void**)&dbhandle->blobpath, strlen(dbentry)+1) != ERROR_OK){
+          sqlite3_finalize(ppStmt);
+          rollback(dbhandle);
+          sqlite3_close(dbhandle->db);
+          freeMemory(dbhandle);
+          return ERROR_MEMORY;
+        }
+        memcpy(dbhandle->blobpath, dbentry, strlen(dbentry));
+        dbhandle->blobpath[strlen(dbentry)] = '\0';
+        break;
+      }
+      else if(retval == SQLITE_DONE){
+        sqlite3_finalize(ppStmt);
+        rollback(dbhandle);
+        sqlite3_close(dbhandle->db);
+        freeMemory(dbhandle);
+        return ERROR_DATABASE_INVALID;
+      }
+      else {
+        //printf("step: %s\n", sqlite3_errmsg(dbhandle->db));
+        sqlite3_finalize(ppStmt);
+        rollback(dbhandle);
+        sqlite3_close(dbhandle->db);
+        freeMemory(dbhandle);
+        return stepError(retval);
+      } 
+  }
+
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
+    //printf("finalize: %s\n", sqlite3_errmsg(dbhandle->db));
+    rollback(dbhandle);
     sqlite3_close(dbhandle->db);
+    freeMemory(dbhandle->blobpath);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
-  notnull = 0; primarykey = 0; autoinc = 0;
 
-  /* domain */
-  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
-                                   NULL,           /* Database name */
-                                   "KeyInfo",      /* Table name */
-                                   "domain",       /* Column name */
-                                   &type,          /* OUT: data type */
-                                   NULL,           /* OUT: sequence name */
-                                   &notnull,       /* OUT: true if not null constraint */
-                                   &primarykey,    /* OUT: true if private key */
-                                   &autoinc)       /* OUT: true if auto inc */
-                                   != SQLITE_OK){
+  commit(dbhandle);
+
+  /*absolute path*/
+  if(dbhandle->blobpath[0] != '/'){
+    //printf("absolute path2");
     sqlite3_close(dbhandle->db);
+    freeMemory(dbhandle->blobpath);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
-  if(strcmp(type, "TEXT") != 0){
+
+  /* every blob file is opened relative to this descriptor, opening it also
+     checks that the blob-path is an existing directory */
+  dbhandle->blobdir = open(dbhandle->blobpath, O_RDONLY | O_DIRECTORY);
+  if(dbhandle->blobdir < 0){
     sqlite3_close(dbhandle->db);
+    freeMemory(dbhandle->blobpath);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
-  notnull = 0; primarykey = 0; autoinc = 0;
 
-  /* key */
-  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
-                                   NULL,           /* Database name */
-                                   "KeyInfo",      /* Table name */
-                                   "key",          /* Column name */
-                                   &type,          /* OUT: data type */
-                                   NULL,           /* OUT: sequence name */
-                                   &notnull,       /* OUT: true if not null constraint */
-                                   &primarykey,    /* OUT: true if private key */
-                                   &autoinc)       /* OUT: true if auto inc */
-                                   != SQLITE_OK){
+  /* optional content-addressed blob store (Int64 with domain NULL and key
+     blob-dedup), reference counts are kept in BlobContent */
+  int64_t dedup = 0;
+  if(readIntegerSetting(dbhandle, "blob-dedup", &dedup) == ERROR_OK && dedup != 0){
+    if(!dbhandle->readonly && sqlite3_exec(dbhandle->db, "CREATE TABLE IF NOT EXISTS BlobContent (digest TEXT PRIMARY KEY NOT NULL, refcount INTEGER NOT NULL);", NULL, NULL, NULL) != SQLITE_OK){
+      close(dbhandle->blobdir);
+      sqlite3_close(dbhandle->db);
+      freeMemory(dbhandle->blobpath);
+      freeMemory(dbhandle);
+      return ERROR_DATABASE_INVALID;
+    }
+    dbhandle->dedup = 1;
+  }
+
+  /* optional hash directories between domain and key (Int64 with domain NULL
+     and key blob-fanout), 0 is the flat legacy layout */
+  int64_t fanout = 0;
+  if(readIntegerSetting(dbhandle, "blob-fanout", &fanout) == ERROR_OK){
+    if(fanout < 0 || fanout > BLOB_FANOUT_MAX){
+      close(dbhandle->blobdir);
+      sqlite3_close(dbhandle->db);
+      freeMemory(dbhandle->blobpath);
+      freeMemory(dbhandle);
+      return ERROR_DATABASE_INVALID;
+    }
+    dbhandle->fanout = fanout;
+  }
+
+  /* optional compression of long strings and blobs (Int64 with domain NULL
+     and key value-compress, the smallest size compressed), the codec of every
+     value is kept in the codec column of ValueString and ValueBlob */
+  int64_t compress = 0;
+  if(readIntegerSetting(dbhandle, "value-compress", &compress) == ERROR_OK){
+    dbhandle->compress = compress;
+  }
+  if(compress < 0 || prepareCodecColumns(dbhandle) != ERROR_OK){
+    close(dbhandle->blobdir);
     sqlite3_close(dbhandle->db);
+    freeMemory(dbhandle->blobpath);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
-  if(strcmp(type, "TEXT") != 0 ||
-     notnull == 0){
+
+  /* optional hot tier of the blob-path on a RAM file system (String with
+     domain NULL and key blob-hot-path, Int64 blob-hot-size is its size) */
+  char* hotpath = NULL;
+  if(readStringSetting(dbhandle, "blob-hot-path", &hotpath) == ERROR_OK &&
+     hotpath[0] != '\0'){
+    int64_t hot_size = 0;
+    readIntegerSetting(dbhandle, "blob-hot-size", &hot_size);
+    if(hotpath[0] == '/' && hot_size >= 0)
+      dbhandle->hotdir = open(hotpath, O_RDONLY | O_DIRECTORY);
+    if(dbhandle->hotdir < 0){
+      freeMemory(hotpath);
+      close(dbhandle->blobdir);
+      sqlite3_close(dbhandle->db);
+      freeMemory(dbhandle->blobpath);
+      freeMemory(dbhandle);
+      return ERROR_DATABASE_INVALID;
+    }
+    dbhandle->hot_size = hot_size > 0 ? hot_size : DATABASE_BLOB_HOT_SIZE;
+  }
+  freeMemory(hotpath);
+
+  /* memory mapped reads, read-only handles use them unless told otherwise */
+  int64_t mmap_size = options->mmap_size;
+  if(mmap_size < 0 && dbhandle->readonly)
+    mmap_size = DATABASE_READONLY_MMAP_SIZE;
+  if(mmap_size >= 0){
+    char pragma[48];
+    snprintf(pragma, sizeof(pragma), "PRAGMA mmap_size=%lld;", (long long)mmap_size);
+    sqlite3_exec(dbhandle->db, pragma, NULL, NULL, NULL);
+  }
+
+  /* nothing is ever written, so journal and synchronous don't matter */
+  if(dbhandle->readonly){
+    *handle = dbhandle;
+    heapHandleOpened();
+    return ERROR_OK;
+  }
+
+  /* durability of the database itself, blob files follow in syncBlobFile.
+     journal and synchronous override it. The journal mode is only a request,
+     it stays as it is if it can't be changed */
+  database_journal_t journal = options->journal;
+  database_synchronous_t synchronous = options->synchronous;
+  if(dbhandle->durability == DATABASE_DURABILITY_NORMAL){
+    if(journal == DATABASE_JOURNAL_DEFAULT)
+      journal = DATABASE_JOURNAL_WAL;
+    if(synchronous == DATABASE_SYNCHRONOUS_DEFAULT)
+      synchronous = DATABASE_SYNCHRONOUS_NORMAL;
+  }else if(synchronous == DATABASE_SYNCHRONOUS_DEFAULT){
+    synchronous = dbhandle->durability == DATABASE_DURABILITY_RELAXED ?
+                  DATABASE_SYNCHRONOUS_OFF : DATABASE_SYNCHRONOUS_FULL;
+  }
+
+  const char* journals[] = DATABASE_JOURNAL_NAMES;
+  const char* synchronouses[] = DATABASE_SYNCHRONOUS_NAMES;
+  char pragma[48];
+  if(journal != DATABASE_JOURNAL_DEFAULT){
+    snprintf(pragma, sizeof(pragma), "PRAGMA journal_mode=%s;", journals[journal]);
+    sqlite3_exec(dbhandle->db, pragma, NULL, NULL, NULL);
+  }
+  snprintf(pragma, sizeof(pragma), "PRAGMA synchronous=%s;",
+           synchronouses[synchronous]);
+  if(sqlite3_exec(dbhandle->db, pragma, NULL, NULL, NULL) != SQLITE_OK){
+    if(dbhandle->hotdir >= 0)
+      close(dbhandle->hotdir);
+    close(dbhandle->blobdir);
     sqlite3_close(dbhandle->db);
+    freeMemory(dbhandle->blobpath);
     freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
+
+  *handle = dbhandle;
+  heapHandleOpened();
+
+  /* startup mode, nobody gets the handle before blob files and rows agree */
+  if(options->recover){
+    database_recovery_t recovery;
+    database_recovery_stats_t stats;
+    recovery.threads = 0;
+    recovery.repair = 1;
+    recovery.quarantine = 1;
+    int error = database_recover(dbhandle, &recovery, &stats);
+    if(error != ERROR_OK){
+      database_close(dbhandle);
+      *handle = NULL;
+      return error;
+    }
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * applies the options that tune SQLite itself, the busy timeout, the page
+ * cache and the place of temporary tables
+ *
+ * @param[in] dbhandle A database handle with an open connection
+ * @param[in] options The options of the handle
+ */
+int
+applyTuning(database_handle_t* dbhandle, const database_options_t* options)
+{
+  if(sqlite3_busy_handler(dbhandle->db, busyHandler, dbhandle) != SQLITE_OK)
+    return ERROR_DATABASE_INVALID;
+
+  char pragma[48];
+  if(options->cache_size != 0){
+    snprintf(pragma, sizeof(pragma), "PRAGMA cache_size=%lld;",
+             (long long)options->cache_size);
+    if(sqlite3_exec(dbhandle->db, pragma, NULL, NULL, NULL) != SQLITE_OK)
+      return ERROR_DATABASE_INVALID;
+  }
+
+  const char* temp_stores[] = DATABASE_TEMP_STORE_NAMES;
+  if(options->temp_store != DATABASE_TEMP_STORE_DEFAULT){
+    snprintf(pragma, sizeof(pragma), "PRAGMA temp_store=%s;",
+             temp_stores[options->temp_store]);
+    if(sqlite3_exec(dbhandle->db, pragma, NULL, NULL, NULL) != SQLITE_OK)
+      return ERROR_DATABASE_INVALID;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * builds the SQLite URI of an immutable database, the characters that have a
+ * meaning in URIs are percent-encoded
+ *
+ * @param[in] path Path to the database
+ * @param[out] result file:path?immutable=1, has to be freed
+ */
+int
+buildImmutableUri(const char* path, char** result)
+{
+  const char* query = "?immutable=1";
+  /* every character may need %XX, absolute paths get an empty authority */
+  size_t size = strlen("file://") + 3 * strlen(path) + strlen(query) + 1;
+  if(requestMemory((void**)result, size) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  size_t used = snprintf(*result, size, "%s", path[0] == '/' ? "file://" : "file:");
+  const char* c = path;
+  for(; *c != '\0'; c++){
+    if(*c == '%' || *c == '?' || *c == '#')
+      used += snprintf(*result + used, size - used, "%%%02X", (unsigned char)*c);
+    else
+      (*result)[used++] = *c;
+  }
+  snprintf(*result + used, size - used, "%s", query);
+  return ERROR_OK;
+}
+
+/**
+ * checks every table and column of the scheme defined in
+ * sql/database-init.sql
+ *
+ * @param[in] dbhandle A database handle with an open connection
+ */
+int
+checkSchema(database_handle_t* dbhandle)
+{
+  const char* type = NULL;
+  int notnull = 0, primarykey = 0, autoinc = 0;
+
+  /** Datatypes */
+  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
+                                   NULL,           /* Database name */
+                                   "Datatypes",    /* Table name */
+                                   "type",         /* Column name */
+                                   &type,          /* OUT: data type */
+                                   NULL,           /* OUT: sequence name */
+                                   &notnull,       /* OUT: true if not null constraint */
+                                   &primarykey,    /* OUT: true if private key */
+                                   &autoinc)       /* OUT: true if auto inc */
+                                   != SQLITE_OK){
+    return ERROR_DATABASE_INVALID;
+  }
+  if(strcmp(type, "TEXT") != 0 ||
+     notnull == 0 ||
+     primarykey == 0){
+    return ERROR_DATABASE_INVALID;
+  }
+  notnull = 0; primarykey = 0; autoinc = 0;
+
+  /** KeyInfo */
+  /* id */
+  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
+                                   NULL,           /* Database name */
+                                   "KeyInfo",      /* Table name */
+                                   "id",           /* Column name */
+                                   &type,          /* OUT: data type */
+                                   NULL,           /* OUT: sequence name */
+                                   &notnull,       /* OUT: true if not null constraint */
+                                   &primarykey,    /* OUT: true if private key */
+                                   &autoinc)       /* OUT: true if auto inc */
+                                   != SQLITE_OK){
+    return ERROR_DATABASE_INVALID;
+  }
+  if(strcmp(type, "INTEGER") != 0 ||
+     notnull == 0 ||
+     primarykey == 0 ||
+     autoinc == 0){
+    return ERROR_DATABASE_INVALID;
+  }
+  notnull = 0; primarykey = 0; autoinc = 0;
+
+  /* domain */
+  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
+                                   NULL,           /* Database name */
+                                   "KeyInfo",      /* Table name */
+                                   "domain",       /* Column name */
+                                   &type,          /* OUT: data type */
+                                   NULL,           /* OUT: sequence name */
+                                   &notnull,       /* OUT: true if not null constraint */
+                                   &primarykey,    /* OUT: true if private key */
+                                   &autoinc)       /* OUT: true if auto inc */
+                                   != SQLITE_OK){
+    return ERROR_DATABASE_INVALID;
+  }
+  if(strcmp(type, "TEXT") != 0){
+    return ERROR_DATABASE_INVALID;
+  }
+  notnull = 0; primarykey = 0; autoinc = 0;
+
+  /* key */
+  if(sqlite3_table_column_metadata(dbhandle->db,   /* Connection handle*/
+                                   NULL,           /* Database name */
+                                   "KeyInfo",      /* Table name */
+                                   "key",          /* Column name */
+                                   &type,          /* OUT: data type */
+                                   NULL,           /* OUT: sequence name */
+                                   &notnull,       /* OUT: true if not null constraint */
+                                   &primarykey,    /* OUT: true if private key */
+                                   &autoinc)       /* OUT: true if auto inc */
+                                   != SQLITE_OK){
+    return ERROR_DATABASE_INVALID;
+  }
+  if(strcmp(type, "TEXT") != 0 ||
+     notnull == 0){
+    return ERROR_DATABASE_INVALID;
+  }
   notnull = 0; primarykey = 0; autoinc = 0;
 
   /* datatype */
@@ -269,14 +974,10 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "TEXT") != 0 ||
      notnull == 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -293,15 +994,11 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "INTEGER") != 0 ||
      notnull == 0 ||
      primarykey == 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -317,14 +1014,10 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "INTEGER") != 0 ||
      notnull == 0 ){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -341,15 +1034,11 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "INTEGER") != 0 ||
      notnull == 0 ||
      primarykey == 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -365,14 +1054,10 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "REAL") != 0 ||
      notnull == 0 ){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -389,15 +1074,11 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "INTEGER") != 0 ||
      notnull == 0 ||
      primarykey == 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -413,14 +1094,10 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "TEXT") != 0 ||
      notnull == 0 ){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -437,15 +1114,11 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "INTEGER") != 0 ||
      notnull == 0 ||
      primarykey == 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   notnull = 0; primarykey = 0; autoinc = 0;
@@ -461,138 +1134,311 @@ database_open(database_handle_t** handle, const char* path)
                                    &primarykey,    /* OUT: true if private key */
                                    &autoinc)       /* OUT: true if auto inc */
                                    != SQLITE_OK){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
   if(strcmp(type, "TEXT") != 0 ||
      notnull == 0 ){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
     return ERROR_DATABASE_INVALID;
   }
 
+  return ERROR_OK;
+}
 
-  /* check if the blob-path is an absolute path and is a directory */
+/**
+ * compares the fingerprint left by @ref stampSchemaFingerprint with the
+ * current schema. SQLite bumps the schema version with every change of the
+ * schema, so a matching version means the schema is still the checked one.
+ *
+ * @param[in] dbhandle A database handle with an open connection
+ */
+int
+schemaFingerprintMatches(database_handle_t* dbhandle)
+{
   sqlite3_stmt *ppStmt = NULL;
   const char** pzTail = NULL;
-  char* statement = "SELECT ValueString.`value` as `value` FROM KeyInfo INNER JOIN ValueString ON KeyInfo.`id` = ValueString.`id`WHERE KeyInfo.`datatype` = 'String' AND KeyInfo.`key`= 'blob-path';";
-
-  begin(dbhandle);
+  char* statement = "SELECT a.application_id, u.user_version, s.schema_version FROM pragma_application_id AS a, pragma_user_version AS u, pragma_schema_version AS s;";
 
   if(sqlite3_prepare_v2(dbhandle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
-    //printf("prepare: %s\n", sqlite3_errmsg(dbhandle->db));
     sqlite3_finalize(ppStmt);
-    rollback(dbhandle);
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle);
-    return ERROR_DATABASE_INVALID;
+    return 0;
   }
 
-  while (42){
-      int retval = sqlite3_step(ppStmt);
+  int matches = 0;
+  if(sqlite3_step(ppStmt) == SQLITE_ROW)
+    matches = sqlite3_column_int64(ppStmt, 0) == DATABASE_APPLICATION_ID &&
+              sqlite3_column_int64(ppStmt, 1) == sqlite3_column_int64(ppStmt, 2);
 
-      if(retval == SQLITE_ROW){    
-        if(sqlite3_column_type(ppStmt, 0) != SQLITE3_TEXT){
-          sqlite3_finalize(ppStmt);
-          rollback(dbhandle);
-          sqlite3_close(dbhandle->db);
-          freeMemory(dbhandle);
-          return ERROR_DATABASE_INVALID;
-        } 
+  sqlite3_finalize(ppStmt);
+  return matches;
+}
 
-        char * dbentry = NULL;
-        dbentry = (char*)sqlite3_column_text(ppStmt, 0); 
-        if(requestMemory((void**)&dbhandle->blobpath, strlen(dbentry)+1) != ERROR_OK){
-          sqlite3_finalize(ppStmt);
-          rollback(dbhandle);
-          sqlite3_close(dbhandle->db);
-          freeMemory(dbhandle);
-          return ERROR_MEMORY;
-        }
-        memcpy(dbhandle->blobpath, dbentry, strlen(dbentry));
-        dbhandle->blobpath[strlen(dbentry)] = '\0';
-        break;
-      }
-      else if(retval == SQLITE_DONE){
-        sqlite3_finalize(ppStmt);
-        rollback(dbhandle);
-        sqlite3_close(dbhandle->db);
-        freeMemory(dbhandle);
-        return ERROR_DATABASE_INVALID;
-      }
-      else {
-        //printf("step: %s\n", sqlite3_errmsg(dbhandle->db));
-        sqlite3_finalize(ppStmt);
-        rollback(dbhandle);
-        sqlite3_close(dbhandle->db);
-        freeMemory(dbhandle);
-        return ERROR_DATABASE_INVALID;
-      } 
-  }
+/**
+ * records the current schema version as checked. Failing to do so is not
+ * critical, the full check simply runs again next time.
+ *
+ * @param[in] dbhandle A database handle with an open connection
+ */
+void
+stampSchemaFingerprint(database_handle_t* dbhandle)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
 
-  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
-    //printf("finalize: %s\n", sqlite3_errmsg(dbhandle->db));
-    rollback(dbhandle);
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle->blobpath);
-    freeMemory(dbhandle);
-    return ERROR_DATABASE_INVALID;
+  if(sqlite3_prepare_v2(dbhandle->db, "PRAGMA schema_version;", -1, &ppStmt, pzTail) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return;
   }
+  if(sqlite3_step(ppStmt) != SQLITE_ROW){
+    sqlite3_finalize(ppStmt);
+    return;
+  }
+  int64_t version = sqlite3_column_int64(ppStmt, 0);
+  sqlite3_finalize(ppStmt);
 
-  commit(dbhandle);
+  /* neither pragma changes the schema version */
+  char statement[96];
+  snprintf(statement, sizeof(statement), "PRAGMA application_id = %d; PRAGMA user_version = %lld;",
+           DATABASE_APPLICATION_ID, (long long)version);
+  sqlite3_exec(dbhandle->db, statement, NULL, NULL, NULL);
+}
 
-  if(stat(dbhandle->blobpath, &sb) != 0){
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle->blobpath);
-    freeMemory(dbhandle);
-    return ERROR_DATABASE_INVALID;
-  }
-  /* check if directory */
-  if(!S_ISDIR(sb.st_mode)){        
-    //printf("directory error2\n");
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle->blobpath);
-    freeMemory(dbhandle);
-    return ERROR_DATABASE_INVALID;
-  }
-  /*absolute path*/
-  if(dbhandle->blobpath[0] != '/'){
-    //printf("absolute path2");
-    sqlite3_close(dbhandle->db);
-    freeMemory(dbhandle->blobpath);
-    freeMemory(dbhandle);
-    return ERROR_DATABASE_INVALID;
-  }
+/**
+ * finds out whether ValueString and ValueBlob have a codec column and adds
+ * it to both if the handle compresses values. Older databases without it
+ * only hold values stored as they are.
+ *
+ * @param[in] dbhandle A database handle with the settings read
+ */
+int
+prepareCodecColumns(database_handle_t* dbhandle)
+{
+  dbhandle->codecs = hasCodecColumns(dbhandle);
+  if(dbhandle->codecs || dbhandle->compress == 0 || dbhandle->readonly)
+    return ERROR_OK;
+
+  /* a column with a default only changes the schema, the rows stay as they
+     are */
+  const char* tables[2] = {"ValueString", "ValueBlob"};
+  int ret = begin(dbhandle);
+  unsigned int i = 0;
+  for(; ret == ERROR_OK && i < 2; i++){
+    char statement[80];
+    snprintf(statement, sizeof(statement),
+             "ALTER TABLE %s ADD COLUMN `codec` INTEGER NOT NULL DEFAULT 0;", tables[i]);
+    if(sqlite3_table_column_metadata(dbhandle->db, NULL, tables[i], "codec", NULL,
+                                     NULL, NULL, NULL, NULL) != SQLITE_OK &&
+       sqlite3_exec(dbhandle->db, statement, NULL, NULL, NULL) != SQLITE_OK)
+      ret = ERROR_DATABASE_INVALID;
+  }
+  if(ret == ERROR_OK)
+    ret = commit(dbhandle);
+  else
+    rollback(dbhandle);
 
-  *handle = dbhandle;
+  /* another connection may have added them in the meantime */
+  dbhandle->codecs = hasCodecColumns(dbhandle);
+  if(!dbhandle->codecs)
+    return ret != ERROR_OK ? ret : ERROR_DATABASE_INVALID;
 
+  stampSchemaFingerprint(dbhandle);
   return ERROR_OK;
 }
 
-
+/**
+ * checks that ValueString and ValueBlob both have a codec column
+ *
+ * @param[in] dbhandle A database handle with an open connection
+ */
 int
-database_close(database_handle_t* handle)
+hasCodecColumns(database_handle_t* dbhandle)
 {
-  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || strlen(handle->blobpath) == 0){
-    return ERROR_INVALID_ARGUMENTS;
-  }
+  return sqlite3_table_column_metadata(dbhandle->db, NULL, "ValueString", "codec",
+                                       NULL, NULL, NULL, NULL, NULL) == SQLITE_OK &&
+         sqlite3_table_column_metadata(dbhandle->db, NULL, "ValueBlob", "codec",
+                                       NULL, NULL, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+/**
+ * compresses a string or blob before it is stored, if the handle compresses
+ * values of its size and the value gets smaller
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] value The value
+ * @param[in] size Size of @a value
+ * @param[out] result The compressed value, NULL if @a value is stored as it
+ *   is, has to be freed
+ * @param[out] result_size Size of @a result
+ */
+int
+packValue(database_handle_t* handle, const unsigned char* value, size_t size,
+          unsigned char** result, size_t* result_size)
+{
+  *result = NULL;
+  *result_size = 0;
+  if(!handle->codecs || handle->compress == 0 || size < (uint64_t)handle->compress)
+    return ERROR_OK;
+
+  unsigned char* packed = NULL;
+  if(requestMemory((void**)&packed, size) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  if(codec_compress(value, size, packed, size - 1, result_size) != ERROR_OK){
+    freeMemory(packed);
+    *result_size = 0;
+    return ERROR_OK;
+  }
+
+  *result = packed;
+  return ERROR_OK;
+}
+
+/**
+ * binds a string to :val, as BLOB if it has been compressed, and its codec
+ * to :codec
+ *
+ * @param[in] ppStmt The statement
+ * @param[in] parameterIndex Index of :val
+ * @param[in] value The string
+ * @param[in] packed The compressed string or NULL
+ * @param[in] packed_size Size of @a packed
+ */
+int
+bindStringValue(sqlite3_stmt* ppStmt, int parameterIndex, const char* value,
+                const unsigned char* packed, size_t packed_size)
+{
+  int ret = packed != NULL ?
+    sqlite3_bind_blob64(ppStmt, parameterIndex, packed, packed_size, SQLITE_TRANSIENT) :
+    sqlite3_bind_text(ppStmt, parameterIndex, value, -1, SQLITE_TRANSIENT);
+  if(ret != SQLITE_OK)
+    return ret;
+  return bindCodec(ppStmt, packed != NULL ? CODEC_LZ : CODEC_NONE);
+}
+
+/**
+ * binds the codec of a value to :codec, statements of a database without
+ * codec column don't have that parameter
+ *
+ * @param[in] ppStmt The statement
+ * @param[in] codec The codec
+ */
+int
+bindCodec(sqlite3_stmt* ppStmt, int codec)
+{
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":codec");
+  if(parameterIndex == 0)
+    return SQLITE_OK;
+  return sqlite3_bind_int(ppStmt, parameterIndex, codec);
+}
+
+/**
+ * restores a string stored with a codec
+ *
+ * @param[in] packed The stored value
+ * @param[in] size Size of @a packed
+ * @param[in] codec The codec of the value
+ * @param[out] value The string, has to be freed
+ */
+int
+unpackString(const unsigned char* packed, size_t size, int codec, char** value)
+{
+  size_t original = 0;
+  size_t written = 0;
+  if(codec != CODEC_LZ || codec_size(packed, size, &original) != ERROR_OK)
+    return ERROR_DATABASE_INVALID;
+  if(requestMemory((void**)value, original + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  if(codec_decompress(packed, size, (unsigned char*)*value, original, &written) != ERROR_OK ||
+     memchr(*value, '\0', original) != NULL){
+    freeMemory(*value);
+    *value = NULL;
+    return ERROR_DATABASE_INVALID;
+  }
+  (*value)[original] = '\0';
+  return ERROR_OK;
+}
+
+/**
+ * reads a compressed blob file and restores its first @a length bytes
+ *
+ * @param[in] fd File descriptor of the blob file
+ * @param[in] codec The codec of the blob
+ * @param[in] length Number of bytes to restore at most
+ * @param[out] value The restored bytes, has to be freed
+ * @param[out] size Number of bytes restored
+ * @param[out] total Size of the whole blob
+ */
+int
+unpackBlobFile(int fd, int codec, size_t length, unsigned char** value,
+               size_t* size, size_t* total)
+{
+  struct stat sb;
+  if(codec != CODEC_LZ)
+    return ERROR_DATABASE_INVALID;
+  if(fstat(fd, &sb) != 0)
+    return ERROR_DATABASE_IO;
+
+  unsigned char* packed = NULL;
+  if(requestMemory((void**)&packed, sb.st_size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+  int error = readBlobFile(fd, packed, sb.st_size, 0);
+  if(error == ERROR_OK)
+    error = codec_size(packed, sb.st_size, total);
+
+  /* always hand out a valid buffer, even for an empty blob */
+  size_t capacity = error == ERROR_OK && *total < length ? *total : length;
+  *value = NULL;
+  if(error == ERROR_OK && requestMemory((void**)value, capacity + 1) != ERROR_OK)
+    error = ERROR_MEMORY;
+  if(error == ERROR_OK)
+    error = codec_decompress(packed, sb.st_size, *value, capacity, size);
+  freeMemory(packed);
+
+  if(error != ERROR_OK){
+    freeMemory(*value);
+    *value = NULL;
+    return error;
+  }
+  return ERROR_OK;
+}
+
+
+int
+database_close(database_handle_t* handle)
+{
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || strlen(handle->blobpath) == 0){
+    return ERROR_INVALID_ARGUMENTS;
+  }
   /* close db connection */
   while(sqlite3_close(handle->db) != SQLITE_OK){
    //printf("close: %s\n", sqlite3_errmsg(handle->db));
   }
+  /* close cached blob directories */
+  forgetBlobDirectories(handle);
+  close(handle->blobdir);
+  if(handle->hotdir >= 0)
+    close(handle->hotdir);
   /* free memory for blob-path */
   freeMemory(handle->blobpath);
   /* free handle */  
   free(handle);
+  heapHandleClosed();
 
   return ERROR_OK;
 }
 
 
 int
-database_get_type(database_handle_t* handle, const char* domain, 
+database_get_type(database_handle_t* handle, const char* domain,
                   const char* key, database_value_type_t* type)
+{
+  startBusy(handle);
+  return finishBusy(handle, getValueType(handle, domain, key, type));
+}
+
+int
+getValueType(database_handle_t* handle, const char* domain, const char* key,
+             database_value_type_t* type)
 {
   /* Input checks */
   if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0 || type == NULL)
@@ -697,7 +1543,7 @@ database_get_type(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         //printf("step: %s\n", sqlite3_errmsg(handle->db));
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -721,7 +1567,16 @@ database_get_type(database_handle_t* handle, const char* domain,
 
 int
 database_enum_keys(database_handle_t* handle, const char* domain,
-                   const char* pattern, size_t* count, size_t* size, char** keys)
+                   const char* pattern, size_t* count, size_t* size,
+                   char** keys)
+{
+  startBusy(handle);
+  return finishBusy(handle, enumKeys(handle, domain, pattern, count, size, keys));
+}
+
+int
+enumKeys(database_handle_t* handle, const char* domain, const char* pattern,
+         size_t* count, size_t* size, char** keys)
 {
  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || pattern == NULL || count == NULL || size == NULL || keys == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0)
     return ERROR_INVALID_ARGUMENTS;
@@ -810,7 +1665,7 @@ database_enum_keys(database_handle_t* handle, const char* domain,
         //printf("step: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -833,174 +1688,1338 @@ database_enum_keys(database_handle_t* handle, const char* domain,
 
 
 int
-database_get_int64(database_handle_t* handle, const char* domain,
-                   const char* key, int64_t* value)
+database_enum_domains(database_handle_t* handle, size_t* count, size_t* size,
+                      char** domains)
 {
-  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || value == NULL || strlen(domain) == 0 || strlen(key) == 0 || strlen(handle->blobpath) == 0)
+  startBusy(handle);
+  return finishBusy(handle, enumDomains(handle, count, size, domains));
+}
+
+int
+enumDomains(database_handle_t* handle, size_t* count, size_t* size,
+            char** domains)
+{
+  if(handle == NULL || handle->db == NULL || count == NULL || size == NULL || domains == NULL)
     return ERROR_INVALID_ARGUMENTS;
-  
-  char* statement = NULL;
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
 
-  unsigned int sizeOfStmt = 193;
-  if(requestMemory((void**)&statement, sizeOfStmt) != ERROR_OK){
-    return ERROR_MEMORY;
-  }
+  *count = 0;
+  *size = 0;
+  *domains = NULL;
 
-  strcpy(statement, "SELECT ValueInt64.`value` as `value` FROM KeyInfo INNER JOIN ValueInt64 ON KeyInfo.`id` = ValueInt64.`id`WHERE KeyInfo.`datatype` = 'Int64' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;");
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  char* statement = "SELECT DISTINCT domain FROM KeyInfo WHERE domain IS NOT NULL ORDER BY domain ASC;";
 
   begin(handle);
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
     sqlite3_finalize(ppStmt);
     rollback(handle);
-    //printf("prepare: %s\n", sqlite3_errmsg(handle->db));
-    freeMemory(statement); 
-    return ERROR_DATABASE_INVALID;
-  }
-  freeMemory(statement);  
-
-  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":dom");
-  if(parameterIndex == 0){
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    //printf("bind parameter domain: %s\n", sqlite3_errmsg(handle->db));
-    return ERROR_DATABASE_INVALID;
-  }
-
-  if(sqlite3_bind_text(ppStmt, parameterIndex, domain, -1, SQLITE_TRANSIENT) != SQLITE_OK){
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    //printf("bind domain: %s\n", sqlite3_errmsg(handle->db));
-    return ERROR_DATABASE_INVALID;
-  }
-  
-  parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
-  if(parameterIndex == 0){
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    //printf("bind parameter key: %s\n", sqlite3_errmsg(handle->db));
-    return ERROR_DATABASE_INVALID;
-  }
-
-  if(sqlite3_bind_text(ppStmt, parameterIndex, key, -1, SQLITE_TRANSIENT) != SQLITE_OK){
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    //printf("bind key: %s\n", sqlite3_errmsg(handle->db));  
     return ERROR_DATABASE_INVALID;
   }
 
+  int error = ERROR_OK;
   while (42){
       int retval = sqlite3_step(ppStmt);
 
-      if(retval == SQLITE_ROW){     
-        if(sqlite3_column_type(ppStmt, 0) != SQLITE_INTEGER){
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          return ERROR_DATABASE_TYPE_MISMATCH;
-        }      
-        *value = (int64_t)sqlite3_column_int64(ppStmt, 0);
-        break;
+      if(retval == SQLITE_ROW){
+        const char* dbentry = (const char*)sqlite3_column_text(ppStmt, 0);
+        if(dbentry == NULL){
+          error = ERROR_DATABASE_INVALID;
+          break;
+        }
+        size_t length = strlen(dbentry) + 1;
+        if(editMemory((void**)domains, *size + length) != ERROR_OK){
+          *domains = NULL;
+          error = ERROR_MEMORY;
+          break;
+        }
+        memcpy(*domains + *size, dbentry, length);
+        *size += length;
+        (*count)++;
       }
       else if(retval == SQLITE_DONE){
-        //printf("no such key1");
-        sqlite3_finalize(ppStmt);
-        rollback(handle);
-        return ERROR_DATABASE_NO_SUCH_KEY;
+        break;
       }
       else {
-        //printf("step: %s\n", sqlite3_errmsg(handle->db));
-        sqlite3_finalize(ppStmt);
-        rollback(handle);
-        return ERROR_DATABASE_INVALID;
-      } 
+        error = stepError(retval);
+        break;
+      }
   }
 
-  if(sqlite3_reset(ppStmt) != SQLITE_OK){
-    //printf("reset: %s\n", sqlite3_errmsg(handle->db));
-    sqlite3_finalize(ppStmt);
+  sqlite3_finalize(ppStmt);
+  if(error != ERROR_OK){
     rollback(handle);
-    return ERROR_DATABASE_INVALID;
+    freeMemory(*domains);
+    *domains = NULL;
+    *count = 0;
+    *size = 0;
+    return error;
   }
 
-  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
-    //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
-    rollback(handle);
-    return ERROR_DATABASE_INVALID;
-  }
   commit(handle);
-
   return ERROR_OK;
-} 
+}
 
 int
-database_set_int64(database_handle_t* handle, const char* domain,
-                   const char* key, int64_t value)
+database_get_settings(database_handle_t* handle, char** settings)
 {
-  /* Input checks */
-  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+  if(handle == NULL || handle->db == NULL || settings == NULL)
     return ERROR_INVALID_ARGUMENTS;
 
-  /* Some variables */
-  char* statement = NULL;
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
+  /* synchronous and temp_store come back as numbers, offset by the default
+     of the option tables */
+  const char* synchronouses[] = DATABASE_SYNCHRONOUS_NAMES;
+  const char* temp_stores[] = DATABASE_TEMP_STORE_NAMES;
+  char journal[16];
+  char synchronous[16];
+  char cache_size[24];
+  char mmap_size[24];
+  char temp_store[16];
+  if(readPragma(handle, "PRAGMA journal_mode;", journal, sizeof(journal)) != ERROR_OK ||
+     readPragma(handle, "PRAGMA synchronous;", synchronous, sizeof(synchronous)) != ERROR_OK ||
+     readPragma(handle, "PRAGMA cache_size;", cache_size, sizeof(cache_size)) != ERROR_OK ||
+     readPragma(handle, "PRAGMA mmap_size;", mmap_size, sizeof(mmap_size)) != ERROR_OK ||
+     readPragma(handle, "PRAGMA temp_store;", temp_store, sizeof(temp_store)) != ERROR_OK)
+    return ERROR_DATABASE_INVALID;
 
-  /* Check if already existing */
-  char* datatype = NULL;
-  unsigned int id = 0;
+  int synchronous_value = atoi(synchronous);
+  int temp_store_value = atoi(temp_store);
+  if(synchronous_value < 0 || synchronous_value >= DATABASE_SYNCHRONOUS_EXTRA ||
+     temp_store_value < 0 || temp_store_value > DATABASE_TEMP_STORE_MEMORY)
+    return ERROR_DATABASE_INVALID;
 
-  if(requestMemory((void**)&datatype, 7) != ERROR_OK)
-    return ERROR_MEMORY;
-  if(requestMemory((void**)&statement, 69) != ERROR_OK)
+  /* PRAGMA busy_timeout reads 0 with busyHandler installed */
+  size_t size = sizeof(journal) + sizeof(cache_size) + sizeof(mmap_size) + 120;
+  if(requestMemory((void**)settings, size) != ERROR_OK)
     return ERROR_MEMORY;
 
-  strcpy(statement, "SELECT id, datatype FROM KeyInfo WHERE domain = :dom and key = :key;");
+  snprintf(*settings, size, "journal=%s&synchronous=%s&cache_size=%s&"
+           "mmap_size=%s&temp_store=%s&busy_timeout=%lld", journal,
+           synchronouses[synchronous_value + 1], cache_size, mmap_size,
+           temp_stores[temp_store_value], (long long)handle->busy_timeout);
+  return ERROR_OK;
+}
 
-  begin(handle);
-  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
-    //printf("prepare: %s\n", sqlite3_errmsg(handle->db));
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    freeMemory(statement);
-    freeMemory(datatype);  
-    return ERROR_DATABASE_INVALID;
-  }
-  freeMemory(statement);
+int
+database_release_memory(database_handle_t* handle, size_t* released)
+{
+  if(handle == NULL || handle->db == NULL || released == NULL)
+    return ERROR_INVALID_ARGUMENTS;
 
-  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":dom");
-  if(parameterIndex == 0){
-    //printf("bind parameter domain: %s\n", sqlite3_errmsg(handle->db));
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    freeMemory(datatype);  
+  /* what the page cache gives back is all that can be counted */
+  int before = 0;
+  int after = 0;
+  int highwater = 0;
+  if(sqlite3_db_status(handle->db, SQLITE_DBSTATUS_CACHE_USED, &before,
+                       &highwater, 0) != SQLITE_OK ||
+     sqlite3_db_release_memory(handle->db) != SQLITE_OK ||
+     sqlite3_db_status(handle->db, SQLITE_DBSTATUS_CACHE_USED, &after,
+                       &highwater, 0) != SQLITE_OK)
     return ERROR_DATABASE_INVALID;
-  }
 
-  if(sqlite3_bind_text(ppStmt, parameterIndex, domain, -1, SQLITE_TRANSIENT) != SQLITE_OK){
-    //printf("bind domain: %s\n", sqlite3_errmsg(handle->db));
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    freeMemory(datatype);  
-    return ERROR_DATABASE_INVALID;
+  /* cached blob directories are reopened on demand */
+  forgetBlobDirectories(handle);
+
+  *released = before > after ? (size_t)(before - after) : 0;
+  return ERROR_OK;
+}
+
+int
+database_get_busy_stats(database_handle_t* handle, database_busy_stats_t* stats)
+{
+  if(handle == NULL || stats == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *stats = handle->busy_stats;
+  return ERROR_OK;
+}
+
+int
+database_backup(database_handle_t* handle, const char* path,
+                database_backup_callback_t callback, void* context)
+{
+  if(handle == NULL || handle->db == NULL || path == NULL || strlen(path) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  size_t path_size = strlen(path);
+  char* temporary = NULL;
+  char* blobpath = NULL;
+  if(requestMemory((void**)&temporary, path_size + sizeof(DATABASE_BACKUP_TEMPORARY)) != ERROR_OK)
+    return ERROR_MEMORY;
+  if(requestMemory((void**)&blobpath, path_size + sizeof(DATABASE_BACKUP_BLOBS)) != ERROR_OK){
+    freeMemory(temporary);
+    return ERROR_MEMORY;
   }
-  
-  parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
-  if(parameterIndex == 0){
-    //printf("bind parameter key: %s\n", sqlite3_errmsg(handle->db));
+  snprintf(temporary, path_size + sizeof(DATABASE_BACKUP_TEMPORARY),
+           "%s" DATABASE_BACKUP_TEMPORARY, path);
+  snprintf(blobpath, path_size + sizeof(DATABASE_BACKUP_BLOBS),
+           "%s" DATABASE_BACKUP_BLOBS, path);
+
+  database_backup_progress_t progress;
+  memset(&progress, 0, sizeof(database_backup_progress_t));
+
+  /* a leftover of an aborted backup is overwritten page by page */
+  sqlite3* target = NULL;
+  int ret = ERROR_OK;
+  unlink(temporary);
+  if(sqlite3_open_v2(temporary, &target, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                     NULL) != SQLITE_OK)
+    ret = ERROR_DATABASE_OPEN;
+
+  startBusy(handle);
+  if(ret == ERROR_OK)
+    ret = finishBusy(handle, backupPages(handle, target, callback, context, &progress));
+  if(ret == ERROR_OK && (mkdir(blobpath, 0777) != 0 && errno != EEXIST))
+    ret = ERROR_DATABASE_IO;
+  if(ret == ERROR_OK)
+    ret = backupBlobs(handle, target, blobpath, callback, context, &progress);
+
+  if(sqlite3_close(target) != SQLITE_OK && ret == ERROR_OK)
+    ret = ERROR_DATABASE_IO;
+  if(ret == ERROR_OK && rename(temporary, path) != 0)
+    ret = ERROR_DATABASE_IO;
+  if(ret != ERROR_OK)
+    unlink(temporary);
+
+  freeMemory(temporary);
+  freeMemory(blobpath);
+  return ret;
+}
+
+/**
+ * copies the pages of the database in batches, no lock is held between two
+ * batches
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] target The connection of the backup
+ * @param[in] callback Told about the progress, may be NULL
+ * @param[in] context Handed to @a callback
+ * @param[out] progress The progress so far
+ */
+int
+backupPages(database_handle_t* handle, sqlite3* target,
+            database_backup_callback_t callback, void* context,
+            database_backup_progress_t* progress)
+{
+  sqlite3_backup* backup = sqlite3_backup_init(target, "main", handle->db, "main");
+  if(backup == NULL)
+    return ERROR_DATABASE_OPEN;
+
+  int ret = ERROR_OK;
+  while(ret == ERROR_OK){
+    int retval = sqlite3_backup_step(backup, DATABASE_BACKUP_PAGES);
+    progress->pages = sqlite3_backup_pagecount(backup);
+    progress->pages_remaining = sqlite3_backup_remaining(backup);
+    if(retval == SQLITE_DONE)
+      break;
+
+    /* busyHandler already waited for the lock */
+    if(retval == SQLITE_BUSY || retval == SQLITE_LOCKED)
+      ret = ERROR_DATABASE_BUSY;
+    else if(retval != SQLITE_OK)
+      ret = ERROR_DATABASE_INVALID;
+    else if(callback != NULL && callback(progress, context) != 0)
+      ret = ERROR_DATABASE_ABORTED;
+  }
+
+  if(sqlite3_backup_finish(backup) != SQLITE_OK && ret == ERROR_OK)
+    ret = ERROR_DATABASE_INVALID;
+  if(ret == ERROR_OK && callback != NULL && callback(progress, context) != 0)
+    ret = ERROR_DATABASE_ABORTED;
+  return ret;
+}
+
+/**
+ * points the blob-path of the backup to its own blob directory
+ *
+ * @param[in] target The connection of the backup
+ * @param[in] blobpath Absolute path of the blob directory
+ */
+int
+pointBackupBlobs(sqlite3* target, const char* blobpath)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  char* statement = "UPDATE ValueString SET `value` = ? WHERE `id` IN (SELECT `id` FROM KeyInfo WHERE `datatype` = 'String' AND `key` = 'blob-path');";
+
+  if(sqlite3_prepare_v2(target, statement, -1, &ppStmt, NULL) != SQLITE_OK ||
+     sqlite3_bind_text(ppStmt, 1, blobpath, -1, SQLITE_STATIC) != SQLITE_OK ||
+     sqlite3_step(ppStmt) != SQLITE_DONE){
     sqlite3_finalize(ppStmt);
-    rollback(handle);
-    freeMemory(datatype);  
     return ERROR_DATABASE_INVALID;
   }
 
-  if(sqlite3_bind_text(ppStmt, parameterIndex, key, -1, SQLITE_TRANSIENT) != SQLITE_OK){
-    //printf("bind key: %s\n", sqlite3_errmsg(handle->db));  
-    sqlite3_finalize(ppStmt);
-    rollback(handle);
-    freeMemory(datatype);  
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK)
     return ERROR_DATABASE_INVALID;
-  }
+  return ERROR_OK;
+}
+
+/**
+ * copies every blob file the backup references into its blob directory,
+ * a shared file of the content-addressed store is copied once
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] target The connection of the backup
+ * @param[in] blobpath The blob directory of the backup
+ * @param[in] callback Told about the progress, may be NULL
+ * @param[in] context Handed to @a callback
+ * @param[out] progress The progress so far
+ */
+int
+backupBlobs(database_handle_t* handle, sqlite3* target, const char* blobpath,
+            database_backup_callback_t callback, void* context,
+            database_backup_progress_t* progress)
+{
+  char* resolved = realpath(blobpath, NULL);
+  if(resolved == NULL)
+    return ERROR_DATABASE_IO;
+  int ret = pointBackupBlobs(target, resolved);
+
+  /* the blob directory of the backup behind a handle of its own, so
+     openBlobFile creates and checks its directories */
+  database_handle_t copy;
+  memset(&copy, 0, sizeof(database_handle_t));
+  copy.blobdir = open(resolved, O_RDONLY | O_DIRECTORY);
+  free(resolved);
+  unsigned int i = 0;
+  for(i = 0; i < DATABASE_DIRECTORY_CACHE_SIZE; i++)
+    copy.directories[i].fd = -1;
+  if(copy.blobdir < 0)
+    return ERROR_DATABASE_IO;
+
+  sqlite3_stmt *ppStmt = NULL;
+  char* statement = "SELECT DISTINCT `path` FROM ValueBlob;";
+  if(ret == ERROR_OK && sqlite3_prepare_v2(target, statement, -1, &ppStmt, NULL) != SQLITE_OK)
+    ret = ERROR_DATABASE_INVALID;
+
+  while(ret == ERROR_OK){
+    int retval = sqlite3_step(ppStmt);
+    if(retval == SQLITE_DONE)
+      break;
+    if(retval != SQLITE_ROW || sqlite3_column_type(ppStmt, 0) != SQLITE_TEXT){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+
+    ret = backupBlobFile(handle, &copy, (const char*)sqlite3_column_text(ppStmt, 0),
+                         progress);
+    if(ret == ERROR_OK && callback != NULL && callback(progress, context) != 0)
+      ret = ERROR_DATABASE_ABORTED;
+  }
+
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK && ret == ERROR_OK)
+    ret = ERROR_DATABASE_INVALID;
+  forgetBlobDirectories(&copy);
+  close(copy.blobdir);
+  return ret;
+}
+
+/**
+ * clones or copies one blob file into the blob directory of the backup
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] copy Handle of the blob directory of the backup
+ * @param[in] path Path relative to the blob-path as stored in ValueBlob
+ * @param[out] progress The progress so far
+ */
+int
+backupBlobFile(database_handle_t* handle, database_handle_t* copy,
+               const char* path, database_backup_progress_t* progress)
+{
+  int from = -1;
+  int ret = openBlobFile(handle, path, O_RDONLY, &from);
+  if(ret == ERROR_DATABASE_INVALID && errno == ENOENT){
+    /* removed since the pages were copied */
+    progress->blobs_missing++;
+    return ERROR_OK;
+  }
+  if(ret != ERROR_OK)
+    return ret;
+
+  int to = -1;
+  ret = openBlobFile(copy, path, O_WRONLY | O_CREAT | O_TRUNC, &to);
+  if(ret != ERROR_OK){
+    close(from);
+    return ret;
+  }
+
+  size_t copied = 0;
+  ret = file_clone(from, to, &copied);
+  close(from);
+  if(close(to) != 0 && ret == ERROR_OK)
+    ret = ERROR_DATABASE_IO;
+  if(ret != ERROR_OK)
+    return ERROR_DATABASE_IO;
+
+  progress->blobs++;
+  progress->blob_bytes += copied;
+  return ERROR_OK;
+}
+
+int
+database_maintain(database_handle_t* handle, const database_maintenance_t* budget,
+                  database_maintenance_stats_t* stats)
+{
+  startBusy(handle);
+  return finishBusy(handle, maintainDatabase(handle, budget, stats));
+}
+
+int
+maintainDatabase(database_handle_t* handle, const database_maintenance_t* budget,
+                 database_maintenance_stats_t* stats)
+{
+  if(handle == NULL || handle->db == NULL || budget == NULL || stats == NULL ||
+     budget->pages < 0 || budget->grace < 0)
+    return ERROR_INVALID_ARGUMENTS;
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
+  memset(stats, 0, sizeof(database_maintenance_stats_t));
+  int ret = ERROR_OK;
+  if(budget->convert)
+    ret = convertAutoVacuum(handle);
+  if(ret == ERROR_OK)
+    ret = vacuumPages(handle, budget->pages, stats);
+  if(ret == ERROR_OK && budget->optimize){
+    ret = runMaintenanceStatement(handle, "PRAGMA optimize;");
+    stats->optimized = ret == ERROR_OK;
+  }
+  if(ret == ERROR_OK && budget->blobs > 0)
+    ret = collectBlobs(handle, budget, stats);
+  return ret;
+}
+
+/**
+ * runs a statement to its end, rows it returns are dropped
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] statement The statement
+ */
+int
+runMaintenanceStatement(database_handle_t* handle, const char* statement)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, NULL) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  int retval = SQLITE_ROW;
+  while(retval == SQLITE_ROW)
+    retval = sqlite3_step(ppStmt);
+  sqlite3_finalize(ppStmt);
+  if(retval != SQLITE_DONE)
+    return stepError(retval);
+  return ERROR_OK;
+}
+
+/**
+ * switches the database to auto_vacuum=INCREMENTAL, which only takes effect
+ * with a VACUUM rebuilding the file
+ *
+ * @param[in] handle A valid database handle
+ */
+int
+convertAutoVacuum(database_handle_t* handle)
+{
+  char mode[16];
+  if(readPragma(handle, "PRAGMA auto_vacuum;", mode, sizeof(mode)) != ERROR_OK)
+    return ERROR_DATABASE_INVALID;
+  if(atoi(mode) == DATABASE_AUTO_VACUUM_INCREMENTAL)
+    return ERROR_OK;
+
+  int ret = runMaintenanceStatement(handle, "PRAGMA auto_vacuum = INCREMENTAL;");
+  if(ret == ERROR_OK)
+    ret = runMaintenanceStatement(handle, "VACUUM;");
+  return ret;
+}
+
+/**
+ * gives back at most pages free pages and counts what is left, a database
+ * without auto_vacuum=INCREMENTAL gives back nothing
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] pages Most pages to give back
+ * @param[out] stats The pages freed and left
+ */
+int
+vacuumPages(database_handle_t* handle, int64_t pages,
+            database_maintenance_stats_t* stats)
+{
+  char before[24];
+  char after[24];
+  if(readPragma(handle, "PRAGMA freelist_count;", before, sizeof(before)) != ERROR_OK)
+    return ERROR_DATABASE_INVALID;
+
+  if(pages > 0){
+    char statement[48];
+    snprintf(statement, sizeof(statement), "PRAGMA incremental_vacuum(%lld);",
+             (long long)pages);
+    int ret = runMaintenanceStatement(handle, statement);
+    if(ret != ERROR_OK)
+      return ret;
+  }
+
+  if(readPragma(handle, "PRAGMA freelist_count;", after, sizeof(after)) != ERROR_OK)
+    return ERROR_DATABASE_INVALID;
+  stats->free_pages = atoll(after);
+  stats->pages_freed = atoll(before) > stats->free_pages ?
+                       atoll(before) - stats->free_pages : 0;
+  return ERROR_OK;
+}
+
+/**
+ * checks the next budget->blobs files below the blob-path and removes the
+ * ones without a row. The write lock is held from the walk to the removal,
+ * so no row shows up in between.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] budget Files to check and their grace period
+ * @param[out] stats The files checked and removed
+ */
+int
+collectBlobs(database_handle_t* handle, const database_maintenance_t* budget,
+             database_maintenance_stats_t* stats)
+{
+  if(handle->blobdir < 0)
+    return ERROR_OK;
+
+  blob_walk_t* walk = NULL;
+  if(requestMemory((void**)&walk, sizeof(blob_walk_t)) != ERROR_OK)
+    return ERROR_MEMORY;
+  walk->skip = handle->maintenance_cursor;
+  walk->seen = 0;
+  walk->limit = budget->blobs > UINT64_MAX - walk->skip ?
+                UINT64_MAX - walk->skip : budget->blobs;
+  walk->before = time(NULL) - budget->grace;
+  walk->path[0] = '\0';
+  walk->insert = NULL;
+
+  int ret = beginWrite(handle);
+  if(ret == ERROR_OK){
+    ret = runMaintenanceStatement(handle, "CREATE TEMP TABLE IF NOT EXISTS BlobCandidate (path TEXT PRIMARY KEY NOT NULL);");
+    if(ret == ERROR_OK &&
+       sqlite3_prepare_v2(handle->db, "INSERT OR IGNORE INTO temp.BlobCandidate(`path`) VALUES (?);",
+                          -1, &walk->insert, NULL) != SQLITE_OK)
+      ret = ERROR_DATABASE_INVALID;
+
+    /* a descriptor of its own, a dup would share the position of readdir */
+    int fd = openat(handle->blobdir, ".", O_RDONLY | O_DIRECTORY);
+    if(ret == ERROR_OK && fd < 0)
+      ret = ERROR_DATABASE_IO;
+    if(ret == ERROR_OK)
+      ret = walkBlobDirectory(walk, fd, 0);
+    else if(fd >= 0)
+      close(fd);
+    sqlite3_finalize(walk->insert);
+
+    if(ret == ERROR_OK)
+      ret = removeOrphanedBlobs(handle, walk->before, stats);
+    if(runMaintenanceStatement(handle, "DROP TABLE IF EXISTS temp.BlobCandidate;") != ERROR_OK &&
+       ret == ERROR_OK)
+      ret = ERROR_DATABASE_INVALID;
+    if(ret == ERROR_OK)
+      ret = commit(handle);
+    else
+      rollback(handle);
+  }
+
+  /* a walk that ended before its limit saw every file, start over */
+  if(ret == ERROR_OK){
+    stats->blobs_checked = walk->seen > walk->skip ? walk->seen - walk->skip : 0;
+    handle->maintenance_cursor = walk->seen < walk->skip + walk->limit ? 0 :
+                                 walk->skip + walk->limit;
+  }
+  freeMemory(walk);
+  return ret;
+}
+
+/**
+ * adds the regular files below a directory of the blob-path that are past
+ * the skipped ones and older than the grace period to BlobCandidate
+ *
+ * @param[in] walk The walk, path holds the directory
+ * @param[in] fd O_DIRECTORY fd of the directory, is closed
+ * @param[in] length Length of the directory in walk->path
+ */
+int
+walkBlobDirectory(blob_walk_t* walk, int fd, size_t length)
+{
+  DIR* directory = fdopendir(fd);
+  if(directory == NULL){
+    close(fd);
+    return ERROR_DATABASE_IO;
+  }
+
+  int ret = ERROR_OK;
+  struct dirent* entry = NULL;
+  while(ret == ERROR_OK && walk->seen < walk->skip + walk->limit &&
+        (entry = readdir(directory)) != NULL){
+    size_t name_size = strlen(entry->d_name);
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+       (length == 0 && strcmp(entry->d_name, DATABASE_RECOVERY_QUARANTINE) == 0) ||
+       length + name_size + 2 > sizeof(walk->path))
+      continue;
+
+    /* removed since readdir, or a link that is never followed */
+    struct stat sb;
+    if(fstatat(dirfd(directory), entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+      continue;
+    memcpy(walk->path + length, entry->d_name, name_size + 1);
+
+    if(S_ISDIR(sb.st_mode)){
+      int child = openat(dirfd(directory), entry->d_name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      if(child < 0)
+        continue;
+      walk->path[length + name_size] = '/';
+      walk->path[length + name_size + 1] = '\0';
+      ret = walkBlobDirectory(walk, child, length + name_size + 1);
+      continue;
+    }
+    if(!S_ISREG(sb.st_mode) || walk->seen++ < walk->skip ||
+       sb.st_mtime > walk->before)
+      continue;
+
+    if(sqlite3_bind_text(walk->insert, 1, walk->path, -1, SQLITE_STATIC) != SQLITE_OK ||
+       sqlite3_step(walk->insert) != SQLITE_DONE)
+      ret = ERROR_DATABASE_INVALID;
+    sqlite3_reset(walk->insert);
+  }
+
+  closedir(directory);
+  return ret;
+}
+
+/**
+ * removes the files in BlobCandidate that no row references. Content of the
+ * content-addressed store still counted in BlobContent is kept.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] before Files changed later are kept
+ * @param[out] stats The files removed
+ */
+int
+removeOrphanedBlobs(database_handle_t* handle, time_t before,
+                    database_maintenance_stats_t* stats)
+{
+  const char* statement = "SELECT `path` FROM temp.BlobCandidate WHERE `path` NOT IN (SELECT `path` FROM ValueBlob);";
+  if(sqlite3_table_column_metadata(handle->db, NULL, "BlobContent", "digest",
+                                   NULL, NULL, NULL, NULL, NULL) == SQLITE_OK)
+    statement = "SELECT `path` FROM temp.BlobCandidate WHERE `path` NOT IN (SELECT `path` FROM ValueBlob) AND (`path` NOT LIKE '" BLOB_CONTENT_DIRECTORY "/%' OR replace(substr(`path`, length('" BLOB_CONTENT_DIRECTORY "/') + 1), '/', '') NOT IN (SELECT `digest` FROM BlobContent));";
+
+  sqlite3_stmt *ppStmt = NULL;
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, NULL) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  int ret = ERROR_OK;
+  while(ret == ERROR_OK){
+    int retval = sqlite3_step(ppStmt);
+    if(retval == SQLITE_DONE)
+      break;
+    if(retval != SQLITE_ROW || sqlite3_column_type(ppStmt, 0) != SQLITE_TEXT){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+
+    /* written again since the walk, its row may still come */
+    const char* path = (const char*)sqlite3_column_text(ppStmt, 0);
+    int directory = -1;
+    const char* name = NULL;
+    struct stat sb;
+    if(openBlobDirectory(handle, path, 0, &directory, &name) != ERROR_OK ||
+       fstatat(directory, name, &sb, AT_SYMLINK_NOFOLLOW) != 0 ||
+       !S_ISREG(sb.st_mode) || sb.st_mtime > before)
+      continue;
+    if(unlinkat(directory, name, 0) == 0)
+      stats->blobs_removed++;
+  }
+
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK && ret == ERROR_OK)
+    ret = ERROR_DATABASE_INVALID;
+  return ret;
+}
+
+int
+database_recover(database_handle_t* handle, const database_recovery_t* recovery,
+                 database_recovery_stats_t* stats)
+{
+  startBusy(handle);
+  return finishBusy(handle, recoverBlobs(handle, recovery, stats));
+}
+
+int
+recoverBlobs(database_handle_t* handle, const database_recovery_t* recovery,
+             database_recovery_stats_t* stats)
+{
+  if(handle == NULL || handle->db == NULL || recovery == NULL || stats == NULL ||
+     handle->blobdir < 0)
+    return ERROR_INVALID_ARGUMENTS;
+  if(handle->readonly && (recovery->repair || recovery->quarantine))
+    return ERROR_DATABASE_READONLY;
+
+  unsigned int threads = recovery->threads;
+  if(threads == 0){
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (unsigned int)online : 1;
+  }
+  if(threads > DATABASE_RECOVERY_THREADS_MAX)
+    threads = DATABASE_RECOVERY_THREADS_MAX;
+
+  /* no row may come or go between the walk and the merge */
+  memset(stats, 0, sizeof(database_recovery_stats_t));
+  int changes = recovery->repair || recovery->quarantine;
+  int ret = changes ? beginWrite(handle) : ERROR_OK;
+  if(ret != ERROR_OK)
+    return ret;
+
+  recovery_worker_t* workers = NULL;
+  const char** files = NULL;
+  ret = walkRecoveryBlobs(handle, threads, &workers, &files, stats);
+  if(ret == ERROR_OK)
+    ret = mergeRecoveryRows(handle, recovery, files, stats);
+
+  if(workers != NULL){
+    unsigned int i = 0;
+    for(; i < threads; i++)
+      freeMemory(workers[i].names);
+  }
+  freeMemory(workers);
+  freeMemory(files);
+
+  if(!changes)
+    return ret;
+  if(ret == ERROR_OK)
+    return commit(handle);
+  rollback(handle);
+  return ret;
+}
+
+/**
+ * walks the blob-path with a pool of threads and sorts the regular files
+ * found, the quarantine is left out
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] threads Number of threads, the calling one included
+ * @param[out] workers The threads, their names hold the paths
+ * @param[out] files The sorted paths, NULL terminated
+ * @param[out] stats The files found
+ */
+int
+walkRecoveryBlobs(database_handle_t* handle, unsigned int threads,
+                  recovery_worker_t** workers, const char*** files,
+                  database_recovery_stats_t* stats)
+{
+  recovery_walk_t walk;
+  walk.blobdir = handle->blobdir;
+  walk.directories = NULL;
+  walk.queued = 0;
+  walk.capacity = 0;
+  walk.reading = 0;
+  walk.error = ERROR_OK;
+  if(pthread_mutex_init(&walk.lock, NULL) != 0)
+    return ERROR_UNKNOWN;
+  if(pthread_cond_init(&walk.wake, NULL) != 0){
+    pthread_mutex_destroy(&walk.lock);
+    return ERROR_UNKNOWN;
+  }
+
+  int ret = ERROR_OK;
+  if(requestMemory((void**)workers, threads * sizeof(recovery_worker_t)) != ERROR_OK)
+    ret = ERROR_MEMORY;
+  else
+    memset(*workers, 0, threads * sizeof(recovery_worker_t));
+  if(ret == ERROR_OK)
+    ret = queueRecoveryDirectory(&walk, "");
+
+  /* the calling thread is the first worker, the others help if they start */
+  unsigned int started = 1;
+  if(ret == ERROR_OK){
+    unsigned int i = 0;
+    for(; i < threads; i++)
+      (*workers)[i].walk = &walk;
+    for(; started < threads; started++){
+      if(pthread_create(&(*workers)[started].thread, NULL, runRecoveryWorker,
+                        &(*workers)[started]) != 0)
+        break;
+    }
+    runRecoveryWorker(&(*workers)[0]);
+    for(i = 1; i < started; i++)
+      pthread_join((*workers)[i].thread, NULL);
+    ret = walk.error;
+  }
+
+  while(walk.queued > 0)
+    freeMemory(walk.directories[--walk.queued]);
+  freeMemory(walk.directories);
+  pthread_cond_destroy(&walk.wake);
+  pthread_mutex_destroy(&walk.lock);
+  if(ret != ERROR_OK)
+    return ret;
+
+  unsigned int i = 0;
+  for(; i < started; i++)
+    stats->files += (*workers)[i].count;
+  if(requestMemory((void**)files, (stats->files + 1) * sizeof(const char*)) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  uint64_t file = 0;
+  for(i = 0; i < started; i++){
+    const char* name = (*workers)[i].names;
+    uint64_t j = 0;
+    for(; j < (*workers)[i].count; j++){
+      (*files)[file++] = name;
+      name += strlen(name) + 1;
+    }
+  }
+  qsort(*files, stats->files, sizeof(const char*), compareRecoveryFiles);
+  (*files)[stats->files] = NULL;
+  return ERROR_OK;
+}
+
+/**
+ * takes directories off the queue of the walk until none is left and no
+ * other thread can queue one anymore
+ *
+ * @param[in] data The recovery_worker_t of the thread
+ */
+void*
+runRecoveryWorker(void* data)
+{
+  recovery_worker_t* worker = data;
+  recovery_walk_t* walk = worker->walk;
+
+  pthread_mutex_lock(&walk->lock);
+  while(1){
+    while(walk->queued == 0 && walk->reading > 0 && walk->error == ERROR_OK)
+      pthread_cond_wait(&walk->wake, &walk->lock);
+    if(walk->queued == 0 || walk->error != ERROR_OK)
+      break;
+
+    char* path = walk->directories[--walk->queued];
+    walk->reading++;
+    pthread_mutex_unlock(&walk->lock);
+
+    int ret = readRecoveryDirectory(worker, path);
+    freeMemory(path);
+
+    pthread_mutex_lock(&walk->lock);
+    walk->reading--;
+    if(ret != ERROR_OK && walk->error == ERROR_OK)
+      walk->error = ret;
+    pthread_cond_broadcast(&walk->wake);
+  }
+  pthread_mutex_unlock(&walk->lock);
+  return NULL;
+}
+
+/**
+ * reads one directory of the blob-path, directories below it are queued and
+ * regular files are added to the worker
+ *
+ * @param[in] worker The thread
+ * @param[in] path Path of the directory relative to the blob-path, "" for
+ *   the blob-path itself
+ */
+int
+readRecoveryDirectory(recovery_worker_t* worker, const char* path)
+{
+  int fd = openat(worker->walk->blobdir, path[0] == '\0' ? "." : path,
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  if(fd < 0)
+    return errno == ENOENT ? ERROR_OK : ERROR_DATABASE_IO;
+  DIR* directory = fdopendir(fd);
+  if(directory == NULL){
+    close(fd);
+    return ERROR_DATABASE_IO;
+  }
+
+  size_t length = strlen(path);
+  char child[PATH_MAX];
+  int ret = ERROR_OK;
+  struct dirent* entry = NULL;
+  while(ret == ERROR_OK && (entry = readdir(directory)) != NULL){
+    size_t name_size = strlen(entry->d_name);
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+       (length == 0 && strcmp(entry->d_name, DATABASE_RECOVERY_QUARANTINE) == 0) ||
+       length + name_size + 2 > sizeof(child))
+      continue;
+
+    /* links are never followed, no row can point through them */
+    struct stat sb;
+    if(fstatat(dirfd(directory), entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+      continue;
+    if(length == 0)
+      memcpy(child, entry->d_name, name_size + 1);
+    else
+      snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+
+    if(S_ISDIR(sb.st_mode))
+      ret = queueRecoveryDirectory(worker->walk, child);
+    else if(S_ISREG(sb.st_mode))
+      ret = addRecoveryFile(worker, child);
+  }
+
+  closedir(directory);
+  return ret;
+}
+
+/**
+ * queues a directory of the blob-path and wakes a waiting thread
+ *
+ * @param[in] walk The walk
+ * @param[in] path Path of the directory relative to the blob-path
+ */
+int
+queueRecoveryDirectory(recovery_walk_t* walk, const char* path)
+{
+  char* directory = NULL;
+  size_t size = strlen(path) + 1;
+  if(requestMemory((void**)&directory, size) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(directory, path, size);
+
+  pthread_mutex_lock(&walk->lock);
+  if(walk->queued == walk->capacity){
+    size_t capacity = walk->capacity == 0 ? 64 : walk->capacity * 2;
+    if(editMemory((void**)&walk->directories, capacity * sizeof(char*)) != ERROR_OK){
+      /* editMemory freed the queue, its directories are lost */
+      walk->directories = NULL;
+      walk->queued = 0;
+      walk->capacity = 0;
+      pthread_mutex_unlock(&walk->lock);
+      freeMemory(directory);
+      return ERROR_MEMORY;
+    }
+    walk->capacity = capacity;
+  }
+  walk->directories[walk->queued++] = directory;
+  pthread_cond_signal(&walk->wake);
+  pthread_mutex_unlock(&walk->lock);
+  return ERROR_OK;
+}
+
+/**
+ * adds a file to the paths a thread found
+ *
+ * @param[in] worker The thread
+ * @param[in] path Path of the file relative to the blob-path
+ */
+int
+addRecoveryFile(recovery_worker_t* worker, const char* path)
+{
+  size_t size = strlen(path) + 1;
+  if(worker->names_size + size > worker->names_capacity){
+    size_t capacity = worker->names_capacity == 0 ? 4096 : worker->names_capacity * 2;
+    while(capacity < worker->names_size + size)
+      capacity *= 2;
+    if(editMemory((void**)&worker->names, capacity) != ERROR_OK){
+      worker->names = NULL;
+      worker->names_size = 0;
+      worker->names_capacity = 0;
+      worker->count = 0;
+      return ERROR_MEMORY;
+    }
+    worker->names_capacity = capacity;
+  }
+
+  memcpy(worker->names + worker->names_size, path, size);
+  worker->names_size += size;
+  worker->count++;
+  return ERROR_OK;
+}
+
+/**
+ * orders two paths like ORDER BY `path` does, byte by byte
+ *
+ * @param[in] first Pointer to the first path
+ * @param[in] second Pointer to the second path
+ */
+int
+compareRecoveryFiles(const void* first, const void* second)
+{
+  return strcmp(*(const char* const*)first, *(const char* const*)second);
+}
+
+/**
+ * streams the rows of ValueBlob ordered by their path against the sorted
+ * files, rows without a file and files without a row are dealt with as
+ * the recovery says
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] recovery What to do about what is found
+ * @param[in] files The sorted paths of the files, NULL terminated
+ * @param[out] stats What was found and done
+ */
+int
+mergeRecoveryRows(database_handle_t* handle, const database_recovery_t* recovery,
+                  const char** files, database_recovery_stats_t* stats)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  if(sqlite3_prepare_v2(handle->db, "SELECT `id`, `path` FROM ValueBlob ORDER BY `path`;",
+                        -1, &ppStmt, NULL) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  /* moved files keep their path below the quarantine */
+  database_handle_t quarantine;
+  memset(&quarantine, 0, sizeof(database_handle_t));
+  quarantine.blobdir = -1;
+  int ret = ERROR_OK;
+  if(recovery->quarantine){
+    if(mkdirat(handle->blobdir, DATABASE_RECOVERY_QUARANTINE, 0777) != 0 && errno != EEXIST)
+      ret = ERROR_DATABASE_IO;
+    quarantine.blobdir = openat(handle->blobdir, DATABASE_RECOVERY_QUARANTINE,
+                                O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if(quarantine.blobdir < 0)
+      ret = ERROR_DATABASE_IO;
+  }
+
+  int64_t* missing = NULL;
+  size_t missing_capacity = 0;
+  int matched = 0;
+  while(ret == ERROR_OK){
+    int retval = sqlite3_step(ppStmt);
+    if(retval == SQLITE_DONE)
+      break;
+    if(retval != SQLITE_ROW || sqlite3_column_type(ppStmt, 1) != SQLITE_TEXT){
+      ret = ERROR_DATABASE_INVALID;
+      break;
+    }
+    const char* path = (const char*)sqlite3_column_text(ppStmt, 1);
+    stats->rows++;
+
+    /* files before the path of the row have none */
+    int order = -1;
+    while(ret == ERROR_OK && *files != NULL && (order = strcmp(*files, path)) < 0){
+      if(!matched){
+        stats->orphans++;
+        if(recovery->quarantine)
+          ret = quarantineBlobFile(handle, &quarantine, *files);
+        if(ret == ERROR_OK && recovery->quarantine)
+          stats->quarantined++;
+      }
+      matched = 0;
+      files++;
+      order = -1;
+    }
+    if(ret != ERROR_OK)
+      break;
+    if(*files != NULL && order == 0){
+      /* rows of the content-addressed store share their file */
+      matched = 1;
+      continue;
+    }
+
+    stats->missing++;
+    if(recovery->repair){
+      if(stats->missing > missing_capacity){
+        missing_capacity = missing_capacity == 0 ? 64 : missing_capacity * 2;
+        if(editMemory((void**)&missing, missing_capacity * sizeof(int64_t)) != ERROR_OK){
+          missing = NULL;
+          ret = ERROR_MEMORY;
+          break;
+        }
+      }
+      missing[stats->missing - 1] = sqlite3_column_int64(ppStmt, 0);
+    }
+  }
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK && ret == ERROR_OK)
+    ret = ERROR_DATABASE_INVALID;
+
+  /* files behind the last row */
+  for(; ret == ERROR_OK && *files != NULL; files++){
+    if(matched){
+      matched = 0;
+      continue;
+    }
+    stats->orphans++;
+    if(recovery->quarantine){
+      ret = quarantineBlobFile(handle, &quarantine, *files);
+      if(ret == ERROR_OK)
+        stats->quarantined++;
+    }
+  }
+
+  if(ret == ERROR_OK && recovery->repair)
+    ret = deleteRecoveryRows(handle, missing, stats->missing);
+  if(ret == ERROR_OK && recovery->repair)
+    stats->repaired = stats->missing;
+
+  freeMemory(missing);
+  forgetBlobDirectories(&quarantine);
+  if(quarantine.blobdir >= 0)
+    close(quarantine.blobdir);
+  return ret;
+}
+
+/**
+ * moves a blob file into the quarantine, below the same relative path
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] quarantine Handle of the quarantine directory
+ * @param[in] path Path relative to the blob-path
+ */
+int
+quarantineBlobFile(database_handle_t* handle, database_handle_t* quarantine,
+                   const char* path)
+{
+  int from = -1;
+  int to = -1;
+  const char* name = NULL;
+  const char* target = NULL;
+  if(openBlobDirectory(handle, path, 0, &from, &name) != ERROR_OK)
+    return ERROR_DATABASE_IO;
+  if(openBlobDirectory(quarantine, path, 1, &to, &target) != ERROR_OK)
+    return ERROR_DATABASE_IO;
+
+  /* gone since the walk, nothing to move */
+  if(renameat(from, name, to, target) != 0 && errno != ENOENT)
+    return ERROR_DATABASE_IO;
+  return ERROR_OK;
+}
+
+/**
+ * deletes the keys of the rows whose blob file is gone and counts the
+ * references of the content-addressed store anew
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] ids The ids of the keys
+ * @param[in] count Number of ids
+ */
+int
+deleteRecoveryRows(database_handle_t* handle, const int64_t* ids, uint64_t count)
+{
+  const char* statements[2] = {"DELETE FROM ValueBlob WHERE `id` = ?;",
+                               "DELETE FROM KeyInfo WHERE `id` = ?;"};
+  unsigned int i = 0;
+  for(; i < 2; i++){
+    sqlite3_stmt *ppStmt = NULL;
+    if(sqlite3_prepare_v2(handle->db, statements[i], -1, &ppStmt, NULL) != SQLITE_OK){
+      sqlite3_finalize(ppStmt);
+      return ERROR_DATABASE_INVALID;
+    }
+
+    uint64_t row = 0;
+    for(; row < count; row++){
+      if(sqlite3_bind_int64(ppStmt, 1, ids[row]) != SQLITE_OK ||
+         sqlite3_step(ppStmt) != SQLITE_DONE){
+        sqlite3_finalize(ppStmt);
+        return ERROR_DATABASE_INVALID;
+      }
+      sqlite3_reset(ppStmt);
+    }
+    if(sqlite3_finalize(ppStmt) != SQLITE_OK)
+      return ERROR_DATABASE_INVALID;
+  }
+
+  /* a crash may also have hit between a file and its reference count */
+  if(sqlite3_table_column_metadata(handle->db, NULL, "BlobContent", "digest",
+                                   NULL, NULL, NULL, NULL, NULL) != SQLITE_OK)
+    return ERROR_OK;
+  if(runMaintenanceStatement(handle, "UPDATE BlobContent SET `refcount` = (SELECT count(*) FROM ValueBlob WHERE `path` = '" BLOB_CONTENT_DIRECTORY "/' || substr(`digest`, 1, 2) || '/' || substr(`digest`, 3));") != ERROR_OK ||
+     runMaintenanceStatement(handle, "DELETE FROM BlobContent WHERE `refcount` = 0;") != ERROR_OK)
+    return ERROR_DATABASE_INVALID;
+  return ERROR_OK;
+}
+
+
+int
+database_get_int64(database_handle_t* handle, const char* domain,
+                   const char* key, int64_t* value)
+{
+  startBusy(handle);
+  return finishBusy(handle, getInt64(handle, domain, key, value));
+}
+
+int
+getInt64(database_handle_t* handle, const char* domain, const char* key,
+         int64_t* value)
+{
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || value == NULL || strlen(domain) == 0 || strlen(key) == 0 || strlen(handle->blobpath) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+  
+  char* statement = NULL;
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+
+  unsigned int sizeOfStmt = 193;
+  if(requestMemory((void**)&statement, sizeOfStmt) != ERROR_OK){
+    return ERROR_MEMORY;
+  }
+
+  strcpy(statement, "SELECT ValueInt64.`value` as `value` FROM KeyInfo INNER JOIN ValueInt64 ON KeyInfo.`id` = ValueInt64.`id`WHERE KeyInfo.`datatype` = 'Int64' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;");
+
+  begin(handle);
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    //printf("prepare: %s\n", sqlite3_errmsg(handle->db));
+    freeMemory(statement); 
+    return ERROR_DATABASE_INVALID;
+  }
+  freeMemory(statement);  
+
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":dom");
+  if(parameterIndex == 0){
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    //printf("bind parameter domain: %s\n", sqlite3_errmsg(handle->db));
+    return ERROR_DATABASE_INVALID;
+  }
+
+  if(sqlite3_bind_text(ppStmt, parameterIndex, domain, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    //printf("bind domain: %s\n", sqlite3_errmsg(handle->db));
+    return ERROR_DATABASE_INVALID;
+  }
+  
+  parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
+  if(parameterIndex == 0){
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    //printf("bind parameter key: %s\n", sqlite3_errmsg(handle->db));
+    return ERROR_DATABASE_INVALID;
+  }
+
+  if(sqlite3_bind_text(ppStmt, parameterIndex, key, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    //printf("bind key: %s\n", sqlite3_errmsg(handle->db));  
+    return ERROR_DATABASE_INVALID;
+  }
+
+  while (42){
+      int retval = sqlite3_step(ppStmt);
+
+      if(retval == SQLITE_ROW){     
+        if(sqlite3_column_type(ppStmt, 0) != SQLITE_INTEGER){
+          sqlite3_finalize(ppStmt);
+          rollback(handle);
+          return ERROR_DATABASE_TYPE_MISMATCH;
+        }      
+        *value = (int64_t)sqlite3_column_int64(ppStmt, 0);
+        break;
+      }
+      else if(retval == SQLITE_DONE){
+        //printf("no such key1");
+        sqlite3_finalize(ppStmt);
+        rollback(handle);
+        return ERROR_DATABASE_NO_SUCH_KEY;
+      }
+      else {
+        //printf("step: %s\n", sqlite3_errmsg(handle->db));
+        sqlite3_finalize(ppStmt);
+        rollback(handle);
+        return stepError(retval);
+      } 
+  }
+
+  if(sqlite3_reset(ppStmt) != SQLITE_OK){
+    //printf("reset: %s\n", sqlite3_errmsg(handle->db));
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
+    //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
+    rollback(handle);
+    return ERROR_DATABASE_INVALID;
+  }
+  commit(handle);
+
+  return ERROR_OK;
+} 
+
+int
+database_set_int64(database_handle_t* handle, const char* domain,
+                   const char* key, int64_t value)
+{
+  startBusy(handle);
+  return finishBusy(handle, setInt64(handle, domain, key, value));
+}
+
+int
+setInt64(database_handle_t* handle, const char* domain, const char* key,
+         int64_t value)
+{
+  /* Input checks */
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* read-only handles refuse before anything is touched */
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
+  /* Some variables */
+  char* statement = NULL;
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+
+  /* Check if already existing */
+  char* datatype = NULL;
+  unsigned int id = 0;
+
+  if(requestMemory((void**)&datatype, 7) != ERROR_OK)
+    return ERROR_MEMORY;
+  if(requestMemory((void**)&statement, 69) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  strcpy(statement, "SELECT id, datatype FROM KeyInfo WHERE domain = :dom and key = :key;");
+
+  int begun = beginWrite(handle);
+  if(begun != ERROR_OK){
+    freeMemory(statement);
+    freeMemory(datatype);
+    return begun;
+  }
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
+    //printf("prepare: %s\n", sqlite3_errmsg(handle->db));
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    freeMemory(statement);
+    freeMemory(datatype);  
+    return ERROR_DATABASE_INVALID;
+  }
+  freeMemory(statement);
+
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":dom");
+  if(parameterIndex == 0){
+    //printf("bind parameter domain: %s\n", sqlite3_errmsg(handle->db));
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    freeMemory(datatype);  
+    return ERROR_DATABASE_INVALID;
+  }
+
+  if(sqlite3_bind_text(ppStmt, parameterIndex, domain, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+    //printf("bind domain: %s\n", sqlite3_errmsg(handle->db));
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    freeMemory(datatype);  
+    return ERROR_DATABASE_INVALID;
+  }
+  
+  parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
+  if(parameterIndex == 0){
+    //printf("bind parameter key: %s\n", sqlite3_errmsg(handle->db));
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    freeMemory(datatype);  
+    return ERROR_DATABASE_INVALID;
+  }
+
+  if(sqlite3_bind_text(ppStmt, parameterIndex, key, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+    //printf("bind key: %s\n", sqlite3_errmsg(handle->db));  
+    sqlite3_finalize(ppStmt);
+    rollback(handle);
+    freeMemory(datatype);  
+    return ERROR_DATABASE_INVALID;
+  }
 
   while (42){
       int retval = sqlite3_step(ppStmt);
@@ -1026,7 +3045,7 @@ database_set_int64(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -1044,8 +3063,6 @@ database_set_int64(database_handle_t* handle, const char* domain,
     freeMemory(datatype);  
     return ERROR_DATABASE_INVALID;
   }
-  commit(handle);
-  begin(handle);
   /* key doesn't exist */
   if(datatype == NULL){
     /* Insert into Keyinfo */
@@ -1106,19 +3123,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1195,19 +3205,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1225,7 +3228,11 @@ database_set_int64(database_handle_t* handle, const char* domain,
         freeMemory(datatype);  
         return ERROR_DATABASE_INVALID;
       }
-      commit(handle);
+      int committed = commit(handle);
+      if(committed != ERROR_OK){
+        freeMemory(datatype);
+        return committed;
+      }
   }
   else{ /* key already exist */    
     /* Datatype is the same - just update value */
@@ -1288,19 +3295,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1328,7 +3328,11 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(ret != ERROR_OK)
           return ret;
       }
-      begin(handle);
+      int begun = beginWrite(handle);
+      if(begun != ERROR_OK){
+        freeMemory(datatype);
+        return begun;
+      }
       /* Delete from ValueXtable */
       if(requestMemory((void**)&statement, 40) != ERROR_OK){
         rollback(handle);
@@ -1372,19 +3376,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1444,19 +3441,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1550,19 +3540,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1639,19 +3622,12 @@ database_set_int64(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -1670,7 +3646,11 @@ database_set_int64(database_handle_t* handle, const char* domain,
         return ERROR_DATABASE_INVALID;
       }
     }
-    commit(handle);    
+    int committed = commit(handle);
+    if(committed != ERROR_OK){
+      freeMemory(datatype);
+      return committed;
+    }
   }
   freeMemory(datatype);  
   return ERROR_OK;
@@ -1680,6 +3660,14 @@ database_set_int64(database_handle_t* handle, const char* domain,
 int
 database_get_double(database_handle_t* handle, const char* domain,
                     const char* key, double* value)
+{
+  startBusy(handle);
+  return finishBusy(handle, getDouble(handle, domain, key, value));
+}
+
+int
+getDouble(database_handle_t* handle, const char* domain, const char* key,
+          double* value)
 {
   if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || value == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
     return ERROR_INVALID_ARGUMENTS;
@@ -1758,7 +3746,7 @@ database_get_double(database_handle_t* handle, const char* domain,
         //printf("step: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -1783,11 +3771,22 @@ database_get_double(database_handle_t* handle, const char* domain,
 int
 database_set_double(database_handle_t* handle, const char* domain,
                     const char* key, double value)
+{
+  startBusy(handle);
+  return finishBusy(handle, setDouble(handle, domain, key, value));
+}
+
+int
+setDouble(database_handle_t* handle, const char* domain, const char* key,
+          double value)
 {
   /* Input checks */
   if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0 || isnan(value))
     return ERROR_INVALID_ARGUMENTS;
 
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
   /* Some variables */
   char* statement = NULL;
   sqlite3_stmt *ppStmt = NULL;
@@ -1805,7 +3804,12 @@ database_set_double(database_handle_t* handle, const char* domain,
 
   strcpy(statement, "SELECT id, datatype FROM KeyInfo WHERE domain = :dom and key = :key;");
 
-  begin(handle);
+  int begun = beginWrite(handle);
+  if(begun != ERROR_OK){
+    freeMemory(statement);
+    freeMemory(datatype);
+    return begun;
+  }
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
     //printf("prepare1: %s\n", sqlite3_errmsg(handle->db));
     sqlite3_finalize(ppStmt);
@@ -1874,7 +3878,7 @@ database_set_double(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -1892,8 +3896,6 @@ database_set_double(database_handle_t* handle, const char* domain,
     freeMemory(datatype);  
     return ERROR_DATABASE_INVALID;
   }
-  commit(handle);
-  begin(handle);
 
   /* key doesn't exist */
   if(datatype == NULL){
@@ -1955,19 +3957,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2044,19 +4039,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2074,7 +4062,11 @@ database_set_double(database_handle_t* handle, const char* domain,
         freeMemory(datatype);  
         return ERROR_DATABASE_INVALID;
       }
-    commit(handle);
+    int committed = commit(handle);
+    if(committed != ERROR_OK){
+      freeMemory(datatype);
+      return committed;
+    }
   }
   else{ /* key already exist */    
     /* Datatype is the same - just update value */
@@ -2087,7 +4079,11 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(ret != ERROR_OK)
           return ret;
       }
-      begin(handle);
+      int begun = beginWrite(handle);
+      if(begun != ERROR_OK){
+        freeMemory(datatype);
+        return begun;
+      }
 
       /* Update ValueDouble */
       if(requestMemory((void**)&statement, 52) != ERROR_OK){
@@ -2147,19 +4143,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2223,19 +4212,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2295,19 +4277,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2401,19 +4376,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2490,19 +4458,12 @@ database_set_double(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2521,7 +4482,11 @@ database_set_double(database_handle_t* handle, const char* domain,
         return ERROR_DATABASE_INVALID;
       }
     }    
-    commit(handle);
+    int committed = commit(handle);
+    if(committed != ERROR_OK){
+      freeMemory(datatype);
+      return committed;
+    }
   }
   freeMemory(datatype);  
   return ERROR_OK;
@@ -2531,6 +4496,14 @@ database_set_double(database_handle_t* handle, const char* domain,
 int
 database_get_string(database_handle_t* handle, const char* domain,
                     const char* key, char** value)
+{
+  startBusy(handle);
+  return finishBusy(handle, getString(handle, domain, key, value));
+}
+
+int
+getString(database_handle_t* handle, const char* domain, const char* key,
+          char** value)
 {
  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || value == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
     return ERROR_INVALID_ARGUMENTS;
@@ -2538,12 +4511,15 @@ database_get_string(database_handle_t* handle, const char* domain,
   char* statement = NULL;
   sqlite3_stmt *ppStmt = NULL;
   const char** pzTail = NULL;
+  const char* select = handle->codecs ?
+    "SELECT ValueString.`value` as `value`, ValueString.`codec` as `codec` FROM KeyInfo INNER JOIN ValueString ON KeyInfo.`id` = ValueString.`id`WHERE KeyInfo.`datatype` = 'String' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;" :
+    "SELECT ValueString.`value` as `value`, 0 as `codec` FROM KeyInfo INNER JOIN ValueString ON KeyInfo.`id` = ValueString.`id`WHERE KeyInfo.`datatype` = 'String' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;";
 
-  unsigned int sizeOfStmt = 197;
+  unsigned int sizeOfStmt = strlen(select) + 1;
   if(requestMemory((void**)&statement, sizeOfStmt) != ERROR_OK)
     return ERROR_MEMORY;
 
-  strcpy(statement, "SELECT ValueString.`value` as `value` FROM KeyInfo INNER JOIN ValueString ON KeyInfo.`id` = ValueString.`id`WHERE KeyInfo.`datatype` = 'String' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;");
+  strcpy(statement, select);
 
   begin(handle);
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
@@ -2589,6 +4565,20 @@ database_get_string(database_handle_t* handle, const char* domain,
       int retval = sqlite3_step(ppStmt);
 
       if(retval == SQLITE_ROW){   
+        /* compressed strings are stored as BLOB */
+        if(sqlite3_column_int(ppStmt, 1) != CODEC_NONE &&
+           sqlite3_column_type(ppStmt, 0) == SQLITE_BLOB){
+          int error = unpackString(sqlite3_column_blob(ppStmt, 0),
+                                   sqlite3_column_bytes(ppStmt, 0),
+                                   sqlite3_column_int(ppStmt, 1), value);
+          if(error != ERROR_OK){
+            sqlite3_finalize(ppStmt);
+            rollback(handle);
+            return error;
+          }
+          break;
+        }
+
         if(sqlite3_column_type(ppStmt, 0) != SQLITE3_TEXT){
           sqlite3_finalize(ppStmt);
           rollback(handle);
@@ -2615,7 +4605,7 @@ database_get_string(database_handle_t* handle, const char* domain,
         //printf("step: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -2640,16 +4630,60 @@ database_get_string(database_handle_t* handle, const char* domain,
 int
 database_set_string(database_handle_t* handle, const char* domain,
                     const char* key, const char* value)
+{
+  startBusy(handle);
+  return finishBusy(handle, setString(handle, domain, key, value));
+}
+
+int
+setString(database_handle_t* handle, const char* domain, const char* key,
+          const char* value)
 {
   /* Input checks */
   if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0 || value == NULL)
     return ERROR_INVALID_ARGUMENTS;
 
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
+  /* long strings are compressed if the handle asks for it */
+  unsigned char* packed = NULL;
+  size_t packed_size = 0;
+  int ret = packValue(handle, (const unsigned char*)value, strlen(value),
+                      &packed, &packed_size);
+  if(ret != ERROR_OK)
+    return ret;
+
+  ret = storeString(handle, domain, key, value, packed, packed_size);
+  freeMemory(packed);
+  return ret;
+}
+
+/**
+ * inserts or updates the ValueString row of domain and key
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[in] value The string
+ * @param[in] packed The compressed string or NULL to store @a value
+ * @param[in] packed_size Size of @a packed
+ */
+int
+storeString(database_handle_t* handle, const char* domain, const char* key,
+            const char* value, const unsigned char* packed, size_t packed_size)
+{
   /* Some variables */
   char* statement = NULL;
   sqlite3_stmt *ppStmt = NULL;
   const char** pzTail = NULL;
   unsigned int error = 0;
+  const char* insertValue = handle->codecs ?
+    "INSERT INTO ValueString(`id`, `value`, `codec`) VALUES (:id,:val,:codec);" :
+    "INSERT INTO ValueString(`id`, `value`) VALUES (:id,:val);";
+  const char* updateValue = handle->codecs ?
+    "UPDATE ValueString SET value = :val, codec = :codec WHERE id = :id;" :
+    "UPDATE ValueString SET value = :val WHERE id = :id;";
 
   /* Check if already existing */
   char* datatype = NULL;
@@ -2661,7 +4695,12 @@ database_set_string(database_handle_t* handle, const char* domain,
 
   strcpy(statement, "SELECT id, datatype FROM KeyInfo WHERE domain = :dom and key = :key;");
 
-  begin(handle);
+  int begun = beginWrite(handle);
+  if(begun != ERROR_OK){
+    freeMemory(statement);
+    freeMemory(datatype);
+    return begun;
+  }
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
     //printf("prepare1: %s\n", sqlite3_errmsg(handle->db));
     sqlite3_finalize(ppStmt);
@@ -2730,7 +4769,7 @@ database_set_string(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -2748,8 +4787,6 @@ database_set_string(database_handle_t* handle, const char* domain,
     freeMemory(datatype);  
     return ERROR_DATABASE_INVALID;
   }
-  commit(handle);
-  begin(handle);
   /* key doesn't exist */
   if(datatype == NULL){
     /* Insert into Keyinfo */
@@ -2810,19 +4847,12 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2842,13 +4872,13 @@ database_set_string(database_handle_t* handle, const char* domain,
       }
 
       /* Insert into ValueString */
-      if(requestMemory((void**)&statement, 58) != ERROR_OK){
+      if(requestMemory((void**)&statement, strlen(insertValue) + 1) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);  
         return ERROR_MEMORY; 
       }
 
-      strcpy(statement, "INSERT INTO ValueString(`id`, `value`) VALUES (:id,:val);");
+      strcpy(statement, insertValue);
 
       if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
         //printf("prepare3: %s\n", sqlite3_errmsg(handle->db));
@@ -2886,7 +4916,7 @@ database_set_string(database_handle_t* handle, const char* domain,
         return ERROR_DATABASE_INVALID;
       }
 
-      if(sqlite3_bind_text(ppStmt, parameterIndex, value, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+      if(bindStringValue(ppStmt, parameterIndex, value, packed, packed_size) != SQLITE_OK){
         //printf("bind value: %s\n", sqlite3_errmsg(handle->db));  
         sqlite3_finalize(ppStmt);
         rollback(handle);
@@ -2899,19 +4929,12 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -2929,7 +4952,11 @@ database_set_string(database_handle_t* handle, const char* domain,
         freeMemory(datatype);  
         return ERROR_DATABASE_INVALID;
       }
-     commit(handle);
+    int committed = commit(handle);
+    if(committed != ERROR_OK){
+      freeMemory(datatype);
+      return committed;
+    }
   }
   else{ /* key already exist */    
     /* Datatype is the same - just update value */
@@ -2942,16 +4969,20 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(ret != ERROR_OK)
           return ret;
       }
-      begin(handle);
+      int begun = beginWrite(handle);
+      if(begun != ERROR_OK){
+        freeMemory(datatype);
+        return begun;
+      }
 
       /* Update ValueDouble */
-      if(requestMemory((void**)&statement, 52) != ERROR_OK){
+      if(requestMemory((void**)&statement, strlen(updateValue) + 1) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);  
         return error;
       }
 
-      strcpy(statement, "UPDATE ValueString SET value = :val WHERE id = :id;");
+      strcpy(statement, updateValue);
 
       if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
         //printf("prepare4: %s\n", sqlite3_errmsg(handle->db));
@@ -2972,7 +5003,7 @@ database_set_string(database_handle_t* handle, const char* domain,
         return ERROR_DATABASE_INVALID;
       }
         
-      if(sqlite3_bind_text(ppStmt, parameterIndex, value, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+      if(bindStringValue(ppStmt, parameterIndex, value, packed, packed_size) != SQLITE_OK){
         //printf("bind value: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);  
         rollback(handle);
@@ -3002,19 +5033,12 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -3079,19 +5103,12 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -3151,19 +5168,12 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -3257,19 +5267,12 @@ database_set_string(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -3289,13 +5292,13 @@ database_set_string(database_handle_t* handle, const char* domain,
       }
 
       /* Insert into ValueString */
-      if(requestMemory((void**)&statement, 58) != ERROR_OK){
+      if(requestMemory((void**)&statement, strlen(insertValue) + 1) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);        
         return ERROR_MEMORY;
       }
 
-      strcpy(statement, "INSERT INTO ValueString(`id`, `value`) VALUES (:id,:val);");
+      strcpy(statement, insertValue);
 
       if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
         //printf("prepare8: %s\n", sqlite3_errmsg(handle->db));
@@ -3333,7 +5336,7 @@ database_set_string(database_handle_t* handle, const char* domain,
         return ERROR_DATABASE_INVALID;
       }
 
-      if(sqlite3_bind_text(ppStmt, parameterIndex, value, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+      if(bindStringValue(ppStmt, parameterIndex, value, packed, packed_size) != SQLITE_OK){
         //printf("bind value: %s\n", sqlite3_errmsg(handle->db));  
         sqlite3_finalize(ppStmt);
         rollback(handle);
@@ -3343,22 +5346,15 @@ database_set_string(database_handle_t* handle, const char* domain,
 
       while(42){
         int retval = sqlite3_step(ppStmt);
-        if(retval == SQLITE_DONE){
-          break;
-        }
-        else if(retval == SQLITE_ERROR){
-          //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+        if(retval == SQLITE_DONE){
+          break;
         }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
+        else if(retval != SQLITE_ROW){
+          //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -3377,7 +5373,11 @@ database_set_string(database_handle_t* handle, const char* domain,
         return ERROR_DATABASE_INVALID;
       }
     }    
-    commit(handle);
+    int committed = commit(handle);
+    if(committed != ERROR_OK){
+      freeMemory(datatype);
+      return committed;
+    }
   }
   freeMemory(datatype);  
   return ERROR_OK;
@@ -3387,21 +5387,106 @@ database_set_string(database_handle_t* handle, const char* domain,
 int
 database_get_blob(database_handle_t* handle, const char* domain,
                   const char* key, unsigned char** value, size_t* size)
+{
+  startBusy(handle);
+  return finishBusy(handle, getBlob(handle, domain, key, value, size));
+}
+
+int
+getBlob(database_handle_t* handle, const char* domain, const char* key,
+        unsigned char** value, size_t* size)
 {
  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || value == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
     return ERROR_INVALID_ARGUMENTS;
-  
+
+  int file = -1;
+  int codec = CODEC_NONE;
+  int error = lookupBlobFile(handle, domain, key, &file, &codec);
+  if(error != ERROR_OK)
+    return error;
+
+  if(codec != CODEC_NONE){
+    size_t total = 0;
+    error = unpackBlobFile(file, codec, SIZE_MAX, value, size, &total);
+    close(file);
+    return error;
+  }
+
+  /* get blob */
+  struct stat sb;
+  if(fstat(file, &sb) != 0){
+    close(file);
+    return ERROR_DATABASE_IO;
+  }
+  *size = sb.st_size;
+
+  if(requestMemory((void**)&*value, sizeof(char)* *size) != ERROR_OK){
+    close(file);
+    return ERROR_MEMORY;
+  }
+
+  error = readBlobFile(file, *value, *size, 0);
+  close(file);
+  if(error != ERROR_OK){
+    freeMemory(*value);
+    *value = NULL;
+    return error;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * looks up the blob file referenced by domain and key and opens it for reading
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[out] result Read-only file descriptor of the blob file
+ * @param[out] codec Codec of the blob file
+ */
+int
+lookupBlobFile(database_handle_t* handle, const char* domain, const char* key,
+               int* result, int* codec)
+{
+  char* blobpath = NULL;
+  int error = selectBlobPath(handle, domain, key, &blobpath, codec);
+  if(error != ERROR_OK)
+    return error;
+
+  error = handle->hot_size > 0 ? openHotBlobFile(handle, blobpath, result) :
+                                 openBlobFile(handle, blobpath, O_RDONLY, result);
+  freeMemory(blobpath);
+  return error;
+}
+/**
+ * selects the path of the blob file referenced by domain and key as it is
+ * stored in ValueBlob
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[out] result Path relative to the blob-path, has to be freed
+ * @param[out] codec Codec of the blob file, may be NULL
+ */
+int
+selectBlobPath(database_handle_t* handle, const char* domain, const char* key,
+               char** result, int* codec)
+{
   char* statement = NULL;
   sqlite3_stmt *ppStmt = NULL;
   const char** pzTail = NULL;
+  const char* select = handle->codecs ?
+    "SELECT ValueBlob.`path` as `path`, ValueBlob.`codec` as `codec` FROM KeyInfo INNER JOIN ValueBlob ON KeyInfo.`id` = ValueBlob.`id`WHERE KeyInfo.`datatype` = 'Blob' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;" :
+    "SELECT ValueBlob.`path` as `path`, 0 as `codec` FROM KeyInfo INNER JOIN ValueBlob ON KeyInfo.`id` = ValueBlob.`id`WHERE KeyInfo.`datatype` = 'Blob' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;";
 
-  unsigned int sizeOfStmt = 188;
+  unsigned int sizeOfStmt = strlen(select) + 1;
 
   if(requestMemory((void**)&statement, sizeOfStmt) != ERROR_OK)
     return ERROR_MEMORY;
   char* blobpath = NULL;
 
-  strcpy(statement, "SELECT ValueBlob.`path` as `path` FROM KeyInfo INNER JOIN ValueBlob ON KeyInfo.`id` = ValueBlob.`id`WHERE KeyInfo.`datatype` = 'Blob' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;");
+  strcpy(statement, select);
 
   begin(handle);
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
@@ -3462,6 +5547,8 @@ database_get_blob(database_handle_t* handle, const char* domain,
         }
         memcpy(blobpath, dbentry, strlen(dbentry));
         blobpath[strlen(dbentry)] = '\0';
+        if(codec != NULL)
+          *codec = sqlite3_column_int(ppStmt, 1);
         break;
       }
       else if(retval == SQLITE_DONE){
@@ -3473,7 +5560,7 @@ database_get_blob(database_handle_t* handle, const char* domain,
         //printf("step: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         sqlite3_finalize(ppStmt);
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -3493,243 +5580,838 @@ database_get_blob(database_handle_t* handle, const char* domain,
   }
   commit(handle);
 
-  /* check for relative path */
-  if(blobpath[0] == '/'){
-    freeMemory(blobpath);
+  *result = blobpath;
+  return ERROR_OK;
+}
+
+/**
+ * opens the directory of a blob file relative to the blob-path. Every
+ * component is opened on its own without following symlinks, so the result is
+ * always inside the blob-path. Directories are kept in a small cache on the
+ * handle, the descriptor is owned by the cache and only valid until the next
+ * call.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] path Path of the blob file relative to the blob-path
+ * @param[in] create Create missing directories
+ * @param[out] result Directory file descriptor
+ * @param[out] name Last component of @a path
+ */
+int
+openBlobDirectory(database_handle_t* handle, const char* path, int create,
+                  int* result, const char** name)
+{
+  const char* slash = strrchr(path, '/');
+  *name = slash == NULL ? path : slash + 1;
+  if(path[0] == '/' || (*name)[0] == '\0' || strcmp(*name, "..") == 0)
     return ERROR_DATABASE_INVALID;
+
+  if(slash == NULL){
+    *result = handle->blobdir;
+    return ERROR_OK;
   }
 
-  char* pathtoblob = NULL;
-  if(requestMemory((void**)&pathtoblob, strlen(handle->blobpath) + 1 + strlen(blobpath)+1) != ERROR_OK){
-    freeMemory(blobpath);
+  size_t length = slash - path;
+  unsigned int i = 0;
+  for(i = 0; i < DATABASE_DIRECTORY_CACHE_SIZE; i++){
+    blob_directory_t* entry = &handle->directories[i];
+    if(entry->name != NULL && strncmp(entry->name, path, length) == 0 &&
+       entry->name[length] == '\0'){
+      *result = entry->fd;
+      return ERROR_OK;
+    }
+  }
+
+  char* directory = NULL;
+  if(requestMemory((void**)&directory, length + 1) != ERROR_OK)
     return ERROR_MEMORY;
+  memcpy(directory, path, length);
+  directory[length] = '\0';
+
+  int fd = -1;
+  int error = descendDirectory(handle->blobdir, directory, create, &fd);
+  if(error != ERROR_OK){
+    freeMemory(directory);
+    return error;
   }
-  strcpy(pathtoblob, handle->blobpath);
-  strcat(pathtoblob, "/");
-  strcat(pathtoblob, blobpath);
-  pathtoblob[strlen(handle->blobpath) + 1 + strlen(blobpath)] = '\0';
-  freeMemory(blobpath);
 
+  /* round robin replacement */
+  blob_directory_t* entry = &handle->directories[handle->nextdirectory];
+  handle->nextdirectory = (handle->nextdirectory + 1) % DATABASE_DIRECTORY_CACHE_SIZE;
+  if(entry->name != NULL){
+    close(entry->fd);
+    freeMemory(entry->name);
+  }
+  entry->name = directory;
+  entry->fd = fd;
 
+  *result = fd;
+  return ERROR_OK;
+}
 
-  /* check if path: is a regular file */
-  struct stat sb;
-  if(stat(pathtoblob, &sb) != 0){
-    //printf("something gone wrong... stat\n");
-    freeMemory(pathtoblob);
-    return ERROR_DATABASE_INVALID;
+/**
+ * opens a directory below @a root one component at a time without following
+ * symlinks
+ *
+ * @param[in] root O_DIRECTORY fd the path starts at, is never closed
+ * @param[in] directory Path of the directory relative to @a root, '/' is
+ *   replaced by NUL while it is walked
+ * @param[in] create Create missing directories
+ * @param[out] result Directory file descriptor, has to be closed
+ */
+int
+descendDirectory(int root, char* directory, int create, int* result)
+{
+  int fd = root;
+  char* component = directory;
+  while(component != NULL){
+    char* next = strchr(component, '/');
+    if(next != NULL)
+      *next = '\0';
+
+    int child = -1;
+    int error = ERROR_DATABASE_INVALID;
+    if(component[0] != '\0' && strcmp(component, "..") != 0){
+      child = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      if(child < 0 && errno == ENOENT && create &&
+         (mkdirat(fd, component, 0777) == 0 || errno == EEXIST))
+        child = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      if(child < 0 && create && errno != ELOOP && errno != ENOTDIR)
+        error = ERROR_DATABASE_IO;
+    }
+
+    if(fd != root)
+      close(fd);
+    if(next != NULL)
+      *next = '/';
+    if(child < 0)
+      return error;
+    fd = child;
+
+    component = next == NULL ? NULL : next + 1;
   }
-  if(!S_ISREG(sb.st_mode)){        /* check if regular file */
-    //printf("regular file");
-    freeMemory(pathtoblob);
-    return ERROR_DATABASE_INVALID;
+
+  *result = fd;
+  return ERROR_OK;
+}
+
+/**
+ * closes all cached blob directories
+ *
+ * @param[in] handle A valid database handle
+ */
+void
+forgetBlobDirectories(database_handle_t* handle)
+{
+  unsigned int i = 0;
+  for(i = 0; i < DATABASE_DIRECTORY_CACHE_SIZE; i++){
+    if(handle->directories[i].name != NULL){
+      close(handle->directories[i].fd);
+      freeMemory(handle->directories[i].name);
+      handle->directories[i].name = NULL;
+      handle->directories[i].fd = -1;
+    }
   }
+}
 
-  int error = check_blob_path(pathtoblob, handle->blobpath);
-  if(error != ERROR_OK){
-    freeMemory(pathtoblob);
-    //printf("something gone wrong... check_blob_path\n");
+/**
+ * opens a blob file relative to the blob-path and checks that it is a regular
+ * file, symlinks are never followed
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] path Path relative to the blob-path as stored in ValueBlob
+ * @param[in] flags Flags for open(2), missing directories are created if
+ *   O_CREAT is set
+ * @param[out] result File descriptor of the blob file
+ */
+int
+openBlobFile(database_handle_t* handle, const char* path, int flags,
+             int* result)
+{
+  int create = (flags & O_CREAT) != 0;
+  int directory = -1;
+  const char* name = NULL;
+  int error = openBlobDirectory(handle, path, create, &directory, &name);
+  if(error != ERROR_OK)
     return error;
+
+  /* O_NONBLOCK: never hang on a fifo planted in the blob-path */
+  int file = openat(directory, name, flags | O_NOFOLLOW | O_NONBLOCK, 0666);
+  if(file < 0 && errno == ENOENT && directory != handle->blobdir){
+    /* the cached directory may have been removed in the meantime */
+    forgetBlobDirectories(handle);
+    error = openBlobDirectory(handle, path, create, &directory, &name);
+    if(error != ERROR_OK)
+      return error;
+    file = openat(directory, name, flags | O_NOFOLLOW | O_NONBLOCK, 0666);
   }
+  if(file < 0)
+    return create && errno != ELOOP ? ERROR_DATABASE_IO : ERROR_DATABASE_INVALID;
 
-  /* get blob */
-  FILE *file = NULL;
-  file = fopen(pathtoblob, "rb");
-  if(file == NULL){
-    //perror("the following error occured: ");
-    freeMemory(pathtoblob);
-    return ERROR_DATABASE_IO;
+  struct stat sb;
+  if(fstat(file, &sb) != 0 || !S_ISREG(sb.st_mode)){
+    close(file);
+    return ERROR_DATABASE_INVALID;
   }
-  freeMemory(pathtoblob);
-  
-  fseek(file, 0, SEEK_END);
-  *size = ftell(file);
-  rewind(file);
 
-  if(requestMemory((void**)&*value, sizeof(char)* *size) != ERROR_OK)
-    return ERROR_MEMORY;
+  *result = file;
+  return ERROR_OK;
+}
 
-  size_t result = fread(*value, 1, *size, file);
-  if(result != *size){
-    //printf("read error\n");
-    freeMemory(value);
-    return ERROR_DATABASE_IO;
+/**
+ * reads exactly size bytes at offset from a blob file
+ *
+ * @param[in] fd File descriptor of the blob file
+ * @param[out] value Buffer of at least @a size bytes
+ * @param[in] size Number of bytes to read
+ * @param[in] offset Position in the blob file
+ */
+int
+readBlobFile(int fd, unsigned char* value, size_t size, size_t offset)
+{
+  size_t done = 0;
+  while(done < size){
+    ssize_t ret = pread(fd, value + done, size - done, offset + done);
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret <= 0)
+      return ERROR_DATABASE_IO;
+    done += ret;
   }
+  return ERROR_OK;
+}
 
-  if(fclose(file) != 0){
-    //printf("fclose error\n");
-    return ERROR_DATABASE_IO;
+/**
+ * writes size bytes to a blob file
+ *
+ * @param[in] fd File descriptor of the blob file
+ * @param[in] value The data
+ * @param[in] size Number of bytes to write
+ */
+int
+writeBlobFile(int fd, const unsigned char* value, size_t size)
+{
+  size_t done = 0;
+  while(done < size){
+    ssize_t ret = write(fd, value + done, size - done);
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret < 0)
+      return ERROR_DATABASE_IO;
+    done += ret;
   }
-
   return ERROR_OK;
 }
 
-int check_blob_path(const char* blobpath, const char* referencepath){
+/**
+ * makes a written blob file as durable as the handle demands: nothing for
+ * relaxed, fdatasync for normal and fsync of the file and its directory for
+ * full
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] fd File descriptor of the blob file or -1 to sync the directory
+ *   only, e.g. after a rename
+ * @param[in] path Path of the blob file relative to the blob-path or NULL to
+ *   sync the file only
+ */
+int
+syncBlobFile(database_handle_t* handle, int fd, const char* path)
+{
+  if(handle->durability == DATABASE_DURABILITY_RELAXED)
+    return ERROR_OK;
 
-  /* check if path is inside blob directory */
-  char *path = NULL;
-  path = realpath(blobpath, NULL);
-  if(path == NULL){
-    //printf("error path not found!\n");
-    freeMemory(path);
-    return ERROR_DATABASE_INVALID;
+  if(fd >= 0){
+    int ret = handle->durability == DATABASE_DURABILITY_FULL ? fsync(fd) : fdatasync(fd);
+    if(ret != 0)
+      return ERROR_DATABASE_IO;
   }
-  if(strncmp(path, referencepath, strlen(referencepath)) != 0){
-    freeMemory(path);
-    return ERROR_DATABASE_INVALID;
+
+  /* a new directory entry only survives a crash once the directory is synced */
+  if(handle->durability == DATABASE_DURABILITY_FULL && path != NULL){
+    int directory = -1;
+    const char* name = NULL;
+    int error = openBlobDirectory(handle, path, 0, &directory, &name);
+    if(error != ERROR_OK)
+      return error;
+    if(fsync(directory) != 0)
+      return ERROR_DATABASE_IO;
   }
-  freeMemory(path);
-  
+
   return ERROR_OK;
 }
 
+/**
+ * opens a blob file for reading from the hot tier if it holds the current
+ * content, otherwise from the blob-path. A miss copies the file into the hot
+ * tier, so the next read is served from RAM.
+ *
+ * @param[in] handle A valid database handle with a hot tier
+ * @param[in] path Path relative to the blob-path as stored in ValueBlob
+ * @param[out] result Read-only file descriptor of the blob file
+ */
+int
+openHotBlobFile(database_handle_t* handle, const char* path, int* result)
+{
+  /* the file on disk is opened but never read, its inode names the copy */
+  int file = -1;
+  int error = openBlobFile(handle, path, O_RDONLY, &file);
+  if(error != ERROR_OK)
+    return error;
+
+  struct stat sb;
+  char* hot = NULL;
+  if(fstat(file, &sb) != 0 || buildHotBlobName(path, &sb, &hot) != ERROR_OK){
+    *result = file;
+    return ERROR_OK;
+  }
+
+  int directory = -1;
+  const char* name = NULL;
+  int cached = -1;
+  if(openHotDirectory(handle, hot, 0, &directory, &name) == ERROR_OK){
+    cached = openat(directory, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+    if(directory != handle->hotdir)
+      close(directory);
+  }
+
+  /* a hit is marked as used, the access time orders the eviction */
+  struct stat hit;
+  if(cached >= 0 && fstat(cached, &hit) == 0 && S_ISREG(hit.st_mode) &&
+     hit.st_size == sb.st_size){
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_NOW;
+    times[1].tv_sec = 0;
+    times[1].tv_nsec = UTIME_OMIT;
+    futimens(cached, times);
+    close(file);
+    freeMemory(hot);
+    *result = cached;
+    return ERROR_OK;
+  }
+  if(cached >= 0)
+    close(cached);
+
+  storeHotBlob(handle, hot, file, NULL, sb.st_size);
+  freeMemory(hot);
+  if(lseek(file, 0, SEEK_SET) != 0){
+    close(file);
+    return ERROR_DATABASE_IO;
+  }
+
+  *result = file;
+  return ERROR_OK;
+}
 
+/**
+ * builds the path of the copy of a blob file in the hot tier. It carries
+ * inode, size and modification time of the file on disk, a new version of
+ * the blob gets a new name and older copies are never read again.
+ *
+ * @param[in] path Path relative to the blob-path as stored in ValueBlob
+ * @param[in] sb Status of the blob file on disk
+ * @param[out] result Path relative to the hot tier, has to be freed
+ */
 int
-database_set_blob(database_handle_t* handle, const char* domain,
-                  const char* key, const unsigned char* value, size_t size)
+buildHotBlobName(const char* path, const struct stat* sb, char** result)
 {
-/* Input checks */
-  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+  char stamp[80];
+  snprintf(stamp, sizeof(stamp), "@%llx-%llx-%llx.%lx",
+           (unsigned long long)sb->st_ino, (unsigned long long)sb->st_size,
+           (unsigned long long)sb->st_mtim.tv_sec, (long)sb->st_mtim.tv_nsec);
+
+  const char* slash = strrchr(path, '/');
+  const char* name = slash == NULL ? path : slash + 1;
+  if(strlen(name) + strlen(stamp) > NAME_MAX)
     return ERROR_INVALID_ARGUMENTS;
 
-  /* Some variables */
-  char* statement = NULL;
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
-
-  char* domain_path = NULL;
-  if(requestMemory((void**)&domain_path, strlen(domain)+1)){
+  size_t size = strlen(path) + strlen(stamp) + 1;
+  if(requestMemory((void**)result, size) != ERROR_OK)
     return ERROR_MEMORY;
+  snprintf(*result, size, "%s%s", path, stamp);
+  return ERROR_OK;
+}
+
+/**
+ * opens the directory of a file in the hot tier like @ref openBlobDirectory
+ * does in the blob-path, without its cache
+ *
+ * @param[in] handle A valid database handle with a hot tier
+ * @param[in] path Path of the file relative to the hot tier
+ * @param[in] create Create missing directories
+ * @param[out] result Directory file descriptor, has to be closed unless it
+ *   is handle->hotdir
+ * @param[out] name Last component of @a path
+ */
+int
+openHotDirectory(database_handle_t* handle, const char* path, int create,
+                 int* result, const char** name)
+{
+  const char* slash = strrchr(path, '/');
+  *name = slash == NULL ? path : slash + 1;
+  if(slash == NULL){
+    *result = handle->hotdir;
+    return ERROR_OK;
   }
-  unsigned int j = 0; 
-  for(j = 0; j < strlen(domain); j++){
-    if(domain[j] == ' ')
-      domain_path[j] = '_';
-    else if(domain[j] == '/')
-      domain_path[j] = '_';
-    else
-      domain_path[j] = domain[j];
-  }
-  domain_path[strlen(domain)] = '\0';
 
-  char* key_path = NULL;
-  if(requestMemory((void**)&key_path, strlen(key)+1)){
-    freeMemory(domain_path);
+  size_t length = slash - path;
+  char* directory = NULL;
+  if(requestMemory((void**)&directory, length + 1) != ERROR_OK)
     return ERROR_MEMORY;
+  memcpy(directory, path, length);
+  directory[length] = '\0';
+
+  int error = descendDirectory(handle->hotdir, directory, create, result);
+  freeMemory(directory);
+  return error;
+}
+
+/**
+ * puts the content of a blob file into the hot tier and evicts the least
+ * recently used files once it is full. The hot tier is only a copy, so
+ * nothing that goes wrong here is an error.
+ *
+ * @param[in] handle A valid database handle with a hot tier
+ * @param[in] hot Path of the copy relative to the hot tier
+ * @param[in] from File descriptor at offset 0 to copy from or -1 to write
+ *   @a value
+ * @param[in] value The content if @a from is -1
+ * @param[in] size Size of the content
+ */
+void
+storeHotBlob(database_handle_t* handle, const char* hot, int from,
+             const unsigned char* value, size_t size)
+{
+  if(size > (uint64_t)handle->hot_size / BLOB_HOT_SHARE)
+    return;
+
+  int directory = -1;
+  const char* name = NULL;
+  if(openHotDirectory(handle, hot, 1, &directory, &name) != ERROR_OK)
+    return;
+
+  /* written next to the copy and renamed, readers never see half of it */
+  static unsigned int counter = 0;
+  char temporary[64];
+  snprintf(temporary, sizeof(temporary), BLOB_TEMPORARY_PREFIX "%ld-%u",
+           (long)getpid(), counter++);
+  int file = openat(directory, temporary, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0666);
+  int error = ERROR_DATABASE_IO;
+  if(file >= 0){
+    error = from >= 0 ? file_clone(from, file, NULL) : writeBlobFile(file, value, size);
+    if(close(file) != 0)
+      error = ERROR_DATABASE_IO;
+    if(error != ERROR_OK || renameat(directory, temporary, directory, name) != 0){
+      unlinkat(directory, temporary, 0);
+      error = ERROR_DATABASE_IO;
+    }
   }
-  for(j = 0; j < strlen(key); j++){
-    if(key[j] == ' ')
-      key_path[j] = '_';
-    else if(key[j] == '/')
-      key_path[j] = '_';
-    else
-      key_path[j] = key[j];
+  if(directory != handle->hotdir)
+    close(directory);
+  if(error != ERROR_OK)
+    return;
+
+  /* other handles fill the hot tier as well, an eviction counts it again */
+  if(handle->hot_used >= 0)
+    handle->hot_used += size;
+  if(handle->hot_used < 0 || handle->hot_used > handle->hot_size)
+    evictHotBlobs(handle);
+}
+
+/**
+ * walks the hot tier and removes the least recently used files until it is
+ * down to BLOB_HOT_LOW_WATER percent of its size
+ *
+ * @param[in] handle A valid database handle with a hot tier
+ */
+void
+evictHotBlobs(database_handle_t* handle)
+{
+  int fd = openat(handle->hotdir, ".", O_RDONLY | O_DIRECTORY);
+  if(fd < 0)
+    return;
+
+  hot_walk_t walk;
+  walk.files = NULL;
+  walk.count = 0;
+  walk.capacity = 0;
+  walk.names = NULL;
+  walk.names_size = 0;
+  walk.names_capacity = 0;
+  walk.total = 0;
+  walk.path[0] = '\0';
+  if(walkHotDirectory(&walk, fd, 0) != ERROR_OK){
+    freeMemory(walk.files);
+    freeMemory(walk.names);
+    return;
+  }
+
+  uint64_t used = walk.total;
+  if(used > (uint64_t)handle->hot_size){
+    uint64_t low = (uint64_t)handle->hot_size / 100 * BLOB_HOT_LOW_WATER;
+    qsort(walk.files, walk.count, sizeof(hot_file_t), compareHotFiles);
+    size_t i = 0;
+    for(; i < walk.count && used > low; i++){
+      int directory = -1;
+      const char* name = NULL;
+      if(openHotDirectory(handle, walk.names + walk.files[i].name, 0,
+                          &directory, &name) != ERROR_OK)
+        continue;
+      if(unlinkat(directory, name, 0) == 0 || errno == ENOENT)
+        used -= walk.files[i].size;
+      if(directory != handle->hotdir)
+        close(directory);
+    }
   }
-  key_path[strlen(key)] = '\0';
 
-  char* path = NULL;
-  if(requestMemory((void**)&path, strlen(domain_path)+1+strlen(key_path)+1) != ERROR_OK){
-    freeMemory(domain_path);
-    freeMemory(key_path);
-    return ERROR_MEMORY;
+  handle->hot_used = used;
+  freeMemory(walk.files);
+  freeMemory(walk.names);
+}
+
+/**
+ * adds the regular files below a directory of the hot tier to the walk
+ *
+ * @param[in] walk The walk, path holds the directory
+ * @param[in] fd O_DIRECTORY fd of the directory, is closed
+ * @param[in] length Length of the directory in walk->path
+ */
+int
+walkHotDirectory(hot_walk_t* walk, int fd, size_t length)
+{
+  DIR* directory = fdopendir(fd);
+  if(directory == NULL){
+    close(fd);
+    return ERROR_DATABASE_IO;
   }
 
-  strcpy(path, domain_path);
-  strcat(path, "/");
+  int ret = ERROR_OK;
+  struct dirent* entry = NULL;
+  while(ret == ERROR_OK && (entry = readdir(directory)) != NULL){
+    size_t name_size = strlen(entry->d_name);
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+       length + name_size + 2 > sizeof(walk->path))
+      continue;
 
-  char* createdirectory_path = NULL;
-  if(requestMemory((void**)&createdirectory_path, strlen(handle->blobpath) + 1 + strlen(domain_path)+1) != ERROR_OK){
-    freeMemory(domain_path);
-    freeMemory(key_path);
-    freeMemory(path);
-    return ERROR_MEMORY;
+    struct stat sb;
+    if(fstatat(dirfd(directory), entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+      continue;
+    memcpy(walk->path + length, entry->d_name, name_size + 1);
+
+    if(S_ISDIR(sb.st_mode)){
+      int child = openat(dirfd(directory), entry->d_name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      if(child < 0)
+        continue;
+      walk->path[length + name_size] = '/';
+      walk->path[length + name_size + 1] = '\0';
+      ret = walkHotDirectory(walk, child, length + name_size + 1);
+      continue;
+    }
+    if(S_ISREG(sb.st_mode))
+      ret = addHotFile(walk, &sb);
   }
-  strcpy(createdirectory_path, handle->blobpath);
-  strcat(createdirectory_path, "/");
-  strcat(createdirectory_path, domain_path);
-  createdirectory_path[strlen(handle->blobpath) + 1 +  strlen(domain_path)] = '\0';
 
-  struct stat sb;
-  if(stat(createdirectory_path, &sb) != 0){
-    if(mkdir(createdirectory_path, 0777) != 0){
-      freeMemory(createdirectory_path);
-      freeMemory(domain_path);
-      freeMemory(key_path);
-      freeMemory(path); 
-      return ERROR_DATABASE_IO;
+  closedir(directory);
+  return ret;
+}
+
+/**
+ * adds the file at walk->path to the files of the walk
+ *
+ * @param[in] walk The walk
+ * @param[in] sb Status of the file
+ */
+int
+addHotFile(hot_walk_t* walk, const struct stat* sb)
+{
+  size_t size = strlen(walk->path) + 1;
+  if(walk->count == walk->capacity){
+    size_t capacity = walk->capacity == 0 ? 64 : walk->capacity * 2;
+    if(editMemory((void**)&walk->files, capacity * sizeof(hot_file_t)) != ERROR_OK){
+      walk->files = NULL;
+      return ERROR_MEMORY;
+    }
+    walk->capacity = capacity;
+  }
+  if(walk->names_size + size > walk->names_capacity){
+    size_t capacity = walk->names_capacity == 0 ? 4096 : walk->names_capacity * 2;
+    while(capacity < walk->names_size + size)
+      capacity *= 2;
+    if(editMemory((void**)&walk->names, capacity) != ERROR_OK){
+      walk->names = NULL;
+      return ERROR_MEMORY;
     }
+    walk->names_capacity = capacity;
   }
-  freeMemory(createdirectory_path);
 
-  strcat(path, key_path);
-  path[strlen(domain_path) + 1 + strlen(key_path)] = '\0';
+  hot_file_t* file = &walk->files[walk->count++];
+  file->used = (int64_t)sb->st_atim.tv_sec * 1000000000 + sb->st_atim.tv_nsec;
+  file->size = sb->st_size;
+  file->name = walk->names_size;
+  memcpy(walk->names + walk->names_size, walk->path, size);
+  walk->names_size += size;
+  walk->total += sb->st_size;
+  return ERROR_OK;
+}
+
+/**
+ * orders two files of the hot tier by their last access, oldest first
+ *
+ * @param[in] first Pointer to the first hot_file_t
+ * @param[in] second Pointer to the second hot_file_t
+ */
+int
+compareHotFiles(const void* first, const void* second)
+{
+  int64_t a = ((const hot_file_t*)first)->used;
+  int64_t b = ((const hot_file_t*)second)->used;
+  return a < b ? -1 : a > b;
+}
 
-  freeMemory(domain_path);
-  freeMemory(key_path);
 
-  /* check for relative path */
-  if(path[0] == '/'){
-    //printf("no relative path");
-    return ERROR_DATABASE_INVALID;
+int
+database_set_blob(database_handle_t* handle, const char* domain,
+                  const char* key, const unsigned char* value, size_t size)
+{
+  startBusy(handle);
+  return finishBusy(handle, setBlob(handle, domain, key, value, size));
+}
+
+int
+setBlob(database_handle_t* handle, const char* domain, const char* key,
+        const unsigned char* value, size_t size)
+{
+/* Input checks */
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain  == NULL || key == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
+  /* content-addressed store: identical content is never written twice */
+  if(handle->dedup){
+    uint8_t sum[SHA1HashSize];
+    SHA1Context context;
+    size_t done = 0;
+    SHA1Reset(&context);
+    while(done < size){
+      unsigned int chunk = size - done > (1u << 30) ? (1u << 30) : size - done;
+      if(SHA1Input(&context, value + done, chunk) != shaSuccess)
+        return ERROR_UNKNOWN;
+      done += chunk;
+    }
+    if(SHA1Result(&context, sum) != shaSuccess)
+      return ERROR_UNKNOWN;
+
+    return storeDeduplicated(handle, domain, key, value, size, NULL, sum);
+  }
+
+  char* path = NULL;
+  int error = buildBlobPath(handle, domain, key, &path);
+  if(error != ERROR_OK)
+    return error;
+
+  /* large blobs are compressed if the handle asks for it */
+  unsigned char* packed = NULL;
+  size_t packed_size = 0;
+  error = packValue(handle, value, size, &packed, &packed_size);
+  if(error != ERROR_OK){
+    freeMemory(path);
+    return error;
   }
 
- char* pathtoblob = NULL;
-  if(requestMemory((void**)&pathtoblob, strlen(handle->blobpath) + 1 + strlen(path) + 1) != ERROR_OK){
+  /* the old file stays untouched until the new one is renamed over it */
+  char* temporary = NULL;
+  int file = -1;
+  error = createBlobTemporary(handle, path, &temporary, &file);
+  if(error != ERROR_OK){
+    freeMemory(packed);
     freeMemory(path);
-    return ERROR_MEMORY;
+    return error;
+  }
+
+  if(packed != NULL){
+    value = packed;
+    size = packed_size;
   }
-  strcpy(pathtoblob, handle->blobpath);
-  strcat(pathtoblob, "/");
-  strcat(pathtoblob, path);
-  pathtoblob[strlen(handle->blobpath) + 1 + strlen(path)] = '\0';
-
-  FILE *file = NULL;
-  file = fopen(pathtoblob, "wb");
-  if(file == NULL){
-    //perror("the following error occured: ");
-    freeMemory(pathtoblob);
-    //printf("cannot open file!\n");
+  error = writeBlobFile(file, value, size);
+  if(error == ERROR_OK)
+    error = syncBlobFile(handle, file, NULL);
+
+  /* the hot tier gets the content under the name of the new file */
+  struct stat sb;
+  char* hot = NULL;
+  if(error == ERROR_OK && handle->hot_size > 0 && fstat(file, &sb) == 0)
+    buildHotBlobName(path, &sb, &hot);
+  if(close(file) != 0 || error != ERROR_OK){
+    discardBlobFile(handle, temporary);
+    freeMemory(temporary);
+    freeMemory(packed);
     freeMemory(path);
     return ERROR_DATABASE_IO;
   }
 
-  /* check if path: is a regular file
-                    has a relative path 
-                    is inside blob directory*/
-  int error = check_blob_path(pathtoblob, handle->blobpath);
+  error = replaceBlobReference(handle, domain, key, path, temporary,
+                               packed != NULL ? CODEC_LZ : CODEC_NONE);
+  if(error == ERROR_OK && hot != NULL)
+    storeHotBlob(handle, hot, -1, value, size);
+  freeMemory(hot);
+  freeMemory(temporary);
+  freeMemory(packed);
+  return error;
+}
+
+/**
+ * escapes domain and key, creates the domain directory inside the blob-path
+ * and builds the path of the blob file relative to the blob-path. With a
+ * fan-out the key is placed below hash directories: domain/ab/cd/key
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[out] result Path relative to the blob-path, has to be freed
+ */
+int
+buildBlobPath(database_handle_t* handle, const char* domain, const char* key,
+              char** result)
+{
+  size_t domain_size = strlen(domain);
+  size_t key_size = strlen(key);
+
+  size_t fanout_size = 3 * handle->fanout;
+
+  char* path = NULL;
+  if(requestMemory((void**)&path, domain_size + 1 + fanout_size + key_size + 1) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  /* domain/key with ' ' and '/' replaced by '_' */
+  size_t j = 0;
+  for(j = 0; j < domain_size; j++)
+    path[j] = (domain[j] == ' ' || domain[j] == '/') ? '_' : domain[j];
+  path[domain_size] = '/';
+  char* key_path = path + domain_size + 1 + fanout_size;
+  for(j = 0; j < key_size; j++)
+    key_path[j] = (key[j] == ' ' || key[j] == '/') ? '_' : key[j];
+  key_path[key_size] = '\0';
+
+  /* one directory per byte of the FNV-1a hash of the escaped key */
+  if(handle->fanout > 0){
+    static const char hex[] = "0123456789abcdef";
+    uint32_t hash = hash_fnv1a(HASH_FNV1A_BASIS, key_path, key_size);
+    for(j = 0; j < (size_t)handle->fanout; j++){
+      unsigned char byte = (hash >> (8 * j)) & 0xff;
+      path[domain_size + 1 + 3 * j] = hex[byte >> 4];
+      path[domain_size + 2 + 3 * j] = hex[byte & 0x0f];
+      path[domain_size + 3 + 3 * j] = '/';
+    }
+  }
+
+  int directory = -1;
+  const char* name = NULL;
+  int error = openBlobDirectory(handle, path, 1, &directory, &name);
   if(error != ERROR_OK){
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    freeMemory(path);
     return error;
   }
 
-  if(fwrite(value, 1, size, file) != size){
-    //printf("cannot write file!\n");
-    freeMemory(pathtoblob);
-    freeMemory(path);
-    return ERROR_DATABASE_IO;
+  *result = path;
+  return ERROR_OK;
+}
+/**
+ * creates a file next to the blob file at @a path to write the new content
+ * to, e.g. domain/ab/tmp <pid>-<n>. It is renamed over the blob file once
+ * complete.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] path Path of the blob file relative to the blob-path
+ * @param[out] result Path of the temporary file relative to the blob-path,
+ *   has to be freed
+ * @param[out] file Writable file descriptor of the temporary file
+ */
+int
+createBlobTemporary(database_handle_t* handle, const char* path,
+                    char** result, int* file)
+{
+  const char* slash = strrchr(path, '/');
+  size_t dir_size = slash == NULL ? 0 : (size_t)(slash - path) + 1;
+  size_t temporary_size = dir_size + sizeof(BLOB_TEMPORARY_PREFIX) + 64;
+  char* temporary = NULL;
+  if(requestMemory((void**)&temporary, temporary_size) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(temporary, path, dir_size);
+
+  /* created exclusively, a name that is taken is simply skipped */
+  static unsigned int counter = 0;
+  int retried = 0;
+  *file = -1;
+  while(*file < 0){
+    snprintf(temporary + dir_size, temporary_size - dir_size,
+             BLOB_TEMPORARY_PREFIX "%ld-%u", (long)getpid(), counter++);
+    int directory = -1;
+    const char* name = NULL;
+    int error = openBlobDirectory(handle, temporary, 1, &directory, &name);
+    if(error != ERROR_OK){
+      freeMemory(temporary);
+      return error;
+    }
+    *file = openat(directory, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0666);
+    if(*file < 0 && errno == ENOENT && !retried && directory != handle->blobdir){
+      /* the cached directory may have been removed in the meantime */
+      forgetBlobDirectories(handle);
+      retried = 1;
+      continue;
+    }
+    if(*file < 0 && errno != EEXIST){
+      freeMemory(temporary);
+      return ERROR_DATABASE_IO;
+    }
   }
 
-  if(fclose(file) != 0){
-    //printf("cannot close file!\n");
-    freeMemory(pathtoblob);
-    freeMemory(path);
-    return ERROR_DATABASE_IO;
-  }
+  *result = temporary;
+  return ERROR_OK;
+}
+
+/**
+ * inserts or updates the ValueBlob row of domain and key so that it references
+ * the blob file at @a path. A @a temporary file is renamed to @a path inside
+ * the transaction of the row and removed if the database update fails.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[in] path Path relative to the blob-path, is freed
+ * @param[in] temporary Written blob file relative to the blob-path or NULL if
+ *   the file is already in place
+ * @param[in] codec Codec of the blob file
+ */
+int
+storeBlobReference(database_handle_t* handle, const char* domain,
+                   const char* key, char* path, const char* temporary,
+                   int codec)
+{
+  /* Some variables */
+  char* statement = NULL;
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  const char* insertValue = handle->codecs ?
+    "INSERT INTO ValueBlob(`id`, `path`, `codec`) VALUES (:id,:pat,:codec);" :
+    "INSERT INTO ValueBlob(`id`, `path`) VALUES (:id,:pat);";
+  const char* updateValue = handle->codecs ?
+    "UPDATE ValueBlob SET path = :pat, codec = :codec WHERE id = :id;" :
+    "UPDATE ValueBlob SET path = :pat WHERE id = :id;";
 
   /* Check if already existing */
   char* datatype = NULL;
   unsigned int id = 0;
 
   if(requestMemory((void**)&datatype, 7) != ERROR_OK){
-    remove(pathtoblob);
-    freeMemory(pathtoblob); 
+    discardBlobFile(handle, temporary);
     freeMemory(path); 
     return ERROR_MEMORY;
   }
   if(requestMemory((void**)&statement, 69) != ERROR_OK){
-    remove(pathtoblob);
-    freeMemory(pathtoblob);  
+    discardBlobFile(handle, temporary);
     freeMemory(datatype); 
     freeMemory(path);
     return ERROR_MEMORY;
@@ -3737,15 +6419,21 @@ database_set_blob(database_handle_t* handle, const char* domain,
 
   strcpy(statement, "SELECT id, datatype FROM KeyInfo WHERE domain = :dom and key = :key;");
 
-  begin(handle);
+  int begun = beginWrite(handle);
+  if(begun != ERROR_OK){
+    freeMemory(statement);
+    freeMemory(datatype);
+    discardBlobFile(handle, temporary);
+    freeMemory(path);
+    return begun;
+  }
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
     //printf("prepare1: %s\n", sqlite3_errmsg(handle->db));
     sqlite3_finalize(ppStmt);
     rollback(handle);
     freeMemory(statement);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3757,8 +6445,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
     sqlite3_finalize(ppStmt);
     rollback(handle);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3768,8 +6455,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
     sqlite3_finalize(ppStmt);
     rollback(handle);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3780,8 +6466,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
     sqlite3_finalize(ppStmt);
     rollback(handle);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3791,8 +6476,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
     sqlite3_finalize(ppStmt);
     rollback(handle);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3805,8 +6489,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
           return ERROR_DATABASE_TYPE_MISMATCH;
         }
@@ -3815,8 +6498,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
           return ERROR_DATABASE_TYPE_MISMATCH;
         }  
@@ -3833,10 +6515,9 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
-        return ERROR_DATABASE_INVALID;
+        return stepError(retval);
       } 
   }
 
@@ -3845,8 +6526,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
     sqlite3_finalize(ppStmt);
     rollback(handle);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3855,8 +6535,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
     //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
     rollback(handle);
     freeMemory(datatype);  
-    remove(pathtoblob);
-    freeMemory(pathtoblob);
+    discardBlobFile(handle, temporary);
     freeMemory(path);
     return ERROR_DATABASE_INVALID;
   }
@@ -3867,8 +6546,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
       if(requestMemory((void**)&statement, 78) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_MEMORY;
       }
@@ -3881,8 +6559,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(statement);
         freeMemory(datatype); 
-        remove(pathtoblob);
-        freeMemory(pathtoblob); 
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -3894,8 +6571,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -3905,8 +6581,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -3917,8 +6592,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -3928,8 +6602,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -3939,25 +6612,14 @@ database_set_blob(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -3966,8 +6628,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -3976,23 +6637,21 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
 
       /* Insert into ValueBlob */
-      if(requestMemory((void**)&statement, 55) != ERROR_OK){
+      if(requestMemory((void**)&statement, strlen(insertValue) + 1) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_MEMORY; 
       }
 
-      strcpy(statement, "INSERT INTO ValueBlob(`id`, `path`) VALUES (:id,:pat);");
+      strcpy(statement, insertValue);
 
       if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
         //printf("prepare3: %s\n", sqlite3_errmsg(handle->db));
@@ -4001,8 +6660,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         freeMemory(statement);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
       freeMemory(statement);
@@ -4014,8 +6672,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
         
@@ -4025,8 +6682,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       } 
 
@@ -4037,19 +6693,18 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
 
-      if(sqlite3_bind_text(ppStmt, parameterIndex, path, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+      if(sqlite3_bind_text(ppStmt, parameterIndex, path, -1, SQLITE_TRANSIENT) != SQLITE_OK ||
+         bindCodec(ppStmt, codec) != SQLITE_OK){
         //printf("bind value: %s\n", sqlite3_errmsg(handle->db));  
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
 
@@ -4058,25 +6713,14 @@ database_set_blob(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -4085,8 +6729,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4095,8 +6738,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4105,16 +6747,15 @@ database_set_blob(database_handle_t* handle, const char* domain,
     /* Datatype is the same - just update value */
     if(!strcmp(datatype, "Blob")){ 
       /* Update ValueDouble */
-      if(requestMemory((void**)&statement, 49) != ERROR_OK){
+      if(requestMemory((void**)&statement, strlen(updateValue) + 1) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_MEMORY;
       }
 
-      strcpy(statement, "UPDATE ValueBlob SET path = :pat WHERE id = :id;");
+      strcpy(statement, updateValue);
 
       if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
         //printf("prepare4: %s\n", sqlite3_errmsg(handle->db));
@@ -4122,8 +6763,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         freeMemory(statement);
         freeMemory(path);
         freeMemory(datatype);   
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
       freeMemory(statement);
@@ -4135,19 +6775,18 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
         
-      if(sqlite3_bind_text(ppStmt, parameterIndex, path, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+      if(sqlite3_bind_text(ppStmt, parameterIndex, path, -1, SQLITE_TRANSIENT) != SQLITE_OK ||
+         bindCodec(ppStmt, codec) != SQLITE_OK){
         //printf("bind path: %s\n", sqlite3_errmsg(handle->db));  
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         return ERROR_DATABASE_INVALID;
       }
 
@@ -4157,8 +6796,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4168,8 +6806,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4179,25 +6816,14 @@ database_set_blob(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -4206,8 +6832,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4216,8 +6841,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4228,8 +6852,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
       if(requestMemory((void**)&statement, 40) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);    
-        remove(pathtoblob);
-        freeMemory(pathtoblob);    
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_MEMORY;
       }
@@ -4244,8 +6867,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(statement);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       } 
@@ -4257,8 +6879,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4268,8 +6889,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4279,25 +6899,14 @@ database_set_blob(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -4306,8 +6915,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4316,8 +6924,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         freeMemory(datatype);  
         rollback(handle);
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4326,8 +6933,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
       if(requestMemory((void**)&statement, 36) != ERROR_OK){
         freeMemory(datatype);   
         rollback(handle);
-        remove(pathtoblob);
-        freeMemory(pathtoblob); 
+        discardBlobFile(handle, temporary);
         freeMemory(path);    
         return ERROR_MEMORY;
       }
@@ -4340,8 +6946,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(statement);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4353,8 +6958,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4364,8 +6968,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4375,25 +6978,14 @@ database_set_blob(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -4402,8 +6994,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4412,8 +7003,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4422,8 +7012,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
       if(requestMemory((void**)&statement, 91) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_MEMORY;
       }
@@ -4436,8 +7025,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         rollback(handle);
         freeMemory(statement);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       } 
@@ -4449,8 +7037,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4460,8 +7047,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4472,8 +7058,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4483,8 +7068,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4495,8 +7079,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4506,8 +7089,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4517,25 +7099,14 @@ database_set_blob(database_handle_t* handle, const char* domain,
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -4544,8 +7115,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4554,33 +7124,29 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
 
       /* Insert into ValueBlob */
-      if(requestMemory((void**)&statement, 55) != ERROR_OK){
+      if(requestMemory((void**)&statement, strlen(insertValue) + 1) != ERROR_OK){
         rollback(handle);
         freeMemory(datatype);   
-        remove(pathtoblob);
-        freeMemory(pathtoblob);  
+        discardBlobFile(handle, temporary);
         freeMemory(path);   
         return ERROR_MEMORY;
       }
 
-      strcpy(statement, "INSERT INTO ValueBlob(`id`, `path`) VALUES (:id,:pat);");
+      strcpy(statement, insertValue);
 
       if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
         //printf("prepare8: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        freeMemory(path);
         freeMemory(statement);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4591,10 +7157,8 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("bind parameter index: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4603,10 +7167,8 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("bind id: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       } 
@@ -4616,51 +7178,36 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("bind parameter index: %s\n", sqlite3_errmsg(handle->db));
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
 
-      if(sqlite3_bind_text(ppStmt, parameterIndex, path, -1, SQLITE_TRANSIENT) != SQLITE_OK){
+      if(sqlite3_bind_text(ppStmt, parameterIndex, path, -1, SQLITE_TRANSIENT) != SQLITE_OK ||
+         bindCodec(ppStmt, codec) != SQLITE_OK){
         //printf("bind value: %s\n", sqlite3_errmsg(handle->db));  
         sqlite3_finalize(ppStmt);
         rollback(handle);
-        freeMemory(path);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
-      freeMemory(path);
 
       while(42){
         int retval = sqlite3_step(ppStmt);
         if(retval == SQLITE_DONE){
           break;
         }
-        else if(retval == SQLITE_ERROR){
+        else if(retval != SQLITE_ROW){
           //printf("fucking step1: %s\n", sqlite3_errmsg(handle->db));
           sqlite3_finalize(ppStmt);
           rollback(handle);
           freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
-          freeMemory(path);
-          return ERROR_DATABASE_INVALID;
-        }
-        else if(retval == SQLITE_MISUSE){
-          //printf("fucking step2: %s\n", sqlite3_errmsg(handle->db));
-          sqlite3_finalize(ppStmt);
-          rollback(handle);
-          freeMemory(datatype);  
-          remove(pathtoblob);
-          freeMemory(pathtoblob);
+          discardBlobFile(handle, temporary);
           freeMemory(path);
-          return ERROR_DATABASE_INVALID;
+          return stepError(retval);
         }
       }
 
@@ -4669,8 +7216,7 @@ database_set_blob(database_handle_t* handle, const char* domain,
         sqlite3_finalize(ppStmt);
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
@@ -4679,167 +7225,1015 @@ database_set_blob(database_handle_t* handle, const char* domain,
         //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
         rollback(handle);
         freeMemory(datatype);  
-        remove(pathtoblob);
-        freeMemory(pathtoblob);
+        discardBlobFile(handle, temporary);
         freeMemory(path);
         return ERROR_DATABASE_INVALID;
       }
     }    
   }
-  commit(handle);
-  freeMemory(pathtoblob);
+  /* readers find either the old row and file or the new ones, never a
+     truncated file. If the commit fails the new file stays, as does the row
+     of an existing key. */
+  if(temporary != NULL){
+    if(renameat(handle->blobdir, temporary, handle->blobdir, path) != 0){
+      rollback(handle);
+      freeMemory(datatype);
+      discardBlobFile(handle, temporary);
+      freeMemory(path);
+      return ERROR_DATABASE_IO;
+    }
+    syncBlobFile(handle, -1, path);
+  }
+
+  int committed = commit(handle);
+  if(committed != ERROR_OK){
+    freeMemory(datatype);
+    freeMemory(path);
+    return committed;
+  }
   freeMemory(path);
   freeMemory(datatype);
   return ERROR_OK;
 }
 
 
-int removeReferencedBlobFile(database_handle_t* handle, const char* domain, const char* key){
-  char* statement = NULL;
-  sqlite3_stmt *ppStmt = NULL;
-  const char** pzTail = NULL;
+int
+database_get_blob_to_fd(database_handle_t* handle, const char* domain,
+                        const char* key, int fd, size_t* size)
+{
+  startBusy(handle);
+  return finishBusy(handle, getBlobToFd(handle, domain, key, fd, size));
+}
+
+int
+getBlobToFd(database_handle_t* handle, const char* domain, const char* key,
+            int fd, size_t* size)
+{
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || fd < 0 || size == NULL || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  int file = -1;
+  int codec = CODEC_NONE;
+  int error = lookupBlobFile(handle, domain, key, &file, &codec);
+  if(error != ERROR_OK)
+    return error;
+
+  /* a compressed blob has to pass through user space */
+  if(codec != CODEC_NONE){
+    unsigned char* value = NULL;
+    size_t total = 0;
+    error = unpackBlobFile(file, codec, SIZE_MAX, &value, size, &total);
+    close(file);
+    if(error != ERROR_OK)
+      return error;
+    error = writeBlobFile(fd, value, *size);
+    freeMemory(value);
+    return error;
+  }
+
+  struct stat sb;
+  if(fstat(file, &sb) != 0){
+    close(file);
+    return ERROR_DATABASE_IO;
+  }
+
+  /* let the kernel move the data, the blob never enters user space */
+  error = file_copy(file, fd, sb.st_size, size);
+  close(file);
+  if(error != ERROR_OK)
+    return ERROR_DATABASE_IO;
+
+  return ERROR_OK;
+}
+
+
+int
+database_set_blob_from_fd(database_handle_t* handle, const char* domain,
+                          const char* key, int fd)
+{
+  startBusy(handle);
+  return finishBusy(handle, setBlobFromFd(handle, domain, key, fd));
+}
+
+int
+setBlobFromFd(database_handle_t* handle, const char* domain, const char* key,
+              int fd)
+{
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || fd < 0 || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
+  /* content-addressed store: the digest is only known after reading it all */
+  if(handle->dedup){
+    uint8_t sum[SHA1HashSize];
+    char* staged = NULL;
+    int error = stageContent(handle, fd, &staged, sum);
+    if(error != ERROR_OK)
+      return error;
+
+    error = storeDeduplicated(handle, domain, key, NULL, 0, staged, sum);
+    freeMemory(staged);
+    return error;
+  }
+
+  char* path = NULL;
+  int error = buildBlobPath(handle, domain, key, &path);
+  if(error != ERROR_OK)
+    return error;
+
+  char* temporary = NULL;
+  int file = -1;
+  error = createBlobTemporary(handle, path, &temporary, &file);
+  if(error != ERROR_OK){
+    freeMemory(path);
+    return error;
+  }
+
+  error = file_copy(fd, file, -1, NULL);
+  if(error == ERROR_OK)
+    error = syncBlobFile(handle, file, NULL);
+  if(close(file) != 0 || error != ERROR_OK){
+    discardBlobFile(handle, temporary);
+    freeMemory(temporary);
+    freeMemory(path);
+    return ERROR_DATABASE_IO;
+  }
+
+  error = replaceBlobReference(handle, domain, key, path, temporary, CODEC_NONE);
+  freeMemory(temporary);
+  return error;
+}
+
+
+int
+database_get_blob_chunk(database_handle_t* handle, const char* domain,
+                        const char* key, size_t offset, size_t length,
+                        unsigned char** value, size_t* size, size_t* total)
+{
+  startBusy(handle);
+  return finishBusy(handle, getBlobChunk(handle, domain, key, offset, length,
+                                          value, size, total));
+}
+
+int
+getBlobChunk(database_handle_t* handle, const char* domain, const char* key,
+             size_t offset, size_t length, unsigned char** value, size_t* size,
+             size_t* total)
+{
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || domain == NULL || key == NULL || value == NULL || size == NULL || total == NULL || length == 0 || strlen(handle->blobpath) == 0 || strlen(domain) == 0 || strlen(key) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  int file = -1;
+  int codec = CODEC_NONE;
+  int error = lookupBlobFile(handle, domain, key, &file, &codec);
+  if(error != ERROR_OK)
+    return error;
+
+  /* a compressed blob is restored up to the end of the chunk */
+  if(codec != CODEC_NONE){
+    size_t restored = 0;
+    error = unpackBlobFile(file, codec, length > SIZE_MAX - offset ? SIZE_MAX : offset + length,
+                           value, &restored, total);
+    close(file);
+    if(error != ERROR_OK)
+      return error;
+    if(offset > *total){
+      freeMemory(*value);
+      *value = NULL;
+      return ERROR_INVALID_ARGUMENTS;
+    }
+    *size = restored - offset;
+    memmove(*value, *value + offset, *size);
+    return ERROR_OK;
+  }
+
+  struct stat sb;
+  if(fstat(file, &sb) != 0){
+    close(file);
+    return ERROR_DATABASE_IO;
+  }
+  *total = sb.st_size;
+  if(offset > *total){
+    close(file);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  *size = *total - offset;
+  if(*size > length)
+    *size = length;
+
+  /* always hand out a valid buffer, even for the last empty chunk */
+  if(requestMemory((void**)value, *size + 1) != ERROR_OK){
+    close(file);
+    return ERROR_MEMORY;
+  }
+
+  error = readBlobFile(file, *value, *size, offset);
+  close(file);
+  if(error != ERROR_OK){
+    freeMemory(*value);
+    *value = NULL;
+    return error;
+  }
+
+  return ERROR_OK;
+}
+
+int removeReferencedBlobFile(database_handle_t* handle, const char* domain, const char* key){
+  char* blobpath = NULL;
+  int error = selectBlobPath(handle, domain, key, &blobpath, NULL);
+  if(error != ERROR_OK)
+    return error;
+
+  /* remove referenced blob */
+  /* regarding to database.h nobody cares if working or not */
+  releaseBlobFile(handle, blobpath);
+  freeMemory(blobpath);
+  return ERROR_OK;
+}
+
+/**
+ * drops one reference of a blob file stored in ValueBlob. Files of the
+ * content-addressed store are shared and only removed with the last reference,
+ * all other files are removed right away.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] blobpath Path relative to the blob-path as stored in ValueBlob
+ */
+int
+releaseBlobFile(database_handle_t* handle, const char* blobpath)
+{
+  int orphaned = 0;
+  int error = dropBlobFile(handle, blobpath, &orphaned);
+  if(orphaned)
+    removeReleasedFile(handle, blobpath);
+  return error;
+}
+
+/**
+ * drops one reference of a blob file stored in ValueBlob in the database only,
+ * the file is left to @ref removeReleasedFile once the transaction committed
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] blobpath Path relative to the blob-path as stored in ValueBlob
+ * @param[out] orphaned Set to 1 if nothing references the file anymore
+ */
+int
+dropBlobFile(database_handle_t* handle, const char* blobpath, int* orphaned)
+{
+  char digest[2 * SHA1HashSize + 1];
+  if(parseContentPath(blobpath, digest))
+    return dropBlobContent(handle, digest, orphaned);
+
+  *orphaned = 1;
+  return ERROR_OK;
+}
+
+/**
+ * removes a blob file dropped by @ref dropBlobFile. A file of the
+ * content-addressed store is kept if a writer referenced the same content
+ * again since.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] blobpath Path relative to the blob-path as stored in ValueBlob
+ */
+void
+removeReleasedFile(database_handle_t* handle, const char* blobpath)
+{
+  char digest[2 * SHA1HashSize + 1];
+  if(!parseContentPath(blobpath, digest)){
+    discardBlobFile(handle, blobpath);
+    return;
+  }
+
+  /* a left over file is found by database_maintain */
+  if(beginWrite(handle) != ERROR_OK)
+    return;
+  int64_t refcount = 0;
+  if(runDigestStatement(handle, "SELECT refcount FROM BlobContent WHERE digest = :dig;",
+                        digest, &refcount) == ERROR_DATABASE_NO_SUCH_KEY)
+    discardBlobFile(handle, blobpath);
+  commit(handle);
+}
+
+/**
+ * extracts the hex digest of a path of the content-addressed store
+ *
+ * @param[in] blobpath Path relative to the blob-path
+ * @param[out] digest Buffer of 2 * SHA1HashSize + 1 bytes
+ *
+ * @return 1 if @a blobpath is in the content-addressed store, 0 otherwise
+ */
+int
+parseContentPath(const char* blobpath, char* digest)
+{
+  size_t prefix = strlen(BLOB_CONTENT_DIRECTORY);
+  if(strncmp(blobpath, BLOB_CONTENT_DIRECTORY, prefix) != 0 ||
+     strlen(blobpath) != prefix + 2 * SHA1HashSize + 2)
+    return 0;
+
+  /* .sha1/ab/cdef... -> abcdef... */
+  memcpy(digest, blobpath + prefix + 1, 2);
+  memcpy(digest + 2, blobpath + prefix + 4, 2 * SHA1HashSize - 2);
+  digest[2 * SHA1HashSize] = '\0';
+  return 1;
+}
+
+/**
+ * replaces the ValueBlob row of domain and key, moves the written file into
+ * place and releases the file that was referenced before, if it differs from
+ * the new one
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[in] path Path relative to the blob-path, is freed
+ * @param[in] temporary Written blob file relative to the blob-path
+ * @param[in] codec Codec of the blob file
+ */
+int
+replaceBlobReference(database_handle_t* handle, const char* domain,
+                     const char* key, char* path, const char* temporary,
+                     int codec)
+{
+  /* no other writer may release the previous file in between */
+  int error = beginWrite(handle);
+  if(error != ERROR_OK){
+    discardBlobFile(handle, temporary);
+    freeMemory(path);
+    return error;
+  }
+
+  char* previous = NULL;
+  if(selectBlobPath(handle, domain, key, &previous, NULL) != ERROR_OK)
+    previous = NULL;
+  if(previous != NULL && strcmp(previous, path) == 0){
+    freeMemory(previous);
+    previous = NULL;
+  }
+
+  int orphaned = 0;
+  error = storeBlobReference(handle, domain, key, path, temporary, codec);
+  if(error == ERROR_OK && previous != NULL)
+    error = dropBlobFile(handle, previous, &orphaned);
+  if(error == ERROR_OK)
+    error = commit(handle);
+  else
+    rollback(handle);
+
+  if(error == ERROR_OK && orphaned)
+    removeReleasedFile(handle, previous);
+  freeMemory(previous);
+  return error;
+}
+
+/**
+ * removes a blob file relative to the blob-path, e.g. after a failed database
+ * update. A NULL path is ignored.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] path Path relative to the blob-path or NULL
+ */
+void
+discardBlobFile(database_handle_t* handle, const char* path)
+{
+  if(path == NULL)
+    return;
+
+  int directory = -1;
+  const char* name = NULL;
+  struct stat sb;
+  if(openBlobDirectory(handle, path, 0, &directory, &name) == ERROR_OK &&
+     fstatat(directory, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(sb.st_mode))
+    unlinkat(directory, name, 0);
+}
+
+/**
+ * reads an integer setting, i.e. an Int64 value with domain NULL
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] name The key of the setting
+ * @param[out] value The value of the setting
+ */
+int
+readIntegerSetting(database_handle_t* handle, const char* name, int64_t* value)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  char* statement = "SELECT ValueInt64.`value` as `value` FROM KeyInfo INNER JOIN ValueInt64 ON KeyInfo.`id` = ValueInt64.`id` WHERE KeyInfo.`datatype` = 'Int64' AND KeyInfo.`domain` IS NULL AND KeyInfo.`key` = :key;";
+
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return ERROR_DATABASE_INVALID;
+  }
+
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
+  if(parameterIndex == 0 ||
+     sqlite3_bind_text(ppStmt, parameterIndex, name, -1, SQLITE_STATIC) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return ERROR_DATABASE_INVALID;
+  }
 
-  unsigned int sizeOfStmt = 188;
+  int error = ERROR_OK;
+  int retval = sqlite3_step(ppStmt);
+  if(retval == SQLITE_ROW)
+    *value = sqlite3_column_int64(ppStmt, 0);
+  else if(retval == SQLITE_DONE)
+    error = ERROR_DATABASE_NO_SUCH_KEY;
+  else
+    error = ERROR_DATABASE_INVALID;
 
-  if(requestMemory((void**)&statement, sizeOfStmt) != ERROR_OK)
-    return ERROR_MEMORY;
-  char* blobpath = NULL;
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK)
+    return ERROR_DATABASE_INVALID;
+  return error;
+}
 
-  strcpy(statement, "SELECT ValueBlob.`path` as `path` FROM KeyInfo INNER JOIN ValueBlob ON KeyInfo.`id` = ValueBlob.`id`WHERE KeyInfo.`datatype` = 'Blob' AND KeyInfo.`domain` = :dom AND KeyInfo.`key`= :key;");
+/**
+ * reads a string setting, i.e. a String value with domain NULL
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] name The key of the setting
+ * @param[out] value The value of the setting, has to be freed
+ */
+int
+readStringSetting(database_handle_t* handle, const char* name, char** value)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  char* statement = "SELECT ValueString.`value` as `value` FROM KeyInfo INNER JOIN ValueString ON KeyInfo.`id` = ValueString.`id` WHERE KeyInfo.`datatype` = 'String' AND KeyInfo.`domain` IS NULL AND KeyInfo.`key` = :key;";
 
-  begin(handle);
   if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
-    //printf("prepare: %s\n", sqlite3_errmsg(handle->db));
     sqlite3_finalize(ppStmt);
-    rollback(handle);
-    freeMemory(statement);
     return ERROR_DATABASE_INVALID;
   }
-  freeMemory(statement);
 
-  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":dom");
-  if(parameterIndex == 0){
-    //printf("bind parameter domain: %s\n", sqlite3_errmsg(handle->db));
-    rollback(handle);
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
+  if(parameterIndex == 0 ||
+     sqlite3_bind_text(ppStmt, parameterIndex, name, -1, SQLITE_STATIC) != SQLITE_OK){
     sqlite3_finalize(ppStmt);
     return ERROR_DATABASE_INVALID;
   }
 
-  if(sqlite3_bind_text(ppStmt, parameterIndex, domain, -1, SQLITE_TRANSIENT) != SQLITE_OK){
-    //printf("bind domain: %s\n", sqlite3_errmsg(handle->db));
-    rollback(handle);
-    sqlite3_finalize(ppStmt);
+  int error = ERROR_OK;
+  int retval = sqlite3_step(ppStmt);
+  if(retval == SQLITE_ROW && sqlite3_column_type(ppStmt, 0) == SQLITE_TEXT){
+    const char* text = (const char*)sqlite3_column_text(ppStmt, 0);
+    if(requestMemory((void**)value, strlen(text) + 1) == ERROR_OK)
+      strcpy(*value, text);
+    else
+      error = ERROR_MEMORY;
+  }
+  else if(retval == SQLITE_ROW)
+    error = ERROR_DATABASE_TYPE_MISMATCH;
+  else if(retval == SQLITE_DONE)
+    error = ERROR_DATABASE_NO_SUCH_KEY;
+  else
+    error = ERROR_DATABASE_INVALID;
+
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
+    if(error == ERROR_OK){
+      freeMemory(*value);
+      *value = NULL;
+    }
     return ERROR_DATABASE_INVALID;
   }
-  
-  parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":key");
-  if(parameterIndex == 0){
-    //printf("bind parameter key: %s\n", sqlite3_errmsg(handle->db));
-    rollback(handle);
+  return error;
+}
+
+/**
+ * runs a statement on the BlobContent table with the digest bound to :dig
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] statement The statement
+ * @param[in] digest The hex digest
+ * @param[out] result First column of the first row, may be NULL if the
+ *   statement doesn't return rows
+ */
+int
+runDigestStatement(database_handle_t* handle, const char* statement,
+                   const char* digest, int64_t* result)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
     sqlite3_finalize(ppStmt);
     return ERROR_DATABASE_INVALID;
   }
 
-  if(sqlite3_bind_text(ppStmt, parameterIndex, key, -1, SQLITE_TRANSIENT) != SQLITE_OK){
-    //printf("bind key: %s\n", sqlite3_errmsg(handle->db));
-    rollback(handle);  
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":dig");
+  if(parameterIndex == 0 ||
+     sqlite3_bind_text(ppStmt, parameterIndex, digest, -1, SQLITE_STATIC) != SQLITE_OK){
     sqlite3_finalize(ppStmt);
     return ERROR_DATABASE_INVALID;
   }
 
-  while (42){
-      int retval = sqlite3_step(ppStmt);
+  int error = ERROR_OK;
+  int retval = sqlite3_step(ppStmt);
+  if(retval == SQLITE_ROW && result != NULL)
+    *result = sqlite3_column_int64(ppStmt, 0);
+  else if(retval == SQLITE_DONE && result != NULL)
+    error = ERROR_DATABASE_NO_SUCH_KEY;
+  else if(retval != SQLITE_DONE && retval != SQLITE_ROW)
+    error = ERROR_DATABASE_INVALID;
 
-      if(retval == SQLITE_ROW){   
-        if(sqlite3_column_type(ppStmt, 0) != SQLITE3_TEXT){
-          rollback(handle);
-          sqlite3_finalize(ppStmt);
-          return ERROR_DATABASE_TYPE_MISMATCH;
-        }      
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK)
+    return ERROR_DATABASE_INVALID;
+  return error;
+}
 
-        char * dbentry = NULL;
-        dbentry = (char*)sqlite3_column_text(ppStmt, 0); 
-        if(requestMemory((void**)&blobpath, strlen(dbentry)+1) != ERROR_OK){
-          rollback(handle);
-          sqlite3_finalize(ppStmt);
-          return ERROR_MEMORY;
-        }
-        memcpy(blobpath, dbentry, strlen(dbentry));
-        blobpath[strlen(dbentry)] = '\0';
-        break;
-      }
-      else if(retval == SQLITE_DONE){
-        rollback(handle);
-        sqlite3_finalize(ppStmt);
-        return ERROR_DATABASE_NO_SUCH_KEY;
-      }
-      else {
-        //printf("step: %s\n", sqlite3_errmsg(handle->db));
-        rollback(handle);
-        sqlite3_finalize(ppStmt);
-        return ERROR_DATABASE_INVALID;
-      } 
+/**
+ * builds the path of a blob in the content-addressed store and creates its
+ * directories
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] digest The hex digest of the content
+ * @param[out] path Buffer of @ref BLOB_CONTENT_PATH_SIZE bytes receiving the
+ *   path relative to the blob-path
+ */
+int
+buildContentPath(database_handle_t* handle, const char* digest, char* path)
+{
+  size_t prefix = strlen(BLOB_CONTENT_DIRECTORY);
+
+  memcpy(path, BLOB_CONTENT_DIRECTORY, prefix);
+  path[prefix] = '/';
+  memcpy(path + prefix + 1, digest, 2);
+  path[prefix + 3] = '/';
+  memcpy(path + prefix + 4, digest + 2, 2 * SHA1HashSize - 2);
+  path[BLOB_CONTENT_PATH_SIZE - 1] = '\0';
+
+  int directory = -1;
+  const char* name = NULL;
+  return openBlobDirectory(handle, path, 1, &directory, &name);
+}
+/**
+ * adds a reference to a blob in the content-addressed store. The content is
+ * only written if nobody references it yet. Runs in the transaction of the
+ * caller, which has to remove a @a created file if it rolls back.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] digest The hex digest of the content
+ * @param[in] path Path of the content relative to the blob-path
+ * @param[in] value The content, used if @a staged is NULL
+ * @param[in] size The size of the content
+ * @param[in] staged Temporary file holding the content relative to the
+ *   blob-path or NULL, is moved into place or removed
+ * @param[out] created Set to 1 if the content was new and written to @a path
+ */
+int
+acquireBlobContent(database_handle_t* handle, const char* digest,
+                   const char* path, const unsigned char* value,
+                   size_t size, const char* staged, int* created)
+{
+  *created = 0;
+  int error = runDigestStatement(handle, "UPDATE BlobContent SET refcount = refcount + 1 WHERE digest = :dig;", digest, NULL);
+  if(error != ERROR_OK){
+    discardBlobFile(handle, staged);
+    return error;
   }
 
-  if(sqlite3_reset(ppStmt) != SQLITE_OK){
-    //printf("reset: %s\n", sqlite3_errmsg(handle->db));
-    rollback(handle);
-    sqlite3_finalize(ppStmt);
-    freeMemory(blobpath);
-    return ERROR_DATABASE_INVALID;
+  /* identical content already stored - don't write it again */
+  int existing = sqlite3_changes(handle->db) > 0;
+  int directory = -1;
+  const char* name = NULL;
+  struct stat sb;
+  if(existing && openBlobDirectory(handle, path, 0, &directory, &name) == ERROR_OK &&
+     fstatat(directory, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(sb.st_mode)){
+    discardBlobFile(handle, staged);
+    return ERROR_OK;
   }
 
-  if(sqlite3_finalize(ppStmt) != SQLITE_OK){
-    //printf("finalize: %s\n", sqlite3_errmsg(handle->db));
+  if(staged != NULL){
+    /* both directories were just checked by buildContentPath and stageContent */
+    if(renameat(handle->blobdir, staged, handle->blobdir, path) != 0){
+      discardBlobFile(handle, staged);
+      return ERROR_DATABASE_IO;
+    }
+    if(syncBlobFile(handle, -1, path) != ERROR_OK){
+      discardBlobFile(handle, path);
+      return ERROR_DATABASE_IO;
+    }
+  }else{
+    int file = -1;
+    error = openBlobFile(handle, path, O_WRONLY | O_CREAT | O_TRUNC, &file);
+    if(error != ERROR_OK){
+      return error;
+    }
+    error = writeBlobFile(file, value, size);
+    if(error == ERROR_OK)
+      error = syncBlobFile(handle, file, path);
+    if(close(file) != 0 || error != ERROR_OK){
+      discardBlobFile(handle, path);
+      return ERROR_DATABASE_IO;
+    }
+  }
+
+  if(!existing){
+    error = runDigestStatement(handle, "INSERT INTO BlobContent(`digest`, `refcount`) VALUES (:dig, 1);", digest, NULL);
+    if(error != ERROR_OK){
+      discardBlobFile(handle, path);
+      return error;
+    }
+    *created = 1;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * drops a reference to a blob in the content-addressed store and deletes its
+ * row with the last reference, the file is left to the caller
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] digest The hex digest of the content
+ * @param[out] orphaned Set to 1 if that was the last reference
+ */
+int
+dropBlobContent(database_handle_t* handle, const char* digest, int* orphaned)
+{
+  int64_t refcount = 0;
+
+  begin(handle);
+  int error = runDigestStatement(handle, "UPDATE BlobContent SET refcount = refcount - 1 WHERE digest = :dig;", digest, NULL);
+  if(error == ERROR_OK)
+    error = runDigestStatement(handle, "SELECT refcount FROM BlobContent WHERE digest = :dig;", digest, &refcount);
+  if(error == ERROR_OK && refcount <= 0)
+    error = runDigestStatement(handle, "DELETE FROM BlobContent WHERE digest = :dig;", digest, NULL);
+  if(error != ERROR_OK){
     rollback(handle);
-    freeMemory(blobpath);
-    return ERROR_DATABASE_INVALID;
+    return error;
   }
-  commit(handle);
+  error = commit(handle);
+  if(error != ERROR_OK)
+    return error;
 
-  /* check for relative path */
-  if(blobpath[0] == '/'){
-    freeMemory(blobpath);
-    return ERROR_DATABASE_INVALID;
+  *orphaned = refcount <= 0;
+  return ERROR_OK;
+}
+
+/**
+ * stores a blob in the content-addressed store and references it from domain
+ * and key. Writing the blob a key already references is a no-op.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[in] value The content, used if @a staged is NULL
+ * @param[in] size The size of the content
+ * @param[in] staged Temporary file holding the content relative to the
+ *   blob-path or NULL, is moved into place or removed
+ * @param[in] sum SHA-1 of the content
+ */
+int
+storeDeduplicated(database_handle_t* handle, const char* domain,
+                  const char* key, const unsigned char* value, size_t size,
+                  const char* staged, const uint8_t* sum)
+{
+  static const char hex[] = "0123456789abcdef";
+  char digest[2 * SHA1HashSize + 1];
+  int i = 0;
+  for(i = 0; i < SHA1HashSize; i++){
+    digest[2 * i] = hex[sum[i] >> 4];
+    digest[2 * i + 1] = hex[sum[i] & 0x0f];
   }
+  digest[2 * SHA1HashSize] = '\0';
 
-  char* pathtoblob = NULL;
-  if(requestMemory((void**)&pathtoblob, strlen(handle->blobpath) + 1 + strlen(blobpath)+1) != ERROR_OK){
-    freeMemory(blobpath);
+  char path[BLOB_CONTENT_PATH_SIZE];
+  int error = buildContentPath(handle, digest, path);
+  if(error != ERROR_OK){
+    discardBlobFile(handle, staged);
+    return error;
+  }
+
+  /* the old reference, both reference counts and the row change together */
+  error = beginWrite(handle);
+  if(error != ERROR_OK){
+    discardBlobFile(handle, staged);
+    return error;
+  }
+
+  /* the key already holds exactly this content */
+  char* previous = NULL;
+  if(selectBlobPath(handle, domain, key, &previous, NULL) != ERROR_OK)
+    previous = NULL;
+  if(previous != NULL && strcmp(previous, path) == 0){
+    freeMemory(previous);
+    commit(handle);
+    discardBlobFile(handle, staged);
+    return ERROR_OK;
+  }
+
+  int created = 0;
+  int orphaned = 0;
+  char* reference = NULL;
+  error = acquireBlobContent(handle, digest, path, value, size, staged, &created);
+  if(error == ERROR_OK &&
+     requestMemory((void**)&reference, BLOB_CONTENT_PATH_SIZE) != ERROR_OK)
+    error = ERROR_MEMORY;
+  if(error == ERROR_OK){
+    memcpy(reference, path, BLOB_CONTENT_PATH_SIZE);
+    error = storeBlobReference(handle, domain, key, reference, NULL, CODEC_NONE);
+  }
+  if(error == ERROR_OK && previous != NULL)
+    error = dropBlobFile(handle, previous, &orphaned);
+  if(error == ERROR_OK)
+    error = commit(handle);
+  else
+    rollback(handle);
+
+  /* files only go once no committed row references them */
+  if(error != ERROR_OK && created)
+    removeReleasedFile(handle, path);
+  else if(error == ERROR_OK && orphaned)
+    removeReleasedFile(handle, previous);
+
+  freeMemory(previous);
+  return error;
+}
+
+/**
+ * copies a file descriptor into a temporary file of the content-addressed
+ * store and calculates the SHA-1 of the content on the way
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] fd Readable file descriptor, read until end of file
+ * @param[out] result Path of the temporary file relative to the blob-path,
+ *   has to be freed
+ * @param[out] sum SHA-1 of the content
+ */
+int
+stageContent(database_handle_t* handle, int fd, char** result, uint8_t* sum)
+{
+  char path[BLOB_CONTENT_PATH_SIZE];
+  int error = buildContentPath(handle, "0000000000000000000000000000000000000000", path);
+  if(error != ERROR_OK)
+    return error;
+
+  /* .sha1/00/staged-<pid>-<n>, created exclusively */
+  static unsigned int counter = 0;
+  size_t dir_size = BLOB_CONTENT_PATH_SIZE - 1 - (2 * SHA1HashSize - 2);
+  size_t staged_size = dir_size + 64;
+  char* staged = NULL;
+  if(requestMemory((void**)&staged, staged_size) != ERROR_OK)
+    return ERROR_MEMORY;
+  memcpy(staged, path, dir_size);
+
+  int file = -1;
+  int directory = -1;
+  const char* name = NULL;
+  while(file < 0){
+    snprintf(staged + dir_size, staged_size - dir_size, "staged-%ld-%u",
+             (long)getpid(), counter++);
+    error = openBlobDirectory(handle, staged, 1, &directory, &name);
+    if(error != ERROR_OK){
+      freeMemory(staged);
+      return error;
+    }
+    file = openat(directory, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+    if(file < 0 && errno != EEXIST){
+      freeMemory(staged);
+      return ERROR_DATABASE_IO;
+    }
+  }
+
+  unsigned char* buffer = NULL;
+  if(requestMemory((void**)&buffer, FILE_COPY_BUFFER_SIZE) != ERROR_OK){
+    close(file);
+    discardBlobFile(handle, staged);
+    freeMemory(staged);
     return ERROR_MEMORY;
   }
-  strcpy(pathtoblob, handle->blobpath);
-  strcat(pathtoblob, "/");
-  strcat(pathtoblob, blobpath);
-  pathtoblob[strlen(handle->blobpath) + 1 + strlen(blobpath)] = '\0';
-  freeMemory(blobpath);
 
-  /* check if path: is a regular file */
-  struct stat sb;
-  if(stat(pathtoblob, &sb) != 0){
-    //printf("something gone wrong... stat\n");
-    freeMemory(pathtoblob);
+  SHA1Context context;
+  SHA1Reset(&context);
+  while(error == ERROR_OK){
+    ssize_t got = read(fd, buffer, FILE_COPY_BUFFER_SIZE);
+    if(got < 0 && errno == EINTR)
+      continue;
+    if(got < 0){
+      error = ERROR_DATABASE_IO;
+      break;
+    }
+    if(got == 0)
+      break;
+
+    if(SHA1Input(&context, buffer, got) != shaSuccess)
+      error = ERROR_UNKNOWN;
+
+    ssize_t written = 0;
+    while(error == ERROR_OK && written < got){
+      ssize_t ret = write(file, buffer + written, got - written);
+      if(ret < 0 && errno != EINTR)
+        error = ERROR_DATABASE_IO;
+      else if(ret > 0)
+        written += ret;
+    }
+  }
+  freeMemory(buffer);
+
+  if(error == ERROR_OK)
+    error = syncBlobFile(handle, file, NULL);
+  if(close(file) != 0 && error == ERROR_OK)
+    error = ERROR_DATABASE_IO;
+  if(error == ERROR_OK && SHA1Result(&context, sum) != shaSuccess)
+    error = ERROR_UNKNOWN;
+  if(error != ERROR_OK){
+    discardBlobFile(handle, staged);
+    freeMemory(staged);
+    return error;
+  }
+
+  *result = staged;
+  return ERROR_OK;
+}
+
+int
+database_migrate_blobs(database_handle_t* handle, size_t* migrated)
+{
+  startBusy(handle);
+  return finishBusy(handle, migrateBlobs(handle, migrated));
+}
+
+int
+migrateBlobs(database_handle_t* handle, size_t* migrated)
+{
+  if(handle == NULL || handle->db == NULL || handle->blobpath == NULL || migrated == NULL || strlen(handle->blobpath) == 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(handle->readonly)
+    return ERROR_DATABASE_READONLY;
+
+  *migrated = 0;
+
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  char* statement = "SELECT KeyInfo.`id`, KeyInfo.`domain`, KeyInfo.`key`, ValueBlob.`path` FROM KeyInfo INNER JOIN ValueBlob ON KeyInfo.`id` = ValueBlob.`id` WHERE KeyInfo.`datatype` = 'Blob' AND KeyInfo.`id` > :id ORDER BY KeyInfo.`id` LIMIT 1;";
+
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
     return ERROR_DATABASE_INVALID;
   }
-  if(!S_ISREG(sb.st_mode)){        /* check if regular file */
-    //printf("regular file");
-    freeMemory(pathtoblob);
+  int parameterIndex = sqlite3_bind_parameter_index(ppStmt, ":id");
+  if(parameterIndex == 0){
+    sqlite3_finalize(ppStmt);
     return ERROR_DATABASE_INVALID;
   }
 
-  int error = check_blob_path(pathtoblob, handle->blobpath);
+  /* one key at a time, the statement is never active while rows are updated */
+  int64_t id = 0;
+  int error = ERROR_OK;
+  while(error == ERROR_OK){
+    if(sqlite3_bind_int64(ppStmt, parameterIndex, id) != SQLITE_OK){
+      error = ERROR_DATABASE_INVALID;
+      break;
+    }
+
+    int retval = sqlite3_step(ppStmt);
+    if(retval == SQLITE_DONE)
+      break;
+    if(retval != SQLITE_ROW || sqlite3_column_type(ppStmt, 1) != SQLITE_TEXT ||
+       sqlite3_column_type(ppStmt, 2) != SQLITE_TEXT ||
+       sqlite3_column_type(ppStmt, 3) != SQLITE_TEXT){
+      error = ERROR_DATABASE_INVALID;
+      break;
+    }
+
+    id = sqlite3_column_int64(ppStmt, 0);
+    const char* columns[3] = {(const char*)sqlite3_column_text(ppStmt, 1),
+                              (const char*)sqlite3_column_text(ppStmt, 2),
+                              (const char*)sqlite3_column_text(ppStmt, 3)};
+    char* copies[3] = {NULL, NULL, NULL};
+    int i = 0;
+    for(i = 0; i < 3 && error == ERROR_OK; i++){
+      if(requestMemory((void**)&copies[i], strlen(columns[i]) + 1) != ERROR_OK)
+        error = ERROR_MEMORY;
+      else
+        strcpy(copies[i], columns[i]);
+    }
+    sqlite3_reset(ppStmt);
+
+    int moved = 0;
+    if(error == ERROR_OK)
+      error = migrateBlobFile(handle, id, copies[0], copies[1], copies[2], &moved);
+    if(moved)
+      (*migrated)++;
+
+    for(i = 0; i < 3; i++)
+      freeMemory(copies[i]);
+  }
+
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK && error == ERROR_OK)
+    error = ERROR_DATABASE_INVALID;
+  return error;
+}
+
+/**
+ * moves one blob file to the place the current layout expects it and updates
+ * its ValueBlob row. Files of the content-addressed store are left alone.
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] id The id of the key
+ * @param[in] domain The domain of the key
+ * @param[in] key The key
+ * @param[in] blobpath Path relative to the blob-path as stored in ValueBlob
+ * @param[out] moved Set to 1 if the file was moved
+ */
+int
+migrateBlobFile(database_handle_t* handle, int64_t id, const char* domain,
+                const char* key, const char* blobpath, int* moved)
+{
+  *moved = 0;
+
+  size_t prefix = strlen(BLOB_CONTENT_DIRECTORY);
+  if(strncmp(blobpath, BLOB_CONTENT_DIRECTORY, prefix) == 0 && blobpath[prefix] == '/')
+    return ERROR_OK;
+
+  char* path = NULL;
+  int error = buildBlobPath(handle, domain, key, &path);
+  if(error != ERROR_OK)
+    return error;
+  if(strcmp(path, blobpath) == 0){
+    freeMemory(path);
+    return ERROR_OK;
+  }
+
+  /* the old file has to be a regular file inside the blob-path */
+  int directory = -1;
+  const char* name = NULL;
+  struct stat sb;
+  error = openBlobDirectory(handle, blobpath, 0, &directory, &name);
+  if(error == ERROR_OK && (fstatat(directory, name, &sb, AT_SYMLINK_NOFOLLOW) != 0 ||
+                          !S_ISREG(sb.st_mode)))
+    error = ERROR_DATABASE_INVALID;
+  /* both directories have just been checked component by component */
+  if(error == ERROR_OK && renameat(handle->blobdir, blobpath, handle->blobdir, path) != 0)
+    error = ERROR_DATABASE_IO;
+  if(error == ERROR_OK)
+    syncBlobFile(handle, -1, path);
   if(error != ERROR_OK){
-    freeMemory(pathtoblob);
-    //printf("something gone wrong... check_blob_path\n");
+    freeMemory(path);
     return error;
   }
 
-  /* remove referenced blob */
-  /* regarding to database.h nobody cares if working or not */
-  remove(pathtoblob);
+  sqlite3_stmt *ppStmt = NULL;
+  const char** pzTail = NULL;
+  char* statement = "UPDATE ValueBlob SET `path` = :val WHERE `id` = :id;";
+
+  error = beginWrite(handle);
+  if(error != ERROR_OK){
+    renameat(handle->blobdir, path, handle->blobdir, blobpath);
+    freeMemory(path);
+    return error;
+  }
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, pzTail) != SQLITE_OK ||
+     sqlite3_bind_text(ppStmt, sqlite3_bind_parameter_index(ppStmt, ":val"), path, -1, SQLITE_STATIC) != SQLITE_OK ||
+     sqlite3_bind_int64(ppStmt, sqlite3_bind_parameter_index(ppStmt, ":id"), id) != SQLITE_OK ||
+     sqlite3_step(ppStmt) != SQLITE_DONE)
+    error = ERROR_DATABASE_INVALID;
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK)
+    error = ERROR_DATABASE_INVALID;
+
+  if(error != ERROR_OK){
+    rollback(handle);
+    renameat(handle->blobdir, path, handle->blobdir, blobpath);
+    freeMemory(path);
+    return error;
+  }
+  commit(handle);
 
+  freeMemory(path);
+  *moved = 1;
   return ERROR_OK;
 }
 
+/**
+ * runs a PRAGMA that returns one value and copies it as text
+ *
+ * @param[in] handle A valid database handle
+ * @param[in] statement The PRAGMA
+ * @param[out] result The value
+ * @param[in] size Size of @a result
+ */
+int
+readPragma(database_handle_t* handle, const char* statement, char* result,
+           size_t size)
+{
+  sqlite3_stmt *ppStmt = NULL;
+  if(sqlite3_prepare_v2(handle->db, statement, -1, &ppStmt, NULL) != SQLITE_OK){
+    sqlite3_finalize(ppStmt);
+    return ERROR_DATABASE_INVALID;
+  }
 
+  int error = ERROR_DATABASE_INVALID;
+  if(sqlite3_step(ppStmt) == SQLITE_ROW && sqlite3_column_text(ppStmt, 0) != NULL){
+    snprintf(result, size, "%s", (const char*)sqlite3_column_text(ppStmt, 0));
+    error = ERROR_OK;
+  }
 
+  if(sqlite3_finalize(ppStmt) != SQLITE_OK)
+    return ERROR_DATABASE_INVALID;
+  return error;
+}
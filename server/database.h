@@ -13,8 +13,11 @@
  * columns as well as data types may exist. However, if any tables, columns or
  * data-types are missing, constraints are not set properly (i.e.. primary key,
  * not null and auto increment)), @ref database_open fails with @ref
- * ERROR_DATABASE_INVALID. Additionally, @ref database_open reads the blob path
- * from the database. The blob path is stored as string value with domain NULL
+ * ERROR_DATABASE_INVALID. Once the scheme passed, PRAGMA application_id and
+ * user_version record it together with SQLite's schema version. As long as
+ * the schema version is unchanged the check is skipped on the next open, any
+ * change to the schema forces it again. Additionally, @ref database_open
+ * reads the blob path from the database. The blob path is stored as string value with domain NULL
  * and key blob-path. The path stored in this value has to exist and has to be
  * a directory.
  *
@@ -38,7 +41,51 @@
  *  where @a $blob-path is extracted from the database in @ref database_open and
  *  @a $path is stored in the ValueBlob table. Every access of an blob file has
  *  to make sure that the file is a regular file and that the file is in @a
- *  $blob-path or any of its subdirectories.
+ *  $blob-path or any of its subdirectories. To do so, @ref database_open keeps
+ *  an O_DIRECTORY descriptor of @a $blob-path and every blob file is opened
+ *  relative to it, one path component at a time and without following
+ *  symlinks. Recently used domain directories are cached on the handle.
+ *
+ *  The 64-bit integer with domain NULL and key blob-fanout selects the layout
+ *  of new blob files. 0 or a missing value is the flat layout @a
+ *  $domain/$key. A value @a n between 1 and 4 places the key below @a n
+ *  directories named after the bytes of a hash of the key, e.g. @a
+ *  $domain/ab/cd/$key for 2, so no directory grows beyond 256 entries plus
+ *  the keys sharing a hash. Since ValueBlob stores the path, files written
+ *  with a different layout stay readable. @ref database_migrate_blobs moves
+ *  them to the current layout.
+ *
+ *  If the 64-bit integer with domain NULL and key blob-dedup is set and not 0,
+ *  blobs are stored content-addressed: the file is named after the SHA-1 of
+ *  its content (@a $blob-path/.sha1/ab/cdef...) and shared by all keys with
+ *  identical content. The number of ValueBlob rows referencing a file is kept
+ *  in the BlobContent table, the file is deleted when the last reference goes
+ *  away. Writing content that is already stored does not touch the disk.
+ *
+ *  If the 64-bit integer with domain NULL and key value-compress is set and
+ *  not 0, @ref database_set_string and @ref database_set_blob compress values
+ *  of at least that many bytes (see codec.h) and keep them as they are if
+ *  they don't get smaller. The codec column of ValueString and ValueBlob
+ *  records the codec of every value, a compressed string is stored as BLOB.
+ *  @ref database_open adds the column to older databases once compression is
+ *  enabled. Blobs written with @ref database_set_blob_from_fd or
+ *  content-addressed are never compressed.
+ *
+ *  If the string with domain NULL and key blob-hot-path is an absolute path,
+ *  that directory, e.g. on /dev/shm, is a hot tier in front of the blob-path.
+ *  Blob files read or written through the handle are copied into it under a
+ *  name made of path, inode, size and modification time of the file on disk,
+ *  so a newer version never finds an old copy. Every write still goes to the
+ *  blob-path as durability says, the hot tier only saves the reads. Once it
+ *  holds more than the 64-bit integer blob-hot-size in bytes (@ref
+ *  DATABASE_BLOB_HOT_SIZE if not set or 0) the least recently read files are
+ *  removed. Its content may be deleted at any time.
+ *
+ *  A handle opened with @ref database_open_readonly or mode=ro uses
+ *  SQLITE_OPEN_READONLY and memory mapped I/O. Reads are not wrapped in
+ *  transactions, every set and @ref database_migrate_blobs fail with @ref
+ *  ERROR_DATABASE_READONLY before touching the database. With immutable=1
+ *  SQLite also skips all locking, the file must not change while it is open.
  *
  *  Wherever a domain or key is required as argument, they both may not be @a
  *  NULL or empty strings. All arguments that are used as destination may not be
@@ -56,6 +103,30 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/** bytes the hot tier of the blob-path holds without blob-hot-size, 64 MiB */
+#define DATABASE_BLOB_HOT_SIZE (64 * 1024 * 1024)
+
+/** mmap_size of read-only handles that don't set it, 256 MiB */
+#define DATABASE_READONLY_MMAP_SIZE (256 * 1024 * 1024)
+
+/** pages @ref database_backup copies before it lets other connections in */
+#define DATABASE_BACKUP_PAGES 64
+
+/** suffix of the blob directory of a backup */
+#define DATABASE_BACKUP_BLOBS ".blobs"
+
+/** suffix of the file a backup is written to before the rename */
+#define DATABASE_BACKUP_TEMPORARY ".tmp"
+
+/** seconds an unreferenced blob file is left alone by @ref database_maintain */
+#define DATABASE_MAINTENANCE_GRACE 300
+
+/** directory inside the blob-path @ref database_recover moves files to */
+#define DATABASE_RECOVERY_QUARANTINE ".quarantine"
+
+/** most threads @ref database_recover walks the blob-path with */
+#define DATABASE_RECOVERY_THREADS_MAX 64
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -74,13 +145,112 @@ typedef enum database_value_type_e
   DATABASE_TYPE_BLOB
 } database_value_type_t;
 
+/**
+ * Lock contention of a database handle, see @ref database_get_busy_stats.
+ */
+typedef struct database_busy_stats_s
+{
+  uint64_t waits;                   /* calls that found the database locked */
+  uint64_t retries;                 /* sleeps between two attempts */
+  uint64_t waited_us;               /* microseconds spent sleeping */
+  uint64_t timeouts;                /* waits that ran past the deadline */
+} database_busy_stats_t;
+
+/**
+ * Progress of @ref database_backup.
+ */
+typedef struct database_backup_progress_s
+{
+  int64_t pages;                    /* pages of the database */
+  int64_t pages_remaining;          /* pages still to copy */
+  uint64_t blobs;                   /* blob files copied */
+  uint64_t blob_bytes;              /* bytes of the blob files copied */
+  uint64_t blobs_missing;           /* blob files gone before their copy */
+} database_backup_progress_t;
+
+/**
+ * Called by @ref database_backup after every batch of pages and every blob
+ * file, a value other than 0 aborts the backup.
+ */
+typedef int (*database_backup_callback_t)(
+    const database_backup_progress_t* progress, void* context);
+
+/**
+ * What one call of @ref database_maintain may do, 0 skips a step.
+ */
+typedef struct database_maintenance_s
+{
+  int convert;                      /* switch to auto_vacuum=INCREMENTAL */
+  int64_t pages;                    /* free pages to give back */
+  int optimize;                     /* run PRAGMA optimize */
+  uint64_t blobs;                   /* blob files to check for a row */
+  int64_t grace;                    /* seconds a new blob file is kept */
+} database_maintenance_t;
+
+/**
+ * Result of @ref database_maintain.
+ */
+typedef struct database_maintenance_stats_s
+{
+  int64_t pages_freed;              /* pages given back to the file system */
+  int64_t free_pages;               /* free pages left in the file */
+  uint64_t blobs_checked;           /* blob files looked up */
+  uint64_t blobs_removed;           /* blob files without a row removed */
+  int optimized;                    /* PRAGMA optimize ran */
+} database_maintenance_stats_t;
+
+/**
+ * What @ref database_recover does about what it finds.
+ */
+typedef struct database_recovery_s
+{
+  unsigned int threads;             /* walking threads, 0 one per CPU */
+  int repair;                       /* delete rows whose file is gone */
+  int quarantine;                   /* move files without a row away */
+} database_recovery_t;
+
+/**
+ * Result of @ref database_recover.
+ */
+typedef struct database_recovery_stats_s
+{
+  uint64_t rows;                    /* ValueBlob rows checked */
+  uint64_t files;                   /* files found below the blob-path */
+  uint64_t missing;                 /* rows whose file is gone */
+  uint64_t orphans;                 /* files without a row */
+  uint64_t repaired;                /* rows deleted */
+  uint64_t quarantined;             /* files moved to the quarantine */
+} database_recovery_stats_t;
+
 /**
  * Open an existing database. The database must exist and be valid. The
  * function returns an error if this is not the case..
  *
  * @param[out] handle Pointer to the database handle that should be used for
  *   this database connection.
- * @param[in] path Path to a valid sqlite database.
+ * @param[in] path Path to a valid sqlite database, optionally followed by
+ *   options in the form ?key=value&key=value. Known options:
+ *
+ *    * durability=full    - synchronous=FULL, blob files and their directory
+ *                           are fsync'ed
+ *    * durability=normal  - the default: WAL journal with synchronous=NORMAL,
+ *                           blob files are fdatasync'ed
+ *    * durability=relaxed - synchronous=OFF and no syncing of blob files, for
+ *                           caches and scratch data
+ *    * mode=ro            - open read-only, see @ref database_open_readonly
+ *    * immutable=1        - read-only and the file never changes, SQLite
+ *                           takes no locks at all
+ *    * mmap_size=N        - map up to N bytes of the database, 0 turns memory
+ *                           mapped I/O off. Read-only handles default to
+ *                           DATABASE_READONLY_MMAP_SIZE
+ *    * recover=1          - run @ref database_recover with repair and
+ *                           quarantine before the handle is handed out,
+ *                           rejected for read-only handles
+ *    * cache_size=N, journal=M, synchronous=M, temp_store=M, busy_timeout=N
+ *                         - handed to SQLite, see database-options.h
+ *
+ *  shards=N and mirror=N are only understood by @ref database_engine_open
+ *  and rejected here.
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_DATABASE_OPEN The database does not exist or is not a
@@ -89,11 +259,26 @@ typedef enum database_value_type_e
  *  not exist or a column doesn't match the specification or the blob-path is
  *  not an existing directory.
  * @return @ref ERROR_MEMORY Out of memory.
- * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  an option is unknown or has an invalid value.
  * @return @ref ERROR_UNKNOWN An unspecified error occurred.
  */
 int database_open(database_handle_t** handle, const char* path);
 
+/**
+ * Open an existing database read-only, like @ref database_open with mode=ro.
+ * Meant for snapshots that are shipped as read-only files: nothing is ever
+ * written to the database, not even the schema fingerprint.
+ *
+ * @param[out] handle Pointer to the database handle that should be used for
+ *   this database connection.
+ * @param[in] path Path to a valid sqlite database, optionally followed by
+ *   options, see @ref database_open. mode=ro is implied.
+ *
+ * @return the error codes of @ref database_open
+ */
+int database_open_readonly(database_handle_t** handle, const char* path);
+
 /**
  * Close database.
  *
@@ -152,6 +337,182 @@ int database_get_type(database_handle_t* handle, const char* domain,
 int database_enum_keys(database_handle_t* handle, const char* domain,
     const char* pattern, size_t* count, size_t* size, char** keys);
 
+/** Enumerate domains.
+ *
+ * The domains that hold at least one key are returned like the keys of @ref
+ * database_enum_keys: sorted and separated by \c 0s. The settings with domain
+ * NULL are left out.
+ *
+ * The caller is responsible to free up the memory pointed to by domains.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[out] count Number of enumerated domains.
+ * @param[out] size Size of domains.
+ * @param[out] domains The enumerated domains, NULL if there are none.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_enum_domains(database_handle_t* handle, size_t* count,
+    size_t* size, char** domains);
+
+/**
+ * Report the settings SQLite uses for the database, in the form of the
+ * options of @ref database_open:
+ *
+ *    journal=wal&synchronous=normal&cache_size=-2000&mmap_size=0&
+ *    temp_store=default&busy_timeout=5000
+ *
+ * The values are read back from SQLite, so a journal mode that couldn't be
+ * changed shows up as the one in effect.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[out] settings The settings, has to be freed.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_INVALID One of the PRAGMAs failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_get_settings(database_handle_t* handle, char** settings);
+
+/**
+ * Give back memory the handle only holds to be faster: unused pages of the
+ * SQLite page cache and the descriptors of cached blob directories. Nothing
+ * is lost, the next calls just fill the caches again.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[out] released Bytes the page cache gave back.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_INVALID SQLite failed to release the pages.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_release_memory(database_handle_t* handle, size_t* released);
+
+/**
+ * Back up the database while it stays in use. The pages are copied with
+ * sqlite3_backup_step in batches of DATABASE_BACKUP_PAGES, between two
+ * batches no lock is held, so other connections read and write as usual and
+ * writes through @a handle are copied along. Blob files referenced by the
+ * copy are cloned or copied into @a path followed by DATABASE_BACKUP_BLOBS,
+ * which becomes the blob-path of the backup. The backup is written next to
+ * @a path and renamed over it once complete.
+ *
+ * A blob file that changes while the blob files are copied may end up in
+ * its newer version, one that is removed is counted in @a blobs_missing.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[in] path Path of the backup.
+ * @param[in] callback Told about the progress, may be NULL.
+ * @param[in] context Handed to @a callback.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_OPEN The backup can't be created.
+ * @return @ref ERROR_DATABASE_BUSY A batch of pages stayed locked past
+ *  busy_timeout.
+ * @return @ref ERROR_DATABASE_ABORTED The callback aborted the backup.
+ * @return @ref ERROR_DATABASE_IO Copying a blob file failed.
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_backup(database_handle_t* handle, const char* path,
+    database_backup_callback_t callback, void* context);
+
+/**
+ * Run one bounded step of maintenance, meant for idle periods. Every step is
+ * limited by @a budget, so a call never holds the database for long:
+ *
+ *    * convert  - a database without auto_vacuum=INCREMENTAL is switched to
+ *                 it with one full VACUUM, later calls find it switched
+ *    * pages    - PRAGMA incremental_vacuum gives back at most this many
+ *                 free pages left behind by deleted rows and type changes
+ *    * optimize - PRAGMA optimize, which runs ANALYZE where the statistics
+ *                 are missing or stale
+ *    * blobs    - at most this many files below the blob-path are looked up
+ *                 in ValueBlob, those without a row and older than @a grace
+ *                 seconds are removed. The next call continues with the
+ *                 following files, after the last one it starts over.
+ *
+ * The blob-path has to belong to this database alone if @a blobs is set,
+ * files of other databases sharing it have no row here. The grace period
+ * keeps blob files alone that are written before their row.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[in] budget What the call may do.
+ * @param[out] stats What the call did.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past
+ *  busy_timeout.
+ * @return @ref ERROR_DATABASE_IO The blob-path can't be read.
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_maintain(database_handle_t* handle,
+    const database_maintenance_t* budget, database_maintenance_stats_t* stats);
+
+/**
+ * Check that ValueBlob and the files below the blob-path agree, e.g. after a
+ * crash between writing a blob file and committing its row. The blob-path is
+ * walked by a pool of threads, the files found are sorted and merged with the
+ * rows of ValueBlob streamed in the order of their paths, so every file is
+ * looked at once and no row is looked up on its own.
+ *
+ * Rows whose file is gone are deleted with their key if @a repair is set, the
+ * reference counts of the content-addressed store are then counted anew.
+ * Files without a row are moved into DATABASE_RECOVERY_QUARANTINE inside the
+ * blob-path if @a quarantine is set, below the same relative path. Nothing is
+ * ever removed, the quarantine is left to the administrator.
+ *
+ * Recovery is meant for the time before other connections use the database,
+ * e.g. with the recover=1 option of @ref database_open. It holds the write
+ * lock while it repairs, a blob file written by another connection meanwhile
+ * has no row yet and is taken for one without.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[in] recovery What to do about what is found.
+ * @param[out] stats What was found and done.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only and @a repair
+ *  or @a quarantine is set.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past
+ *  busy_timeout.
+ * @return @ref ERROR_DATABASE_IO The blob-path can't be read or a file can't
+ *  be moved.
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_recover(database_handle_t* handle,
+    const database_recovery_t* recovery, database_recovery_stats_t* stats);
+
+/**
+ * Report how often the handle had to wait for a database locked by another
+ * connection. A locked database is retried with a backoff growing from
+ * 100 microseconds to 20 milliseconds until the busy_timeout of
+ * @ref database_open (5 seconds by default) has passed, then the call fails
+ * with @ref ERROR_DATABASE_BUSY.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[out] stats The counters since the handle was opened.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int database_get_busy_stats(database_handle_t* handle,
+    database_busy_stats_t* stats);
+
 /**
  * Retrieve the value associated to the domain and key.
  *
@@ -183,6 +544,8 @@ int database_get_int64(database_handle_t* handle, const char* domain,
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout.
  * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
  *  queries failed.
  * @return @ref ERROR_MEMORY Out of memory.
@@ -222,6 +585,8 @@ int database_get_double(database_handle_t* handle, const char* domain,
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout.
  * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
  *  queries failed.
  * @return @ref ERROR_MEMORY Out of memory.
@@ -261,6 +626,8 @@ int database_get_string(database_handle_t* handle, const char* domain,
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout.
  * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
  *  queries failed.
  * @return @ref ERROR_MEMORY Out of memory.
@@ -303,6 +670,8 @@ int database_get_blob(database_handle_t* handle, const char* domain,
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout.
  * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
  *  queries failed.
  * @return @ref ERROR_DATABASE_IO Writing to the blob file failed.
@@ -311,6 +680,106 @@ int database_get_blob(database_handle_t* handle, const char* domain,
 int database_set_blob(database_handle_t* handle, const char* domain,
     const char* key, const unsigned char* value, size_t size);
 
+/**
+ * Write the blob associated to the domain and key to a file descriptor. The
+ * blob is written at the current position of @a fd. The data is copied by the
+ * kernel (copy_file_range or sendfile) where possible and never held in memory
+ * as a whole.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[in] domain The domain of the keys.
+ * @param[in] key The key.
+ * @param[in] fd Writable file descriptor
+ * @param[out] size Number of bytes written to @a fd
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed or the referenced file is not a regular file or doesn't exist
+ *  or isn't located in the blob-path or any of its subdirectories.
+ * @return @ref ERROR_DATABASE_NO_SUCH_KEY The domain, key pair does not exist.
+ * @return @ref ERROR_DATABASE_TYPE_MISMATCH The value associated to the domain,
+ *  key pair is not of the correct type.
+ * @return @ref ERROR_DATABASE_IO Reading the blob or writing to @a fd failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ */
+int database_get_blob_to_fd(database_handle_t* handle, const char* domain,
+    const char* key, int fd, size_t* size);
+
+/**
+ * Set the blob associated to the domain and key to the content of a file
+ * descriptor. Everything from the current position of @a fd up to end of file
+ * is stored. Like @ref database_get_blob_to_fd the data is streamed and never
+ * held in memory as a whole.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[in] domain The domain of the keys.
+ * @param[in] key The key.
+ * @param[in] fd Readable file descriptor
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout.
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed.
+ * @return @ref ERROR_DATABASE_IO Reading from @a fd or writing the blob file
+ *  failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ */
+int database_set_blob_from_fd(database_handle_t* handle, const char* domain,
+    const char* key, int fd);
+
+/**
+ * Retrieve a part of the blob associated to the domain and key. Used to
+ * transfer large blobs over a channel in chunks of bounded size.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[in] domain The domain of the keys.
+ * @param[in] key The key.
+ * @param[in] offset Offset of the first byte, at most the size of the blob
+ * @param[in] length Maximal number of bytes to return, not 0
+ * @param[out] value The chunk, has to be freed even if @a size is 0
+ * @param[out] size The size of the chunk, 0 if @a offset is the blob's size
+ * @param[out] total The size of the whole blob
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  @a offset is beyond the end of the blob
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed or the referenced file is not a regular file or doesn't exist
+ *  or isn't located in the blob-path or any of its subdirectories.
+ * @return @ref ERROR_DATABASE_NO_SUCH_KEY The domain, key pair does not exist.
+ * @return @ref ERROR_DATABASE_TYPE_MISMATCH The value associated to the domain,
+ *  key pair is not of the correct type.
+ * @return @ref ERROR_DATABASE_IO Reading from the referenced file failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ */
+int database_get_blob_chunk(database_handle_t* handle, const char* domain,
+    const char* key, size_t offset, size_t length, unsigned char** value,
+    size_t* size, size_t* total);
+
+/**
+ * Moves all blob files that are not stored according to the current blob-fanout
+ * setting to their new place and updates ValueBlob accordingly. Files of the
+ * content-addressed store are not touched. Every file is moved and updated
+ * on its own, an interrupted migration can simply be run again.
+ *
+ * @param[in] handle A valid database handle.
+ * @param[out] migrated Number of blob files that have been moved.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_READONLY The handle is read-only.
+ * @return @ref ERROR_DATABASE_BUSY The database stayed locked past busy_timeout.
+ * @return @ref ERROR_DATABASE_INVALID The database is invalid, i.e one of the
+ *  queries failed or a referenced file is not a regular file inside the
+ *  blob-path.
+ * @return @ref ERROR_DATABASE_IO Moving a file failed.
+ * @return @ref ERROR_MEMORY Out of memory.
+ */
+int database_migrate_blobs(database_handle_t* handle, size_t* migrated);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
@@ -0,0 +1,173 @@
+/** @brief Copying between file descriptors
+ *
+ * This file contains the zero-copy helpers used for streaming blobs of 'the
+ * registry'.
+ *
+ * @file file-copy.c
+ */
+
+#ifndef COPY_FILE_RANGE
+#define COPY_FILE_RANGE
+#define _GNU_SOURCE
+#include <features.h>
+#endif // COPY_FILE_RANGE
+
+#include "file-copy.h"
+#include "../errors.h"
+#include "../memory.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+int copyWithBuffer(int from, int to, int64_t length, size_t* copied);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+file_copy(int from, int to, int64_t length, size_t* copied)
+{
+  if(from < 0 || to < 0 || length < -1)
+    return ERROR_INVALID_ARGUMENTS;
+
+  size_t done = 0;
+  if(copied != NULL)
+    *copied = 0;
+
+  struct stat in;
+  struct stat out;
+  if(fstat(from, &in) != 0 || fstat(to, &out) != 0)
+    return ERROR_DATABASE_IO;
+
+  /* the kernel can only help if the source is a regular file */
+  int kernel = S_ISREG(in.st_mode);
+  int range = kernel && S_ISREG(out.st_mode);
+
+  while(kernel && (length == -1 || done < (size_t)length)){
+    size_t chunk = FILE_COPY_BUFFER_SIZE * 16;
+    if(length != -1 && (size_t)length - done < chunk)
+      chunk = (size_t)length - done;
+
+    ssize_t ret = -1;
+    if(range){
+      ret = copy_file_range(from, NULL, to, NULL, chunk, 0);
+      if(ret < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                     errno == EOPNOTSUPP)){
+        range = 0;
+        continue;
+      }
+    }else{
+      ret = sendfile(to, from, NULL, chunk);
+      if(ret < 0 && (errno == ENOSYS || errno == EINVAL) && done == 0){
+        kernel = 0;
+        break;
+      }
+    }
+
+    if(ret < 0){
+      if(errno == EINTR || errno == EAGAIN)
+        continue;
+      return ERROR_DATABASE_IO;
+    }
+    if(ret == 0)
+      break;
+
+    done += ret;
+    if(copied != NULL)
+      *copied = done;
+  }
+
+  if(!kernel){
+    size_t rest = 0;
+    int ret = copyWithBuffer(from, to, length == -1 ? -1 : length - (int64_t)done, &rest);
+    done += rest;
+    if(copied != NULL)
+      *copied = done;
+    return ret;
+  }
+
+  if(length != -1 && done != (size_t)length)
+    return ERROR_EOF;
+
+  return ERROR_OK;
+}
+
+int
+file_clone(int from, int to, size_t* copied)
+{
+  if(from < 0 || to < 0)
+    return ERROR_INVALID_ARGUMENTS;
+
+#ifdef FICLONE
+  struct stat sb;
+  if(fstat(from, &sb) == 0 && S_ISREG(sb.st_mode) && ioctl(to, FICLONE, from) == 0){
+    /* positions as if the data had been copied */
+    if(lseek(from, sb.st_size, SEEK_SET) < 0 || lseek(to, sb.st_size, SEEK_SET) < 0)
+      return ERROR_DATABASE_IO;
+    if(copied != NULL)
+      *copied = sb.st_size;
+    return ERROR_OK;
+  }
+#endif // FICLONE
+
+  return file_copy(from, to, -1, copied);
+}
+
+/**
+ * copies through a bounded user space buffer, used for pipes and sockets
+ *
+ * @param[in] from Source file descriptor
+ * @param[in] to Destination file descriptor
+ * @param[in] length Number of bytes to copy, or -1 to copy until end of file
+ * @param[out] copied Number of bytes copied
+ */
+int
+copyWithBuffer(int from, int to, int64_t length, size_t* copied)
+{
+  unsigned char* buffer = NULL;
+  if(requestMemory((void**)&buffer, FILE_COPY_BUFFER_SIZE) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  *copied = 0;
+  while(length == -1 || *copied < (size_t)length){
+    size_t chunk = FILE_COPY_BUFFER_SIZE;
+    if(length != -1 && (size_t)length - *copied < chunk)
+      chunk = (size_t)length - *copied;
+
+    ssize_t got = read(from, buffer, chunk);
+    if(got < 0){
+      if(errno == EINTR || errno == EAGAIN)
+        continue;
+      freeMemory(buffer);
+      return ERROR_DATABASE_IO;
+    }
+    if(got == 0)
+      break;
+
+    ssize_t written = 0;
+    while(written < got){
+      ssize_t ret = write(to, buffer + written, got - written);
+      if(ret < 0){
+        if(errno == EINTR || errno == EAGAIN)
+          continue;
+        freeMemory(buffer);
+        return ERROR_DATABASE_IO;
+      }
+      written += ret;
+    }
+    *copied += got;
+  }
+  freeMemory(buffer);
+
+  if(length != -1 && *copied != (size_t)length)
+    return ERROR_EOF;
+
+  return ERROR_OK;
+}
@@ -0,0 +1,61 @@
+#ifndef FILE_COPY_H
+#define FILE_COPY_H
+
+/** @brief Copying between file descriptors
+ *
+ * Moves data from one file descriptor to another without staging it in user
+ * space whenever the kernel allows it. copy_file_range(2) is used between two
+ * regular files, sendfile(2) if only the source is a regular file and a plain
+ * read(2)/write(2) loop with a bounded buffer otherwise. Whole files are
+ * cloned with the FICLONE ioctl(2) on file systems that share extents.
+ *
+ * @file file-copy.h
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** Size of the bounce buffer used if the kernel can't copy on its own */
+#define FILE_COPY_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Copies @a length bytes from the current position of @a from to the current
+ * position of @a to. Both positions are advanced by the number of copied bytes.
+ *
+ * @param[in] from Source file descriptor
+ * @param[in] to Destination file descriptor
+ * @param[in] length Number of bytes to copy, or -1 to copy until end of file
+ * @param[out] copied Number of bytes copied, may be NULL
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_EOF @a from ended before @a length bytes were copied
+ * @return @ref ERROR_DATABASE_IO Reading or writing failed
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int file_copy(int from, int to, int64_t length, size_t* copied);
+
+/**
+ * Copies the whole regular file @a from into the empty regular file @a to.
+ * On file systems that support reflinks both files share their extents
+ * until one of them changes, otherwise the data is copied with @ref
+ * file_copy.
+ *
+ * @param[in] from Source file descriptor, at offset 0
+ * @param[in] to Destination file descriptor, empty and at offset 0
+ * @param[out] copied Size of the file, may be NULL
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by @ref file_copy
+ */
+int file_clone(int from, int to, size_t* copied);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // FILE_COPY_H
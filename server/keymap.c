@@ -0,0 +1,388 @@
+/** @brief Hash table of typed registry values
+ *
+ * This file contains the in-memory index used by the memory engine of 'the
+ * registry'.
+ *
+ * @file keymap.c
+ */
+
+#ifndef FNMATCH
+#define FNMATCH
+#define _XOPEN_SOURCE 500
+#include <features.h>
+#endif // FNMATCH
+
+#include "keymap.h"
+#include "../errors.h"
+#include "../memory.h"
+#include "../hash.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+
+
+/* Prototyping */
+/* -------------------------------------------------------------------------- */
+uint32_t hashEntry(const char* domain, const char* key);
+keymap_entry_t** findSlot(keymap_t* map, const char* domain, const char* key,
+                          uint32_t hash);
+int growMap(keymap_t* map);
+void freeValue(keymap_entry_t* entry);
+int compareKeys(const void* a, const void* b);
+int joinSorted(const char** strings, size_t* count, size_t* size,
+               char** result);
+
+
+/* Implementation */
+/* -------------------------------------------------------------------------- */
+int
+keymap_new(keymap_t** map)
+{
+  if(map == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(requestMemory((void**)map, sizeof(keymap_t)) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  size_t bytes = KEYMAP_INITIAL_BUCKETS * sizeof(keymap_entry_t*);
+  if(requestMemory((void**)&(*map)->buckets, bytes) != ERROR_OK){
+    freeMemory(*map);
+    *map = NULL;
+    return ERROR_MEMORY;
+  }
+  memset((*map)->buckets, 0, bytes);
+  (*map)->size = KEYMAP_INITIAL_BUCKETS;
+  (*map)->count = 0;
+
+  return ERROR_OK;
+}
+
+void
+keymap_free(keymap_t* map)
+{
+  if(map == NULL)
+    return;
+
+  size_t i = 0;
+  for(; i < map->size; i++){
+    keymap_entry_t* entry = map->buckets[i];
+    while(entry != NULL){
+      keymap_entry_t* next = entry->next;
+      freeValue(entry);
+      freeMemory(entry->domain);
+      freeMemory(entry->key);
+      freeMemory(entry);
+      entry = next;
+    }
+  }
+  freeMemory(map->buckets);
+  freeMemory(map);
+}
+
+int
+keymap_find(keymap_t* map, const char* domain, const char* key,
+            keymap_entry_t** entry)
+{
+  if(map == NULL || domain == NULL || key == NULL || entry == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t** slot = findSlot(map, domain, key, hashEntry(domain, key));
+  if(*slot == NULL)
+    return ERROR_DATABASE_NO_SUCH_KEY;
+
+  *entry = *slot;
+  return ERROR_OK;
+}
+
+int
+keymap_set(keymap_t* map, const char* domain, const char* key,
+           database_value_type_t type, const void* value, size_t size)
+{
+  if(map == NULL || domain == NULL || key == NULL || value == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* copy strings and blobs first, a failure must not lose the old value */
+  unsigned char* bytes = NULL;
+  if(type == DATABASE_TYPE_STRING)
+    size = strlen((const char*)value) + 1;
+  if(type == DATABASE_TYPE_STRING || type == DATABASE_TYPE_BLOB){
+    if(requestMemory((void**)&bytes, size + 1) != ERROR_OK)
+      return ERROR_MEMORY;
+    memcpy(bytes, value, size);
+    bytes[size] = '\0';
+  }else if(type != DATABASE_TYPE_INT64 && type != DATABASE_TYPE_DOUBLE){
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  uint32_t hash = hashEntry(domain, key);
+  keymap_entry_t** slot = findSlot(map, domain, key, hash);
+  keymap_entry_t* entry = *slot;
+  if(entry == NULL){
+    size_t domain_size = strlen(domain);
+    size_t key_size = strlen(key);
+    if(requestMemory((void**)&entry, sizeof(keymap_entry_t)) != ERROR_OK){
+      freeMemory(bytes);
+      return ERROR_MEMORY;
+    }
+    entry->domain = NULL;
+    entry->key = NULL;
+    if(requestMemory((void**)&entry->domain, domain_size + 1) != ERROR_OK ||
+       requestMemory((void**)&entry->key, key_size + 1) != ERROR_OK){
+      freeMemory(entry->domain);
+      freeMemory(entry);
+      freeMemory(bytes);
+      return ERROR_MEMORY;
+    }
+    memcpy(entry->domain, domain, domain_size + 1);
+    memcpy(entry->key, key, key_size + 1);
+    entry->hash = hash;
+    entry->type = DATABASE_TYPE_INT64;
+    entry->next = NULL;
+    *slot = entry;
+    map->count++;
+  }else{
+    freeValue(entry);
+  }
+
+  entry->type = type;
+  switch(type){
+    case DATABASE_TYPE_INT64:
+      entry->value.integer = *(const int64_t*)value;
+      break;
+    case DATABASE_TYPE_DOUBLE:
+      entry->value.dob = *(const double*)value;
+      break;
+    default:
+      entry->value.bytes.data = bytes;
+      entry->value.bytes.size = size;
+      break;
+  }
+
+  /* a failed resize only makes the chains longer */
+  if(map->count > map->size)
+    growMap(map);
+
+  return ERROR_OK;
+}
+
+int
+keymap_remove(keymap_t* map, const char* domain, const char* key)
+{
+  if(map == NULL || domain == NULL || key == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  keymap_entry_t** slot = findSlot(map, domain, key, hashEntry(domain, key));
+  keymap_entry_t* entry = *slot;
+  if(entry == NULL)
+    return ERROR_DATABASE_NO_SUCH_KEY;
+
+  *slot = entry->next;
+  map->count--;
+  freeValue(entry);
+  freeMemory(entry->domain);
+  freeMemory(entry->key);
+  freeMemory(entry);
+
+  return ERROR_OK;
+}
+
+int
+keymap_enum(keymap_t* map, const char* domain, const char* pattern,
+            size_t* count, size_t* size, char** keys)
+{
+  if(map == NULL || domain == NULL || pattern == NULL || count == NULL ||
+     size == NULL || keys == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *count = 0;
+  *size = 0;
+  *keys = NULL;
+  if(map->count == 0)
+    return ERROR_OK;
+
+  const char** matches = NULL;
+  if(requestMemory((void**)&matches, map->count * sizeof(char*)) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  /* GLOB is case sensitive and knows no escape character */
+  size_t i = 0;
+  for(; i < map->size; i++){
+    keymap_entry_t* entry = map->buckets[i];
+    for(; entry != NULL; entry = entry->next){
+      if(strcmp(entry->domain, domain) != 0 ||
+         fnmatch(pattern, entry->key, FNM_NOESCAPE) != 0)
+        continue;
+      matches[*count] = entry->key;
+      (*count)++;
+    }
+  }
+
+  int ret = joinSorted(matches, count, size, keys);
+  freeMemory(matches);
+  return ret;
+}
+
+int
+keymap_domains(keymap_t* map, size_t* count, size_t* size, char** domains)
+{
+  if(map == NULL || count == NULL || size == NULL || domains == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  *count = 0;
+  *size = 0;
+  *domains = NULL;
+  if(map->count == 0)
+    return ERROR_OK;
+
+  const char** all = NULL;
+  if(requestMemory((void**)&all, map->count * sizeof(char*)) != ERROR_OK)
+    return ERROR_MEMORY;
+
+  size_t i = 0;
+  for(; i < map->size; i++){
+    keymap_entry_t* entry = map->buckets[i];
+    for(; entry != NULL; entry = entry->next){
+      all[*count] = entry->domain;
+      (*count)++;
+    }
+  }
+
+  int ret = joinSorted(all, count, size, domains);
+  freeMemory(all);
+  return ret;
+}
+
+/**
+ * sorts strings, drops duplicates and joins them separated by \c 0s
+ *
+ * @param[in] strings The strings, sorted in place
+ * @param[in,out] count Number of strings, number of distinct strings
+ * @param[out] size Size of the result
+ * @param[out] result The joined strings, NULL if there are none
+ */
+int
+joinSorted(const char** strings, size_t* count, size_t* size, char** result)
+{
+  *size = 0;
+  *result = NULL;
+  if(*count == 0)
+    return ERROR_OK;
+
+  qsort(strings, *count, sizeof(char*), compareKeys);
+
+  size_t distinct = 0;
+  size_t i = 0;
+  for(; i < *count; i++){
+    if(distinct > 0 && strcmp(strings[distinct - 1], strings[i]) == 0)
+      continue;
+    strings[distinct++] = strings[i];
+    *size += strlen(strings[i]) + 1;
+  }
+  *count = distinct;
+
+  if(requestMemory((void**)result, *size) != ERROR_OK){
+    *count = 0;
+    *size = 0;
+    *result = NULL;
+    return ERROR_MEMORY;
+  }
+
+  size_t position = 0;
+  for(i = 0; i < *count; i++){
+    size_t length = strlen(strings[i]) + 1;
+    memcpy(*result + position, strings[i], length);
+    position += length;
+  }
+
+  return ERROR_OK;
+}
+
+/**
+ * FNV-1a over domain and key, the NUL between them keeps ("ab", "c") and
+ * ("a", "bc") apart
+ *
+ * @param[in] domain The domain
+ * @param[in] key The key
+ */
+uint32_t
+hashEntry(const char* domain, const char* key)
+{
+  uint32_t hash = hash_fnv1a(HASH_FNV1A_BASIS, domain, strlen(domain) + 1);
+  return hash_fnv1a(hash, key, strlen(key));
+}
+
+/**
+ * returns the link pointing to the entry of domain and key, or the link at the
+ * end of its bucket if there is none
+ *
+ * @param[in] map The map
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] hash The hash of domain and key
+ */
+keymap_entry_t**
+findSlot(keymap_t* map, const char* domain, const char* key, uint32_t hash)
+{
+  keymap_entry_t** slot = &map->buckets[hash & (map->size - 1)];
+  for(; *slot != NULL; slot = &(*slot)->next){
+    if((*slot)->hash == hash && strcmp((*slot)->key, key) == 0 &&
+       strcmp((*slot)->domain, domain) == 0)
+      break;
+  }
+  return slot;
+}
+
+/**
+ * doubles the number of buckets and redistributes the entries
+ *
+ * @param[in] map The map
+ */
+int
+growMap(keymap_t* map)
+{
+  size_t size = map->size * 2;
+  keymap_entry_t** buckets = NULL;
+  if(requestMemory((void**)&buckets, size * sizeof(keymap_entry_t*)) != ERROR_OK)
+    return ERROR_MEMORY;
+  memset(buckets, 0, size * sizeof(keymap_entry_t*));
+
+  size_t i = 0;
+  for(; i < map->size; i++){
+    keymap_entry_t* entry = map->buckets[i];
+    while(entry != NULL){
+      keymap_entry_t* next = entry->next;
+      entry->next = buckets[entry->hash & (size - 1)];
+      buckets[entry->hash & (size - 1)] = entry;
+      entry = next;
+    }
+  }
+
+  freeMemory(map->buckets);
+  map->buckets = buckets;
+  map->size = size;
+  return ERROR_OK;
+}
+
+/**
+ * frees the string or blob of an entry
+ *
+ * @param[in] entry The entry
+ */
+void
+freeValue(keymap_entry_t* entry)
+{
+  if(entry->type == DATABASE_TYPE_STRING || entry->type == DATABASE_TYPE_BLOB)
+    freeMemory(entry->value.bytes.data);
+}
+
+/**
+ * qsort callback ordering keys like SQLite's BINARY collation
+ *
+ * @param[in] a Pointer to the first key
+ * @param[in] b Pointer to the second key
+ */
+int
+compareKeys(const void* a, const void* b)
+{
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
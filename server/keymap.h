@@ -0,0 +1,154 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+/** @brief Hash table of typed registry values
+ *
+ * Maps a domain, key pair to one typed value, the same four types the
+ * database stores. Lookups hash domain and key together, the table doubles
+ * once it holds more entries than buckets. Enumeration collects the matching
+ * keys of a domain and sorts them, so the result is ordered exactly like the
+ * one of @ref database_enum_keys.
+ *
+ * All values are copied into the map, everything handed out has to be freed
+ * by the caller.
+ *
+ * @file keymap.h
+ */
+
+#include "database.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/** Number of buckets of a new map */
+#define KEYMAP_INITIAL_BUCKETS 64
+
+typedef struct keymap_entry_s {
+  char *domain;                     /* domain of the value     */
+  char *key;                        /* key of the value        */
+  uint32_t hash;                    /* hash of domain and key  */
+  database_value_type_t type;       /* type of the value       */
+  union {
+    int64_t integer;
+    double dob;
+    struct {
+      unsigned char *data;          /* string including its NUL */
+      size_t size;
+    } bytes;
+  } value;
+  struct keymap_entry_s *next;      /* next entry of the bucket */
+} keymap_entry_t;
+
+typedef struct keymap_s {
+  keymap_entry_t **buckets;         /* chained buckets      */
+  size_t size;                      /* number of buckets    */
+  size_t count;                     /* number of entries    */
+} keymap_t;
+
+/**
+ * Creates an empty map.
+ *
+ * @param[out] map The new map, has to be freed with @ref keymap_free
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS @a map is NULL
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int keymap_new(keymap_t** map);
+
+/**
+ * Frees the map and all of its values.
+ *
+ * @param[in] map The map, may be NULL
+ */
+void keymap_free(keymap_t* map);
+
+/**
+ * Looks up the value of a domain, key pair. The entry stays owned by the map
+ * and is only valid until the map is modified.
+ *
+ * @param[in] map The map
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[out] entry The entry
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_NO_SUCH_KEY The domain, key pair does not exist
+ */
+int keymap_find(keymap_t* map, const char* domain, const char* key,
+    keymap_entry_t** entry);
+
+/**
+ * Sets the value of a domain, key pair, replacing any value of any type.
+ * Integers and doubles are read from @a value, strings are copied including
+ * their terminating NUL and blobs are copied with @a size bytes.
+ *
+ * @param[in] map The map
+ * @param[in] domain The domain
+ * @param[in] key The key
+ * @param[in] type The type of @a value
+ * @param[in] value Pointer to the int64_t, the double, the string or the blob
+ * @param[in] size Size of a blob, ignored for the other types
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_MEMORY Out of memory, the old value is left untouched
+ */
+int keymap_set(keymap_t* map, const char* domain, const char* key,
+    database_value_type_t type, const void* value, size_t size);
+
+/**
+ * Removes the value of a domain, key pair.
+ *
+ * @param[in] map The map
+ * @param[in] domain The domain
+ * @param[in] key The key
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_DATABASE_NO_SUCH_KEY The domain, key pair does not exist
+ */
+int keymap_remove(keymap_t* map, const char* domain, const char* key);
+
+/**
+ * Enumerates the keys of a domain that match a GLOB pattern. The result has
+ * the format of @ref database_enum_keys: the sorted keys separated by \c 0s.
+ *
+ * @param[in] map The map
+ * @param[in] domain The domain
+ * @param[in] pattern The key pattern
+ * @param[out] count Number of enumerated keys
+ * @param[out] size Size of keys
+ * @param[out] keys The enumerated keys, NULL if there are none
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int keymap_enum(keymap_t* map, const char* domain, const char* pattern,
+    size_t* count, size_t* size, char** keys);
+
+/**
+ * Enumerates the domains that hold at least one value, in the format of @ref
+ * database_enum_domains.
+ *
+ * @param[in] map The map
+ * @param[out] count Number of enumerated domains
+ * @param[out] size Size of domains
+ * @param[out] domains The enumerated domains, NULL if there are none
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_MEMORY Out of memory
+ */
+int keymap_domains(keymap_t* map, size_t* count, size_t* size, char** domains);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // KEYMAP_H
@@ -5,22 +5,68 @@
  * @file server.c
  */
 
+#ifndef FILENO
+#define FILENO
+#define _XOPEN_SOURCE 500
+#include <features.h>
+#endif // FILENO
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "server.h"
 #include "../errors.h"
 #include "../memory.h"
 #include "../datastructure.h"
 #include "database.h"
+#include "database-options.h"
+#include "database-engine.h"
 #include "../communication/channel.h"
 #include "../communication/simple-memory-buffer.h"
 #include "../communication/datastore.h"
 #include "../communication/bpack.h"
 
 
+/* Typedefs and Defines */
+/* -------------------------------------------------------------------------- */
+/** upper bound of a single chunk handed out by PACKET_GET_BLOB_CHUNK */
+#define SERVER_BLOB_CHUNK_MAX (1024 * 1024)
+
+/** packets between two checks of the soft memory limit */
+#define SERVER_MEMORY_CHECK_INTERVAL 256
+
+/** servers shared by server_acquire, keyed by canonical database identifier */
+static shared_server_t* shared_servers = NULL;
+
+/** guards shared_servers and the references of its entries */
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 /* Prototyping */
 /* -------------------------------------------------------------------------- */
 int sendPacket(data_store_t *ds, size_t *response_size, unsigned char **response);
+void discardUpload(server_client_t* client);
+int stageBlobChunk(server_t* server, server_client_t* client,
+                   const char* domain, const char* key, int64_t offset,
+                   int64_t final, const unsigned char* chunk, size_t size);
+int canonicalDatabase(const char* database, char** result);
+int resolveLogPath(const char* file, char** result);
+int backupDirectory(const char* database, char** result);
+int writingPacket(unsigned char packettype);
+int residentMemory(size_t* resident);
+void checkMemoryLimit(server_t* server);
+int sharedServer(server_t* server);
+int processPacket(server_t* server, server_client_t* client,
+                  const unsigned char* data, size_t size,
+                  unsigned char** response, size_t* response_size);
+int clientBackup(server_t* server, const char* name,
+                 database_backup_progress_t* progress);
+int recordBackup(const database_backup_progress_t* progress, void* context);
 
 /* Implementation */
 /* -------------------------------------------------------------------------- */
@@ -34,17 +80,45 @@ server_init(server_t** server, const char* database)
   if(requestMemory((void**)server, sizeof(server_t)) != ERROR_OK)
     return ERROR_MEMORY;
   (*server)->db = NULL;
+  (*server)->backups = NULL;
+  memset(&(*server)->client, 0, sizeof(server_client_t));
+  (*server)->memory_limit = 0;
+  (*server)->memory_check = 0;
+  (*server)->last_packet = time(NULL);
+
+  /* recursive, packets call the public functions of the server themselves */
+  pthread_mutexattr_t attributes;
+  if(pthread_mutexattr_init(&attributes) != 0 ||
+     pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE) != 0 ||
+     pthread_mutex_init(&(*server)->lock, &attributes) != 0){
+    pthread_mutexattr_destroy(&attributes);
+    freeMemory(*server);
+    *server = NULL;
+    return ERROR_SERVER_INIT;
+  }
+  pthread_mutexattr_destroy(&attributes);
 
   /* open database connection */
-  database_handle_t *db = NULL;
-  int retval = database_open(&db, database);
+  database_engine_t *db = NULL;
+  int retval = database_engine_open(&db, database);
   if(retval != ERROR_OK){
-    //freeMemory(*server);
-    //freeMemory(db);
+    pthread_mutex_destroy(&(*server)->lock);
+    freeMemory(*server);
+    *server = NULL;
     return retval;
   }
   (*server)->db = db;
 
+  /* resolved now, a later chdir of the process doesn't move the backups */
+  retval = backupDirectory(database, &(*server)->backups);
+  if(retval != ERROR_OK){
+    database_engine_close(db);
+    pthread_mutex_destroy(&(*server)->lock);
+    freeMemory(*server);
+    *server = NULL;
+    return retval;
+  }
+
   return ERROR_OK;
 }
 
@@ -53,10 +127,51 @@ int
 server_process(server_t* server, const unsigned char* data, size_t size, 
                unsigned char** response, size_t* response_size)
 {
-  if(server == NULL || server->db == NULL || data == NULL || strlen((char*)data) == 0
-     || size == 0 || response == NULL || response_size == NULL)
+  if(server == NULL)
     return ERROR_INVALID_ARGUMENTS;
 
+  return server_process_client(server, &server->client, data, size, response,
+                               response_size);
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_process_client(server_t* server, server_client_t* client,
+                      const unsigned char* data, size_t size,
+                      unsigned char** response, size_t* response_size)
+{
+  if(server == NULL || server->db == NULL || client == NULL || data == NULL ||
+     strlen((char*)data) == 0 || size == 0 || response == NULL ||
+     response_size == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&server->lock);
+  int ret = processPacket(server, client, data, size, response, response_size);
+  pthread_mutex_unlock(&server->lock);
+
+  /* the lock has to be released before it goes away with the server */
+  if(ret == ERROR_SERVER_SHUTDOWN && server_shutdown(server) != ERROR_OK)
+    return ERROR_UNKNOWN;
+  return ret;
+}
+
+/**
+ * processes a packet while the caller holds the lock of the server, see
+ * server_process_client
+ *
+ * @param[in] server The server
+ * @param[in] client The client that sent the packet
+ * @param[in] data The data
+ * @param[in] size The size of data
+ * @param[out] response The response data
+ * @param[out] response_size The size of the response data
+ */
+int
+processPacket(server_t* server, server_client_t* client,
+              const unsigned char* data, size_t size,
+              unsigned char** response, size_t* response_size)
+{
+
   /* unpack package */
   unsigned char packettype = '\0';
   unsigned char *domain = NULL;
@@ -74,6 +189,13 @@ server_process(server_t* server, const unsigned char* data, size_t size,
       freeMemory(key);
   }
 
+  /* a read-only database refuses writes before their value is unpacked */
+  if(ret == ERROR_OK && server->db->readonly && writingPacket(packettype)){
+    freeMemory(domain);
+    freeMemory(key);
+    ret = ERROR_DATABASE_READONLY;
+  }
+
   /* handle incomming data */
   int64_t integer = 0;
   double dob = 0.0;
@@ -85,6 +207,12 @@ server_process(server_t* server, const unsigned char* data, size_t size,
   int64_t count_enum = 0;
   size_t esize = 0;
   char* keys = NULL; 
+  int64_t offset = 0;
+  int64_t length = 0;
+  size_t total = 0;
+  database_backup_progress_t progress;
+  database_maintenance_t budget;
+  database_maintenance_stats_t maintenance;
 
   data_store_t response_ds;
   if(simple_memory_buffer_new(&response_ds, NULL, 0) != ERROR_OK){
@@ -101,7 +229,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
 
       /* Int handling */
       case PACKET_GET_INT:
-         ret = database_get_int64(server->db, (char*)domain, (char*)key, &integer);
+         ret = database_engine_get_int64(server->db, (char*)domain, (char*)key, &integer);
          if(ret != ERROR_OK) break;
 
          if(data_store_write_byte(&response_ds, PACKET_INT) != ERROR_OK ||
@@ -114,7 +242,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
            ret = ERROR_UNKNOWN; break;
           }
 
-         ret = database_set_int64(server->db, (char*)domain, (char*)key, integer);
+         ret = database_engine_set_int64(server->db, (char*)domain, (char*)key, integer);
          if(ret != ERROR_OK) break;
 
          if(data_store_write_byte(&response_ds, PACKET_OK) != ERROR_OK)
@@ -123,7 +251,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
 
       /* Double handling */
       case PACKET_GET_DOUBLE:
-         ret = database_get_double(server->db, (char*)domain, (char*)key, &dob);
+         ret = database_engine_get_double(server->db, (char*)domain, (char*)key, &dob);
          if(ret != ERROR_OK) break;
 
          if(data_store_write_byte(&response_ds, PACKET_DOUBLE) != ERROR_OK ||
@@ -136,7 +264,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
            ret = ERROR_UNKNOWN; break;
          }
 
-         ret = database_set_double(server->db, (char*)domain, (char*)key, dob);
+         ret = database_engine_set_double(server->db, (char*)domain, (char*)key, dob);
          if(ret != ERROR_OK) break;
 
          if(data_store_write_byte(&response_ds, PACKET_OK) != ERROR_OK)
@@ -145,7 +273,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
 
       /* String handling */
       case PACKET_GET_STRING:
-         ret = database_get_string(server->db, (char*)domain, (char*)key, &string);
+         ret = database_engine_get_string(server->db, (char*)domain, (char*)key, &string);
          if(ret != ERROR_OK){
            if(string)
              freeMemory(string);
@@ -163,7 +291,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
            ret = ERROR_UNKNOWN; break;
          }
 
-         ret = database_set_string(server->db, (char*)domain, (char*)key, string);
+         ret = database_engine_set_string(server->db, (char*)domain, (char*)key, string);
          if(ret != ERROR_OK) break;
          freeMemory(string);
 
@@ -173,7 +301,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
 
       /* Blob handling */
       case PACKET_GET_BLOB:
-         ret = database_get_blob(server->db, (char*)domain, (char*)key, &blob, &bsize);
+         ret = database_engine_get_blob(server->db, (char*)domain, (char*)key, &blob, &bsize);
          if(ret != ERROR_OK){
            if(blob != NULL)
              freeMemory(blob);
@@ -191,9 +319,42 @@ server_process(server_t* server, const unsigned char* data, size_t size,
            ret = ERROR_UNKNOWN; break;
          }
 
-         ret = database_set_blob(server->db, (char*)domain, (char*)key, blob, bsize);
+         ret = database_engine_set_blob(server->db, (char*)domain, (char*)key, blob, bsize);
+         if(ret != ERROR_OK) break;
+         freeMemory(blob);
+
+         if(data_store_write_byte(&response_ds, PACKET_OK) != ERROR_OK)
+           ret = ERROR_UNKNOWN; 
+         break;
+
+      /* Chunked blob handling */
+      case PACKET_GET_BLOB_CHUNK:
+         if(bunpack(&ds, "ll", &offset, &length) != ERROR_OK || offset < 0 ||
+            length <= 0){
+           ret = ERROR_INVALID_ARGUMENTS; break;
+         }
+         if(length > SERVER_BLOB_CHUNK_MAX)
+           length = SERVER_BLOB_CHUNK_MAX;
+
+         ret = database_engine_get_blob_chunk(server->db, (char*)domain, (char*)key, 
+                                       offset, length, &blob, &bsize, &total);
          if(ret != ERROR_OK) break;
+
+         if(data_store_write_byte(&response_ds, PACKET_BLOB_CHUNK) != ERROR_OK ||
+            bpack(&response_ds, "lb", (int64_t)total, bsize, blob) != ERROR_OK)
+           ret = ERROR_UNKNOWN; 
          freeMemory(blob);
+         break;
+
+      case PACKET_SET_BLOB_CHUNK:
+         if(bunpack(&ds, "llb", &offset, &length, &bsize, &blob) != ERROR_OK){
+           ret = ERROR_UNKNOWN; break;
+         }
+
+         ret = stageBlobChunk(server, client, (char*)domain, (char*)key, offset,
+                              length, blob, bsize);
+         freeMemory(blob);
+         if(ret != ERROR_OK) break;
 
          if(data_store_write_byte(&response_ds, PACKET_OK) != ERROR_OK)
            ret = ERROR_UNKNOWN; 
@@ -201,7 +362,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
 
       /* Others handling */
       case PACKET_GET_ENUM:
-         ret = database_enum_keys(server->db, (char*)domain, (char*)key, &count, &esize, &keys);
+         ret = database_engine_enum_keys(server->db, (char*)domain, (char*)key, &count, &esize, &keys);
          if(ret != ERROR_OK){
            if(keys != NULL)
              freeMemory(keys);
@@ -222,7 +383,7 @@ server_process(server_t* server, const unsigned char* data, size_t size,
          break;
 
       case PACKET_GET_VALUE_TYPE:
-         ret = database_get_type(server->db, (char*)domain, (char*)key, &type);
+         ret = database_engine_get_type(server->db, (char*)domain, (char*)key, &type);
          if(ret != ERROR_OK) break;
 
          if(data_store_write_byte(&response_ds, PACKET_TYPE) != ERROR_OK ||
@@ -230,10 +391,62 @@ server_process(server_t* server, const unsigned char* data, size_t size,
            ret = ERROR_UNKNOWN; 
          break;
 
+      case PACKET_GET_SETTINGS:
+         ret = database_engine_get_settings(server->db, &string);
+         if(ret != ERROR_OK) break;
+
+         if(data_store_write_byte(&response_ds, PACKET_SETTINGS) != ERROR_OK ||
+            bpack(&response_ds, "s", string) != ERROR_OK)
+           ret = ERROR_UNKNOWN;
+         freeMemory(string);
+         break;
+
+      case PACKET_RELEASE_MEMORY:
+         ret = server_release_memory(server, &bsize);
+         if(ret != ERROR_OK) break;
+
+         if(data_store_write_byte(&response_ds, PACKET_RELEASED) != ERROR_OK ||
+            bpack(&response_ds, "l", (int64_t)bsize) != ERROR_OK)
+           ret = ERROR_UNKNOWN;
+         break;
+
+      /* the key carries the file name of the backup */
+      case PACKET_BACKUP:
+         ret = clientBackup(server, (char*)key, &progress);
+         if(ret != ERROR_OK) break;
+
+         if(data_store_write_byte(&response_ds, PACKET_BACKED_UP) != ERROR_OK ||
+            bpack(&response_ds, "ll", progress.pages, (int64_t)progress.blobs) != ERROR_OK)
+           ret = ERROR_UNKNOWN;
+         break;
+
+      /* the key is not used, the budget follows it */
+      case PACKET_MAINTAIN:
+         if(bunpack(&ds, "ll", &length, &integer) != ERROR_OK){
+           ret = ERROR_UNKNOWN; break;
+         }
+         if(length < 0 || integer < 0){
+           ret = ERROR_INVALID_ARGUMENTS; break;
+         }
+
+         memset(&budget, 0, sizeof(database_maintenance_t));
+         budget.pages = length;
+         budget.optimize = 1;
+         budget.blobs = integer;
+         budget.grace = SERVER_MAINTENANCE_GRACE;
+         ret = server_maintain(server, &budget, 0, &maintenance);
+         if(ret != ERROR_OK) break;
+
+         if(data_store_write_byte(&response_ds, PACKET_MAINTAINED) != ERROR_OK ||
+            bpack(&response_ds, "ll", maintenance.pages_freed, (int64_t)maintenance.blobs_removed) != ERROR_OK)
+           ret = ERROR_UNKNOWN;
+         break;
+
+      /* a shared server belongs to its channels, see server_release */
       case PACKET_SHUTDOWN:
-        if(server_shutdown(server) != ERROR_OK){
-          ret = ERROR_UNKNOWN; break;
-        } 
+        if(sharedServer(server)){
+          ret = ERROR_INVALID_ARGUMENTS; break;
+        }
         ret =  ERROR_SERVER_SHUTDOWN; 
         break;
 
@@ -271,6 +484,11 @@ server_process(server_t* server, const unsigned char* data, size_t size,
     }
   }
 
+  /* a server about to shut down doesn't need any care */
+  if(ret != ERROR_SERVER_SHUTDOWN){
+    checkMemoryLimit(server);
+    server->last_packet = time(NULL);
+  }
   return ret;
 }
 
@@ -296,15 +514,325 @@ sendPacket(data_store_t *ds, size_t *response_size, unsigned char **response)
   return ERROR_OK;
 }
 
+/**
+ * checks whether a packet changes the database
+ *
+ * @param[in] packettype The type of the packet
+ */
+int
+writingPacket(unsigned char packettype)
+{
+  return packettype == PACKET_SET_INT || packettype == PACKET_SET_DOUBLE ||
+         packettype == PACKET_SET_STRING || packettype == PACKET_SET_BLOB ||
+         packettype == PACKET_SET_BLOB_CHUNK || packettype == PACKET_MAINTAIN;
+}
+
+/**
+ * appends a chunk of a blob sent with PACKET_SET_BLOB_CHUNK to the staging
+ * file of the client. A chunk with offset 0 starts a new upload, the final
+ * chunk stores the staged data in the database.
+ *
+ * @param[in] server The server
+ * @param[in] client The client uploading the blob
+ * @param[in] domain The domain of the blob
+ * @param[in] key The key of the blob
+ * @param[in] offset Offset of the chunk inside the blob
+ * @param[in] final Not 0 if this is the last chunk
+ * @param[in] chunk The data of the chunk
+ * @param[in] size The size of the chunk
+ */
+int
+stageBlobChunk(server_t* server, server_client_t* client, const char* domain,
+               const char* key, int64_t offset, int64_t final,
+               const unsigned char* chunk, size_t size)
+{
+  if(offset == 0){
+    discardUpload(client);
+
+    size_t domain_size = strlen(domain);
+    size_t key_size = strlen(key);
+    if(requestMemory((void**)&client->upload_domain, domain_size + 1) != ERROR_OK)
+      return ERROR_MEMORY;
+    if(requestMemory((void**)&client->upload_key, key_size + 1) != ERROR_OK){
+      discardUpload(client);
+      return ERROR_MEMORY;
+    }
+    memcpy(client->upload_domain, domain, domain_size + 1);
+    memcpy(client->upload_key, key, key_size + 1);
+
+    /* staged on disk, so the server never holds the whole blob */
+    client->upload = tmpfile();
+    if(client->upload == NULL){
+      discardUpload(client);
+      return ERROR_DATABASE_IO;
+    }
+  }
+
+  /* chunks have to arrive in order and belong to the same blob */
+  if(client->upload == NULL || offset < 0 || (size_t)offset != client->upload_size ||
+     strcmp(client->upload_domain, domain) != 0 ||
+     strcmp(client->upload_key, key) != 0){
+    discardUpload(client);
+    return ERROR_INVALID_ARGUMENTS;
+  }
+
+  if(size > 0 && fwrite(chunk, 1, size, client->upload) != size){
+    discardUpload(client);
+    return ERROR_DATABASE_IO;
+  }
+  client->upload_size += size;
+
+  if(final == 0)
+    return ERROR_OK;
+
+  int ret = ERROR_OK;
+  int fd = fileno(client->upload);
+  if(fflush(client->upload) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+    ret = ERROR_DATABASE_IO;
+  else
+    ret = database_engine_set_blob_from_fd(server->db, domain, key, fd);
+
+  discardUpload(client);
+  return ret;
+}
+
+/**
+ * releases the caches of a server whose process went beyond its soft memory
+ * limit, the limit is only checked every SERVER_MEMORY_CHECK_INTERVAL packets
+ *
+ * @param[in] server The server
+ */
+void
+checkMemoryLimit(server_t* server)
+{
+  if(server->memory_limit == 0 ||
+     ++server->memory_check < SERVER_MEMORY_CHECK_INTERVAL)
+    return;
+  server->memory_check = 0;
+
+  size_t resident = 0;
+  size_t released = 0;
+  if(residentMemory(&resident) == ERROR_OK && resident > server->memory_limit)
+    server_release_memory(server, &released);
+}
+
+/**
+ * reads the resident set size of the process from /proc/self/statm
+ *
+ * @param[out] resident The resident set size in bytes
+ */
+int
+residentMemory(size_t* resident)
+{
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if(statm == NULL)
+    return ERROR_UNKNOWN;
+
+  unsigned long size = 0;
+  unsigned long pages = 0;
+  int fields = fscanf(statm, "%lu %lu", &size, &pages);
+  fclose(statm);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if(fields != 2 || page_size <= 0)
+    return ERROR_UNKNOWN;
+
+  *resident = (size_t)pages * page_size;
+  return ERROR_OK;
+}
+
+/**
+ * drops a staged chunked blob
+ *
+ * @param[in] client The client uploading the blob
+ */
+void
+discardUpload(server_client_t* client)
+{
+  if(client->upload != NULL)
+    fclose(client->upload);
+  freeMemory(client->upload_domain);
+  freeMemory(client->upload_key);
+  client->upload = NULL;
+  client->upload_domain = NULL;
+  client->upload_key = NULL;
+  client->upload_size = 0;
+}
+
 /* -------------------------------------------------------------------------- */
 int
-server_shutdown(server_t* server)
+server_client_new(server_client_t** client)
+{
+  if(client == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  if(requestMemory((void**)client, sizeof(server_client_t)) != ERROR_OK)
+    return ERROR_MEMORY;
+  memset(*client, 0, sizeof(server_client_t));
+  return ERROR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_client_free(server_client_t* client)
+{
+  if(client == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  discardUpload(client);
+  freeMemory(client);
+  return ERROR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_get_blob_to_fd(server_t* server, const char* domain, const char* key,
+                      int fd, size_t* size)
 {
   if(server == NULL || server->db == NULL)
     return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&server->lock);
+  int ret = database_engine_get_blob_to_fd(server->db, domain, key, fd, size);
+  pthread_mutex_unlock(&server->lock);
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_set_blob_from_fd(server_t* server, const char* domain, const char* key,
+                        int fd)
+{
+  if(server == NULL || server->db == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&server->lock);
+  int ret = database_engine_set_blob_from_fd(server->db, domain, key, fd);
+  pthread_mutex_unlock(&server->lock);
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_release_memory(server_t* server, size_t* released)
+{
+  if(server == NULL || server->db == NULL || released == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&server->lock);
+  int ret = database_engine_release_memory(server->db, released);
+  pthread_mutex_unlock(&server->lock);
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_backup(server_t* server, const char* path)
+{
+  if(server == NULL || server->db == NULL || path == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&server->lock);
+  int ret = database_engine_backup(server->db, path, NULL, NULL);
+  pthread_mutex_unlock(&server->lock);
+  return ret;
+}
+
+/**
+ * backs up the database for a client. Clients only pick a plain file name,
+ * the backup always ends up in SERVER_BACKUP_DIRECTORY next to the database
+ *
+ * @param[in] server The server
+ * @param[in] name File name of the backup
+ * @param[out] progress Progress of the backup once it is done
+ */
+int
+clientBackup(server_t* server, const char* name,
+             database_backup_progress_t* progress)
+{
+  if(server == NULL || server->db == NULL || name == NULL || strlen(name) == 0 ||
+     name[0] == '.' || strchr(name, '/') != NULL || progress == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+  memset(progress, 0, sizeof(database_backup_progress_t));
+
+  /* engines without a database file have no place for backups */
+  if(server->backups == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  size_t size = strlen(server->backups) + strlen(name) + 2;
+  char* path = NULL;
+  if(requestMemory((void**)&path, size) != ERROR_OK)
+    return ERROR_MEMORY;
+  snprintf(path, size, "%s/%s", server->backups, name);
+
+  int ret = ERROR_OK;
+  if(mkdir(server->backups, 0777) != 0 && errno != EEXIST)
+    ret = ERROR_DATABASE_IO;
+  if(ret == ERROR_OK)
+    ret = database_engine_backup(server->db, path, recordBackup, progress);
+
+  freeMemory(path);
+  return ret;
+}
+
+/**
+ * keeps the latest progress of a backup, the channel can't call back into
+ * the client while the backup runs
+ *
+ * @param[in] progress Progress of the backup
+ * @param[out] context The database_backup_progress_t to update
+ */
+int
+recordBackup(const database_backup_progress_t* progress, void* context)
+{
+  memcpy(context, progress, sizeof(database_backup_progress_t));
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_maintain(server_t* server, const database_maintenance_t* budget,
+                unsigned int idle, database_maintenance_stats_t* stats)
+{
+  if(server == NULL || server->db == NULL || budget == NULL || stats == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  /* clients come first */
+  memset(stats, 0, sizeof(database_maintenance_stats_t));
+  pthread_mutex_lock(&server->lock);
+  int ret = ERROR_OK;
+  if(time(NULL) - server->last_packet >= (time_t)idle)
+    ret = database_engine_maintain(server->db, budget, stats);
+  pthread_mutex_unlock(&server->lock);
+  return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_set_memory_limit(server_t* server, size_t limit)
+{
+  if(server == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&server->lock);
+  server->memory_limit = limit;
+  server->memory_check = 0;
+  pthread_mutex_unlock(&server->lock);
+  return ERROR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_shutdown(server_t* server)
+{
+  if(server == NULL || server->db == NULL || sharedServer(server))
+    return ERROR_INVALID_ARGUMENTS;
  
+  discardUpload(&server->client);
+  pthread_mutex_destroy(&server->lock);
+  free(server->backups);
+
   /* free database */
-  int ret = database_close(server->db);
+  int ret = database_engine_close(server->db);
   if(ret != ERROR_OK){
     freeMemory(server);
     return ERROR_UNKNOWN;
@@ -315,3 +843,242 @@ server_shutdown(server_t* server)
   return ERROR_OK;
 }
 
+/* -------------------------------------------------------------------------- */
+int
+server_acquire(server_t** server, const char* database)
+{
+  if(server == NULL || database == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  char* key = NULL;
+  int ret = canonicalDatabase(database, &key);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* held while the server is created, so a database is never opened twice */
+  pthread_mutex_lock(&shared_lock);
+  shared_server_t* entry = shared_servers;
+  for(; entry != NULL; entry = entry->next){
+    if(strcmp(entry->key, key) == 0){
+      entry->references++;
+      *server = entry->server;
+      pthread_mutex_unlock(&shared_lock);
+      freeMemory(key);
+      return ERROR_OK;
+    }
+  }
+
+  if(requestMemory((void**)&entry, sizeof(shared_server_t)) != ERROR_OK){
+    pthread_mutex_unlock(&shared_lock);
+    freeMemory(key);
+    return ERROR_MEMORY;
+  }
+
+  ret = server_init(&entry->server, database);
+  if(ret != ERROR_OK){
+    pthread_mutex_unlock(&shared_lock);
+    freeMemory(entry);
+    freeMemory(key);
+    return ret;
+  }
+
+  entry->key = key;
+  entry->references = 1;
+  entry->next = shared_servers;
+  shared_servers = entry;
+
+  *server = entry->server;
+  pthread_mutex_unlock(&shared_lock);
+  return ERROR_OK;
+}
+
+/**
+ * tells if a server was handed out by server_acquire and is still in use
+ *
+ * @param[in] server The server
+ */
+int
+sharedServer(server_t* server)
+{
+  pthread_mutex_lock(&shared_lock);
+  shared_server_t* entry = shared_servers;
+  while(entry != NULL && entry->server != server)
+    entry = entry->next;
+  pthread_mutex_unlock(&shared_lock);
+  return entry != NULL;
+}
+
+/**
+ * builds the key of a shared server: the resolved path of the database
+ * followed by its options as given, so different options never share a server
+ *
+ * @param[in] database The database identifier
+ * @param[out] result The key, has to be freed
+ */
+int
+canonicalDatabase(const char* database, char** result)
+{
+  database_options_t options;
+  int ret = database_options_parse(database, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  /* an unresolvable path fails in database_open anyway, mem:// is a name */
+  const char* scheme = "";
+  char* path = NULL;
+  if(strncmp(options.path, DATABASE_ENGINE_LOG, strlen(DATABASE_ENGINE_LOG)) == 0){
+    /* the log may not exist yet, so only its directory is resolved */
+    scheme = DATABASE_ENGINE_LOG;
+    ret = resolveLogPath(options.path + strlen(DATABASE_ENGINE_LOG), &path);
+    if(ret != ERROR_OK){
+      database_options_free(&options);
+      return ret;
+    }
+  }else if(strncmp(options.path, DATABASE_ENGINE_MEMORY,
+                   strlen(DATABASE_ENGINE_MEMORY)) != 0){
+    path = realpath(options.path, NULL);
+  }
+  const char* base = path != NULL ? path : options.path;
+  if(path == NULL)
+    scheme = "";
+  const char* query = strchr(database, '?');
+  if(query == NULL)
+    query = "";
+
+  size_t scheme_size = strlen(scheme);
+  size_t base_size = strlen(base);
+  size_t query_size = strlen(query);
+  if(requestMemory((void**)result, scheme_size + base_size + query_size + 1) != ERROR_OK){
+    free(path);
+    database_options_free(&options);
+    return ERROR_MEMORY;
+  }
+  memcpy(*result, scheme, scheme_size);
+  memcpy(*result + scheme_size, base, base_size);
+  memcpy(*result + scheme_size + base_size, query, query_size + 1);
+
+  free(path);
+  database_options_free(&options);
+  return ERROR_OK;
+}
+
+/**
+ * resolves the directory of a file that may not exist yet, e.g. a log, and
+ * appends the name of the file to it
+ *
+ * @param[in] file Path of the file
+ * @param[out] result The resolved path or NULL if the directory can't be
+ *   resolved, has to be freed with free(3)
+ */
+int
+resolveLogPath(const char* file, char** result)
+{
+  *result = NULL;
+  const char* name = strrchr(file, '/');
+  size_t directory_size = name == NULL ? 1 : (size_t)(name - file);
+  name = name == NULL ? file : name + 1;
+
+  char* directory = NULL;
+  if(requestMemory((void**)&directory, directory_size + 2) != ERROR_OK)
+    return ERROR_MEMORY;
+  if(name == file)
+    memcpy(directory, ".", 2);
+  else if(directory_size == 0)
+    memcpy(directory, "/", 2);
+  else{
+    memcpy(directory, file, directory_size);
+    directory[directory_size] = '\0';
+  }
+
+  char* resolved = realpath(directory, NULL);
+  freeMemory(directory);
+  if(resolved == NULL)
+    return ERROR_OK;
+
+  size_t resolved_size = strlen(resolved);
+  size_t name_size = strlen(name);
+  *result = malloc(resolved_size + name_size + 2);
+  if(*result == NULL){
+    free(resolved);
+    return ERROR_MEMORY;
+  }
+  memcpy(*result, resolved, resolved_size);
+  (*result)[resolved_size] = '/';
+  memcpy(*result + resolved_size + 1, name, name_size + 1);
+  free(resolved);
+  return ERROR_OK;
+}
+
+/**
+ * builds the absolute path of SERVER_BACKUP_DIRECTORY in the directory of the
+ * database file
+ *
+ * @param[in] database The database identifier
+ * @param[out] result The path or NULL if the engine has no database file or
+ *   its directory can't be resolved, has to be freed with free(3)
+ */
+int
+backupDirectory(const char* database, char** result)
+{
+  *result = NULL;
+  database_options_t options;
+  int ret = database_options_parse(database, &options);
+  if(ret != ERROR_OK)
+    return ret;
+
+  const char* path = options.path;
+  if(strncmp(path, DATABASE_ENGINE_LOG, strlen(DATABASE_ENGINE_LOG)) == 0)
+    path += strlen(DATABASE_ENGINE_LOG);
+  else if(strncmp(path, DATABASE_ENGINE_MEMORY, strlen(DATABASE_ENGINE_MEMORY)) == 0){
+    database_options_free(&options);
+    return ERROR_OK;
+  }
+
+  /* <directory>/<database> -> <directory>/backups */
+  char* resolved = NULL;
+  ret = resolveLogPath(path, &resolved);
+  database_options_free(&options);
+  if(ret != ERROR_OK || resolved == NULL)
+    return ret;
+
+  char* name = strrchr(resolved, '/');
+  size_t directory_size = (size_t)(name - resolved) + 1;
+  *result = malloc(directory_size + sizeof(SERVER_BACKUP_DIRECTORY));
+  if(*result == NULL){
+    free(resolved);
+    return ERROR_MEMORY;
+  }
+  memcpy(*result, resolved, directory_size);
+  memcpy(*result + directory_size, SERVER_BACKUP_DIRECTORY, sizeof(SERVER_BACKUP_DIRECTORY));
+  free(resolved);
+  return ERROR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+server_release(server_t* server)
+{
+  if(server == NULL)
+    return ERROR_INVALID_ARGUMENTS;
+
+  pthread_mutex_lock(&shared_lock);
+  shared_server_t** entry = &shared_servers;
+  for(; *entry != NULL; entry = &(*entry)->next){
+    if((*entry)->server != server)
+      continue;
+
+    if(--(*entry)->references > 0){
+      pthread_mutex_unlock(&shared_lock);
+      return ERROR_OK;
+    }
+
+    shared_server_t* last = *entry;
+    *entry = last->next;
+    freeMemory(last->key);
+    freeMemory(last);
+    break;
+  }
+  pthread_mutex_unlock(&shared_lock);
+
+  return server_shutdown(server);
+}
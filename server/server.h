@@ -9,21 +9,32 @@
 #include <stddef.h>
 
 #include "communication/channel.h"
+#include "database.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
 
+/** directory of PACKET_BACKUP, in the directory of the database file */
+#define SERVER_BACKUP_DIRECTORY "backups"
+
+/** seconds PACKET_MAINTAIN keeps a blob file without a row */
+#define SERVER_MAINTENANCE_GRACE 3600
+
 typedef struct server_s server_t;
+typedef struct server_client_s server_client_t;
 
 /**
- * Initializes a server. The database referenced by @a database is opened.
+ * Initializes a server. The database referenced by @a database is opened
+ * with the storage engine selected by @ref database_engine_open. The memory
+ * SQLite uses is configured with @ref database_heap_configure before the
+ * first server is initialized.
  *
  * @param[out] server Pointer to the server
- * @param[in] database Path to the sqlite database file
+ * @param[in] database Path to the sqlite database file or mem://name
  *
  * @return @ref ERROR_OK on success.
- * @return Any error code that is returned by @ref database_open.
+ * @return Any error code that is returned by @ref database_engine_open.
  * @return @ref ERROR_MEMORY Out of memory.
  * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
  * @return @ref ERROR_UNKNOWN An unspecified error occurred.
@@ -31,7 +42,112 @@ typedef struct server_s server_t;
 int server_init(server_t** server, const char* database);
 
 /**
- * Processes a packet
+ * Returns a server for the database referenced by @a database that is shared
+ * with every other caller in this process using the same database. Servers
+ * are keyed by the resolved path of the database plus its options, so
+ * different options never share a server. The server is created by @ref
+ * server_init on first use and torn down by the last @ref server_release.
+ * Acquiring and releasing is safe from several threads. Every function of
+ * a server holds the lock of the server, so its users may call it from
+ * different threads and their packets are processed one after another. A
+ * shared server can't be shut down, neither by @ref server_shutdown nor by
+ * PACKET_SHUTDOWN.
+ *
+ * @param[out] server Pointer to the server
+ * @param[in] database Path to the sqlite database file
+ *
+ * @return @ref ERROR_OK on success.
+ * @return Any error code that is returned by @ref server_init.
+ * @return @ref ERROR_MEMORY Out of memory.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed.
+ */
+int server_acquire(server_t** server, const char* database);
+
+/**
+ * Drops a reference obtained by @ref server_acquire, the last one shuts the
+ * server down. Servers created by @ref server_init are shut down right away.
+ *
+ * @param[in] server The server, not NULL.
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by @ref server_shutdown.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_release(server_t* server);
+
+/**
+ * Gives back memory the server only holds to be faster: the page cache of
+ * SQLite, cached blob directories and the domains a mirroring engine keeps,
+ * see @ref database_engine_release_memory. PACKET_RELEASE_MEMORY does the
+ * same for a client.
+ *
+ * @param[in] server The server
+ * @param[out] released Bytes SQLite's page cache gave back
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by the engine
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_release_memory(server_t* server, size_t* released);
+
+/**
+ * Backs up the database of the server while it keeps serving, see @ref
+ * database_backup. PACKET_BACKUP does the same for a client, but only takes a
+ * plain file name and writes the backup to @ref SERVER_BACKUP_DIRECTORY, a
+ * name with a '/' or a leading '.' is refused with @ref
+ * ERROR_INVALID_ARGUMENTS. That directory is in the directory of the database
+ * file, resolved by @ref server_init, so the working directory of the process
+ * doesn't matter.
+ *
+ * @param[in] server The server
+ * @param[in] path Path of the backup
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by @ref database_engine_backup
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  the engine has no database file to back up
+ */
+int server_backup(server_t* server, const char* path);
+
+/**
+ * Runs one bounded step of maintenance with @ref database_engine_maintain if
+ * no packet came in for @a idle seconds, otherwise nothing is done. The owner
+ * of the server calls it whenever its channel has nothing to do, e.g. on the
+ * timeout of its poll. A client asks for a step with PACKET_MAINTAIN, see
+ * registry_maintain, which runs at once and keeps new files for
+ * SERVER_MAINTENANCE_GRACE seconds.
+ *
+ * @param[in] server The server
+ * @param[in] budget What the step may do, see @ref database_maintain
+ * @param[in] idle Seconds without a packet before the step runs
+ * @param[out] stats What the step did, all 0 if it didn't run
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by @ref database_engine_maintain
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  the engine has no database file to maintain
+ */
+int server_maintain(server_t* server, const database_maintenance_t* budget,
+                    unsigned int idle, database_maintenance_stats_t* stats);
+
+/**
+ * Sets a soft limit of the resident memory of the process. Every 256th
+ * packet the server compares the resident set size against it and releases
+ * its memory with @ref server_release_memory if the process is bigger.
+ *
+ * @param[in] server The server
+ * @param[in] limit The limit in bytes, 0 turns the check off
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_set_memory_limit(server_t* server, size_t limit);
+
+/**
+ * Processes a packet. If the database is read-only, set packets are answered
+ * with an error packet carrying @ref ERROR_DATABASE_READONLY before their value
+ * is unpacked. A packet is processed under the lock of the server, so packets
+ * from several threads never run at the same time.
  *
  * @param[in] server The server
  * @param[in] data The data
@@ -47,6 +163,82 @@ int server_init(server_t** server, const char* database);
  */
 int server_process(server_t* server, const unsigned char* data, size_t size, unsigned char** response, size_t* response_size);
 
+/**
+ * Creates the state a server keeps for one client between two packets, the
+ * blob it uploads chunk by chunk with PACKET_SET_BLOB_CHUNK. @ref
+ * server_process keeps one for all of its callers, clients sharing a server
+ * each need their own, see @ref server_process_client.
+ *
+ * @param[out] client The state of the client
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_MEMORY Out of memory
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_client_new(server_client_t** client);
+
+/**
+ * Frees the state of a client and drops the blob it was uploading.
+ *
+ * @param[in] client The state of the client
+ *
+ * @return @ref ERROR_OK on success,
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_client_free(server_client_t* client);
+
+/**
+ * Processes a packet like @ref server_process, but a chunked upload is staged
+ * in the state of @a client, so uploads of several clients of one server
+ * never mix.
+ *
+ * @param[in] server The server
+ * @param[in] client The state of the client that sent the packet
+ * @param[in] data The data
+ * @param[in] size The size of data
+ * @param[out] response The response data
+ * @param[out] response_size The size of the response data
+ *
+ * @return Any error code that is returned by @ref server_process
+ */
+int server_process_client(server_t* server, server_client_t* client,
+    const unsigned char* data, size_t size, unsigned char** response,
+    size_t* response_size);
+
+/**
+ * Writes the blob associated to domain and key directly to a file descriptor.
+ * This is the in-process shortcut for clients that share the address space
+ * with the server, the blob is neither packed nor copied through a channel.
+ *
+ * @param[in] server The server
+ * @param[in] domain The domain of the blob
+ * @param[in] key The key of the blob
+ * @param[in] fd Writable file descriptor
+ * @param[out] size Number of bytes written to @a fd
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by @ref database_get_blob_to_fd.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_get_blob_to_fd(server_t* server, const char* domain, const char* key,
+    int fd, size_t* size);
+
+/**
+ * Stores the content of a file descriptor as blob associated to domain and
+ * key. See @ref server_get_blob_to_fd.
+ *
+ * @param[in] server The server
+ * @param[in] domain The domain of the blob
+ * @param[in] key The key of the blob
+ * @param[in] fd Readable file descriptor, read until end of file
+ *
+ * @return @ref ERROR_OK on success,
+ * @return Any error code that is returned by @ref database_set_blob_from_fd.
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ */
+int server_set_blob_from_fd(server_t* server, const char* domain,
+    const char* key, int fd);
+
 /**
  * Closes the server
  *
@@ -54,7 +246,8 @@ int server_process(server_t* server, const unsigned char* data, size_t size, uns
  *
  * @return @ref ERROR_OK on success,
  * @return @ref ERROR_UNKNOWN An unspecified error occurred
- * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed
+ * @return @ref ERROR_INVALID_ARGUMENTS Invalid arguments have been passed or
+ *  the server is shared, see @ref server_release
  */
 int server_shutdown(server_t* server);
 
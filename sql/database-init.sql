@@ -35,16 +35,38 @@ CREATE TABLE ValueDouble (
 CREATE TABLE ValueString (
   id    INTEGER PRIMARY KEY NOT NULL,
   value TEXT NOT NULL,
+  codec INTEGER NOT NULL DEFAULT 0,
   FOREIGN KEY(id) REFERENCES KeyInfo(id)
 );
 
 CREATE TABLE ValueBlob (
   id    INTEGER PRIMARY KEY NOT NULL,
   path TEXT NOT NULL,
+  codec INTEGER NOT NULL DEFAULT 0,
   FOREIGN KEY(id) REFERENCES KeyInfo(id)
 );
 
+CREATE TABLE BlobContent (
+  digest    TEXT PRIMARY KEY NOT NULL,
+  refcount  INTEGER NOT NULL
+);
+
 INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-path', 'String');
 INSERT INTO ValueString(id, value) VALUES(last_insert_rowid(), '/tmp');
 
+INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-dedup', 'Int64');
+INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 0);
+
+INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-fanout', 'Int64');
+INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 0);
+
+INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'value-compress', 'Int64');
+INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 0);
+
+INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-hot-path', 'String');
+INSERT INTO ValueString(id, value) VALUES(last_insert_rowid(), '');
+
+INSERT INTO KeyInfo(domain, key, datatype) VALUES(NULL, 'blob-hot-size', 'Int64');
+INSERT INTO ValueInt64(id, value) VALUES(last_insert_rowid(), 0);
+
 COMMIT;
@@ -0,0 +1,57 @@
+/*
+ * Checks the blob files of a database against its rows, e.g. after a crash:
+ *
+ *   ./blob-recover ../examples/mydb.sqlite
+ *   ./blob-recover ../examples/mydb.sqlite repair 8
+ *
+ * check only counts what is wrong and is the default. repair deletes rows
+ * whose blob file is gone and moves files without a row into the quarantine
+ * of the blob-path. The blob-path is walked by the given number of threads,
+ * one per CPU if none is given.
+ */
+
+#include "server/database.h"
+#include "errors.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2 || argc > 4 ||
+     (argc > 2 && strcmp(argv[2], "check") != 0 && strcmp(argv[2], "repair") != 0)){
+    fprintf(stderr, "usage: %s <database> [check|repair] [threads]\n", argv[0]);
+    return 2;
+  }
+
+  database_recovery_t recovery;
+  recovery.threads = argc == 4 ? (unsigned int)strtoul(argv[3], NULL, 10) : 0;
+  recovery.repair = argc > 2 && strcmp(argv[2], "repair") == 0;
+  recovery.quarantine = recovery.repair;
+
+  database_handle_t* db = NULL;
+  int error = recovery.repair ? database_open(&db, argv[1]) :
+                                database_open_readonly(&db, argv[1]);
+  if(error != ERROR_OK){
+    fprintf(stderr, "%s: can't open %s (error %d)\n", argv[0], argv[1], error);
+    return 1;
+  }
+
+  database_recovery_stats_t stats;
+  error = database_recover(db, &recovery, &stats);
+  database_close(db);
+  if(error != ERROR_OK){
+    fprintf(stderr, "%s: can't recover %s (error %d)\n", argv[0], argv[1], error);
+    return 1;
+  }
+
+  printf("%s: %" PRIu64 " rows, %" PRIu64 " files, %" PRIu64 " rows without "
+         "file, %" PRIu64 " files without row\n", argv[1], stats.rows,
+         stats.files, stats.missing, stats.orphans);
+  if(recovery.repair)
+    printf("%s: %" PRIu64 " rows deleted, %" PRIu64 " files moved to "
+           DATABASE_RECOVERY_QUARANTINE "\n", argv[1], stats.repaired,
+           stats.quarantined);
+  return stats.missing == 0 && stats.orphans == 0 ? 0 : 3;
+}
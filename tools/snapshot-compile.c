@@ -0,0 +1,53 @@
+/*
+ * Compiles a database into a snapshot that can be read with
+ * registry/snapshot.h:
+ *
+ *   ./snapshot-compile ../examples/mydb.sqlite config.snapshot
+ *   ./snapshot-compile ../examples/mydb.sqlite?mode=ro config.snapshot domain
+ *
+ * The database may be anything database_engine_open understands. Without a
+ * domain all domains end up in the snapshot.
+ */
+
+#include "server/database-engine.h"
+#include "server/database-snapshot.h"
+#include "registry/snapshot.h"
+#include "errors.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+int main(int argc, char* argv[])
+{
+  if(argc != 3 && argc != 4){
+    fprintf(stderr, "usage: %s <database> <snapshot> [domain]\n", argv[0]);
+    return 2;
+  }
+
+  database_engine_t* engine = NULL;
+  int error = database_engine_open(&engine, argv[1]);
+  if(error != ERROR_OK){
+    fprintf(stderr, "%s: can't open %s (error %d)\n", argv[0], argv[1], error);
+    return 1;
+  }
+
+  error = database_snapshot_compile(engine, argc == 4 ? argv[3] : NULL, argv[2]);
+  database_engine_close(engine);
+  if(error != ERROR_OK){
+    fprintf(stderr, "%s: can't compile %s (error %d)\n", argv[0], argv[2], error);
+    return 1;
+  }
+
+  /* reading it back checks the result */
+  snapshot_t* snapshot = NULL;
+  uint64_t generation = 0;
+  error = snapshot_open(&snapshot, argv[2]);
+  if(error != ERROR_OK){
+    fprintf(stderr, "%s: %s is unreadable (error %d)\n", argv[0], argv[2], error);
+    return 1;
+  }
+  snapshot_generation(snapshot, &generation);
+  snapshot_close(snapshot);
+
+  printf("%s: generation %" PRIu64 "\n", argv[2], generation);
+  return 0;
+}